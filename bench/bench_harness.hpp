@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+
+namespace kusabira::bench {
+
+  /**
+  * @brief 1つの計測対象の結果
+  */
+  struct bench_result {
+    // 計測対象の名前
+    std::string name;
+    // 1回の処理で読んだバイト数
+    std::size_t bytes = 0;
+    // 1回の処理で扱ったトークン数
+    std::size_t tokens = 0;
+    // 各回の処理時間（秒）、昇順
+    std::vector<double> seconds{};
+
+    /**
+    * @brief 処理時間の分位点を求める
+    * @param p 0.0～1.0の割合
+    * @return 秒
+    */
+    fn percentile(double p) const -> double {
+      if (seconds.empty()) return 0.0;
+      const auto index = static_cast<std::size_t>(p * static_cast<double>(seconds.size() - 1) + 0.5);
+      return seconds[std::min(index, seconds.size() - 1)];
+    }
+  };
+
+  /**
+  * @brief 処理を繰り返し実行して時間を計る
+  * @details 1回目は計測せずに捨てる（ファイルキャッシュやメモリの確保を温めるため）
+  * @details 各回の後に計測の外でdef_mrを解放し、毎回同じアロケータの状態から始める、def_mrから確保する入力はsetupで毎回作ること
+  * @param name 計測対象の名前
+  * @param bytes 1回の処理で読むバイト数
+  * @param repeat 計測する回数
+  * @param setup 計測しない準備処理、戻り値がfに渡される
+  * @param f 計測する処理、扱ったトークン数を返す
+  * @return 計測結果
+  */
+  template<typename Setup, typename F>
+  fn run_bench(std::string name, std::size_t bytes, std::size_t repeat, Setup&& setup, F&& f) -> bench_result {
+    using clock = std::chrono::steady_clock;
+
+    bench_result result{ .name = std::move(name), .bytes = bytes };
+    result.seconds.reserve(repeat);
+
+    for (std::size_t i = 0; i <= repeat; ++i) {
+      {
+        auto&& input = setup();
+
+        const auto start = clock::now();
+        result.tokens = f(input);
+        const auto finish = clock::now();
+
+        if (0 < i) result.seconds.push_back(std::chrono::duration<double>(finish - start).count());
+      }
+      kusabira::def_mr.release();
+    }
+
+    std::ranges::sort(result.seconds);
+    return result;
+  }
+
+  /**
+  * @brief 準備処理の要らない処理を繰り返し実行して時間を計る
+  * @param f 計測する処理、扱ったトークン数を返す
+  */
+  template<typename F>
+  fn run_bench(std::string name, std::size_t bytes, std::size_t repeat, F&& f) -> bench_result {
+    return run_bench(std::move(name), bytes, repeat, [] { return 0; }, [&f](int) { return f(); });
+  }
+
+  /**
+  * @brief 計測結果の表の見出しを出力する
+  */
+  inline void print_header(std::FILE* out = stdout) {
+    std::fprintf(out, "%-28s %10s %10s %10s %10s %12s %12s\n", "phase", "min[ms]", "median[ms]", "p99[ms]", "MB/s", "Mtokens/s", "tokens");
+  }
+
+  /**
+  * @brief 計測結果を1行出力する
+  * @details スループットは中央値の処理時間から求める
+  */
+  inline void print_result(const bench_result& result, std::FILE* out = stdout) {
+    const double median = result.percentile(0.5);
+    const double mbps = median <= 0.0 ? 0.0 : static_cast<double>(result.bytes) / median / (1024.0 * 1024.0);
+    const double mtps = median <= 0.0 ? 0.0 : static_cast<double>(result.tokens) / median / 1'000'000.0;
+
+    std::fprintf(out, "%-28s %10.3f %10.3f %10.3f %10.2f %12.3f %12zu\n", result.name.c_str(),
+                 result.percentile(0.0) * 1000.0, median * 1000.0, result.percentile(0.99) * 1000.0, mbps, mtps, result.tokens);
+  }
+
+  /**
+  * @brief 最適化で計測対象の処理が消されないようにする
+  */
+  template<typename T>
+  inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+  }
+
+} // namespace kusabira::bench
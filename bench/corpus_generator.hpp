@@ -0,0 +1,331 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+#include "common.hpp"
+
+namespace kusabira::bench {
+
+  /**
+  * @brief 生成する入力の種類
+  */
+  enum class corpus_kind : std::uint8_t {
+    plain_code,       // ディレクティブを含まない普通のコード
+    xmacro_table,     // X-macroによる表の定義と展開
+    nested_if,        // 深く入れ子になった#if/#elif/#else
+    repetition_macro, // Boost.PPのような、番号付きマクロによる繰り返し
+    raw_string,       // 複数行にわたる長い生文字列リテラル
+    token_paste       // #と##の多用
+  };
+
+  inline constexpr std::array all_corpus_kinds = {
+    corpus_kind::plain_code,
+    corpus_kind::xmacro_table,
+    corpus_kind::nested_if,
+    corpus_kind::repetition_macro,
+    corpus_kind::raw_string,
+    corpus_kind::token_paste
+  };
+
+  /**
+  * @brief 入力の種類の名前を取得する
+  */
+  ifn corpus_name(corpus_kind kind) -> std::string_view {
+    switch (kind) {
+      case corpus_kind::plain_code: return "plain_code";
+      case corpus_kind::xmacro_table: return "xmacro_table";
+      case corpus_kind::nested_if: return "nested_if";
+      case corpus_kind::repetition_macro: return "repetition_macro";
+      case corpus_kind::raw_string: return "raw_string";
+      case corpus_kind::token_paste: return "token_paste";
+    }
+    return "unknown";
+  }
+
+  /**
+  * @brief 名前から入力の種類を取得する
+  * @return 入力の種類、知らない名前なら無効値
+  */
+  ifn parse_corpus_kind(std::string_view name) -> std::optional<corpus_kind> {
+    for (auto kind : all_corpus_kinds) {
+      if (corpus_name(kind) == name) return kind;
+    }
+    return std::nullopt;
+  }
+
+  /**
+  * @brief 入力の生成設定
+  */
+  struct corpus_options {
+    // 乱数のシード、同じシードと設定からは同じ入力が生成される
+    std::uint64_t seed = 1;
+    // 生成する入力のおおよそのバイト数
+    std::size_t target_bytes = 1024 * 1024;
+    // #ifの入れ子の深さ
+    std::size_t nest_depth = 32;
+    // 繰り返しマクロの回数、X-macroの表の行数
+    std::size_t repeat_count = 64;
+  };
+
+  /**
+  * @brief プリプロセッサの処理速度を計るための入力を生成する
+  * @details 乱数はstd::mt19937_64を直接使い、標準ライブラリの実装によらず同じシードから同じ入力を生成する
+  */
+  class corpus_generator {
+    corpus_options m_options;
+    std::mt19937_64 m_rng;
+    std::string m_out{};
+    // 生成した定義の通し番号、名前が衝突しないようにする
+    std::size_t m_serial = 0;
+
+    /**
+    * @brief [0, n)の乱数を得る
+    */
+    fn random(std::size_t n) -> std::size_t {
+      return n == 0 ? 0 : static_cast<std::size_t>(m_rng() % n);
+    }
+
+    fn random_identifier() -> std::string {
+      constexpr std::string_view head = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+      constexpr std::string_view tail = "abcdefghijklmnopqrstuvwxyz0123456789_";
+
+      std::string id{};
+      id.push_back(head[random(head.size())]);
+      for (auto n = 2 + random(10); 0 < n; --n) {
+        id.push_back(tail[random(tail.size())]);
+      }
+      return id;
+    }
+
+    fn random_number() -> std::string {
+      switch (random(4)) {
+        case 0: return std::to_string(random(1000000));
+        case 1: {
+          constexpr std::string_view hex = "0123456789abcdef";
+          std::string num = "0x";
+          for (auto n = 1 + random(8); 0 < n; --n) num.push_back(hex[random(hex.size())]);
+          return num;
+        }
+        case 2: return std::to_string(random(1000)) + "." + std::to_string(random(1000)) + "e-" + std::to_string(random(10));
+        default: return std::to_string(random(100000)) + "ull";
+      }
+    }
+
+    /**
+    * @brief 文字列リテラルの中身、エスケープシーケンスを含む
+    */
+    fn random_text(std::size_t length) -> std::string {
+      constexpr std::string_view chars = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+-*/=<>(){}[];:,.";
+      std::string text{};
+      while (text.size() < length) {
+        if (random(32) == 0) {
+          text.append(random(2) == 0 ? "\\n" : "\\\"");
+        } else {
+          text.push_back(chars[random(chars.size())]);
+        }
+      }
+      return text;
+    }
+
+    /**
+    * @brief コメントの中身、コメントを終わらせる文字列を含まない
+    */
+    fn random_words(std::size_t length) -> std::string {
+      std::string text{};
+      while (text.size() < length) {
+        text.append(random_identifier()).push_back(' ');
+      }
+      return text;
+    }
+
+    /**
+    * @brief 式1つ分、識別子と数値を演算子で繋ぐ
+    */
+    fn random_expression(std::size_t terms) -> std::string {
+      constexpr std::array<std::string_view, 8> ops = {" + ", " - ", " * ", " / ", " << ", " & ", " | ", " ^ "};
+      std::string expr = random(2) == 0 ? random_identifier() : random_number();
+      for (std::size_t i = 1; i < terms; ++i) {
+        expr.append(ops[random(ops.size())]);
+        expr.append(random(2) == 0 ? random_identifier() : random_number());
+      }
+      return expr;
+    }
+
+    void plain_code() {
+      const auto name = random_identifier() + "_" + std::to_string(m_serial);
+
+      if (random(4) == 0) {
+        m_out.append("// ").append(random_words(20 + random(60))).append("\n");
+      }
+      if (random(6) == 0) {
+        m_out.append("/* ").append(random_words(20 + random(40))).append("\n   ").append(random_words(20 + random(40))).append(" */\n");
+      }
+
+      if (random(3) == 0) {
+        m_out.append("struct ").append(name).append(" {\n");
+        for (auto n = 1 + random(6); 0 < n; --n) {
+          m_out.append("  ").append(random(2) == 0 ? "int " : "double ").append(random_identifier()).append(" = ").append(random_number()).append(";\n");
+        }
+        m_out.append("};\n\n");
+      } else {
+        m_out.append("auto ").append(name).append("(int ").append(random_identifier()).append(") -> long {\n");
+        for (auto n = 1 + random(8); 0 < n; --n) {
+          switch (random(3)) {
+            case 0: m_out.append("  auto ").append(random_identifier()).append(" = ").append(random_expression(1 + random(6))).append(";\n"); break;
+            case 1: m_out.append("  const char* ").append(random_identifier()).append(" = \"").append(random_text(10 + random(40))).append("\";\n"); break;
+            default: m_out.append("  if (").append(random_expression(2)).append(") { ").append(random_identifier()).append("(").append(random_number()).append("); }\n"); break;
+          }
+        }
+        m_out.append("  return ").append(random_expression(1 + random(4))).append(";\n}\n\n");
+      }
+    }
+
+    void xmacro_table() {
+      const auto table = "KB_TABLE_" + std::to_string(m_serial);
+
+      m_out.append("#define ").append(table).append("(X) \\\n");
+      for (std::size_t i = 0; i < m_options.repeat_count; ++i) {
+        m_out.append("  X(").append(random_identifier()).append("_").append(std::to_string(i)).append(", ").append(random_number()).append(", \"").append(random_text(8 + random(24))).append("\") \\\n");
+      }
+      m_out.append("\n");
+
+      m_out.append("#define KB_ENUM_").append(std::to_string(m_serial)).append("(name, value, str) name,\n");
+      m_out.append("#define KB_VALUE_").append(std::to_string(m_serial)).append("(name, value, str) value,\n");
+      m_out.append("#define KB_NAME_").append(std::to_string(m_serial)).append("(name, value, str) #name,\n");
+      m_out.append("#define KB_STR_").append(std::to_string(m_serial)).append("(name, value, str) str,\n");
+
+      m_out.append("enum class kb_enum_").append(std::to_string(m_serial)).append(" { ").append(table).append("(KB_ENUM_").append(std::to_string(m_serial)).append(") };\n");
+      m_out.append("const unsigned long long kb_values_").append(std::to_string(m_serial)).append("[] = { ").append(table).append("(KB_VALUE_").append(std::to_string(m_serial)).append(") };\n");
+      m_out.append("const char* kb_names_").append(std::to_string(m_serial)).append("[] = { ").append(table).append("(KB_NAME_").append(std::to_string(m_serial)).append(") };\n");
+      m_out.append("const char* kb_strs_").append(std::to_string(m_serial)).append("[] = { ").append(table).append("(KB_STR_").append(std::to_string(m_serial)).append(") };\n\n");
+    }
+
+    void nested_if_group(std::size_t depth) {
+      m_out.append("int ").append(random_identifier()).append(" = ").append(random_expression(1 + random(3))).append(";\n");
+      if (depth == 0) return;
+
+      // 条件式はマクロの定義状態と算術の組み合わせ
+      const auto macro = "KB_COND_" + std::to_string(random(16));
+      switch (random(3)) {
+        case 0: m_out.append("#if defined(").append(macro).append(") && ").append(macro).append(" > ").append(std::to_string(random(8))).append("\n"); break;
+        case 1: m_out.append("#ifdef ").append(macro).append("\n"); break;
+        default: m_out.append("#if (").append(std::to_string(random(4))).append(" + ").append(std::to_string(random(4))).append(") * 2 >= ").append(std::to_string(random(12))).append("\n"); break;
+      }
+      nested_if_group(depth - 1);
+
+      if (random(2) == 0) {
+        m_out.append("#elif ").append(std::to_string(random(3))).append(" == ").append(std::to_string(random(3))).append(" || !defined(").append(macro).append(")\n");
+        nested_if_group(depth / 2);
+      }
+      if (random(2) == 0) {
+        m_out.append("#else\n");
+        nested_if_group(depth / 2);
+      }
+      m_out.append("#endif\n");
+    }
+
+    void nested_if() {
+      if (m_serial == 0) {
+        // 半分ほどの条件用マクロを定義しておく
+        for (std::size_t i = 0; i < 16; ++i) {
+          if (random(2) == 0) m_out.append("#define KB_COND_").append(std::to_string(i)).append(" ").append(std::to_string(random(16))).append("\n");
+        }
+      }
+      nested_if_group(m_options.nest_depth);
+    }
+
+    void repetition_macro() {
+      if (m_serial == 0) {
+        // KB_REPEAT_n(m)はm(0) m(1) ... m(n-1)に展開される
+        m_out.append("#define KB_CAT(a, b) KB_CAT_I(a, b)\n#define KB_CAT_I(a, b) a ## b\n");
+        m_out.append("#define KB_REPEAT_0(m)\n");
+        for (std::size_t i = 1; i <= m_options.repeat_count; ++i) {
+          m_out.append("#define KB_REPEAT_").append(std::to_string(i)).append("(m) KB_REPEAT_").append(std::to_string(i - 1)).append("(m) m(").append(std::to_string(i - 1)).append(")\n");
+        }
+        m_out.append("#define KB_REPEAT(n, m) KB_CAT(KB_REPEAT_, n)(m)\n\n");
+      }
+
+      const auto serial = std::to_string(m_serial);
+      m_out.append("#define KB_DECL_").append(serial).append("(i) int KB_CAT(").append(random_identifier()).append("_, i) = i * ").append(random_number()).append(";\n");
+      m_out.append("KB_REPEAT(").append(std::to_string(1 + random(m_options.repeat_count))).append(", KB_DECL_").append(serial).append(")\n");
+      m_out.append("#undef KB_DECL_").append(serial).append("\n");
+    }
+
+    void raw_string() {
+      constexpr std::array<std::string_view, 4> prefixes = {"R", "u8R", "uR", "LR"};
+      const auto delimiter = random(2) == 0 ? std::string{} : "kb" + std::to_string(random(1000));
+
+      m_out.append("const auto ").append(random_identifier()).append("_").append(std::to_string(m_serial)).append(" = ");
+      m_out.append(prefixes[random(prefixes.size())]).append("\"").append(delimiter).append("(");
+      for (auto n = 1 + random(16); 0 < n; --n) {
+        // 生文字列の中ではエスケープも引用符も括弧もそのまま
+        m_out.append(random_text(20 + random(100))).append(" \" ) \\ /* // ").append("\n");
+      }
+      m_out.append(")").append(delimiter).append("\";\n");
+    }
+
+    void token_paste() {
+      if (m_serial == 0) {
+        m_out.append("#define KB_STR(x) #x\n#define KB_XSTR(x) KB_STR(x)\n");
+        m_out.append("#define KB_PASTE(a, b) a ## b\n#define KB_PASTE3(a, b, c) a ## b ## c\n");
+        m_out.append("#define KB_FIELD(type, name) type KB_PASTE(m_, name); const char* KB_PASTE(name, _name) = #name;\n\n");
+      }
+
+      const auto name = random_identifier();
+      m_out.append("struct ").append(name).append("_").append(std::to_string(m_serial)).append(" {\n");
+      for (auto n = 1 + random(8); 0 < n; --n) {
+        m_out.append("  KB_FIELD(int, ").append(random_identifier()).append(")\n");
+      }
+      m_out.append("  int KB_PASTE3(").append(random_identifier()).append(", _, ").append(std::to_string(random(100))).append(") = ").append(random_number()).append(";\n");
+      m_out.append("  const char* text = KB_XSTR(").append(random_expression(2 + random(6))).append(");\n");
+      m_out.append("  const char* value = KB_STR(").append(random_number()).append(" + \"").append(random_text(8)).append("\");\n};\n\n");
+    }
+
+  public:
+
+    explicit corpus_generator(const corpus_options& options)
+      : m_options{options}
+      , m_rng{options.seed}
+    {}
+
+    /**
+    * @brief 入力を生成する
+    * @param kind 入力の種類
+    * @return おおよそtarget_bytesの大きさのソースコード
+    */
+    fn generate(corpus_kind kind) -> std::string {
+      m_out.clear();
+      m_out.reserve(m_options.target_bytes + 4096);
+      m_serial = 0;
+
+      while (m_out.size() < m_options.target_bytes) {
+        switch (kind) {
+          case corpus_kind::plain_code: this->plain_code(); break;
+          case corpus_kind::xmacro_table: this->xmacro_table(); break;
+          case corpus_kind::nested_if: this->nested_if(); break;
+          case corpus_kind::repetition_macro: this->repetition_macro(); break;
+          case corpus_kind::raw_string: this->raw_string(); break;
+          case corpus_kind::token_paste: this->token_paste(); break;
+        }
+        ++m_serial;
+      }
+
+      return std::move(m_out);
+    }
+  };
+
+  /**
+  * @brief 入力を生成する
+  * @param kind 入力の種類
+  * @param options 生成設定
+  */
+  ifn generate_corpus(corpus_kind kind, const corpus_options& options) -> std::string {
+    return corpus_generator{options}.generate(kind);
+  }
+
+} // namespace kusabira::bench
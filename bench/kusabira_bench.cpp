@@ -0,0 +1,390 @@
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string_view>
+
+#include "PP/pp_parser.hpp"
+#include "bench_harness.hpp"
+#include "corpus_generator.hpp"
+
+/*
+* プリプロセッサの各段階の処理速度を計る
+* kusabira_bench [<file>...] [--repeat=N] [--seed=N] [--size=BYTES]
+*   <file>を入力として、ファイル読み込み・トークナイズ・オートマトン・マクロ展開・定数式・全体のそれぞれの処理時間を計る
+*   <file>を省略すると、組み込みの入力とcorpus_generatorで生成した各種の入力（--seed、--sizeで指定、既定は1MB）を一時ディレクトリに書き出して使う
+*   各段階をN回（既定は20回）繰り返し、処理時間の最小値・中央値・99パーセンタイルと、中央値でのMB/sとトークン数/sを出力する
+*   ファイルを読む段階のトークン数は、入力ファイルの字句トークン数（ホワイトスペースを含む）
+*/
+
+namespace {
+
+  namespace fs = std::filesystem;
+  namespace PP = kusabira::PP;
+  using namespace std::string_view_literals;
+
+  using file_tokenizer = PP::tokenizer<PP::filereader, PP::pp_tokenizer_sm>;
+  using reporter_factory = kusabira::report::reporter_factory<>;
+  using file_paser = PP::ll_paser<file_tokenizer, reporter_factory>;
+
+  // 組み込みの入力、ディレクティブとマクロ呼び出しを含むテキスト行を繰り返す
+  constexpr std::string_view builtin_unit = R"(#define BENCH_ZERO 0
+#define BENCH_ONE (BENCH_ZERO + 1)
+#define BENCH_ADD(a, b) ((a) + (b))
+#define BENCH_MUL(a, b) ((a) * (b))
+#define BENCH_STR(x) #x
+#define BENCH_CAT(a, b) a ## b
+#if BENCH_ADD(BENCH_ONE, 2) * 3 == 9 && defined(BENCH_ZERO)
+int BENCH_CAT(value_, BENCH_ZERO) = BENCH_MUL(BENCH_ADD(1, 2), BENCH_ONE);
+#else
+int never_used = 0;
+#endif
+/* block comment */ static const char* name = BENCH_STR(some tokens here); // line comment
+struct point { int x; int y; double length() const { return x * 1.5e-3 + y * 0x1fu; } };
+#undef BENCH_ZERO
+#undef BENCH_ONE
+#undef BENCH_ADD
+#undef BENCH_MUL
+#undef BENCH_STR
+#undef BENCH_CAT
+)";
+
+  // マクロ展開の計測に使う定義
+  constexpr std::string_view macro_definitions = R"(#define OBJ_ZERO 0
+#define OBJ_ADD (OBJ_ZERO + 1)
+#define OBJ_NEST (OBJ_ADD * OBJ_ADD + OBJ_ZERO)
+#define FUNC_ADD(a, b) ((a) + (b))
+#define FUNC_NEST(a, b, c) FUNC_ADD(FUNC_ADD(a, b), c) * OBJ_NEST
+#define FUNC_STR(x) #x
+#define FUNC_CAT(a, b) a ## b
+)";
+
+  // 定数式の計測に使う式
+  constexpr std::string_view constant_expression = "(1 + 2) * 3 - 40 / 2 << 1 == -22 && 0x10 > 5u || !0 ? 97 : 10 % 3 ^ 7 | 8 & ~0"sv;
+
+  // マクロ展開と定数式の計測で、1回の処理で繰り返す回数
+  constexpr std::size_t inner_loop = 1000;
+
+  /**
+  * @brief 文字列をファイルに書き出す
+  */
+  auto write_file(const fs::path& path, std::string_view content) -> bool {
+    std::ofstream ofs{path, std::ios::binary};
+    ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
+    return bool(ofs);
+  }
+
+  /**
+  * @brief 読み込んだ論理行を全て保持しておく
+  */
+  auto read_all_lines(const fs::path& path) -> std::vector<PP::logical_line> {
+    std::vector<PP::logical_line> lines{};
+    PP::filereader reader{path};
+    while (auto line = reader.readline()) {
+      lines.push_back(*std::move(line));
+    }
+    return lines;
+  }
+
+  /**
+  * @brief 1行だけの論理行の列を作る、計測用に直接作るトークンが参照する
+  */
+  auto make_line(std::string_view str) -> std::pmr::forward_list<PP::logical_line> {
+    std::pmr::forward_list<PP::logical_line> ll{ &kusabira::def_mr };
+    auto& line = ll.emplace_front(1, 1);
+    line.line.assign(reinterpret_cast<const char8_t*>(str.data()), str.size());
+    return ll;
+  }
+
+  /**
+  * @brief 1行の文字列から空白と改行以外のトークンを切り出す
+  */
+  auto tokenize_line(const std::pmr::forward_list<PP::logical_line>& ll) -> std::vector<PP::pp_token> {
+    std::vector<PP::pp_token> tokens{};
+    const std::u8string_view line = ll.front().line;
+    PP::pp_tokenizer_sm sm{};
+
+    std::size_t first = 0;
+    auto push = [&](PP::pp_token_category cat, std::size_t last) {
+      if (cat != PP::pp_token_category::whitespaces and first != last) {
+        tokens.emplace_back(cat, line.substr(first, last - first), first, ll.begin());
+      }
+      first = last;
+    };
+
+    // 受理した時の文字は次のトークンの先頭として再度入力する
+    for (std::size_t i = 0; i < line.size();) {
+      if (auto cat = sm.input_char(line[i]); cat != PP::pp_token_category::Unaccepted) {
+        push(cat, i);
+      } else {
+        ++i;
+      }
+    }
+    push(sm.input_newline(), line.size());
+
+    return tokens;
+  }
+
+  /**
+  * @brief 1行だけの論理行と、そこから切り出したトークン列
+  * @details トークンは論理行を参照しているので一緒に持っておく
+  */
+  struct line_input {
+    std::pmr::forward_list<PP::logical_line> ll;
+    std::vector<PP::pp_token> tokens;
+  };
+
+  auto make_line_input(std::string_view str) -> line_input {
+    line_input input{ make_line(str), {} };
+    input.tokens = tokenize_line(input.ll);
+    return input;
+  }
+
+  /**
+  * @brief マクロ展開の計測の入力
+  * @details 各回の後にdef_mrを解放するので、定義したマクロごと毎回作り直す
+  */
+  struct macro_input {
+    // 定義したマクロのトークンはパーサの行を参照している
+    std::unique_ptr<file_paser> parser;
+    line_input line;
+    PP::macro_args args{};
+  };
+
+  auto make_macro_input(const fs::path& path, std::string_view invocation) -> macro_input {
+    macro_input input{ std::make_unique<file_paser>(file_tokenizer{path}, path), make_line_input(invocation) };
+    if (auto status = input.parser->start(); not status) {
+      std::cerr << "kusabira_bench: failed to define macros" << std::endl;
+      std::exit(1);
+    }
+    return input;
+  }
+
+  auto bench_readline(const fs::path& path, std::size_t bytes, std::size_t lex_tokens, std::size_t repeat) -> kusabira::bench::bench_result {
+    return kusabira::bench::run_bench("filereader::readline", bytes, repeat, [&] {
+      PP::filereader reader{path};
+      while (auto line = reader.readline()) {
+        kusabira::bench::do_not_optimize(line->line.size());
+      }
+      return lex_tokens;
+    });
+  }
+
+  auto bench_tokenize(const fs::path& path, std::size_t bytes, std::size_t repeat) -> kusabira::bench::bench_result {
+    return kusabira::bench::run_bench("tokenizer::tokenize", bytes, repeat, [&] {
+      file_tokenizer tokenizer{path};
+      std::size_t count = 0;
+      while (auto token = tokenizer.tokenize()) {
+        ++count;
+      }
+      return count;
+    });
+  }
+
+  auto bench_automaton(const fs::path& path, std::size_t bytes, std::size_t repeat) -> kusabira::bench::bench_result {
+    return kusabira::bench::run_bench("pp_tokenizer_sm::input_char", bytes, repeat, [&path] { return read_all_lines(path); }, [](const std::vector<PP::logical_line>& lines) {
+      PP::pp_tokenizer_sm sm{};
+      std::size_t count = 0;
+      for (const auto& line : lines) {
+        for (char8_t c : line.line) {
+          if (sm.input_char(c) != PP::pp_token_category::Unaccepted) ++count;
+        }
+        kusabira::bench::do_not_optimize(sm.input_newline());
+        ++count;
+      }
+      return count;
+    });
+  }
+
+  auto bench_ll_paser(const fs::path& path, std::size_t bytes, std::size_t lex_tokens, std::size_t repeat) -> kusabira::bench::bench_result {
+    return kusabira::bench::run_bench("ll_paser::start", bytes, repeat, [&] {
+      file_paser parser{file_tokenizer{path}, path};
+      if (auto status = parser.start(); not status) {
+        std::cerr << "kusabira_bench: failed to preprocess " << path << std::endl;
+        std::exit(1);
+      }
+      kusabira::bench::do_not_optimize(parser.get_phase4_result().size());
+      return lex_tokens;
+    });
+  }
+
+  /**
+  * @brief マクロ展開の処理時間を計る
+  * @details トークン数は展開結果のトークン数
+  */
+  auto bench_macro(const fs::path& dir, std::size_t repeat) -> std::vector<kusabira::bench::bench_result> {
+    const auto path = dir / "macros.hpp";
+    if (not write_file(path, macro_definitions)) {
+      std::cerr << "kusabira_bench: failed to write " << path << std::endl;
+      std::exit(1);
+    }
+
+    auto reporter = reporter_factory::create();
+
+    std::vector<kusabira::bench::bench_result> results{};
+
+    // オブジェクト形式マクロ
+    {
+      const std::string_view invocation = "OBJ_NEST";
+
+      results.push_back(kusabira::bench::run_bench("macro_manager::objmacro", invocation.size() * inner_loop, repeat, [&] { return make_macro_input(path, invocation); }, [&](const macro_input& input) {
+        const auto& pp = input.parser->get_preprocessor();
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < inner_loop; ++i) {
+          auto [success, complete, result, outer] = pp.expand_objmacro(*reporter, input.line.tokens.front());
+          count += result.size();
+        }
+        return count;
+      }));
+    }
+
+    // 関数形式マクロ、FUNC_NEST(x + 1, FUNC_STR(y z), FUNC_CAT(a, b))
+    {
+      const std::string_view invocation = "FUNC_NEST(x + 1, FUNC_STR(y z), FUNC_CAT(a, b))";
+
+      auto setup = [&] {
+        auto input = make_macro_input(path, invocation);
+        const auto& tokens = input.line.tokens;
+
+        // 実引数を切り分ける
+        std::size_t depth = 0;
+        for (std::size_t i = 2; i + 1 < tokens.size(); ++i) {
+          const auto str = tokens[i].token.to_view();
+          if (str == u8"(") ++depth;
+          if (str == u8")") --depth;
+          if (depth == 0 and str == u8",") {
+            input.args.close_arg();
+            continue;
+          }
+          input.args.push_token(tokens[i]);
+        }
+        input.args.close_arg();
+
+        return input;
+      };
+
+      results.push_back(kusabira::bench::run_bench("macro_manager::funcmacro", invocation.size() * inner_loop, repeat, setup, [&](const macro_input& input) {
+        const auto& pp = input.parser->get_preprocessor();
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < inner_loop; ++i) {
+          auto [success, complete, result, outer] = pp.expand_funcmacro(*reporter, input.line.tokens.front(), input.args);
+          count += result.size();
+        }
+        return count;
+      }));
+    }
+
+    return results;
+  }
+
+  /**
+  * @brief 定数式の評価の処理時間を計る
+  */
+  auto bench_constexpr(std::size_t repeat) -> kusabira::bench::bench_result {
+    auto reporter = reporter_factory::create();
+    const fs::path filename = "bench.cpp";
+    const PP::pp_constexpr ce_calc{*reporter, filename};
+
+    return kusabira::bench::run_bench("pp_constexpr", constant_expression.size() * inner_loop, repeat, [] { return make_line_input(constant_expression); }, [&](const line_input& input) {
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < inner_loop; ++i) {
+        kusabira::bench::do_not_optimize(ce_calc(input.tokens));
+        count += input.tokens.size();
+      }
+      return count;
+    });
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t repeat = 20;
+  kusabira::bench::corpus_options corpus{};
+  std::vector<fs::path> inputs{};
+
+  auto parse_number = [](std::string_view arg, auto& value) -> bool {
+    auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    return ec == std::errc{} and ptr == arg.data() + arg.size();
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    bool valid = true;
+
+    if (arg.starts_with("--repeat=")) {
+      valid = parse_number(arg.substr(9), repeat) and repeat != 0;
+    } else if (arg.starts_with("--seed=")) {
+      valid = parse_number(arg.substr(7), corpus.seed);
+    } else if (arg.starts_with("--size=")) {
+      valid = parse_number(arg.substr(7), corpus.target_bytes);
+    } else if (not arg.starts_with("-")) {
+      inputs.emplace_back(arg);
+    } else {
+      std::cerr << "usage: kusabira_bench [<file>...] [--repeat=N] [--seed=N] [--size=BYTES]" << std::endl;
+      return 2;
+    }
+
+    if (not valid) {
+      std::cerr << "kusabira_bench: invalid option " << argv[i] << std::endl;
+      return 2;
+    }
+  }
+
+  const auto work_dir = fs::temp_directory_path() / "kusabira_bench";
+  std::error_code ec{};
+  fs::create_directories(work_dir, ec);
+
+  if (inputs.empty()) {
+    // 組み込みの入力と、シードから生成した各種の入力を使う
+    std::string content{};
+    while (content.size() < corpus.target_bytes) content.append(builtin_unit);
+    inputs.push_back(work_dir / "builtin.cpp");
+    if (not write_file(inputs.back(), content)) {
+      std::cerr << "kusabira_bench: failed to write " << inputs.back() << std::endl;
+      return 1;
+    }
+
+    for (auto kind : kusabira::bench::all_corpus_kinds) {
+      inputs.push_back(work_dir / (std::string{kusabira::bench::corpus_name(kind)} + ".cpp"));
+      if (not write_file(inputs.back(), kusabira::bench::generate_corpus(kind, corpus))) {
+        std::cerr << "kusabira_bench: failed to write " << inputs.back() << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  for (const auto& input : inputs) {
+    if (not fs::is_regular_file(input)) {
+      std::cerr << "kusabira_bench: " << input << " not found" << std::endl;
+      return 1;
+    }
+
+    const auto bytes = static_cast<std::size_t>(fs::file_size(input));
+    const auto line_count = read_all_lines(input).size();
+    const std::size_t lex_tokens = [&input] {
+      file_tokenizer tokenizer{input};
+      std::size_t count = 0;
+      while (tokenizer.tokenize()) ++count;
+      return count;
+    }();
+
+    std::printf("input: %s (%zu bytes, %zu lines, %zu tokens), repeat: %zu\n", input.string().c_str(), bytes, line_count, lex_tokens, repeat);
+    kusabira::bench::print_header();
+
+    kusabira::bench::print_result(bench_readline(input, bytes, lex_tokens, repeat));
+    kusabira::bench::print_result(bench_tokenize(input, bytes, repeat));
+    kusabira::bench::print_result(bench_automaton(input, bytes, repeat));
+    kusabira::bench::print_result(bench_ll_paser(input, bytes, lex_tokens, repeat));
+    std::printf("\n");
+  }
+
+  // 入力ファイルによらないもの
+  std::printf("input: built-in expressions, repeat: %zu\n", repeat);
+  kusabira::bench::print_header();
+  for (const auto& result : bench_macro(work_dir, repeat)) {
+    kusabira::bench::print_result(result);
+  }
+  kusabira::bench::print_result(bench_constexpr(repeat));
+
+  return 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "../common.hpp"
+#include "phase_timer.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 1つの処理段階でのメモリ確保の集計
+  */
+  struct allocation_counter {
+    // 確保の回数
+    std::uint64_t allocations = 0;
+    // 確保したバイト数の合計
+    std::uint64_t bytes = 0;
+  };
+
+  /**
+  * @brief メモリ確保の集計結果
+  * @details 処理段階の外での確保は最後の要素に数える
+  */
+  struct allocation_table {
+    std::array<allocation_counter, pp_phase_count + 1> phases{};
+    // 解放の回数と、解放されたバイト数の合計
+    std::uint64_t deallocations = 0;
+    std::uint64_t deallocated_bytes = 0;
+    // 使用中のバイト数とその最大値
+    std::uint64_t live_bytes = 0;
+    std::uint64_t high_water = 0;
+
+    fn total() const -> allocation_counter {
+      allocation_counter sum{};
+      for (const auto& c : phases) {
+        sum.allocations += c.allocations;
+        sum.bytes += c.bytes;
+      }
+      return sum;
+    }
+  };
+
+  /**
+  * @brief 確保を数えて上流に渡すmemory_resource
+  * @details 確保は、その時のスレッドの処理段階（current_phase()）に数える
+  * @details スレッドセーフではないので、上流と同じスレッドで使うこと
+  */
+  class counting_memory_resource : public std::pmr::memory_resource {
+    std::pmr::memory_resource* m_upstream;
+    allocation_table m_table{};
+
+  public:
+
+    explicit counting_memory_resource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) noexcept
+      : m_upstream{upstream}
+    {}
+
+    counting_memory_resource(const counting_memory_resource&) = delete;
+    counting_memory_resource& operator=(const counting_memory_resource&) = delete;
+
+    fn upstream() const noexcept -> std::pmr::memory_resource* {
+      return m_upstream;
+    }
+
+    fn table() const noexcept -> const allocation_table& {
+      return m_table;
+    }
+
+    /**
+    * @brief 集計結果を消去する
+    */
+    void reset() noexcept {
+      m_table = allocation_table{};
+    }
+
+  private:
+
+    fn do_allocate(std::size_t bytes, std::size_t alignment) -> void* override {
+      void* p = m_upstream->allocate(bytes, alignment);
+
+      const auto phase = current_phase();
+      auto& counter = m_table.phases[phase ? static_cast<std::size_t>(*phase) : pp_phase_count];
+      ++counter.allocations;
+      counter.bytes += bytes;
+
+      m_table.live_bytes += bytes;
+      m_table.high_water = std::max(m_table.high_water, m_table.live_bytes);
+
+      return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+      m_upstream->deallocate(p, bytes, alignment);
+
+      ++m_table.deallocations;
+      m_table.deallocated_bytes += bytes;
+      m_table.live_bytes -= std::min<std::uint64_t>(bytes, m_table.live_bytes);
+    }
+
+    fn do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override {
+      return this == &other;
+    }
+  };
+
+  /**
+  * @brief スコープの間、作業領域（kusabira::def_mr）の確保を数える
+  */
+  class scoped_arena_accounting {
+    counting_memory_resource m_counter{ kusabira::def_mr.base() };
+    std::pmr::memory_resource* m_prev;
+
+  public:
+
+    scoped_arena_accounting() noexcept
+      : m_prev{ kusabira::def_mr.set_front(&m_counter) }
+    {}
+
+    ~scoped_arena_accounting() {
+      kusabira::def_mr.set_front(m_prev);
+    }
+
+    scoped_arena_accounting(const scoped_arena_accounting&) = delete;
+    scoped_arena_accounting& operator=(const scoped_arena_accounting&) = delete;
+
+    fn table() const noexcept -> const allocation_table& {
+      return m_counter.table();
+    }
+  };
+
+  /**
+  * @brief 集計結果を表にする
+  * @param table 集計結果
+  * @param filename 翻訳単位のファイル名
+  * @return 出力する文字列
+  */
+  ifn format_allocation_report(const allocation_table& table, std::string_view filename) -> std::string {
+    constexpr double KiB = 1024.0;
+    const auto total = table.total();
+
+    std::string report = "===-- kusabira allocation report: ";
+    report.append(filename).append(" --===\n");
+
+    char buf[160]{};
+    std::snprintf(buf, sizeof(buf), "  %-18s %12s %14s %8s %10s\n", "phase", "allocations", "bytes[KiB]", "%", "avg[B]");
+    report.append(buf);
+
+    auto row = [&](std::string_view name, const allocation_counter& c) {
+      const double ratio = total.bytes == 0 ? 0.0 : static_cast<double>(c.bytes) / static_cast<double>(total.bytes) * 100.0;
+      const double avg = c.allocations == 0 ? 0.0 : static_cast<double>(c.bytes) / static_cast<double>(c.allocations);
+      std::snprintf(buf, sizeof(buf), "  %-18.*s %12llu %14.1f %7.1f%% %10.1f\n", static_cast<int>(name.size()), name.data(),
+                    static_cast<unsigned long long>(c.allocations), static_cast<double>(c.bytes) / KiB, ratio, avg);
+      report.append(buf);
+    };
+
+    for (std::size_t i = 0; i < pp_phase_count; ++i) {
+      row(phase_name(static_cast<pp_phase>(i)), table.phases[i]);
+    }
+    row("other", table.phases[pp_phase_count]);
+    row("total", total);
+
+    std::snprintf(buf, sizeof(buf), "  high-water %.1f KiB, %llu deallocations (%.1f KiB)\n", static_cast<double>(table.high_water) / KiB,
+                  static_cast<unsigned long long>(table.deallocations), static_cast<double>(table.deallocated_bytes) / KiB);
+    report.append(buf);
+
+    return report;
+  }
+
+} // namespace kusabira::PP
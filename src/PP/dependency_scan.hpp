@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdio>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../common.hpp"
+#include "../json_output.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief ヘッダ名の探索方法
+  */
+  enum class include_lookup : std::uint8_t {
+    none,   // ヘッダではない（名前付きモジュール）
+    quote,  // "..."
+    angle   // <...>
+  };
+
+  /**
+  * @brief インクルードするファイルの探索設定
+  * @details 翻訳単位とそこからインクルードしたヘッダの処理で共有する
+  */
+  struct include_options {
+    // "..."形式の時だけ探索するディレクトリ（-iquote）
+    std::vector<fs::path> quote_dirs{};
+    // どちらの形式でも探索するディレクトリ（-I）
+    std::vector<fs::path> angle_dirs{};
+    // インクルードの入れ子の上限
+    std::size_t max_depth = 200;
+
+    /**
+    * @brief ヘッダ名からファイルを探す
+    * @details "..."形式はインクルード元のディレクトリ、quote_dirs、angle_dirsの順に、<...>形式はangle_dirsだけを探す
+    * @param name ヘッダ名（区切り文字は含まない）
+    * @param lookup 探索方法
+    * @param includer インクルード元のファイル
+    * @return 見つかったファイルのパス、見つからなければ無効値
+    */
+    fn find(std::u8string_view name, include_lookup lookup, const fs::path& includer) const -> std::optional<fs::path> {
+      const fs::path header{name};
+
+      auto exists = [](const fs::path& path) {
+        std::error_code ec{};
+        return fs::is_regular_file(path, ec);
+      };
+
+      if (header.is_absolute()) {
+        if (exists(header)) return header.lexically_normal();
+        return std::nullopt;
+      }
+
+      if (lookup == include_lookup::quote) {
+        if (auto path = includer.parent_path() / header; exists(path)) return path.lexically_normal();
+
+        for (const auto& dir : quote_dirs) {
+          if (auto path = dir / header; exists(path)) return path.lexically_normal();
+        }
+      }
+
+      for (const auto& dir : angle_dirs) {
+        if (auto path = dir / header; exists(path)) return path.lexically_normal();
+      }
+
+      return std::nullopt;
+    }
+  };
+
+  /**
+  * @brief インポートしたモジュール1つ分
+  */
+  struct module_dependency {
+    // モジュール名、ヘッダユニットの場合はヘッダ名
+    std::u8string logical_name;
+    // ヘッダユニットの場合はその探索方法
+    include_lookup lookup = include_lookup::none;
+    // ヘッダユニットのファイル、見つからなかった場合と名前付きモジュールでは空
+    fs::path source_path{};
+  };
+
+  /**
+  * @brief 翻訳単位の依存関係
+  */
+  struct dependency_info {
+    // 翻訳単位のファイル
+    fs::path source{};
+    // インクルードしたファイル、最初に現れた順で重複しない
+    std::vector<fs::path> includes{};
+    // 宣言しているモジュールの名前
+    std::optional<std::u8string> provided_module{};
+    // モジュールインターフェース単位か否か
+    bool is_interface = false;
+    // インポートしたモジュールとヘッダユニット
+    std::vector<module_dependency> required_modules{};
+    // includesの重複除去用
+    std::unordered_set<fs::path::string_type> included_set{};
+
+    /**
+    * @brief インクルードしたファイルを追加する
+    * @param path ファイルパス
+    */
+    void add_include(const fs::path& path) {
+      if (included_set.insert(path.native()).second) {
+        includes.push_back(path);
+      }
+    }
+
+    /**
+    * @brief インクルードしたヘッダの依存関係を取り込む
+    * @param header ヘッダの依存関係
+    */
+    void merge(const dependency_info& header) {
+      for (const auto& path : header.includes) {
+        this->add_include(path);
+      }
+      required_modules.insert(required_modules.end(), header.required_modules.begin(), header.required_modules.end());
+    }
+  };
+
+  namespace detail {
+
+    ifn generic_u8(const fs::path& path) -> std::u8string {
+      return path.generic_u8string();
+    }
+
+    /**
+    * @brief Makefileのルール中で使える形にファイルパスをエスケープする
+    */
+    inline void escape_make(std::u8string_view str, std::ostream& os) {
+      for (char8_t c : str) {
+        switch (c) {
+          case u8' ': os << "\\ "; break;
+          case u8'#': os << "\\#"; break;
+          case u8'$': os << "$$"; break;
+          default: os.put(static_cast<char>(c));
+        }
+      }
+    }
+  }
+
+  /**
+  * @brief Makefile形式の依存関係（depfile）を出力する
+  * @details gcc -MD -MPと同じく、インクルードしたファイル毎に空のルールを付ける
+  * @param deps 依存関係
+  * @param target ルールのターゲット（通常はオブジェクトファイル）
+  * @param os 出力先
+  */
+  inline void write_depfile(const dependency_info& deps, const fs::path& target, std::ostream& os) {
+    detail::escape_make(detail::generic_u8(target), os);
+    os << ':';
+
+    os << " \\\n  ";
+    detail::escape_make(detail::generic_u8(deps.source), os);
+    for (const auto& path : deps.includes) {
+      os << " \\\n  ";
+      detail::escape_make(detail::generic_u8(path), os);
+    }
+    os << '\n';
+
+    for (const auto& path : deps.includes) {
+      os << '\n';
+      detail::escape_make(detail::generic_u8(path), os);
+      os << ":\n";
+    }
+  }
+
+  /**
+  * @brief P1689形式（P1689R5）のモジュール依存関係を出力する
+  * @param deps 依存関係
+  * @param primary_output 翻訳単位のコンパイル結果（通常はオブジェクトファイル）
+  * @param os 出力先
+  */
+  inline void write_p1689(const dependency_info& deps, const fs::path& primary_output, std::ostream& os) {
+    os << "{\n  \"version\": 1,\n  \"revision\": 0,\n  \"rules\": [\n    {\n      \"primary-output\": ";
+    detail::write_json_string(detail::generic_u8(primary_output), os);
+
+    if (deps.provided_module) {
+      os << ",\n      \"provides\": [\n        {\n          \"logical-name\": ";
+      detail::write_json_string(*deps.provided_module, os);
+      os << ",\n          \"is-interface\": " << (deps.is_interface ? "true" : "false");
+      os << ",\n          \"source-path\": ";
+      detail::write_json_string(detail::generic_u8(deps.source), os);
+      os << "\n        }\n      ]";
+    }
+
+    if (not deps.required_modules.empty()) {
+      os << ",\n      \"requires\": [";
+      bool first = true;
+      for (const auto& dep : deps.required_modules) {
+        os << (std::exchange(first, false) ? "\n" : ",\n") << "        {\n          \"logical-name\": ";
+        detail::write_json_string(dep.logical_name, os);
+
+        if (dep.lookup != include_lookup::none) {
+          os << ",\n          \"lookup-method\": " << (dep.lookup == include_lookup::quote ? "\"include-quote\"" : "\"include-angle\"");
+        }
+        if (not dep.source_path.empty()) {
+          os << ",\n          \"source-path\": ";
+          detail::write_json_string(detail::generic_u8(dep.source_path), os);
+        }
+        os << "\n        }";
+      }
+      os << "\n      ]";
+    }
+
+    os << "\n    }\n  ]\n}\n";
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "../common.hpp"
+#include "../report_output.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 1つの翻訳単位の処理に掛けられる上限
+  * @details 悪意のある、あるいは誤ったマクロによって処理が終わらなくなったりメモリを使い果たすのを防ぐ、0は無制限
+  */
+  struct expansion_limits {
+    // マクロ展開の入れ子の深さ
+    std::size_t max_depth = std::size_t(1) << 16;
+    // ソース上の1つのマクロ呼び出しの展開で生成するトークン数（入れ子の展開の分を含む）
+    std::size_t max_expansion_tokens = std::size_t(1) << 24;
+    // 翻訳単位全体の出力トークン数
+    std::size_t max_output_tokens = std::size_t(1) << 28;
+    // 翻訳単位の処理時間
+    std::chrono::milliseconds time_limit{0};
+  };
+
+  /**
+  * @brief 翻訳単位の処理で使った量を数え、上限と比べる
+  * @details マクロテーブルと共にインクルードしたヘッダの処理に引き継がれる
+  */
+  class expansion_budget {
+    using clock = std::chrono::steady_clock;
+
+    expansion_limits m_limits{};
+    clock::time_point m_deadline = clock::time_point::max();
+    // 現在のマクロ展開の入れ子の深さ
+    std::size_t m_depth = 0;
+    // 現在の最も外側のマクロ展開で生成したトークン数
+    std::size_t m_expansion_tokens = 0;
+    // 翻訳単位の出力トークン数
+    std::size_t m_output_tokens = 0;
+    // 時刻を取得する間隔を空けるためのカウンタ
+    std::uint32_t m_tick = 0;
+
+  public:
+
+    fn limits() const noexcept -> const expansion_limits& {
+      return m_limits;
+    }
+
+    void set_limits(const expansion_limits& limits) noexcept {
+      m_limits = limits;
+    }
+
+    /**
+    * @brief 翻訳単位の処理の開始時に呼ぶ、出力トークン数と期限を初期化する
+    */
+    void start() noexcept {
+      m_depth = 0;
+      m_expansion_tokens = 0;
+      m_output_tokens = 0;
+      m_tick = 0;
+      m_deadline = m_limits.time_limit.count() == 0 ? clock::time_point::max() : clock::now() + m_limits.time_limit;
+    }
+
+    /**
+    * @brief マクロ展開を1段深くする、leave()と対にして呼ぶ
+    * @details 最も外側の展開の開始で、生成したトークン数を初期化する
+    * @return 深さが上限を超えていれば、その診断メッセージ
+    */
+    fn enter() noexcept -> std::optional<pp_parse_context> {
+      if (m_depth++ == 0) m_expansion_tokens = 0;
+      if (m_limits.max_depth != 0 and m_limits.max_depth < m_depth) return pp_parse_context::Macro_NestTooDeep;
+      return std::nullopt;
+    }
+
+    void leave() noexcept {
+      --m_depth;
+    }
+
+    /**
+    * @brief マクロの置換で生成したトークンを数える
+    * @param count 置換結果のトークン数
+    * @return 上限を超えていれば、その診断メッセージ
+    */
+    fn produce(std::size_t count) noexcept -> std::optional<pp_parse_context> {
+      m_expansion_tokens += count;
+      if (m_limits.max_expansion_tokens != 0 and m_limits.max_expansion_tokens < m_expansion_tokens) return pp_parse_context::Macro_TooManyTokens;
+      return this->check_deadline();
+    }
+
+    /**
+    * @brief 出力したトークンを数える
+    * @param count 出力に追加したトークン数
+    * @return 上限を超えていれば、その診断メッセージ
+    */
+    fn output(std::size_t count) noexcept -> std::optional<pp_parse_context> {
+      m_output_tokens += count;
+      if (m_limits.max_output_tokens != 0 and m_limits.max_output_tokens < m_output_tokens) return pp_parse_context::Output_TooManyTokens;
+      return std::nullopt;
+    }
+
+    /**
+    * @brief 期限を過ぎたかを調べる
+    * @details 時刻の取得は何回かに1回だけ行う
+    * @return 過ぎていれば、その診断メッセージ
+    */
+    fn check_deadline() noexcept -> std::optional<pp_parse_context> {
+      if (m_deadline == clock::time_point::max() or (++m_tick % 64) != 0) return std::nullopt;
+      if (m_deadline < clock::now()) return pp_parse_context::TimeLimit_Exceeded;
+      return std::nullopt;
+    }
+
+    /**
+    * @brief 出力したトークン数
+    */
+    fn output_tokens() const noexcept -> std::size_t {
+      return m_output_tokens;
+    }
+  };
+
+  /**
+  * @brief スコープの間、マクロ展開を1段深くする
+  */
+  class scoped_expansion_depth {
+    expansion_budget& m_budget;
+    std::optional<pp_parse_context> m_error;
+
+  public:
+
+    explicit scoped_expansion_depth(expansion_budget& budget) noexcept
+      : m_budget{budget}
+      , m_error{budget.enter()}
+    {}
+
+    ~scoped_expansion_depth() {
+      m_budget.leave();
+    }
+
+    scoped_expansion_depth(const scoped_expansion_depth&) = delete;
+    scoped_expansion_depth& operator=(const scoped_expansion_depth&) = delete;
+
+    /**
+    * @brief 深さが上限を超えていれば、その診断メッセージ
+    */
+    fn error() const noexcept -> const std::optional<pp_parse_context>& {
+      return m_error;
+    }
+  };
+
+} // namespace kusabira::PP
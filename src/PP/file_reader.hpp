@@ -6,6 +6,7 @@
 #include <optional>
 
 #include "common.hpp"
+#include "phase_timer.hpp"
 
 namespace kusabira::PP {
 
@@ -79,6 +80,7 @@ namespace kusabira::PP {
     * @return 論理行型のoptional
     */
     fn readline() -> maybe_line {
+      [[maybe_unused]] scoped_phase_timer timer{pp_phase::file_read};
       logical_line ll{m_pline_num, m_lline_num};
 
       //論理行数カウント
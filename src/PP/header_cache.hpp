@@ -0,0 +1,257 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <forward_list>
+
+#include "../common.hpp"
+#include "macro_manager.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief ヘッダの処理結果のキャッシュ
+  * @details ヘッダの処理中に参照したマクロとその定義、フェーズ4の結果、マクロ定義への副作用を記録しておく
+  * @details 参照したマクロの定義が全て同じ状態で再びインクルードされた場合は、再パースせずに記録を再生する
+  * @details 事前定義マクロや#lineに依存するものは記録しない、スレッドセーフではない
+  */
+  class header_cache {
+  public:
+
+    // 1つのヘッダについて保持する結果の数
+    static constexpr std::size_t max_variants = 8;
+
+    /**
+    * @brief 処理結果が依存するマクロ1つ分
+    */
+    struct observed_macro {
+      // マクロ名、キャッシュの所有する文字列を参照する
+      std::u8string_view name;
+      // 処理開始時点での定義のフィンガープリント、未定義なら0
+      std::uint64_t fingerprint;
+    };
+
+    /**
+    * @brief ヘッダを1度処理した結果
+    */
+    struct entry {
+      // トークンとマクロ名の参照する行と文字列の保存先、ヘッダやインクルード元の寿命とは無関係、他のメンバより後に破棄されるように先頭に置く
+      std::shared_ptr<macro_environment> storage = std::make_shared<macro_environment>();
+      // 処理開始時点で満たされているべきマクロ定義の状態
+      std::pmr::vector<observed_macro> observed{ &kusabira::def_mr };
+      // フェーズ4の結果
+      std::pmr::list<pp_token> output{ &kusabira::def_mr };
+      // 処理後のマクロ定義の状態、無効値は#undefされたもの
+      std::pmr::vector<std::pair<std::u8string_view, std::optional<unified_macro>>> effects{ &kusabira::def_mr };
+      // ヘッダからさらにインクルードしたファイル
+      std::vector<fs::path> includes{};
+    };
+
+  private:
+
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    /**
+    * @brief トークンとその参照する行を記録の保存先へ複製する
+    * @details 出力のトークンはインクルード元で定義されたマクロの置換リストに由来することもあるので、行ごと複製しておく
+    */
+    class token_copier {
+      macro_environment& m_storage;
+      // 複製元の行 -> 複製した行
+      std::pmr::unordered_map<const logical_line*, line_iterator> m_lines{ &kusabira::def_mr };
+
+      sfn is_within(const std::pmr::u8string& str, std::u8string_view view) -> bool {
+        const std::less_equal<const char8_t*> le{};
+        return le(str.data(), view.data()) and le(view.data() + view.size(), str.data() + str.size());
+      }
+
+    public:
+
+      token_copier(macro_environment& storage)
+        : m_storage{storage}
+      {}
+
+      fn operator()(std::u8string_view str) -> std::u8string_view {
+        return m_storage.intern(str);
+      }
+
+      fn operator()(const pp_token& pptoken) -> pp_token {
+        auto str = pptoken.token.to_view();
+
+        if (pptoken.is_generated) {
+          pp_token result{pptoken.category, m_storage.intern(str)};
+          result.column = pptoken.column;
+          this->copy_composed(pptoken, result);
+          return result;
+        }
+
+        const auto& src = *pptoken.srcline_ref;
+        auto [pos, inserted] = m_lines.try_emplace(&src);
+        if (inserted) {
+          (*pos).second = m_storage.add_line(src.phisic_line_num, src.logical_line_num, src.line, src.line_offset);
+        }
+        const auto line = (*pos).second;
+
+        // 行を参照しているトークン文字列は複製した行の同じ位置を参照させる
+        if (is_within(src.line, str)) {
+          str = std::u8string_view{ (*line).line.data() + (str.data() - src.line.data()), str.size() };
+        } else {
+          str = m_storage.intern(str);
+        }
+
+        pp_token result{pptoken.category, str, pptoken.column, line, m_storage.resource()};
+        this->copy_composed(pptoken, result);
+        return result;
+      }
+
+    private:
+
+      void copy_composed(const pp_token& from, pp_token& to) {
+        auto pos = to.composed_tokens.before_begin();
+        for (const auto& composed : from.composed_tokens) {
+          pos = to.composed_tokens.insert_after(pos, (*this)(composed));
+        }
+      }
+    };
+
+    // ヘッダのパス -> 処理結果、新しいものが先頭
+    std::pmr::unordered_map<std::u8string, std::pmr::list<entry>> m_entries{ &kusabira::def_mr };
+    // 参照されたマクロ名の実体、要素の位置は変わらない
+    std::pmr::unordered_set<std::u8string> m_names{ &kusabira::def_mr };
+    // 記録が使われた回数
+    std::size_t m_hit_count = 0;
+
+  public:
+
+    header_cache() = default;
+
+    /**
+    * @brief 現在のマクロ定義の状態で使用できる処理結果を探す
+    * @param path ヘッダのパス
+    * @param macros 現在のマクロテーブル
+    * @return 見つからなければnullptr
+    */
+    fn find(const fs::path& path, const macro_manager& macros) -> const entry* {
+      const auto pos = m_entries.find(path.u8string());
+      if (pos == m_entries.end()) return nullptr;
+
+      for (const auto& result : (*pos).second) {
+        const bool match = std::ranges::all_of(result.observed, [&macros](const observed_macro& dep) {
+          return macros.definition_fingerprint(dep.name) == dep.fingerprint;
+        });
+
+        if (match) {
+          ++m_hit_count;
+          return &result;
+        }
+      }
+
+      return nullptr;
+    }
+
+    /**
+    * @brief 処理結果を記録する
+    * @param path ヘッダのパス
+    * @param macros 処理後のマクロテーブル
+    * @param start 処理開始時点の記録の位置、これ以降の記録をこのヘッダの処理によるものとする
+    * @param output フェーズ4の結果
+    * @param includes ヘッダからさらにインクルードしたファイル
+    * @return 記録したか否か
+    */
+    fn store(const fs::path& path, const macro_manager& macros, const macro_observer::mark& start, const std::pmr::list<pp_token>& output, std::span<const fs::path> includes = {}) -> bool {
+      const auto& observed = macros.observed();
+
+      // 位置によって結果が変わりうる
+      if (observed.predefined != start.predefined or observed.line_control != start.line_control) return false;
+
+      const auto modified = std::span{observed.modified}.subspan(start.modified);
+
+      entry result{};
+      token_copier copy{ *result.storage };
+
+      // 問い合わせたマクロの、処理開始時点での定義
+      // ヘッダ自身が変更したものは最初の変更の直前の定義、そうでないものは現在の定義が開始時点のもの
+      for (auto name : std::span{observed.names}.subspan(start.names)) {
+        const std::u8string_view interned = *m_names.emplace(name).first;
+        if (std::ranges::any_of(result.observed, [interned](const observed_macro& dep) { return dep.name.data() == interned.data(); })) continue;
+
+        const auto first_change = std::ranges::find(modified, name, &std::pair<std::u8string_view, std::uint64_t>::first);
+        const auto fingerprint = first_change != modified.end() ? (*first_change).second : macros.definition_fingerprint(name);
+        result.observed.push_back({ interned, fingerprint });
+      }
+
+      // 変更したマクロの処理後の定義
+      for (const auto& [name, ignore] : modified) {
+        if (std::ranges::any_of(result.effects, [name](const auto& effect) { return effect.first == name; })) continue;
+
+        auto& effect = result.effects.emplace_back(copy(name), std::nullopt);
+        if (const auto macro = macros.find_definition(name); macro != nullptr) {
+          effect.second.emplace(*macro, result.storage->resource(), copy);
+        }
+      }
+
+      for (const auto& pptoken : output) {
+        result.output.emplace_back(copy(pptoken));
+      }
+      result.includes.assign(includes.begin(), includes.end());
+
+      auto& results = m_entries[path.u8string()];
+      results.emplace_front(std::move(result));
+      if (max_variants < results.size()) {
+        results.pop_back();
+      }
+
+      return true;
+    }
+
+    /**
+    * @brief 記録した処理結果を再生する
+    * @details マクロ定義への副作用をmacrosに反映し、フェーズ4の結果をoutputの末尾に追加する
+    * @details 外側で記録中であれば、ヘッダを処理した場合と同じく参照と変更が記録される
+    * @details 再生したトークンとマクロはresult.storageを参照するので、呼び出し側でその寿命を延ばしておくこと
+    * @param result find()で得た処理結果
+    * @param macros マクロテーブル
+    * @param output 出力先
+    */
+    void replay(const entry& result, macro_manager& macros, std::pmr::list<pp_token>& output) const {
+      for (const auto& dep : result.observed) {
+        macros.note_observed(dep.name);
+      }
+
+      for (const auto& [name, macro] : result.effects) {
+        if (macro) {
+          macros.restore_macro(name, *macro);
+        } else {
+          macros.unregister_macro(name);
+        }
+      }
+
+      output.insert(output.end(), result.output.begin(), result.output.end());
+    }
+
+    /**
+    * @brief 記録されているヘッダの数
+    */
+    fn size() const noexcept -> std::size_t {
+      return m_entries.size();
+    }
+
+    /**
+    * @brief 記録が使われた回数
+    */
+    fn hit_count() const noexcept -> std::size_t {
+      return m_hit_count;
+    }
+  };
+
+} // namespace kusabira::PP
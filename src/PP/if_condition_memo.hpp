@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+
+#include "../common.hpp"
+#include "macro_manager.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief #if/#elifの条件式の評価結果をメモ化する
+  * @details ディレクティブの位置（ファイルと論理行）と、条件式が参照したマクロの定義のフィンガープリントをキーとする
+  * @details 参照したマクロの定義が全て同じなら、マクロ展開も定数式の評価も同じ経過をたどるので結果を再利用できる
+  * @details 同じヘッダの複数回のインクルードや、マクロ環境を共有する翻訳単位間での共有を想定している、スレッドセーフではない
+  */
+  class if_condition_memo {
+  public:
+
+    // 1つのディレクティブについて保持する結果の数
+    static constexpr std::size_t max_variants = 4;
+
+  private:
+
+    /**
+    * @brief 参照したマクロ1つ分
+    */
+    struct dependency {
+      // マクロ名、m_namesの要素を参照する
+      std::u8string_view name;
+      // 定義のフィンガープリント、未定義なら0
+      std::uint64_t fingerprint;
+    };
+
+    /**
+    * @brief あるマクロ定義の状態での評価結果
+    */
+    struct variant {
+      std::pmr::vector<dependency> dependencies{ &kusabira::def_mr };
+      bool result = false;
+      // 最後に一致を確認したマクロテーブルとその世代、同じならフィンガープリントの比較を省ける
+      std::uint64_t table_id = 0;
+      std::uint64_t generation = 0;
+    };
+
+    /**
+    * @brief 1つのディレクティブの位置についての記録
+    */
+    struct site {
+      // ディレクティブの行の内容のハッシュ、ファイルの内容が変わっていたら使わない
+      std::uint64_t line_hash = 0;
+      std::array<variant, max_variants> variants{};
+      std::size_t count = 0;
+      // 次に置き換える位置
+      std::size_t next = 0;
+    };
+
+    // ファイルパスとファイルIDの対応
+    std::pmr::unordered_map<std::u8string, std::uint32_t> m_files{ &kusabira::def_mr };
+    // {ファイルID, 論理行番号} -> 記録
+    std::pmr::unordered_map<std::uint64_t, site> m_sites{ &kusabira::def_mr };
+    // 参照されたマクロ名の実体、要素の位置は変わらない
+    std::pmr::unordered_set<std::u8string> m_names{ &kusabira::def_mr };
+    // メモが使われた回数
+    std::size_t m_hit_count = 0;
+
+    sfn site_key(std::uint32_t file_id, const logical_line& line) noexcept -> std::uint64_t {
+      return (std::uint64_t(file_id) << 32) | std::uint32_t(line.logical_line_num);
+    }
+
+    sfn line_hash(const logical_line& line) noexcept -> std::uint64_t {
+      std::uint64_t hash = 14695981039346656037ull;
+      for (char8_t c : line.line) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+  public:
+
+    if_condition_memo() = default;
+
+    /**
+    * @brief ファイルに対応するIDを取得する
+    * @param path ファイルパス
+    * @return 初めて見たファイルなら新しいIDを振る
+    */
+    fn file_id(const fs::path& path) -> std::uint32_t {
+      const auto [pos, inserted] = m_files.try_emplace(path.u8string(), std::uint32_t(m_files.size()));
+      return (*pos).second;
+    }
+
+    /**
+    * @brief メモ化された評価結果を探す
+    * @param file_id ファイルID
+    * @param line ディレクティブのある論理行
+    * @param macros 現在のマクロテーブル
+    * @return 見つからなければ無効値
+    */
+    fn find(std::uint32_t file_id, const logical_line& line, const macro_manager& macros) -> std::optional<bool> {
+      const auto pos = m_sites.find(site_key(file_id, line));
+      if (pos == m_sites.end()) return std::nullopt;
+
+      auto& memo = (*pos).second;
+      if (memo.line_hash != line_hash(line)) return std::nullopt;
+
+      const auto table_id = macros.table_id();
+      const auto generation = macros.generation();
+
+      for (auto& var : std::span{memo.variants}.first(memo.count)) {
+        // 前回確認した時からマクロ定義が変化していない
+        const bool unchanged = var.table_id == table_id and var.generation == generation;
+
+        if (unchanged or std::ranges::all_of(var.dependencies, [&macros](const dependency& dep) {
+              return macros.definition_fingerprint(dep.name) == dep.fingerprint;
+            }))
+        {
+          var.table_id = table_id;
+          var.generation = generation;
+          ++m_hit_count;
+
+          // 評価した場合と同じく、外側の記録に参照したマクロを残す
+          for (const auto& dep : var.dependencies) {
+            macros.note_observed(dep.name);
+          }
+          return var.result;
+        }
+      }
+
+      return std::nullopt;
+    }
+
+    /**
+    * @brief 評価結果を記録する
+    * @details 事前定義マクロを参照していた場合は記録しない（__LINE__などは位置によって値が変わる）
+    * @param file_id ファイルID
+    * @param line ディレクティブのある論理行
+    * @param macros 評価に用いたマクロテーブル
+    * @param start 評価開始時点の記録の位置、これ以降の問い合わせを評価が依存するものとする
+    * @param result 評価結果
+    * @return 記録したか否か
+    */
+    fn store(std::uint32_t file_id, const logical_line& line, const macro_manager& macros, const macro_observer::mark& start, bool result) -> bool {
+      const auto& observed = macros.observed();
+      if (observed.predefined != start.predefined) return false;
+
+      auto& memo = m_sites[site_key(file_id, line)];
+      if (const auto hash = line_hash(line); memo.line_hash != hash) {
+        // 初めて見たか、ファイルの内容が変わっている
+        memo.line_hash = hash;
+        memo.count = 0;
+        memo.next = 0;
+      }
+
+      // 保持できる数を超えたら古いものから上書きする
+      auto& var = memo.variants[memo.next];
+      memo.next = (memo.next + 1) % max_variants;
+      memo.count = std::min(memo.count + 1, max_variants);
+
+      var.dependencies.clear();
+      for (auto name : std::span{observed.names}.subspan(start.names)) {
+        const auto& stored = *m_names.emplace(name).first;
+        const std::u8string_view interned = stored;
+
+        // 名前は実体化されているので、同じ名前はポインタ比較で重複を除ける
+        if (std::ranges::any_of(var.dependencies, [interned](const dependency& dep) { return dep.name.data() == interned.data(); })) continue;
+        var.dependencies.push_back({ interned, macros.definition_fingerprint(interned) });
+      }
+      var.result = result;
+      var.table_id = macros.table_id();
+      var.generation = macros.generation();
+
+      return true;
+    }
+
+    /**
+    * @brief 記録されているディレクティブの位置の数
+    */
+    fn size() const noexcept -> std::size_t {
+      return m_sites.size();
+    }
+
+    /**
+    * @brief メモが使われた回数
+    */
+    fn hit_count() const noexcept -> std::size_t {
+      return m_hit_count;
+    }
+  };
+
+} // namespace kusabira::PP
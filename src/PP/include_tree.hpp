@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "../common.hpp"
+#include "../json_output.hpp"
+#include "dependency_scan.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief インクルードの木の1ノード、1回のファイルの処理を表す
+  * @details 同じヘッダでもインクルードされた回数だけノードがある
+  */
+  struct include_node {
+    fs::path path;
+    // このファイルの処理にかかった時間、インクルードしたヘッダの分も含む
+    std::chrono::nanoseconds inclusive_time{};
+    // フェーズ4の出力に寄与したトークン数、インクルードしたヘッダの分も含む
+    std::uint64_t tokens = 0;
+    // このファイルで処理した行数（有効なグループの論理行）
+    std::uint64_t lines = 0;
+    // このファイルで無効なグループとして読み飛ばした行数（物理行）
+    std::uint64_t skipped_lines = 0;
+    // ヘッダキャッシュから再生したか否か、trueなら行数は数えていない
+    bool from_cache = false;
+    std::vector<include_node> includes{};
+
+    /**
+    * @brief インクルードしたヘッダのノードを追加する
+    * @details 返した参照は次にadd_include()を呼ぶまで有効
+    */
+    fn add_include(fs::path header) -> include_node& {
+      return includes.emplace_back(include_node{ .path = std::move(header) });
+    }
+
+    /**
+    * @brief インクルードしたヘッダの分を除いた時間
+    */
+    fn exclusive_time() const -> std::chrono::nanoseconds {
+      auto time = inclusive_time;
+      for (const auto& child : includes) time -= child.inclusive_time;
+      return std::max(time, std::chrono::nanoseconds{});
+    }
+
+    /**
+    * @brief インクルードしたヘッダの分を除いたトークン数
+    */
+    fn exclusive_tokens() const -> std::uint64_t {
+      std::uint64_t child_tokens = 0;
+      for (const auto& child : includes) child_tokens += child.tokens;
+      return child_tokens < tokens ? tokens - child_tokens : 0;
+    }
+  };
+
+  namespace detail {
+
+    inline void write_include_tree_text_impl(const include_node& node, std::size_t depth, std::string& out) {
+      char buf[128]{};
+      std::snprintf(buf, sizeof(buf), "  %10.3f %10.3f %10llu %10llu %8llu %8llu  ",
+                    std::chrono::duration<double, std::milli>(node.inclusive_time).count(),
+                    std::chrono::duration<double, std::milli>(node.exclusive_time()).count(),
+                    static_cast<unsigned long long>(node.tokens), static_cast<unsigned long long>(node.exclusive_tokens()),
+                    static_cast<unsigned long long>(node.lines), static_cast<unsigned long long>(node.skipped_lines));
+      out.append(buf).append(depth * 2, ' ').append(node.path.string());
+      if (node.from_cache) out.append(" (cached)");
+      out.push_back('\n');
+
+      for (const auto& child : node.includes) {
+        write_include_tree_text_impl(child, depth + 1, out);
+      }
+    }
+
+    inline void write_include_tree_json_impl(const include_node& node, std::ostream& os) {
+      os << "{\"file\":";
+      write_json_string(generic_u8(node.path), os);
+      os << ",\"inclusive_ms\":" << std::chrono::duration<double, std::milli>(node.inclusive_time).count()
+         << ",\"exclusive_ms\":" << std::chrono::duration<double, std::milli>(node.exclusive_time()).count()
+         << ",\"tokens\":" << node.tokens
+         << ",\"exclusive_tokens\":" << node.exclusive_tokens()
+         << ",\"lines\":" << node.lines
+         << ",\"skipped_lines\":" << node.skipped_lines
+         << ",\"cached\":" << (node.from_cache ? "true" : "false")
+         << ",\"includes\":[";
+
+      bool first = true;
+      for (const auto& child : node.includes) {
+        if (not first) os << ',';
+        first = false;
+        write_include_tree_json_impl(child, os);
+      }
+      os << "]}";
+    }
+  }
+
+  /**
+  * @brief インクルードの木を、インクルードの深さで字下げした表にする
+  * @param root 翻訳単位のノード
+  * @return 出力する文字列
+  */
+  ifn format_include_tree(const include_node& root) -> std::string {
+    std::string report = "===-- kusabira include tree: ";
+    report.append(root.path.string()).append(" --===\n");
+
+    char buf[128]{};
+    std::snprintf(buf, sizeof(buf), "  %10s %10s %10s %10s %8s %8s  %s\n", "incl[ms]", "excl[ms]", "tokens", "excl tok", "lines", "skipped", "file");
+    report.append(buf);
+
+    detail::write_include_tree_text_impl(root, 0, report);
+    return report;
+  }
+
+  /**
+  * @brief インクルードの木をJSONで出力する
+  * @details 各ノードは {"file", "inclusive_ms", "exclusive_ms", "tokens", "exclusive_tokens", "lines", "skipped_lines", "cached", "includes"}
+  * @param root 翻訳単位のノード
+  * @param os 出力先
+  */
+  inline void write_include_tree_json(const include_node& root, std::ostream& os) {
+    detail::write_include_tree_json_impl(root, os);
+    os << '\n';
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../common.hpp"
+#include "macro_manager.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 1回の#includeが翻訳単位に寄与したもの
+  */
+  struct include_usage {
+    fs::path path;
+    // インクルードの入れ子の深さ、翻訳単位が直接インクルードしたものは1
+    std::size_t depth = 1;
+    // フェーズ4の出力に寄与したトークン数（改行・空白・プレースメーカーを除く）、インクルードしたヘッダの分も含む
+    std::uint64_t tokens = 0;
+    // #define/#undefしたマクロの数、インクルードしたヘッダの分も含む
+    std::size_t macros = 0;
+    // 定義したマクロのうち、このヘッダの外で展開されたか#if等で調べられたもの
+    std::vector<std::u8string> used_macros{};
+
+    /**
+    * @brief 何かしら使われたか否か
+    * @details falseなら、この#includeは取り除いても翻訳単位の結果に影響しない（ただし、ヘッダが宣言のみを持つ場合はトークンの出力で使われたとみなす）
+    */
+    fn used() const noexcept -> bool {
+      return tokens != 0 or not used_macros.empty();
+    }
+  };
+
+  /**
+  * @brief フェーズ4の出力のうち、後段から参照されうるトークンを数える
+  */
+  template<typename Iterator, typename Sentinel>
+  ifn count_output_tokens(Iterator first, Sentinel last) -> std::uint64_t {
+    std::uint64_t count = 0;
+    for (; first != last; ++first) {
+      const auto kind = (*first).category;
+      if (pp_token_category::header_name <= kind and kind != pp_token_category::placemarker_token) ++count;
+    }
+    return count;
+  }
+
+  /**
+  * @brief #include毎に、そのヘッダが翻訳単位に何か寄与したかを調べる
+  * @details 翻訳単位全体でマクロテーブルへの問い合わせと変更を記録し（macro_observer）、各ヘッダを処理した区間と突き合わせる
+  * @details ヘッダで定義したマクロが、その後ヘッダの外で再定義されるまでに問い合わせ（展開、#ifdef、defined）を受けていれば使われたとみなす
+  * @details 同じヘッダの別の#includeからの問い合わせ（インクルードガードの判定）は数えない
+  */
+  class include_usage_tracker {
+
+    // ヘッダを処理した区間
+    struct span {
+      macro_observer::mark begin;
+      macro_observer::mark end;
+    };
+
+    std::vector<include_usage> m_includes{};
+    std::vector<span> m_spans{};
+
+  public:
+
+    /**
+    * @brief #includeの処理の開始を記録する
+    * @param path ヘッダのパス
+    * @param depth インクルードの入れ子の深さ
+    * @param start 処理開始時点の記録の位置
+    * @return このインクルードの番号、close()に渡す
+    */
+    fn open(const fs::path& path, std::size_t depth, const macro_observer::mark& start) -> std::size_t {
+      m_includes.push_back(include_usage{ .path = path, .depth = depth });
+      m_spans.push_back(span{ start, start });
+      return m_includes.size() - 1;
+    }
+
+    /**
+    * @brief #includeの処理の終了を記録する
+    * @param index open()の戻り値
+    * @param end 処理終了時点の記録の位置
+    * @param tokens 出力に寄与したトークン数
+    */
+    void close(std::size_t index, const macro_observer::mark& end, std::uint64_t tokens) {
+      m_spans[index].end = end;
+      m_includes[index].tokens = tokens;
+    }
+
+    /**
+    * @brief 翻訳単位の処理を終えた後、記録を突き合わせて各ヘッダのマクロが使われたかを調べる
+    * @param observed 翻訳単位全体の問い合わせと変更の記録
+    */
+    void analyze(const macro_observer& observed) {
+      // 名前毎の、問い合わせの位置と変更の位置
+      std::unordered_map<std::u8string_view, std::vector<std::size_t>> queries{}, changes{};
+      for (std::size_t i = 0; i < observed.names.size(); ++i) {
+        queries[observed.names[i]].push_back(i);
+      }
+      for (std::size_t i = 0; i < observed.modified.size(); ++i) {
+        changes[observed.modified[i].first].push_back(i);
+      }
+
+      for (std::size_t n = 0; n < m_includes.size(); ++n) {
+        auto& usage = m_includes[n];
+        const auto& [begin, end] = m_spans[n];
+
+        // 同じヘッダを処理していた区間、そこでの問い合わせは数えない
+        auto in_same_header = [&](std::size_t pos) {
+          for (std::size_t k = 0; k < m_includes.size(); ++k) {
+            if (m_spans[k].begin.names <= pos and pos < m_spans[k].end.names and m_includes[k].path == usage.path) return true;
+          }
+          return false;
+        };
+
+        std::vector<std::u8string_view> defined{};
+        for (std::size_t i = begin.modified; i < end.modified; ++i) {
+          const auto name = observed.modified[i].first;
+          if (std::ranges::find(defined, name) == defined.end()) defined.push_back(name);
+        }
+        usage.macros = defined.size();
+
+        for (const auto name : defined) {
+          // ヘッダの外で次に変更されるまでが、このヘッダの定義の有効な区間
+          const auto& change = changes[name];
+          const auto next = std::ranges::lower_bound(change, end.modified);
+          const auto limit = next == change.end() ? observed.names.size() : observed.modified_at[*next];
+
+          const auto& query = queries[name];
+          for (auto it = std::ranges::lower_bound(query, end.names); it != query.end() and *it < limit; ++it) {
+            if (in_same_header(*it)) continue;
+            usage.used_macros.emplace_back(name);
+            break;
+          }
+        }
+      }
+    }
+
+    /**
+    * @brief 処理した順の#includeの一覧
+    */
+    fn includes() const noexcept -> const std::vector<include_usage>& {
+      return m_includes;
+    }
+  };
+
+  /**
+  * @brief #include毎の寄与を表にする
+  * @details 何も寄与していない#includeにはUNUSEDを付ける
+  * @param includes include_usage_trackerの結果
+  * @param filename 翻訳単位のファイル名
+  * @return 出力する文字列
+  */
+  ifn format_include_usage_report(const std::vector<include_usage>& includes, std::string_view filename) -> std::string {
+    std::string report = "===-- kusabira include usage: ";
+    report.append(filename).append(" --===\n");
+
+    char buf[128]{};
+    std::snprintf(buf, sizeof(buf), "  %-8s %10s %8s %8s  %s\n", "status", "tokens", "macros", "used", "file");
+    report.append(buf);
+
+    std::size_t unused = 0;
+    for (const auto& usage : includes) {
+      if (not usage.used()) ++unused;
+
+      std::snprintf(buf, sizeof(buf), "  %-8s %10llu %8zu %8zu  ", usage.used() ? "used" : "UNUSED",
+                    static_cast<unsigned long long>(usage.tokens), usage.macros, usage.used_macros.size());
+      report.append(buf).append((usage.depth - 1) * 2, ' ').append(usage.path.string());
+
+      // 使われたマクロをいくつか示す
+      constexpr std::size_t shown = 3;
+      for (std::size_t i = 0; i < usage.used_macros.size() and i < shown; ++i) {
+        report.append(i == 0 ? " (" : ", ").append(reinterpret_cast<const char*>(usage.used_macros[i].data()), usage.used_macros[i].size());
+      }
+      if (shown < usage.used_macros.size()) report.append(", ...");
+      if (not usage.used_macros.empty()) report.push_back(')');
+      report.push_back('\n');
+    }
+
+    std::snprintf(buf, sizeof(buf), "  %zu of %zu includes contribute nothing\n", unused, includes.size());
+    report.append(buf);
+
+    return report;
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <string_view>
+
+#include "../common.hpp"
+#include "file_reader.hpp"
+#include "pp_automaton.hpp"
+#include "macro_manager.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 複数の翻訳単位で共有する基底のマクロ環境を構築する
+  * @details コマンドラインの-Dや共通の設定ヘッダに相当するマクロ定義を一度だけ解析しておき、
+  * @details 各翻訳単位はbuild()の結果を基底として共有する（コピーは行われない）
+  */
+  class macro_environment_builder {
+
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    // 構築中の環境
+    std::shared_ptr<macro_environment> m_env = std::make_shared<macro_environment>();
+    // 定義元の行に振る行番号
+    std::size_t m_line_num = 0;
+    // 1行分のトークン列、定義毎に使いまわす
+    std::vector<pp_token> m_tokens{};
+
+  public:
+
+    macro_environment_builder() = default;
+
+    /**
+    * @brief コマンドラインの-D形式でマクロを定義する
+    * @details NAME -> NAME 1、NAME= -> 空のマクロ、NAME=VAL -> NAME VAL、NAME(a, b)=VAL -> 関数マクロ
+    * @param def -Dの後ろの文字列
+    * @return 定義に成功したか否か
+    */
+    fn define(std::u8string_view def) -> bool {
+      const auto eq_pos = def.find(u8'=');
+      std::pmr::u8string body{ def.substr(0, eq_pos), &kusabira::def_mr };
+
+      if (eq_pos == std::u8string_view::npos) {
+        body.append(u8" 1");
+      } else if (eq_pos + 1 < def.length()) {
+        body.push_back(u8' ');
+        body.append(def.substr(eq_pos + 1));
+      }
+
+      return this->define_directive(body);
+    }
+
+    /**
+    * @brief #defineディレクティブの形式でマクロを定義する
+    * @details ソース中の#defineと同じ解釈をするので、同じ定義はソース中での再定義と同一とみなされる
+    * @param body #defineの後ろの文字列（マクロ名から改行の手前まで）
+    * @return 定義に成功したか否か
+    */
+    fn define_directive(std::u8string_view body) -> bool {
+      using namespace std::string_view_literals;
+
+      auto line = m_env->add_line(m_line_num, m_line_num, body);
+      ++m_line_num;
+
+      m_tokens.clear();
+      if (not tokenize_line(line, m_tokens)) return false;
+
+      auto it = m_tokens.begin();
+      const auto end = m_tokens.end();
+
+      it = skip_whitespaces(it, end);
+      if (it == end or (*it).category != pp_token_category::identifier) return false;
+
+      const auto name = (*it).token.to_view();
+      ++it;
+
+      // 関数マクロの場合、マクロ名と開き括弧の間にスペースは入らない
+      const bool is_func = it != end and (*it).category == pp_token_category::op_or_punc and (*it).token == u8"("sv;
+      std::pmr::vector<std::u8string_view> params{ &kusabira::def_mr };
+      bool is_va = false;
+
+      if (is_func) {
+        if (not parse_params(++it, end, params, is_va)) return false;
+      } else if (it != end and pp_token_category::block_comment < (*it).category) {
+        // オブジェクトマクロは必ずスペースが入る
+        return false;
+      }
+
+      std::pmr::list<pp_token> replist{ &kusabira::def_mr };
+      if (not make_replacement_list(skip_whitespaces(it, end), end, replist)) return false;
+
+      if (is_func) {
+        unified_macro macro{ name, std::move(params), std::move(replist), is_va };
+        if (macro.is_ready()) return false;
+        m_env->insert(name, macro);
+      } else {
+        unified_macro macro{ name, std::move(replist) };
+        if (macro.is_ready()) return false;
+        m_env->insert(name, macro);
+      }
+
+      return true;
+    }
+
+    /**
+    * @brief #define/#undefの並んだファイル（gcc -dM -Eの出力など）からマクロを読み込む
+    * @details ll_paserを通さず、1行ずつ直接マクロ定義として解析する
+    * @details 空行は無視し、それ以外のディレクティブやテキスト行はエラーとする
+    * @tparam SrcReader ソースファイルを行毎に読み込む型
+    * @param path 定義ファイルのパス
+    * @return 成功すれば処理したディレクティブの数、失敗すればエラーの起きた論理行番号（ファイルが読めない場合は0）
+    */
+    template<concepts::src_reader SrcReader = filereader>
+    fn load_definitions(const fs::path& path) -> kusabira::expected<std::size_t, std::size_t> {
+      using namespace std::string_view_literals;
+
+      std::error_code ec{};
+      const auto file_size = fs::file_size(path, ec);
+      if (ec) return kusabira::error(std::size_t(0));
+
+      // 1行あたり平均30文字程度
+      m_env->reserve(m_env->size() + file_size / 30);
+
+      SrcReader reader{path};
+      std::size_t count = 0;
+
+      while (auto line = reader.readline()) {
+        std::u8string_view str = (*line).line;
+
+        str = trim_whitespaces(str);
+        if (str.empty()) continue;
+
+        // "#" "define"/"undef" の間には空白があってもいい
+        if (not str.starts_with(u8'#')) return kusabira::error(std::size_t((*line).logical_line_num));
+        str = trim_whitespaces(str.substr(1));
+
+        bool success = false;
+        if (auto body = directive_body(str, u8"define"sv); body) {
+          success = this->define_directive(*body);
+        } else if (auto name = directive_body(str, u8"undef"sv); name and is_identifier(*name)) {
+          this->undef(*name);
+          success = true;
+        }
+
+        if (not success) return kusabira::error(std::size_t((*line).logical_line_num));
+        ++count;
+      }
+
+      return kusabira::ok(count);
+    }
+
+    /**
+    * @brief マクロ定義を取り消す
+    * @param name マクロ名
+    */
+    void undef(std::u8string_view name) {
+      m_env->erase(name);
+    }
+
+    /**
+    * @brief 構築中の環境を参照する
+    */
+    fn environment() const noexcept -> const macro_environment& {
+      return *m_env;
+    }
+
+    /**
+    * @brief 構築を完了し、共有可能な環境を取得する
+    * @details 以降このビルダーは空の環境から構築を再開する
+    * @return 構築したマクロ環境
+    */
+    fn build() -> std::shared_ptr<const macro_environment> {
+      m_line_num = 0;
+      return std::exchange(m_env, std::make_shared<macro_environment>());
+    }
+
+  private:
+
+    /**
+    * @brief 論理行1行をトークン列に分割する
+    * @details tokenizerと同じく、受理した文字は次のトークンの先頭として読み直す
+    * @return トークナイズエラーが無ければtrue
+    */
+    sfn tokenize_line(line_iterator line, std::vector<pp_token>& tokens) -> bool {
+      const auto& str = (*line).line;
+      pp_tokenizer_sm accepter{};
+
+      auto first = str.begin();
+      for (auto pos = first; pos != str.end();) {
+        const auto cat = accepter.input_char(*pos);
+        if (cat == pp_token_category::Unaccepted) {
+          ++pos;
+          continue;
+        }
+        if (cat < pp_token_category::Unaccepted) return false;
+
+        tokens.emplace_back(cat, std::u8string_view{ &*first, std::size_t(pos - first) }, std::size_t(first - str.begin()), line);
+        first = pos;
+      }
+
+      const auto cat = accepter.input_newline();
+      if (cat < pp_token_category::Unaccepted) return false;
+      if (first != str.end()) {
+        tokens.emplace_back(cat, std::u8string_view{ &*first, std::size_t(str.end() - first) }, std::size_t(first - str.begin()), line);
+      }
+
+      return true;
+    }
+
+    /**
+    * @brief ディレクティブ名とその後の空白を取り除く
+    * @return ディレクティブ名が一致しなければ無効値
+    */
+    /**
+    * @brief 文字列全体が1つの識別子であるか
+    */
+    sfn is_identifier(std::u8string_view str) -> bool {
+      if (str.empty() or (u8'0' <= str.front() and str.front() <= u8'9')) return false;
+
+      return std::ranges::all_of(str, [](char8_t c) {
+        return c == u8'_' or (u8'a' <= c and c <= u8'z') or (u8'A' <= c and c <= u8'Z') or (u8'0' <= c and c <= u8'9') or 0x80 <= c;
+      });
+    }
+
+    sfn directive_body(std::u8string_view str, std::u8string_view directive) -> std::optional<std::u8string_view> {
+      if (not str.starts_with(directive)) return std::nullopt;
+      str.remove_prefix(directive.length());
+
+      // ディレクティブ名の直後には空白が必要
+      if (not str.empty() and str.front() != u8' ' and str.front() != u8'\t') return std::nullopt;
+      return trim_whitespaces(str);
+    }
+
+    sfn trim_whitespaces(std::u8string_view str) -> std::u8string_view {
+      const auto first = str.find_first_not_of(u8" \t");
+      if (first == std::u8string_view::npos) return {};
+      return str.substr(first, str.find_last_not_of(u8" \t") - first + 1);
+    }
+
+    template<typename Iterator>
+    sfn skip_whitespaces(Iterator it, Iterator end) -> Iterator {
+      while (it != end and (*it).category <= pp_token_category::block_comment) ++it;
+      return it;
+    }
+
+    /**
+    * @brief 仮引数列を読み取る
+    * @param it 開き括弧の次のトークン、閉じ括弧の次を指して戻る
+    */
+    template<typename Iterator>
+    sfn parse_params(Iterator& it, Iterator end, std::pmr::vector<std::u8string_view>& params, bool& is_va) -> bool {
+      using namespace std::string_view_literals;
+
+      for (;;) {
+        it = skip_whitespaces(it, end);
+        if (it == end) return false;
+
+        if ((*it).category == pp_token_category::identifier) {
+          params.emplace_back((*it).token.to_view());
+        } else if ((*it).category == pp_token_category::op_or_punc and (*it).token == u8"..."sv) {
+          is_va = true;
+          params.emplace_back(u8"...");
+        } else if ((*it).category == pp_token_category::op_or_punc and (*it).token == u8")"sv and params.empty()) {
+          ++it;
+          return true;
+        } else {
+          return false;
+        }
+
+        // 区切りのカンマか閉じ括弧
+        it = skip_whitespaces(++it, end);
+        if (it == end or (*it).category != pp_token_category::op_or_punc) return false;
+
+        if ((*it).token == u8")"sv) {
+          ++it;
+          return true;
+        }
+        // 可変長引数は最後に来る
+        if (is_va or (*it).token != u8","sv) return false;
+        ++it;
+      }
+    }
+
+    /**
+    * @brief 置換リストを構成する
+    * @details ll_paserの置換リスト構成と同じく、コメントを含むホワイトスペースは1つのスペースとして残す
+    */
+    template<typename Iterator>
+    sfn make_replacement_list(Iterator it, Iterator end, std::pmr::list<pp_token>& replist) -> bool {
+      using namespace std::string_view_literals;
+
+      for (; it != end; ++it) {
+        auto& pptoken = *it;
+
+        switch (pptoken.category) {
+        case pp_token_category::empty:
+          break;
+        case pp_token_category::whitespaces:   [[fallthrough]];
+        case pp_token_category::line_comment:  [[fallthrough]];
+        case pp_token_category::block_comment:
+        {
+          auto& ws = replist.emplace_back(std::move(pptoken));
+          ws.category = pp_token_category::whitespaces;
+          ws.token = u8" "sv;
+          break;
+        }
+        case pp_token_category::string_literal:     [[fallthrough]];
+        case pp_token_category::raw_string_literal:
+        {
+          auto& literal = replist.emplace_back(std::move(pptoken));
+          auto str = literal.token.to_view();
+
+          if (str.ends_with(u8'\'')) {
+            literal.category = pp_token_category::charcter_literal;
+          }
+          // 直後の識別子はユーザー定義リテラルのサフィックス、行上で連続しているのでviewを広げる
+          if (auto next = std::next(it); next != end and (*next).category == pp_token_category::identifier) {
+            using enum_int = std::underlying_type_t<pp_token_category>;
+            literal.category = static_cast<pp_token_category>(static_cast<enum_int>(literal.category) + enum_int(1u));
+            literal.token = std::u8string_view{ str.data(), str.length() + (*next).token.to_view().length() };
+            it = next;
+          }
+          break;
+        }
+        case pp_token_category::during_raw_string_literal:
+          // 1行に収まっていない
+          return false;
+        default:
+          replist.emplace_back(std::move(pptoken));
+        }
+      }
+
+      return true;
+    }
+  };
+
+} // namespace kusabira::PP
@@ -3,9 +3,94 @@
 #include <functional>
 #include <algorithm>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <bit>
+#include <span>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#include <emmintrin.h>
+#define KUSABIRA_STRINGIZE_SSE2 1
+#endif
 
 #include "../common.hpp"
 #include "../report_output.hpp"
+#include "phase_timer.hpp"
+#include "time_trace.hpp"
+#include "macro_profiler.hpp"
+#include "expansion_budget.hpp"
+
+// 1にすると、#演算子で文字列化したトークンに元のトークン列を記録する（composed_tokens）
+#ifndef KUSABIRA_TOKEN_PROVENANCE
+#define KUSABIRA_TOKEN_PROVENANCE 0
+#endif
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 文字列化したトークンに元のトークン列を記録するか否か
+  */
+  inline constexpr bool token_provenance_enabled = KUSABIRA_TOKEN_PROVENANCE != 0;
+
+  namespace detail {
+
+    /**
+    * @brief 文字列化の際に\を前置する文字（"と\）を探す
+    * @details SSE2が使える場合は16文字ずつまとめて調べる
+    * @param str 文字/文字列リテラルのトークン文字列
+    * @param pos 探索開始位置
+    * @return 見つかった位置、無ければstr.size()
+    */
+    ifn find_stringize_escape(std::u8string_view str, std::size_t pos) noexcept -> std::size_t {
+      const auto size = str.size();
+
+#ifdef KUSABIRA_STRINGIZE_SSE2
+      const auto quote = _mm_set1_epi8('"');
+      const auto backslash = _mm_set1_epi8('\\');
+
+      for (; pos + 16 <= size; pos += 16) {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + pos));
+        const auto hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        if (const auto mask = static_cast<unsigned int>(_mm_movemask_epi8(hit)); mask != 0) {
+          return pos + std::countr_zero(mask);
+        }
+      }
+#endif
+
+      for (; pos < size; ++pos) {
+        if (str[pos] == u8'"' or str[pos] == u8'\\') return pos;
+      }
+      return size;
+    }
+
+    /**
+    * @brief 文字列化の際に\を前置する文字の数を数える
+    */
+    ifn count_stringize_escapes(std::u8string_view str) noexcept -> std::size_t {
+      std::size_t count = 0;
+      for (auto pos = find_stringize_escape(str, 0); pos != str.size(); pos = find_stringize_escape(str, pos + 1)) {
+        ++count;
+      }
+      return count;
+    }
+
+    /**
+    * @brief "と\の前に\を挿入しながら追記する
+    * @param out 追記先
+    * @param str 文字/文字列リテラルのトークン文字列
+    */
+    inline void append_stringize_escaped(std::pmr::u8string& out, std::u8string_view str) {
+      std::size_t copied = 0;
+      for (auto pos = find_stringize_escape(str, 0); pos != str.size(); pos = find_stringize_escape(str, pos + 1)) {
+        out.append(str.substr(copied, pos - copied));
+        out.push_back(u8'\\');
+        copied = pos;
+      }
+      out.append(str.substr(copied));
+    }
+  }
+}
 
 namespace kusabira::PP::inline free_func {
 
@@ -37,106 +122,249 @@ namespace kusabira::PP::inline free_func {
 
   /**
   * @brief プリプロセッシングトークン列の文字列化を行う
-  * @param it 文字列化対象のトークン列の先頭
-  * @param end 文字列化対象のトークン列の終端
+  * @details 結果の長さを先に求めてから、1つのバッファに1度で書き込む
+  * @details 元のトークン列はtoken_provenance_enabledの時だけ記録する
+  * @param range 文字列化対象のトークン列
   * @return 文字列化されたトークン（列）、必ず1要素になる
   */
   template<bool IsVA, std::ranges::bidirectional_range R>
   ifn pp_stringize(R&& range) -> std::pmr::list<pp_token> {
     using namespace std::string_view_literals;
 
-    //結果のリスト
-    std::pmr::list<pp_token> result{ &kusabira::def_mr };
-    //文字列トークン
-    pp_token& first = result.emplace_back(PP::pp_token_category::string_literal);
-
-    //トークン列を順に文字列化するための一時文字列
-    std::pmr::u8string str{u8"\""sv , &kusabira::def_mr};
-    //字句トークン列挿入位置
-    auto insert_pos = first.composed_tokens.before_begin();
-
     // 先頭と末尾のホワイトスペースとプレイスメーカートークンを無視する
     auto skip = [](const auto& token) {
       return token.category == pp_token_category::whitespaces or token.category == pp_token_category::placemarker_token;
     };
 
-    for (auto& pptoken : range | std::views::drop_while(skip)
-                               | std::views::reverse
-                               | std::views::drop_while(skip)
-                               | std::views::reverse)
-    {
+    const auto first = std::ranges::find_if_not(range, skip);
+    auto last = std::ranges::next(first, std::ranges::end(range));
+    while (last != first and skip(*std::prev(last))) --last;
+
+    // "と\をエスケープする必要があるトークン
+    auto is_literal = [](pp_token_category cat) {
+      return pp_token_category::charcter_literal <= cat and cat <= pp_token_category::user_defined_raw_string_literal;
+    };
+
+    // 前後の"を含めた結果の長さ
+    std::size_t length = 2;
+    for (const auto& pptoken : std::ranges::subrange{first, last}) {
       // プレイスメーカートークンはいないものとする
       if (pptoken.category == pp_token_category::placemarker_token) continue;
 
-      auto&& tmp = pptoken.token.to_string();
+      const auto str = pptoken.token.to_view();
+      length += str.size();
+      if (is_literal(pptoken.category)) length += detail::count_stringize_escapes(str);
 
-      // "と\ をエスケープする必要がある
-      if (auto cat = pptoken.category; pp_token_category::charcter_literal <= cat and cat <= pp_token_category::user_defined_raw_string_literal) {
-        // バックスラッシュをエスケープする
-        auto bpos = tmp.find(u8'\\');
-        while (bpos != std::u8string::npos) {
-          tmp.replace(bpos, 1, u8R"(\\)");
-          bpos = tmp.find(u8'\\', bpos + 2);
-        }
+      if constexpr (IsVA) {
+        // カンマの後にスペースを補う
+        if (str == u8","sv) ++length;
+      }
+    }
 
-        if (pp_token_category::string_literal <= cat) {
-          // "をエスケープする
-          auto lpos = tmp.find(u8'"');
-          tmp.replace(lpos, 1, u8R"(\")");
-          auto rpos = tmp.rfind(u8'"');
-          tmp.replace(rpos, 1, u8R"(\")");
-        }
+    std::pmr::u8string str{ &kusabira::def_mr };
+    str.reserve(length);
+    str.push_back(u8'"');
+
+    for (const auto& pptoken : std::ranges::subrange{first, last}) {
+      if (pptoken.category == pp_token_category::placemarker_token) continue;
+
+      const auto view = pptoken.token.to_view();
+      if (is_literal(pptoken.category)) {
+        detail::append_stringize_escaped(str, view);
+      } else {
+        str.append(view);
       }
-      str.append(std::move(tmp));
 
       if constexpr (IsVA) {
-        // カンマの後にスペースを補う
-        if (pptoken.token == u8","sv) {
-          str.append(u8" ");
-        }
+        if (view == u8","sv) str.push_back(u8' ');
       }
+    }
+
+    str.push_back(u8'"');
+    assert(str.size() == length);
+
+    //結果のリスト
+    std::pmr::list<pp_token> result{ &kusabira::def_mr };
+    //文字列トークン
+    pp_token& strtoken = result.emplace_back(PP::pp_token_category::string_literal);
+    strtoken.token = std::move(str);
 
+    if constexpr (token_provenance_enabled) {
       // 文字列化したプリプロセッシングトークンを構成するトークン列を保存しておく
-      insert_pos = first.composed_tokens.insert_after(insert_pos, pptoken);
+      auto insert_pos = strtoken.composed_tokens.before_begin();
+      for (const auto& pptoken : std::ranges::subrange{first, last}) {
+        if (pptoken.category == pp_token_category::placemarker_token) continue;
+        insert_pos = strtoken.composed_tokens.insert_after(insert_pos, pptoken);
+      }
     }
 
-    str.append(u8"\"");
-    first.token = std::move(str);
-
     return result;
   }
 
+  /**
+  * @brief 関数マクロ呼び出しの実引数列
+  * @details 全ての実引数のトークンを1つの連続した領域に詰めて保持し、実引数毎にその範囲を持つ
+  * @details clear()しても領域は解放しないので、使いまわせばマクロ呼び出し毎の確保も起こらない
+  */
+  class macro_args {
+    // 全ての実引数のトークン列
+    std::pmr::vector<pp_token> m_tokens{ &kusabira::def_mr };
+    // 各実引数のm_tokens上の範囲[first, last)
+    std::pmr::vector<std::pair<std::size_t, std::size_t>> m_ranges{ &kusabira::def_mr };
+    // 構築中の実引数の先頭位置
+    std::size_t m_pending = 0;
+
+  public:
+
+    /**
+    * @brief 実引数を1つずつ参照するイテレータ
+    */
+    class iterator {
+      const macro_args* m_args = nullptr;
+      std::size_t m_index = 0;
+
+    public:
+      using value_type = std::span<const pp_token>;
+      using difference_type = std::ptrdiff_t;
+
+      iterator() = default;
+
+      iterator(const macro_args* args, std::size_t index) noexcept
+        : m_args{args}
+        , m_index{index}
+      {}
+
+      fn operator*() const noexcept -> std::span<const pp_token> {
+        return (*m_args)[m_index];
+      }
+
+      iterator& operator++() noexcept {
+        ++m_index;
+        return *this;
+      }
+
+      iterator operator++(int) noexcept {
+        auto copy = *this;
+        ++m_index;
+        return copy;
+      }
+
+      ffn operator==(const iterator& lhs, const iterator& rhs) noexcept -> bool {
+        return lhs.m_index == rhs.m_index;
+      }
+    };
+
+    macro_args() = default;
+
+    /**
+    * @brief 実引数毎のトークンリストから構築する
+    * @param args 1つの実引数を表すlistを引数分保持したvector
+    */
+    macro_args(const std::pmr::vector<std::pmr::list<pp_token>>& args) {
+      for (const auto& arg : args) {
+        m_tokens.insert(m_tokens.end(), arg.begin(), arg.end());
+        this->close_arg();
+      }
+    }
+
+    /**
+    * @brief 全ての実引数を取り除く、確保済みの領域は保持する
+    */
+    void clear() noexcept {
+      m_tokens.clear();
+      m_ranges.clear();
+      m_pending = 0;
+    }
+
+    /**
+    * @brief 構築中の実引数の末尾にトークンを追加する
+    */
+    void push_token(pp_token token) {
+      m_tokens.emplace_back(std::move(token));
+    }
+
+    /**
+    * @brief 構築中の実引数の末尾にトークン列を移動する
+    */
+    void push_tokens(std::pmr::list<pp_token>&& tokens) {
+      for (auto& token : tokens) m_tokens.emplace_back(std::move(token));
+      tokens.clear();
+    }
+
+    /**
+    * @brief 構築中の実引数のトークン列
+    */
+    fn pending() noexcept -> std::span<pp_token> {
+      return std::span<pp_token>{m_tokens}.subspan(m_pending);
+    }
+
+    /**
+    * @brief 構築中の実引数を確定し、次の実引数の構築を始める
+    */
+    void close_arg() {
+      m_ranges.emplace_back(m_pending, m_tokens.size());
+      m_pending = m_tokens.size();
+    }
+
+    fn size() const noexcept -> std::size_t {
+      return m_ranges.size();
+    }
+
+    fn empty() const noexcept -> bool {
+      return m_ranges.empty();
+    }
+
+    /**
+    * @brief 実引数1つのトークン列
+    * @details 次にトークンを追加するまで有効
+    */
+    fn operator[](std::size_t index) const noexcept -> std::span<const pp_token> {
+      const auto [first, last] = m_ranges[index];
+      return std::span<const pp_token>{m_tokens}.subspan(first, last - first);
+    }
+
+    fn back() const noexcept -> std::span<const pp_token> {
+      return (*this)[m_ranges.size() - 1];
+    }
+
+    fn begin() const noexcept -> iterator {
+      return iterator{this, 0};
+    }
+
+    fn end() const noexcept -> iterator {
+      return iterator{this, m_ranges.size()};
+    }
+  };
+
   /**
   * @brief 関数マクロ呼び出しの実引数を取得する
-  * @param it 関数マクロ呼び出しの(の次の位置
+  * @details 閉じかっこまでを1度だけ走査し、実引数を区切りながらargsに詰めていく
+  * @param it 関数マクロ呼び出しの(の次の位置、閉じかっこが見つかればそこを指して終わる
   * @param end 関数マクロ呼び出しの)を含むような範囲の終端
+  * @param args 実引数列の格納先、クリアしてから使用する
   * @param other_token_func 記号以外のトークンを処理する関数オブジェクト
-  * @return 1つの引数を表すlistを引数分保持したvector
+  * @return 閉じかっこが見つかったか否か（エラーの場合もfalse）
   */
-  template <std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel, std::invocable<Iterator&, Sentinel, std::pmr::list<pp_token>&> F>
+  template <std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel, std::invocable<Iterator&, Sentinel, macro_args&> F>
     requires std::same_as<std::iter_value_t<Iterator>, pp_token> and
-             std::convertible_to<std::invoke_result_t<F, Iterator&, Sentinel, std::pmr::list<pp_token>&>, bool>
-  ifn parse_macro_args(Iterator& it, Sentinel fin, F&& other_token_func) -> std::pmr::vector<std::pmr::list<pp_token>> {
+             std::convertible_to<std::invoke_result_t<F, Iterator&, Sentinel, macro_args&>, bool>
+  ifn parse_macro_args(Iterator& it, Sentinel fin, macro_args& args, F&& other_token_func) -> bool {
     using namespace std::string_view_literals;
 
-    // 最初の非ホワイトスペーストークンまで進める
-    it = std::ranges::find_if_not(std::move(it), fin, [](const pp_token &token) {
+    args.clear();
+
+    // カンマや開きかっこの直後のホワイトスペースを飛ばす
+    auto skip_whitespaces = [&it, &fin]() {
       // ここにくるものはプリプロセッシングトークンとして妥当なものであるはず
       // 改行はホワイトスペースになってるはずだし、それ以外に無視すべきトークンは残ってないはず
-      return token.category <= pp_token_category::block_comment;
-    });
-
-    // 見つけた実引数列
-    std::pmr::vector<std::pmr::list<pp_token>> args{&kusabira::def_mr};
-
-    // こうなってたら何か変なきがする
-    if (it == fin) return args;
+      it = std::ranges::find_if_not(std::move(it), fin, [](const pp_token& token) {
+        return token.category <= pp_token_category::block_comment;
+      });
+    };
 
-    // とりあえず引数10個分確保しておく
-    args.reserve(10);
+    // 最初の非ホワイトスペーストークンまで進める
+    skip_whitespaces();
 
-    // 実引数1つ分のリスト、作業用
-    std::pmr::list<pp_token> arg_list{&kusabira::def_mr};
     // 実引数リストの区切りカンマまでの間に出現したネストかっこの数
     std::size_t inner_paren = 0;
 
@@ -144,24 +372,20 @@ namespace kusabira::PP::inline free_func {
       if (deref(it).category == pp_token_category::op_or_punc) {
         //カンマの出現で1つの実引数のパースを完了する
         if (inner_paren == 0 and deref(it).token == u8","sv) {
-          args.emplace_back(std::move(arg_list));
-          //要らないけど、一応
-          arg_list = std::pmr::list<pp_token>{&kusabira::def_mr};
+          args.close_arg();
           //カンマは保存しない
           ++it;
           //カンマ直後のホワイトスペースは飛ばす
-          it = std::ranges::find_if_not(std::move(it), fin, [](const pp_token& token) {
-            return token.category <= pp_token_category::block_comment;
-          });
+          skip_whitespaces();
           continue;
         } else if (deref(it).token == u8"("sv) {
           //かっこの始まり
           ++inner_paren;
         } else if (deref(it).token == u8")"sv) {
-          //マクロ終了の閉じかっこ判定
+          //マクロ終了の閉じかっこ判定、実引数の最後が空だとしても空の実引数が追加される
           if (inner_paren == 0) {
-            args.emplace_back(std::move(arg_list));
-            break;
+            args.close_arg();
+            return true;
           }
           //入れ子閉じかっこ
           --inner_paren;
@@ -169,37 +393,49 @@ namespace kusabira::PP::inline free_func {
       }
 
       // その他の種別のトークンを処理する、外部から渡された関数オブジェクトに委譲
-      if (other_token_func(it, fin, arg_list) == false) {
+      if (other_token_func(it, fin, args) == false) {
         // エラーが起きていたらそこで終わる、詳細なエラーハンドリングは外の責任
-        return args;
+        return false;
       }
     }
 
-    // 実引数の最後が空だとしても空のリストが引数として追加される
-    // args.emplace_back(std::move(arg_list));
+    return false;
+  }
 
+  /**
+  * @brief 関数マクロ呼び出しの実引数を取得する
+  * @param it 関数マクロ呼び出しの(の次の位置
+  * @param end 関数マクロ呼び出しの)を含むような範囲の終端
+  * @param other_token_func 記号以外のトークンを処理する関数オブジェクト
+  * @return 実引数列
+  */
+  template <std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel, std::invocable<Iterator&, Sentinel, macro_args&> F>
+    requires std::same_as<std::iter_value_t<Iterator>, pp_token> and
+             std::convertible_to<std::invoke_result_t<F, Iterator&, Sentinel, macro_args&>, bool>
+  ifn parse_macro_args(Iterator& it, Sentinel fin, F&& other_token_func) -> macro_args {
+    macro_args args{};
+    (void)parse_macro_args(it, fin, args, std::forward<F>(other_token_func));
     return args;
   }
-  
-  
+
   /**
   * @brief 関数マクロ呼び出しの実引数を取得する
   * @param it 関数マクロ呼び出しの(の次の位置
   * @param end 関数マクロ呼び出しの)を含むような範囲の終端
   * @details マクロ展開の途中と最後のタイミングで含まれるマクロを再帰的に展開する時を想定しているので、バリデーションなどは最低限
   * @todo 引数パースエラーを考慮する必要がある？
-  * @return 1つの引数を表すlistを引数分保持したvector
+  * @return 実引数列
   */
   template <std::input_iterator Iterator, std::sentinel_for<Iterator> Sentinel>
     requires std::same_as<std::iter_value_t<Iterator>, pp_token>
-  ifn parse_macro_args(Iterator& it, Sentinel fin) -> std::pmr::vector<std::pmr::list<pp_token>> { 
-    return parse_macro_args(it, fin, [](Iterator& itr, Sentinel, auto& arg_list) -> bool {
+  ifn parse_macro_args(Iterator& it, Sentinel fin) -> macro_args {
+    return parse_macro_args(it, fin, [](Iterator& itr, Sentinel, macro_args& args) -> bool {
       //改行はホワイトスペースになってるはずだし、ホワイトスペースは1つに畳まれているはず
       //妥当なプリプロセッシングトークン列としも構成済みのはず
       //従って、ここではその処理を行わない
       //そして、マクロ引数列中のマクロもここでは処理しない（外側マクロの置換後に再スキャンされる）
 
-      arg_list.emplace_back(std::move(*itr));
+      args.push_token(std::move(*itr));
       ++itr;
       return true;
     });
@@ -226,8 +462,13 @@ namespace kusabira::PP {
     std::optional<std::pair<pp_parse_context, pp_token>> m_replist_err{};
     //{置換リストに現れる仮引数名のインデックス, 対応する実引数のインデックス, __VA_ARGS__?, __VA_OPT__?, #?, ##の左辺?, ##の右辺?, VA_OPTの中？}}
     std::pmr::vector<std::tuple<std::size_t, std::size_t, bool, bool, bool, bool, bool, bool>> m_correspond;
+    //定義内容のフィンガープリント
+    std::uint64_t m_fingerprint = 0;
 
   public:
+
+    //置換リスト上の仮引数と実引数の対応情報の型
+    using correspond_t = std::tuple<std::size_t, std::size_t, bool, bool, bool, bool, bool, bool>;
     
     //マクロ実行の結果型
     using macro_result_t = kusabira::expected<std::pmr::list<pp_token>, std::pair<pp_parse_context, pp_token>>;
@@ -458,12 +699,12 @@ namespace kusabira::PP {
 
     /**
     * @brief 通常の（固定長引数）関数マクロの処理の実装
-    * @param args 実引数列（カンマ区切り毎のトークン列のvector
+    * @param args 実引数列
     * @return マクロ置換後のトークンリスト
     */
     template<std::invocable<std::pmr::list<pp_token>&> F>
       requires std::same_as<bool, std::invoke_result_t<F, std::pmr::list<pp_token>&>>
-    fn func_macro_impl(const std::pmr::vector<std::pmr::list<pp_token>>& args, F&& expand_macro) const -> macro_result_t {
+    fn func_macro_impl(const macro_args& args, F&& expand_macro) const -> macro_result_t {
       //置換対象のトークンシーケンスをコピー（終了後そのまま置換結果となる）
       std::pmr::list<pp_token> result_list{ m_tokens, &kusabira::def_mr };
 
@@ -481,12 +722,12 @@ namespace kusabira::PP {
         auto rhs = std::next(it);
 
         if (arg_index != std::size_t(-1)) {
-          //対応する実引数のトークン列をコピー
-          std::pmr::list<pp_token> arg_list{args[arg_index], &kusabira::def_mr};
+          const auto arg = args[arg_index];
+          //対応する実引数のトークン列をコピー、文字列化する場合は実引数から直接文字列化する
+          std::pmr::list<pp_token> arg_list = sharp_op ? pp_stringize<false>(arg) : std::pmr::list<pp_token>{arg.begin(), arg.end(), &kusabira::def_mr};
 
-          //文字列化
           if (sharp_op) {
-            arg_list = pp_stringize<false>(arg_list);
+            //文字列化済み
           } else if (empty(arg_list)) {
             //文字列化対象ではなく引数が空の時、プレイスメーカートークンを挿入しておく
             result_list.insert(it, pp_token{ pp_token_category::placemarker_token });
@@ -529,13 +770,13 @@ namespace kusabira::PP {
 
     /**
     * @brief 可変引数関数マクロの処理の実装
-    * @param args 実引数列（カンマ区切り毎のトークン列のvector
+    * @param args 実引数列
     * @param f 引数のマクロ置換処理
     * @return マクロ置換後のトークンリスト
     */
     template<std::invocable<std::pmr::list<pp_token>&> F>
       requires std::same_as<bool, std::invoke_result_t<F, std::pmr::list<pp_token>&>>
-    fn va_macro_impl(const std::pmr::vector<std::pmr::list<pp_token>>& args, F&& expand_macro) const -> macro_result_t {
+    fn va_macro_impl(const macro_args& args, F&& expand_macro) const -> macro_result_t {
       using namespace std::string_view_literals;
 
       //置換対象のトークンシーケンスをコピー（終了後そのまま置換結果となる）
@@ -557,11 +798,11 @@ namespace kusabira::PP {
 
           // 実引数のトークン列を直接変えられると再帰マクロ展開のタイミングが異なってしまうのでコピーする
           // この結果を使いまわす手もあるけど、出現頻度が低いと思われるので微妙かも・・・
-          std::pmr::list<pp_token> copylist{args.back(), &kusabira::def_mr};
+          std::pmr::list<pp_token> copylist{args.back().begin(), args.back().end(), &kusabira::def_mr};
 
           // falseが帰ってきたら置換中のエラー
           if (not expand_macro(copylist))
-            return kusabira::error(std::make_pair(pp_parse_context::Funcmacro_ReplacementFail, std::move(args.back().front())));
+            return kusabira::error(std::make_pair(pp_parse_context::Funcmacro_ReplacementFail, args.back().front()));
           // 置換結果が空ならば可変長部は空
           is_va_empty_tmp = std::ranges::empty(copylist);
         }
@@ -685,7 +926,7 @@ namespace kusabira::PP {
           //可変長引数部分をコピーしつつカンマを登録
           for (std::size_t va_index = arg_index; va_index < N; ++va_index) {
             //実引数一つをコピー
-            arg_list.splice(pos, std::pmr::list<pp_token>{args[va_index], &kusabira::def_mr});
+            arg_list.insert(pos, args[va_index].begin(), args[va_index].end());
 
             //最後の引数にはカンマをつけない
             if (va_index != (N - 1)) {
@@ -693,15 +934,18 @@ namespace kusabira::PP {
               arg_list.emplace_back(pp_token_category::op_or_punc, u8","sv);
             }
           }
-        } else if (arg_index != std::size_t(-1)) {
+        } else if (arg_index != std::size_t(-1) and not sharp_op) {
           //対応する実引数のトークン列をコピー
-          arg_list = args[arg_index];
+          arg_list.assign(args[arg_index].begin(), args[arg_index].end());
         }
 
         if (sharp_op) {
           //#演算子の処理、文字列化を行う
           if (va_args) {
             arg_list = pp_stringize<true>(arg_list);
+          } else if (arg_index != std::size_t(-1)) {
+            // 実引数から直接文字列化する
+            arg_list = pp_stringize<false>(args[arg_index]);
           } else {
             arg_list = pp_stringize<false>(arg_list);
           }
@@ -804,6 +1048,37 @@ namespace kusabira::PP {
       });
     }
 
+    /**
+    * @brief 定義内容のフィンガープリントを計算する
+    * @details 形式と仮引数列と置換リスト（トークン種別と文字列）のFNV-1aハッシュ、同一の定義は同じ値になる
+    * @return 0以外の値、0は未定義を表すのに使う
+    */
+    fn make_fingerprint() const noexcept -> std::uint64_t {
+      constexpr std::uint64_t prime = 1099511628211ull;
+      std::uint64_t hash = 14695981039346656037ull;
+
+      auto feed = [&hash](std::uint8_t byte) {
+        hash ^= byte;
+        hash *= prime;
+      };
+      auto feed_str = [&feed](std::u8string_view str) {
+        for (char8_t c : str) feed(static_cast<std::uint8_t>(c));
+        // 区切り、文字列の連結が同じになる別の定義を区別する
+        feed(0xff);
+      };
+
+      feed(static_cast<std::uint8_t>((m_is_func ? 1u : 0u) | (m_is_va ? 2u : 0u)));
+      for (auto param : m_params) {
+        feed_str(param);
+      }
+      for (const auto& pptoken : m_tokens) {
+        feed(static_cast<std::uint8_t>(pptoken.category));
+        feed_str(pptoken.token.to_view());
+      }
+
+      return hash == 0 ? 1 : hash;
+    }
+
   public:
 
     /**
@@ -826,6 +1101,7 @@ namespace kusabira::PP {
       } else {
         this->make_id_to_param_pair<false>(name, 0, m_tokens.size());
       }
+      m_fingerprint = this->make_fingerprint();
     }
 
     /**
@@ -843,11 +1119,96 @@ namespace kusabira::PP {
     {
       this->objmacro_token_concat();
       this->recursion_macro_marking(name);
+      m_fingerprint = this->make_fingerprint();
+    }
+
+    /**
+    * @brief 別のmemory_resource上に複製する
+    * @param other 複製元マクロ
+    * @param mr 複製先で使用するmemory_resource
+    * @param rehome 文字列とトークンを複製先の所有する領域へ移す関数（u8string_view -> u8string_view、const pp_token& -> pp_token）
+    * @details 置換リストの解析結果も含めてそのまま複製し、再解析は行わない
+    */
+    template <typename F>
+    unified_macro(const unified_macro& other, std::pmr::memory_resource* mr, F&& rehome)
+      : m_params{ mr }
+      , m_tokens{ mr }
+      , m_is_va{other.m_is_va}
+      , m_is_func{other.m_is_func}
+      , m_correspond{ other.m_correspond, mr }
+      , m_fingerprint{ other.m_fingerprint }
+    {
+      m_params.reserve(other.m_params.size());
+      for (auto param : other.m_params) {
+        m_params.emplace_back(rehome(param));
+      }
+      for (const auto& pptoken : other.m_tokens) {
+        m_tokens.emplace_back(rehome(pptoken));
+      }
+      if (other.m_replist_err) {
+        m_replist_err.emplace((*other.m_replist_err).first, rehome((*other.m_replist_err).second));
+      }
     }
 
+    /**
+    * @brief 解析済みの状態から復元する
+    * @param params 仮引数列
+    * @param replist 置換リスト
+    * @param is_va 可変引数マクロであるか否か
+    * @param is_func 関数マクロであるか否か
+    * @param correspond 置換リスト上の仮引数と実引数の対応情報
+    * @param replist_err 置換リストのエラー
+    * @details 置換リストの再解析は行わない、各コンテナのmemory_resourceはそのまま引き継ぐ
+    */
+    unified_macro(std::pmr::vector<std::u8string_view>&& params, std::pmr::list<pp_token>&& replist, bool is_va, bool is_func, std::pmr::vector<correspond_t>&& correspond, std::optional<std::pair<pp_parse_context, pp_token>>&& replist_err)
+      : m_params{ std::move(params) }
+      , m_tokens{ std::move(replist) }
+      , m_is_va{is_va}
+      , m_is_func{is_func}
+      , m_replist_err{ std::move(replist_err) }
+      , m_correspond{ std::move(correspond) }
+      , m_fingerprint{ this->make_fingerprint() }
+    {}
+
     unified_macro(unified_macro&&) = default;
     unified_macro& operator=(unified_macro&&) = default;
 
+    /**
+    * @brief 仮引数列を取得する
+    */
+    fn params() const noexcept -> const std::pmr::vector<std::u8string_view>& {
+      return m_params;
+    }
+
+    /**
+    * @brief 置換リストを取得する
+    */
+    fn replacement_list() const noexcept -> const std::pmr::list<pp_token>& {
+      return m_tokens;
+    }
+
+    /**
+    * @brief 置換リスト上の仮引数と実引数の対応情報を取得する
+    */
+    fn correspond() const noexcept -> const std::pmr::vector<correspond_t>& {
+      return m_correspond;
+    }
+
+    /**
+    * @brief 可変引数マクロであるかを調べる
+    */
+    fn is_va() const noexcept -> bool {
+      return m_is_va;
+    }
+
+    /**
+    * @brief 定義内容のフィンガープリントを取得する
+    * @details 同一の定義（is_identical()がtrueとなるもの）は同じ値を持つ
+    */
+    fn fingerprint() const noexcept -> std::uint64_t {
+      return m_fingerprint;
+    }
+
     /**
     * @brief 仮引数列と置換リストから別のマクロとの同一性を判定する
     * @param params 仮引数列
@@ -881,7 +1242,7 @@ namespace kusabira::PP {
     * @details 可変引数マクロなら仮引数の数-1以上、それ以外の場合は仮引数の数と同一である場合に引数の数が合っているとみなす
     * @return 実引数の数が合っているか否か
     */
-    fn validate_argnum(const std::pmr::vector<std::pmr::list<pp_token>>& args) const noexcept -> bool {
+    fn validate_argnum(const macro_args& args) const noexcept -> bool {
       if (m_is_va == true) {
         // 可変長マクロ
         // 可変長部を除いた仮引数の数以上であればok
@@ -909,7 +1270,7 @@ namespace kusabira::PP {
     * @param args 実引数列
     * @return 置換結果のトークンリスト
     */
-    fn operator()(const std::pmr::vector<std::pmr::list<pp_token>>& args) const -> macro_result_t {
+    fn operator()(const macro_args& args) const -> macro_result_t {
       //可変引数マクロと処理を分ける
       if (m_is_va) {
         return this->va_macro_impl(args, [](auto&&) constexpr { return true; });
@@ -926,7 +1287,7 @@ namespace kusabira::PP {
     */
     template<std::invocable<std::pmr::list<pp_token>&> F>
       requires std::same_as<bool, std::invoke_result_t<F, std::pmr::list<pp_token>&>>
-    fn operator()(const std::pmr::vector<std::pmr::list<pp_token>>& args, F&& f) const -> macro_result_t {
+    fn operator()(const macro_args& args, F&& f) const -> macro_result_t {
       //可変引数マクロと処理を分ける
       if (m_is_va) {
         return this->va_macro_impl(args, std::forward<F>(f));
@@ -940,68 +1301,359 @@ namespace kusabira::PP {
 
 namespace kusabira::PP {
 
-  class macro_manager {
-
-    using funcmacro_map = std::pmr::unordered_map<std::u8string_view, unified_macro>;
-    using timepoint_t = decltype(std::chrono::system_clock::now());
-
-    // ソースファイル名
-    fs::path m_filename{};
-    // 変更があった場合のファイル名
-    fs::path m_replace_filename{};
-    // コンパイル開始時時刻
-    std::time_t m_datetime{};
-    // ユーザー定義のマクロ
-    funcmacro_map m_macros{ &kusabira::def_mr };
-    // 行番号変更の対応を取っておく
-    std::pmr::map<std::size_t, std::size_t> m_line_map{ &kusabira::def_mr };
-
-    // 事前定義マクロ、以降変更されることは無いはず、ムーブしたいのでconstを付けないでおく・・・
-    std::unordered_map<std::u8string_view, std::u8string_view> m_predef_macro = {
-      {u8"__LINE__", u8""},
-      {u8"__FILE__", u8""},
-      {u8"__DATE__", u8""},
-      {u8"__TIME__", u8""},
-      {u8"_­_­cplusplus", u8"202002L"},
-      {u8"__STDC_­HOSTED__", u8"1"},
-      {u8"__STDCPP_­DEFAULT_­NEW_­ALIGNMENT__", u8"16ull"},
-      //{u8"__STDCPP_­STRICT_­POINTER_­SAFETY__", u8"1"},
-      {u8"__STDCPP_­THREADS__", u8"1"}
-    };
+  /**
+  * @brief 事前に構築しておく、変更されないマクロ環境
+  * @details 事前定義マクロやコマンドラインの-D指定などを一度だけ構築し、翻訳単位毎のmacro_managerから共有して参照する
+  * @details 全てのデータを自前のmemory_resource上に所有しており、kusabira::def_mrの寿命とは無関係
+  * @details 構築（macro_environment_builder）の完了後はconstとして扱い、複数スレッドから同時に参照してよい
+  */
+  class macro_environment {
+    using macro_map = std::pmr::unordered_map<std::u8string_view, unified_macro>;
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    // 全データの確保元、アドレスを固定しておくためにヒープに置く
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> m_mr = std::make_unique<std::pmr::monotonic_buffer_resource>();
+    // マクロ定義の元になった行
+    std::pmr::forward_list<logical_line> m_lines{ m_mr.get() };
+    // 最後に追加した行の位置
+    line_iterator m_last_line = m_lines.before_begin();
+    // 行に含まれない文字列の保存先
+    std::pmr::forward_list<std::pmr::u8string> m_strings{ m_mr.get() };
+    // マクロ名 -> マクロ
+    macro_map m_macros{ m_mr.get() };
 
   public:
 
-    macro_manager() = default;
+    macro_environment() = default;
 
-    macro_manager(const fs::path& filename)
-      : m_filename{ filename }
-      , m_replace_filename{ filename.filename() }
-      , m_datetime{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) }
-    {}
+    macro_environment(const macro_environment&) = delete;
+    macro_environment& operator=(const macro_environment&) = delete;
 
-  private:
+    /**
+    * @brief マクロを検索する
+    * @param name マクロ名
+    * @return 見つかればそのマクロへのポインタ、なければnullptr
+    */
+    fn find(std::u8string_view name) const -> const unified_macro* {
+      if (auto pos = m_macros.find(name); pos != m_macros.end()) {
+        return &(*pos).second;
+      }
+      return nullptr;
+    }
 
     /**
-    * @brief 事前定義マクロを処理する
-    * @details __LINE__ __FILE__ __DATE__ __TIME__ の4つは特殊処理、その他はトークン置換で生成
-    * @param macro_name マクロ名
-    * @return 処理結果、無効値は対象外
+    * @brief 登録されているマクロ全体を取得する
     */
-    fn predefined_macro(const pp_token& macro_name) const -> std::optional<std::pmr::list<pp_token>> {
+    fn macros() const noexcept -> const macro_map& {
+      return m_macros;
+    }
 
-      //結果プリプロセッシングトークンリストを作成する処理
-      auto make_result = [&macro_name, &mr = kusabira::def_mr](auto str, auto pptoken_cat) {
-        std::pmr::list<pp_token> result_list{ &mr };
-        auto& linenum_token = result_list.emplace_back(pptoken_cat, u8"", macro_name.column, macro_name.srcline_ref);
-        linenum_token.token = std::move(str);
+    fn size() const noexcept -> std::size_t {
+      return m_macros.size();
+    }
 
-        return result_list;
-      };
+    /**
+    * @brief マクロの登録数の見込みを設定し、再ハッシュを避ける
+    * @param count 登録されるマクロの数
+    */
+    void reserve(std::size_t count) {
+      m_macros.reserve(count);
+    }
 
-      if (macro_name.token == u8"__LINE__") {
-        auto line_num = macro_name.get_logicalline_num();
+    /**
+    * @brief マクロ定義元の行を追加する
+    * @param pline_num 物理行番号
+    * @param lline_num 論理行番号
+    * @param str 行文字列
+    * @param line_offset 行継続がある場合の、物理1行毎の文字列長
+    * @return 追加した行へのイテレータ、この環境が生きている間有効
+    */
+    fn add_line(std::size_t pline_num, std::size_t lline_num, std::u8string_view str, std::span<const std::size_t> line_offset = {}) -> line_iterator {
+      auto pos = m_lines.emplace_after(m_last_line, pline_num, lline_num, m_mr.get());
+      (*pos).line = str;
+      (*pos).line_offset.assign(line_offset.begin(), line_offset.end());
+      m_last_line = pos;
+      return m_last_line;
+    }
 
-        //現在の実行数に対応する#lineによる行数変更を捜索        
+    /**
+    * @brief 文字列をこの環境の所有する領域へ複製する
+    * @param str 文字列
+    * @return 複製した文字列を参照するview
+    */
+    fn intern(std::u8string_view str) -> std::u8string_view {
+      if (str.empty()) return {};
+      return m_strings.emplace_front(str);
+    }
+
+    /**
+    * @brief トークンをこの環境の所有する領域へ複製する
+    * @details トークン文字列がこの環境の持つ行を参照していればそのまま、そうでなければ複製する
+    * @details 生成されたトークンを除いて、トークンの対応する論理行はこの環境の持つ行（add_line()で追加したもの）であること
+    * @details 複製後のトークン文字列は全てviewになるので、コピーしてもこの環境のmemory_resourceが使われることは無い
+    * @param pptoken 複製元トークン
+    * @return 複製したトークン
+    */
+    fn rehome(const pp_token& pptoken) -> pp_token {
+      auto str = pptoken.token.to_view();
+
+      if (pptoken.is_generated or not is_within((*pptoken.srcline_ref).line, str)) {
+        str = this->intern(str);
+      }
+
+      pp_token result{pptoken.category, str, pptoken.column, pptoken.srcline_ref, m_mr.get()};
+      result.is_generated = pptoken.is_generated;
+
+      auto pos = result.composed_tokens.before_begin();
+      for (const auto& composed : pptoken.composed_tokens) {
+        pos = result.composed_tokens.insert_after(pos, this->rehome(composed));
+      }
+
+      return result;
+    }
+
+    /**
+    * @brief マクロを登録する、同名のマクロがあれば置き換える
+    * @param name マクロ名、この環境の所有する文字列を参照していること
+    * @param macro マクロ、この環境の領域へ複製される（置換リストのトークンについてはrehome()の事前条件を満たすこと）
+    */
+    void insert(std::u8string_view name, const unified_macro& macro) {
+      m_macros.erase(name);
+      m_macros.try_emplace(name, macro, m_mr.get(), overloaded{
+        [this](std::u8string_view str) { return this->intern(str); },
+        [this](const pp_token& pptoken) { return this->rehome(pptoken); }
+      });
+    }
+
+    /**
+    * @brief 構築済みのマクロをそのまま登録する、同名のマクロがあれば置き換える
+    * @param name マクロ名、この環境の所有する文字列を参照していること
+    * @param macro マクロ、内部の文字列とトークンはこの環境の所有するものを参照していること
+    */
+    void emplace(std::u8string_view name, unified_macro&& macro) {
+      m_macros.erase(name);
+      m_macros.try_emplace(name, std::move(macro));
+    }
+
+    /**
+    * @brief この環境の全データの確保元を取得する
+    */
+    fn resource() const noexcept -> std::pmr::memory_resource* {
+      return m_mr.get();
+    }
+
+    /**
+    * @brief マクロを削除する
+    * @param name マクロ名
+    */
+    void erase(std::u8string_view name) {
+      m_macros.erase(name);
+    }
+
+  private:
+
+    /**
+    * @brief 文字列が別の文字列の範囲内を参照しているか
+    */
+    sfn is_within(const std::pmr::u8string& str, std::u8string_view view) -> bool {
+      const std::less_equal<const char8_t*> le{};
+      return le(str.data(), view.data()) and le(view.data() + view.size(), str.data() + str.size());
+    }
+  };
+
+  /**
+  * @brief ある時点のマクロ定義の状態、別の翻訳単位の開始状態として使用する
+  */
+  struct macro_snapshot {
+    // その時点で見えていた全てのマクロ
+    std::shared_ptr<const macro_environment> macros{};
+    // #lineディレクティブによる行番号変更の対応
+    std::pmr::map<std::size_t, std::size_t> line_map{};
+    // #lineディレクティブによって変更されたファイル名
+    std::optional<fs::path> replaced_filename{};
+  };
+
+  /**
+  * @brief マクロテーブルへの問い合わせと変更の記録
+  * @details #if条件やヘッダの処理結果を再利用する際に、それがどのマクロに依存していたかを知るために使う
+  * @details 記録は入れ子にできるので追記のみを行い、各利用者は開始時点のmark以降を自分の記録とする
+  */
+  struct macro_observer {
+    // マクロであるか（定義されているか）を問い合わせた識別子、重複を含む
+    std::pmr::vector<std::u8string_view> names{ &kusabira::def_mr };
+    // #define/#undefしたマクロ名と、その直前の定義のフィンガープリント（未定義なら0）
+    std::pmr::vector<std::pair<std::u8string_view, std::uint64_t>> modified{ &kusabira::def_mr };
+    // 各変更の時点でのnamesの長さ、問い合わせと変更の前後関係を知るためのもの
+    std::pmr::vector<std::size_t> modified_at{ &kusabira::def_mr };
+    // 事前定義マクロを参照した回数
+    std::size_t predefined = 0;
+    // #lineディレクティブを実行した回数
+    std::size_t line_control = 0;
+
+    /**
+    * @brief ある時点での記録の位置
+    */
+    struct mark {
+      std::size_t names;
+      std::size_t modified;
+      std::size_t predefined;
+      std::size_t line_control;
+    };
+
+    fn current() const noexcept -> mark {
+      return { names.size(), modified.size(), predefined, line_control };
+    }
+
+    void clear() noexcept {
+      names.clear();
+      modified.clear();
+      modified_at.clear();
+      predefined = 0;
+      line_control = 0;
+    }
+  };
+
+  class macro_manager {
+
+    using funcmacro_map = std::pmr::unordered_map<std::u8string_view, unified_macro>;
+    using timepoint_t = decltype(std::chrono::system_clock::now());
+
+    // ソースファイル名
+    fs::path m_filename{};
+    // 変更があった場合のファイル名
+    fs::path m_replace_filename{};
+    // コンパイル開始時時刻
+    std::time_t m_datetime{};
+    // ユーザー定義のマクロ
+    funcmacro_map m_macros{ &kusabira::def_mr };
+    // 行番号変更の対応を取っておく
+    std::pmr::map<std::size_t, std::size_t> m_line_map{ &kusabira::def_mr };
+    // 共有する基底のマクロ環境、m_macrosはこの上に重ねる差分になる
+    std::shared_ptr<const macro_environment> m_base{};
+    // #undefされた基底環境のマクロ名
+    std::pmr::unordered_set<std::u8string_view> m_hidden_base{ &kusabira::def_mr };
+    // このマクロテーブルの識別番号、プロセス内で一意
+    std::uint64_t m_table_id = next_table_id();
+    // マクロ定義の世代、#define/#undefの度に進む
+    std::uint64_t m_generation = 0;
+    // 問い合わせと変更の記録
+    mutable macro_observer m_observer{};
+    // 記録を要求している数、0なら記録しない
+    std::size_t m_observe_depth = 0;
+    // マクロ展開と出力の上限と、使った量
+    mutable expansion_budget m_budget{};
+
+    // 事前定義マクロ、以降変更されることは無いはず、ムーブしたいのでconstを付けないでおく・・・
+    std::unordered_map<std::u8string_view, std::u8string_view> m_predef_macro = {
+      {u8"__LINE__", u8""},
+      {u8"__FILE__", u8""},
+      {u8"__DATE__", u8""},
+      {u8"__TIME__", u8""},
+      {u8"_­_­cplusplus", u8"202002L"},
+      {u8"__STDC_­HOSTED__", u8"1"},
+      {u8"__STDCPP_­DEFAULT_­NEW_­ALIGNMENT__", u8"16ull"},
+      //{u8"__STDCPP_­STRICT_­POINTER_­SAFETY__", u8"1"},
+      {u8"__STDCPP_­THREADS__", u8"1"}
+    };
+
+  public:
+
+    macro_manager() = default;
+
+    macro_manager(const fs::path& filename)
+      : m_filename{ filename }
+      , m_replace_filename{ filename.filename() }
+      , m_datetime{ std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) }
+    {}
+
+    /**
+    * @brief 基底のマクロ環境を指定して構築する
+    * @param filename ソースファイル名
+    * @param base 基底のマクロ環境、コピーせずに参照する
+    */
+    macro_manager(const fs::path& filename, std::shared_ptr<const macro_environment> base)
+      : macro_manager(filename)
+    {
+      m_base = std::move(base);
+    }
+
+    /**
+    * @brief 保存しておいたマクロ定義の状態から構築する
+    * @param filename ソースファイル名
+    * @param snapshot マクロ定義の状態、マクロはコピーせずに基底環境として参照する
+    */
+    macro_manager(const fs::path& filename, const macro_snapshot& snapshot)
+      : macro_manager(filename, snapshot.macros)
+    {
+      m_line_map.insert(snapshot.line_map.begin(), snapshot.line_map.end());
+      if (snapshot.replaced_filename) {
+        m_replace_filename = *snapshot.replaced_filename;
+      }
+    }
+
+  private:
+
+    sfn next_table_id() noexcept -> std::uint64_t {
+      static std::atomic<std::uint64_t> counter{0};
+      return ++counter;
+    }
+
+    /**
+    * @brief マクロを検索する
+    * @details この翻訳単位で定義されたもの、基底環境のもの、の順に探す
+    * @param name マクロ名
+    * @return 見つかればそのマクロへのポインタ、なければnullptr
+    */
+    fn find_macro(std::u8string_view name) const -> const unified_macro* {
+      if (auto pos = m_macros.find(name); pos != m_macros.end()) {
+        return &(*pos).second;
+      }
+      return this->find_base_macro(name);
+    }
+
+    /**
+    * @brief 基底環境からマクロを検索する
+    * @param name マクロ名
+    * @return 見つかり、かつ#undefされていなければそのマクロへのポインタ、なければnullptr
+    */
+    fn find_base_macro(std::u8string_view name) const -> const unified_macro* {
+      if (m_base == nullptr) return nullptr;
+      if (not m_hidden_base.empty() and m_hidden_base.contains(name)) return nullptr;
+      return m_base->find(name);
+    }
+
+    /**
+    * @brief マクロの変更を記録する
+    * @param name 変更するマクロ名、変更前に呼ぶ
+    */
+    void note_modified(std::u8string_view name) {
+      if (m_observe_depth == 0) return;
+      const auto macro = this->find_macro(name);
+      m_observer.modified.emplace_back(name, macro == nullptr ? 0 : macro->fingerprint());
+      m_observer.modified_at.push_back(m_observer.names.size());
+    }
+
+    /**
+    * @brief 事前定義マクロを処理する
+    * @details __LINE__ __FILE__ __DATE__ __TIME__ の4つは特殊処理、その他はトークン置換で生成
+    * @param macro_name マクロ名
+    * @return 処理結果、無効値は対象外
+    */
+    fn predefined_macro(const pp_token& macro_name) const -> std::optional<std::pmr::list<pp_token>> {
+
+      //結果プリプロセッシングトークンリストを作成する処理
+      auto make_result = [&macro_name, &mr = kusabira::def_mr](auto str, auto pptoken_cat) {
+        std::pmr::list<pp_token> result_list{ &mr };
+        auto& linenum_token = result_list.emplace_back(pptoken_cat, u8"", macro_name.column, macro_name.srcline_ref);
+        linenum_token.token = std::move(str);
+
+        return result_list;
+      };
+
+      if (macro_name.token == u8"__LINE__") {
+        auto line_num = macro_name.get_logicalline_num();
+
+        //現在の実行数に対応する#lineによる行数変更を捜索        
         if (auto pos = m_line_map.upper_bound(line_num); not empty(m_line_map)) {
           //実行数よりも大きい要素を探しているので、その一つ前が適用すべき#lineの処理
           std::advance(pos, -1);
@@ -1124,142 +1776,300 @@ namespace kusabira::PP {
       return std::nullopt;
     }
 
+    using token_iterator = std::pmr::list<pp_token>::iterator;
+
+    /**
+    * @brief マクロ名の後に関数マクロの呼び出しが続いているかの判定結果
+    */
+    enum class invocation_status : std::uint8_t {
+      invoked,      // 引数リストが閉じている
+      not_invoked,  // 開きかっこ以外のトークンが続いている
+      unclosed      // 引数リストが閉じる前にリストの終端に達した
+    };
+
+    /**
+    * @brief 関数マクロの呼び出しの範囲
+    */
+    struct invocation {
+      invocation_status status;
+      // 開きかっこの次の位置、not_invokedなら開きかっこの代わりに現れたトークンの位置
+      token_iterator args_first;
+      // 閉じかっこの次の位置
+      token_iterator last;
+    };
+
+    /**
+    * @brief 関数マクロ名の後に続く呼び出しの範囲を調べ、実引数を取得する
+    * @details 呼び出しが閉じていない場合はリストをそのまま外側で再処理するので、実引数はムーブせずにコピーする
+    * @param name_pos マクロ名の位置
+    * @param fin リストの終端
+    * @param args 実引数の格納先、invokedの時のみ有効
+    */
+    sfn find_invocation(token_iterator name_pos, token_iterator fin, macro_args& args) -> invocation {
+      // マクロ引数列の先頭位置（開きかっこ）を探索
+      auto start_pos = std::ranges::find_if_not(std::next(name_pos), fin, [](const auto& pptoken) {
+        return pptoken.category <= pp_token_category::block_comment;
+      });
+
+      // 終わってしまったらそこで終わり
+      if (start_pos == fin) return { invocation_status::unclosed, fin, fin };
+
+      // マクロ呼び出しではなかった
+      if (deref(start_pos).token != u8"(") return { invocation_status::not_invoked, start_pos, fin };
+
+      // 開きかっこの次へ移動
+      ++start_pos;
+
+      // 実引数を取得しつつ終端かっこを探す、マクロが閉じる前に終端に達した場合何もしない（外側で再処理）
+      auto close_pos = start_pos;
+      const bool closed = parse_macro_args(close_pos, fin, args, [](token_iterator& itr, token_iterator, macro_args& collected) -> bool {
+        collected.push_token(*itr);
+        ++itr;
+        return true;
+      });
+      if (not closed) return { invocation_status::unclosed, start_pos, fin };
+
+      // 閉じかっこの次まで進めておく
+      return { invocation_status::invoked, start_pos, std::next(close_pos) };
+    }
+
     /**
-    * @brief マクロ置換処理の共通部分
+    * @brief 関数マクロの引数内のマクロを展開する
     * @param reporter エラー出力先
     * @param list 引数1つのプリプロセッシングトークンのリスト
-    * @param outer_macro 外側のマクロ名のメモ（この関数自体はこのメモを書き換えない、ただし再帰呼び出し先が書き換えてる）
-    * @return {エラーが起きなかった, マクロのスキャンは完了（falseならば関数マクロの引数リストが閉じていない）}
+    * @details マクロの引数内ではそのマクロと同じものが現れていても構わない、再帰的展開されず、再スキャン時は展開対象にならないので無限再帰に陥ることは無い
+    * @details ここでは置換後の再スキャンとさらなるマクロ展開を行わない
+    * @return 成功？
     */
-    template<bool Rescanning, typename Reporter>
-    fn macro_replacement_impl(Reporter& reporter, std::pmr::list<pp_token>& list, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::pair<bool, bool> {
+    template<typename Reporter>
+    fn macro_replacement(Reporter& reporter, std::pmr::list<pp_token>& list) const -> bool {
       auto it = std::begin(list);
       const auto fin = std::end(list);
+      // 実引数列、呼び出し毎に使いまわす
+      macro_args args{};
 
       while (it != fin) {
         // 識別子以外は無視
-        // 外側マクロを無視
         if (deref(it).category != pp_token_category::identifier) {
           ++it;
           continue;
-        } else if (outer_macro.contains(deref(it).token)) {
-          // メモにあったマクロのトークン種別を変更してマークしておく
-          // 更に外側で再スキャンされたときにも展開を防止するため
-          // 最終的にはパーサ側で元に戻す
-          deref(it).category = pp_token_category::not_macro_name_identifier;
-          ++it;
-          continue;
         }
 
         // マクロ判定
-        if (auto opt = this->is_macro(deref(it).token); opt) {
-          std::pmr::list<pp_token> result{ &kusabira::def_mr };
-          bool success = false;
-          [[maybe_unused]] bool scan_complete = true;
-
-          const bool is_funcmacro = *opt;
-
-          // マクロの終端位置（関数マクロなら閉じかっこの次を計算して入れておく）
-          auto close_pos = std::next(it);
-
-          if (not is_funcmacro) {
-            if constexpr (not Rescanning) {
-              // オブジェクトマクロ置換（再スキャンしない）
-              std::tie(success, std::ignore, result, std::ignore) = this->objmacro<true>(reporter, *it);
-            } else {
-              // オブジェクトマクロ置換（再スキャンはこの中で再帰的に行われる）
-              std::tie(success, scan_complete, result) = this->objmacro<false>(reporter, *it, outer_macro);
-            }
-          } else {
-            // マクロ引数列の先頭位置（開きかっこ）を探索
-            auto start_pos = std::ranges::find_if_not(std::next(it), fin, [](const auto& pptoken) {
-              return pptoken.category <= pp_token_category::block_comment;
-              });
-
-            // 終わってしまったらそこで終わり
-            if (start_pos == fin) return { true, false };
-
-            // マクロ呼び出しではなかった
-            if (deref(start_pos).token != u8"(") {
-              it = start_pos;
-              continue;
-            }
-
-            // 開きかっこの次へ移動
-            ++start_pos;
+        const auto opt = this->is_macro(deref(it).token);
+        if (not opt) {
+          // 識別子はマクロ名ではなかった
+          ++it;
+          continue;
+        }
 
-            // 終端かっこのチェック、マクロが閉じる前に終端に達した場合何もしない（外側で再処理）
-            close_pos = search_close_parenthesis(start_pos, fin);
-            if (close_pos == fin) return { true, false };
+        bool success = false;
+        std::pmr::list<pp_token> result{ &kusabira::def_mr };
+        // マクロの終端位置（関数マクロなら閉じかっこの次）
+        auto close_pos = std::next(it);
 
-            // 閉じかっこの次まで進めておく
-            ++close_pos;
-            // マクロの引数リスト取得
-            const auto args = parse_macro_args(start_pos, close_pos);
+        if (not *opt) {
+          // オブジェクトマクロ置換（再スキャンしない）
+          std::tie(success, std::ignore, result, std::ignore) = this->objmacro<true>(reporter, *it);
+        } else {
+          const auto call = find_invocation(it, fin, args);
 
-            if constexpr (not Rescanning) {
-              // 関数マクロ置換（再スキャンしない）
-              std::tie(success, std::ignore, result, std::ignore) = this->funcmacro<true>(reporter, *it, args);
-            } else {
-              // 関数マクロ置換（再スキャンはこの中で再帰的に行われる）
-              std::tie(success, scan_complete, result) = this->funcmacro<false>(reporter, *it, args, outer_macro);
-            }
+          // 引数リストが閉じていないものは外側で再処理される
+          if (call.status == invocation_status::unclosed) return true;
+          if (call.status == invocation_status::not_invoked) {
+            it = call.args_first;
+            continue;
           }
 
-          //エラーが起きてればそのまま終わる
-          if (not success) return { false, false };
+          close_pos = call.last;
 
-          const auto erase_pos = it;
-
-          // マクロ全体の次のトークンからスキャンを再開
-          it = close_pos;
-
-          // リストのスキャンが完了していなければ、戻ってきたリストの先頭からスキャンし関数マクロ名を探す（それより前のマクロは置換済み）
-          // スキャンが未完（別のマクロの呼び出しが途中で終わってた）で、そこまでの間に同じマクロの呼び出しがある場合、おかしくなりそう・・・
-          if (Rescanning and not scan_complete) {
-            it = std::begin(result);
-          }
+          // 関数マクロ置換（再スキャンしない）
+          std::tie(success, std::ignore, result, std::ignore) = this->funcmacro<true>(reporter, *it, args);
+        }
 
-          // 戻ってきたリストをspliceする
-          list.splice(erase_pos, std::move(result));
-          // 置換したマクロ範囲を消去
-          list.erase(erase_pos, close_pos);
+        //エラーが起きてればそのまま終わる
+        if (not success) return false;
 
-        } else {
-          // 識別子はマクロ名ではなかった
-          ++it;
-        }
+        // 戻ってきたリストをspliceし、置換したマクロ範囲を消去する
+        list.splice(it, std::move(result));
+        it = list.erase(it, close_pos);
       }
 
-      // 恙なく終了したときここで終わる
-      return { true, true };
+      return true;
     }
 
     /**
-    * @brief 関数マクロの引数内のマクロを展開する
-    * @param reporter エラー出力先
-    * @param list 引数1つのプリプロセッシングトークン列
-    * @details マクロの引数内ではそのマクロと同じものが現れていても構わない、再帰的展開されず、再スキャン時は展開対象にならないので無限再帰に陥ることは無い
-    * @details ここでは置換後の再スキャンとさらなるマクロ展開を行わない
-    * @return 成功？
+    * @brief 再スキャン中の1つのマクロの展開
+    * @details 計測のためのオブジェクトは、置換の開始から結果の再スキャンの完了まで生存する
     */
-    template<typename Reporter>
-    fn macro_replacement(Reporter& reporter, std::pmr::list<pp_token>& list) const -> bool {
-      std::pmr::unordered_set<std::u8string_view> memo{ &kusabira::def_mr };
-      const auto [success, ignore] = macro_replacement_impl<false>(reporter, list, memo);
-      return success;
-    }
+    struct rescan_frame {
+      // 置換結果、再スキャンしながら書き換える
+      std::pmr::list<pp_token> list{ &kusabira::def_mr };
+      // 外側マクロのメモに記録したマクロ名、事前定義マクロなら空
+      std::u8string_view name;
+      // 呼び出し元のリスト上でのマクロ呼び出しの範囲
+      token_iterator call_first;
+      token_iterator call_last;
+
+      scoped_expansion_depth depth;
+      scoped_phase_timer timer{pp_phase::macro_expand};
+      scoped_trace_span span;
+      scoped_macro_profile profile;
+
+      rescan_frame(expansion_budget& budget, std::u8string_view macro_name, token_iterator first, token_iterator last)
+        : call_first{first}
+        , call_last{last}
+        , depth{budget}
+        , span{trace_kind::macro, macro_name}
+        , profile{macro_name}
+      {}
+
+      template<typename Args>
+      rescan_frame(expansion_budget& budget, std::u8string_view macro_name, token_iterator first, token_iterator last, const Args& args)
+        : call_first{first}
+        , call_last{last}
+        , depth{budget}
+        , span{trace_kind::macro, macro_name}
+        , profile{macro_name, args}
+      {}
+    };
 
     /**
     * @brief マクロ置換後の結果リストに対して再スキャンとさらなる展開を行う
+    * @details 入れ子になったマクロの展開は再帰呼び出しではなく、展開中のマクロのスタック（rescan_frame）を積んで処理する
+    * @details 入れ子の深さはネイティブのスタックではなくヒープ（def_mr）を消費する
     * @param reporter エラー出力先
     * @param list 引数1つのプリプロセッシングトークン列
-    * @param outer_macro 外側のマクロ名のメモ（この関数自体はこのメモを書き換えない、ただし再帰呼び出し先が書き換えてる）
+    * @param outer_macro 外側のマクロ名のメモ（展開中のマクロ名を追加し、展開が完了したら取り除く）
     * @return {エラーが起きなかった, マクロのスキャンは完了した（falseならば関数マクロの引数リストが閉じていない）}
     */
     template<typename Reporter>
     fn further_macro_replacement(Reporter& reporter, std::pmr::list<pp_token>& list, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::pair<bool, bool> {
-      return macro_replacement_impl<true>(reporter, list, outer_macro);
+      // 展開中のマクロ、末尾が最も内側
+      std::pmr::list<rescan_frame> frames{ &kusabira::def_mr };
+      // 実引数列、呼び出し毎に使いまわす
+      macro_args args{};
+      auto it = std::begin(list);
+
+      // 最も内側のマクロの再スキャンを終え、結果を呼び出し元のリストに戻す
+      // 戻り値は呼び出し元でスキャンを再開する位置
+      auto finish = [&](bool complete) -> token_iterator {
+        auto& frame = frames.back();
+        auto& caller = frames.size() == 1 ? list : (*std::prev(frames.end(), 2)).list;
+
+        //メモを消す
+        if (complete and not frame.name.empty()) outer_macro.erase(frame.name);
+
+        // ホワイトスペースの除去
+        std::erase_if(frame.list, [](const auto& pptoken) {
+          return pptoken.category == pp_token_category::whitespaces;
+        });
+        frame.profile.set_output(frame.list.size());
+
+        // スキャンが完了していなければ、戻したリストの先頭からスキャンし関数マクロ名を探す（それより前のマクロは置換済み）
+        auto next = complete or frame.list.empty() ? frame.call_last : std::begin(frame.list);
+        const auto call_first = frame.call_first;
+        const auto call_last = frame.call_last;
+
+        // マクロ名のトークンは計測が終わるまで残しておく
+        caller.splice(call_first, std::move(frame.list));
+        frames.pop_back();
+        caller.erase(call_first, call_last);
+
+        return next;
+      };
+
+      // エラー時は内側から順に破棄する
+      auto fail = [&frames]() -> std::pair<bool, bool> {
+        while (not frames.empty()) frames.pop_back();
+        return { false, false };
+      };
+
+      // 上限を超えていれば報告する
+      auto exceeded = [&](const pp_token& macro_name, const std::optional<pp_parse_context>& error) {
+        if (error) reporter.pp_err_report(m_filename, macro_name, *error);
+        return bool(error);
+      };
+
+      while (true) {
+        auto& current = frames.empty() ? list : frames.back().list;
+        const auto fin = std::end(current);
+
+        if (it == fin) {
+          // 恙なく終了したときここで終わる
+          if (frames.empty()) return { true, true };
+          it = finish(true);
+          continue;
+        }
+
+        // 識別子以外は無視
+        if (deref(it).category != pp_token_category::identifier) {
+          ++it;
+          continue;
+        }
+        // 外側マクロを無視
+        if (outer_macro.contains(deref(it).token)) {
+          // メモにあったマクロのトークン種別を変更してマークしておく
+          // 更に外側で再スキャンされたときにも展開を防止するため
+          // 最終的にはパーサ側で元に戻す
+          deref(it).category = pp_token_category::not_macro_name_identifier;
+          ++it;
+          continue;
+        }
+
+        // マクロ判定
+        const auto opt = this->is_macro(deref(it).token);
+        if (not opt) {
+          // 識別子はマクロ名ではなかった
+          ++it;
+          continue;
+        }
+
+        const auto& macro_name = *it;
+
+        if (not *opt) {
+          auto& frame = frames.emplace_back(m_budget, macro_name.token, it, std::next(it));
+          if (exceeded(macro_name, frame.depth.error())) return fail();
+
+          //事前定義マクロを処理（この結果には再スキャンの対象となるものは含まれていないはず）
+          if (auto result = predefined_macro(macro_name); result) {
+            frame.list = std::move(*result);
+            it = std::end(frame.list);
+            continue;
+          }
+
+          auto result = this->objmacro_substitute(macro_name);
+          if (not result) return fail();
+          frame.list = std::move(*result);
+        } else {
+          const auto call = find_invocation(it, fin, args);
+
+          if (call.status == invocation_status::unclosed) {
+            // 引数リストが閉じていない、このマクロの展開は外側（呼び出し元のリストかパーサ）で続ける
+            if (frames.empty()) return { true, false };
+            it = finish(false);
+            continue;
+          }
+          if (call.status == invocation_status::not_invoked) {
+            it = call.args_first;
+            continue;
+          }
+
+          auto& frame = frames.emplace_back(m_budget, macro_name.token, it, call.last, args);
+          if (exceeded(macro_name, frame.depth.error())) return fail();
+
+          auto result = this->funcmacro_substitute<false>(reporter, macro_name, args);
+          if (not result) return fail();
+          frame.list = std::move(*result);
+        }
+
+        //現在のマクロ名をメモして、置換結果の先頭から再スキャンする
+        auto& frame = frames.back();
+        if (exceeded(macro_name, m_budget.produce(frame.list.size()))) return fail();
+        frame.name = macro_name.token;
+        outer_macro.emplace(frame.name);
+        it = std::begin(frame.list);
+      }
     }
 
    public:
@@ -1282,6 +2092,27 @@ namespace kusabira::PP {
        const std::pair<pp_parse_context, pp_token>* replist_err = nullptr;
        const auto name_str = macro_name.token.to_view();
 
+       // 再定義のチェックは以前の定義に依存する、この問い合わせは変更の後に記録する
+       this->note_modified(name_str);
+       this->note_observed(name_str);
+       // 失敗した場合も登録はされうるので、常に世代を進めておく
+       ++m_generation;
+
+       //基底環境にあるマクロの再定義、同一ならばok
+       if (auto base = this->find_base_macro(name_str); base != nullptr and not m_macros.contains(name_str)) {
+         bool is_identical;
+         if constexpr (std::is_same_v<ParamList, std::nullptr_t>) {
+           is_identical = not base->is_function() and base->is_identical({}, tokenlist);
+         } else {
+           is_identical = base->is_function() and base->is_identical(params, tokenlist);
+         }
+
+         if (is_identical) return true;
+
+         reporter.pp_err_report(m_filename, macro_name, pp_parse_context::Define_Duplicate);
+         return false;
+       }
+
        if constexpr (std::is_same_v<ParamList, std::nullptr_t>) {
          //オブジェクトマクロの登録
          const auto [pos, is_registered] = m_macros.try_emplace(name_str, name_str, std::forward<ReplacementList>(tokenlist));
@@ -1349,49 +2180,88 @@ namespace kusabira::PP {
      */
      template<bool MacroExpandOff = false, typename Reporter>
      fn objmacro(Reporter& reporter, const pp_token& macro_name, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
+       scoped_expansion_depth depth{m_budget};
+       if (depth.error()) {
+         reporter.pp_err_report(m_filename, macro_name, *depth.error());
+         return { false, false, std::pmr::list<pp_token>{} };
+       }
+
+       [[maybe_unused]] scoped_phase_timer timer{pp_phase::macro_expand};
+       [[maybe_unused]] scoped_trace_span span{trace_kind::macro, macro_name.token};
+       [[maybe_unused]] scoped_macro_profile profile{macro_name.token};
+
+       auto result = this->objmacro_impl<MacroExpandOff>(reporter, macro_name, outer_macro);
+       profile.set_output(std::get<2>(result).size());
+       return result;
+     }
+
+   private:
+
+     /**
+     * @brief objmacro()の本体、計測と統計の記録はobjmacro()で行う
+     */
+     template<bool MacroExpandOff, typename Reporter>
+     fn objmacro_impl(Reporter& reporter, const pp_token& macro_name, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
 
        //事前定義マクロを処理（この結果には再スキャンの対象となるものは含まれていないはず）
        if (auto result = predefined_macro(macro_name); result) {
          return { true, true, std::move(*result) };
        }
 
-       //マクロを取り出す（存在は予め調べてあるものとする）
-       const auto& macro = deref(m_macros.find(macro_name.token)).second;
-
-       // ここでmemory_resourceを適切に設定しておかないと、アロケータが正しく伝搬しない
-       unified_macro::macro_result_t result{ tl::in_place, &kusabira::def_mr };
-
-       // 第一弾マクロ展開（オブジェクトマクロでは引数内マクロ置換は常に不要）
-       result = macro({});
+       // 第一弾マクロ展開
+       auto result = this->objmacro_substitute(macro_name);
+       if (not result) return std::make_tuple(false, false, std::pmr::list<pp_token>{});
+       if (auto error = m_budget.produce(result->size()); error) {
+         reporter.pp_err_report(m_filename, macro_name, *error);
+         return std::make_tuple(false, false, std::pmr::list<pp_token>{});
+       }
 
        if constexpr (MacroExpandOff) {
          // さらなる展開をしないときはこれで終わり
-         if (result) return { true, true, std::pmr::list<pp_token>{std::move(*result)} };
+         return { true, true, std::move(*result) };
        }
 
-       if (result) {
-         //現在のマクロ名をメモ
-         outer_macro.emplace(macro_name.token);
+       //現在のマクロ名をメモ
+       outer_macro.emplace(macro_name.token);
+
+       //リストの再スキャンとさらなる展開
+       const auto [success, complete] = this->further_macro_replacement(reporter, *result, outer_macro);
 
-         //リストの再スキャンとさらなる展開
-         const auto [success, complete] = this->further_macro_replacement(reporter, *result, outer_macro);
+       //メモを消す
+       if (complete) outer_macro.erase(macro_name.token);
 
-         //メモを消す
-         if (complete) outer_macro.erase(macro_name.token);
+       // ホワイトスペースの除去
+       std::erase_if(*result, [](const auto& pptoken) {
+         return pptoken.category == pp_token_category::whitespaces;
+         });
 
-         // ホワイトスペースの除去
-         std::erase_if(*result, [](const auto& pptoken) {
-           return pptoken.category == pp_token_category::whitespaces;
-           });
+       return std::make_tuple(success, complete, std::move(*result));
+     }
 
-         return std::make_tuple(success, complete, std::pmr::list<pp_token>{std::move(*result)});
-       } else {
+     /**
+     * @brief オブジェクトマクロの第一段階の置換を行う
+     * @param macro_name マクロ名、事前定義マクロではないこと
+     * @return 置換リスト
+     */
+     fn objmacro_substitute(const pp_token& macro_name) const -> std::optional<std::pmr::list<pp_token>> {
+       //マクロを取り出す（存在は予め調べてあるものとする）
+       const auto& macro = *this->find_macro(macro_name.token);
+
+       // ここでmemory_resourceを適切に設定しておかないと、アロケータが正しく伝搬しない
+       unified_macro::macro_result_t result{ tl::in_place, &kusabira::def_mr };
+
+       // オブジェクトマクロでは引数内マクロ置換は常に不要
+       result = macro({});
+
+       if (not result) {
          //オブジェクトマクロはこっちにこないのでは？
          assert(false);
-         return std::make_tuple(false, false, std::pmr::list<pp_token>{});
+         return std::nullopt;
        }
+       return std::pmr::list<pp_token>{std::move(*result)};
      }
 
+   public:
 
      /**
      * @brief 関数マクロによる置換リストを取得する
@@ -1401,7 +2271,7 @@ namespace kusabira::PP {
      * @return {エラーの有無, スキャン完了したか, 置換リスト}
      */
      template<bool MacroExpandOff = false, typename Reporter>
-     fn funcmacro(Reporter& reporter, const pp_token& macro_name, const std::pmr::vector<std::pmr::list<pp_token>>& args) const -> std::tuple<bool, bool, std::pmr::list<pp_token>, std::pmr::unordered_set<std::u8string_view>> {
+     fn funcmacro(Reporter& reporter, const pp_token& macro_name, const macro_args& args) const -> std::tuple<bool, bool, std::pmr::list<pp_token>, std::pmr::unordered_set<std::u8string_view>> {
        std::pmr::unordered_set<std::u8string_view> memo{ &kusabira::def_mr };
        auto&& tuple = this->funcmacro<MacroExpandOff>(reporter, macro_name, args, memo);
        return std::tuple_cat(std::move(tuple), std::make_tuple(std::move(memo)));
@@ -1416,15 +2286,76 @@ namespace kusabira::PP {
      * @return {エラーの有無, スキャン完了したか, 置換リスト}
      */
      template<bool MacroExpandOff = false, typename Reporter>
-     fn funcmacro(Reporter& reporter, const pp_token& macro_name, const std::pmr::vector<std::pmr::list<pp_token>>& args, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
+     fn funcmacro(Reporter& reporter, const pp_token& macro_name, const macro_args& args, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
+       scoped_expansion_depth depth{m_budget};
+       if (depth.error()) {
+         reporter.pp_err_report(m_filename, macro_name, *depth.error());
+         return { false, false, std::pmr::list<pp_token>{} };
+       }
+
+       [[maybe_unused]] scoped_phase_timer timer{pp_phase::macro_expand};
+       [[maybe_unused]] scoped_trace_span span{trace_kind::macro, macro_name.token};
+       [[maybe_unused]] scoped_macro_profile profile{macro_name.token, args};
+
+       auto result = this->funcmacro_impl<MacroExpandOff>(reporter, macro_name, args, outer_macro);
+       profile.set_output(std::get<2>(result).size());
+       return result;
+     }
+
+   private:
+
+     /**
+     * @brief funcmacro()の本体、計測と統計の記録はfuncmacro()で行う
+     */
+     template<bool MacroExpandOff, typename Reporter>
+     fn funcmacro_impl(Reporter& reporter, const pp_token& macro_name, const macro_args& args, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
+
+       // 第一弾マクロ展開
+       auto result = this->funcmacro_substitute<MacroExpandOff>(reporter, macro_name, args);
+       if (not result) return { false, false, std::pmr::list<pp_token>{} };
+       if (auto error = m_budget.produce(result->size()); error) {
+         reporter.pp_err_report(m_filename, macro_name, *error);
+         return { false, false, std::pmr::list<pp_token>{} };
+       }
+
+       if constexpr (MacroExpandOff) {
+         // さらなる展開をしないときはこれで終わり
+         return { true, true, std::move(*result) };
+       }
+
+       //現在のマクロ名をメモ
+       outer_macro.emplace(macro_name.token);
+
+       //リストの再スキャンとさらなる展開
+       const auto [success, complete] = this->further_macro_replacement(reporter, *result, outer_macro);
+
+       //メモを消す
+       if (complete) outer_macro.erase(macro_name.token);
 
+       // ホワイトスペースの除去
+       std::erase_if(*result, [](const auto& pptoken) {
+         return pptoken.category == pp_token_category::whitespaces;
+       });
+
+       return { success, complete, std::move(*result) };
+     }
+
+     /**
+     * @brief 関数マクロの第一段階の置換（実引数の置換と#/##の処理）を行う
+     * @tparam MacroExpandOff 実引数内のマクロを展開しないか否か
+     * @param macro_name マクロ名
+     * @param args 関数マクロの実引数トークン列
+     * @return 置換リスト、エラーの場合は報告済みで無効値
+     */
+     template<bool MacroExpandOff, typename Reporter>
+     fn funcmacro_substitute(Reporter& reporter, const pp_token& macro_name, const macro_args& args) const -> std::optional<std::pmr::list<pp_token>> {
        //マクロを取り出す（存在は予め調べてあるものとする）
-       const auto& macro = deref(m_macros.find(macro_name.token)).second;
+       const auto& macro = *this->find_macro(macro_name.token);
 
        //引数長さのチェック
        if (not macro.validate_argnum(args)) {
          reporter.pp_err_report(m_filename, macro_name, PP::pp_parse_context::Funcmacro_InsufficientArgs);
-         return { false, false, std::pmr::list<pp_token>{} };
+         return std::nullopt;
        }
 
        // ここでmemory_resourceを適切に設定しておかないと、アロケータが正しく伝搬しない
@@ -1436,74 +2367,223 @@ namespace kusabira::PP {
          result = macro(args, [&, this](auto& list) { return this->macro_replacement(reporter, list); });
        }
 
-       if constexpr (MacroExpandOff) {
-         // さらなる展開をしないときはこれで終わり
-         if (result) return { true, true, std::pmr::list<pp_token>{std::move(*result)} };
-       }
-
-       //置換結果取得
-       if (result) {
-         //現在のマクロ名をメモ
-         outer_macro.emplace(macro_name.token);
-
-         //リストの再スキャンとさらなる展開
-         const auto [success, complete] = this->further_macro_replacement(reporter, *result, outer_macro);
+       if (result) return std::pmr::list<pp_token>{std::move(*result)};
 
-         //メモを消す
-         if (complete) outer_macro.erase(macro_name.token);
-
-         // ホワイトスペースの除去
-         std::erase_if(*result, [](const auto& pptoken) {
-           return pptoken.category == pp_token_category::whitespaces;
-         });
-
-         return { success, complete, std::pmr::list<pp_token>{std::move(*result)} };
+       //エラー報告（##で不正なトークンが生成された）
+       const auto [context, pptoken] = result.error();
+       if (context == pp_parse_context::Funcmacro_ReplacementFail) {
+         //どの引数置換時にマクロ展開に失敗したのかは報告済み、ここではどこの呼び出しで失敗したかを伝える
+         reporter.pp_err_report(m_filename, macro_name, context);
        } else {
-         //エラー報告（##で不正なトークンが生成された）
-         const auto [context, pptoken] = result.error();
-         if (context == pp_parse_context::Funcmacro_ReplacementFail) {
-           //どの引数置換時にマクロ展開に失敗したのかは報告済み、ここではどこの呼び出しで失敗したかを伝える
-           reporter.pp_err_report(m_filename, macro_name, context);
-         } else {
-           reporter.pp_err_report(m_filename, pptoken, context);
-         }
-         return { false, false, std::pmr::list<pp_token>{} };
+         reporter.pp_err_report(m_filename, pptoken, context);
        }
+       return std::nullopt;
      }
 
+   public:
+
      /**
      * @brief 識別子がマクロ名であるか、また関数形式かをチェックする
      * @param identifier 識別子の文字列
      * @return マクロでないなら無効値、関数マクロならtrue
      */
      fn is_macro(std::u8string_view identifier) const -> std::optional<bool> {
+       if (m_observe_depth != 0) m_observer.names.emplace_back(identifier);
+
        //事前定義マクロのチェック
-       if (m_predef_macro.contains(identifier)) return false;
+       if (m_predef_macro.contains(identifier)) {
+         if (m_observe_depth != 0) ++m_observer.predefined;
+         return false;
+       }
 
-       const auto pos = m_macros.find(identifier);
+       const auto macro = this->find_macro(identifier);
 
        //見つからなかったら、その時用の戻り値を返す
-       if (pos == std::end(m_macros)) {
+       if (macro == nullptr) {
          return std::nullopt;
        }
 
        //それ以外のマクロのチェック
-       const auto& macro = (*pos).second;
-       return macro.is_function();
+       return macro->is_function();
+     }
+
+     /**
+     * @brief 識別子がマクロとして定義されているかを調べる
+     * @details #ifdef/#ifndef/definedのためのもの、マクロ本体には触れずにハッシュテーブルを引くだけ
+     * @param identifier 識別子の文字列
+     * @return マクロとして定義されていればtrue
+     */
+     fn is_defined(std::u8string_view identifier) const -> bool {
+       if (m_observe_depth != 0) m_observer.names.emplace_back(identifier);
+
+       // この翻訳単位で定義されたもの
+       if (m_macros.contains(identifier)) return true;
+       // 基底環境のもの
+       if (m_base != nullptr and this->find_base_macro(identifier) != nullptr) return true;
+       // 事前定義マクロは全て_から始まる
+       return identifier.starts_with(u8'_') and m_predef_macro.contains(identifier);
+     }
+
+     /**
+     * @brief マクロ定義のフィンガープリントを取得する
+     * @details 事前定義マクロは対象外
+     * @param identifier 識別子の文字列
+     * @return 定義されていなければ0
+     */
+     fn definition_fingerprint(std::u8string_view identifier) const -> std::uint64_t {
+       const auto macro = this->find_macro(identifier);
+       return macro == nullptr ? 0 : macro->fingerprint();
+     }
+
+     /**
+     * @brief マクロテーブルの識別番号を取得する
+     */
+     fn table_id() const noexcept -> std::uint64_t {
+       return m_table_id;
+     }
+
+     /**
+     * @brief マクロ定義の世代を取得する
+     * @details 同じテーブルで世代が変わっていなければ、全てのマクロ定義は変化していない
+     */
+     fn generation() const noexcept -> std::uint64_t {
+       return m_generation;
+     }
+
+     /**
+     * @brief マクロテーブルへの問い合わせと変更の記録を開始する
+     * @details 入れ子にできる、observe_end()と対にして呼ぶ
+     * @return 記録の開始位置、これ以降の記録が呼び出し元のもの
+     */
+     fn observe_begin() -> macro_observer::mark {
+       if (m_observe_depth++ == 0) m_observer.clear();
+       return m_observer.current();
+     }
+
+     /**
+     * @brief マクロテーブルへの問い合わせと変更の記録を終了する
+     */
+     void observe_end() noexcept {
+       assert(m_observe_depth != 0);
+       --m_observe_depth;
+     }
+
+     /**
+     * @brief マクロ展開と出力の上限と、使った量を取得する
+     */
+     fn budget() noexcept -> expansion_budget& {
+       return m_budget;
+     }
+
+     fn budget() const noexcept -> const expansion_budget& {
+       return m_budget;
+     }
+
+     /**
+     * @brief 問い合わせと変更の記録を取得する
+     */
+     fn observed() const noexcept -> const macro_observer& {
+       return m_observer;
+     }
+
+     /**
+     * @brief 問い合わせを記録する
+     * @details 記録済みの処理結果を再利用する際に、その処理が行ったはずの問い合わせを外側の記録に残すために使う
+     */
+     void note_observed(std::u8string_view identifier) const {
+       if (m_observe_depth != 0) m_observer.names.emplace_back(identifier);
+     }
+
+     /**
+     * @brief 見えているマクロを検索する
+     * @param name マクロ名
+     * @return 見つかればそのマクロへのポインタ、なければnullptr
+     */
+     fn find_definition(std::u8string_view name) const -> const unified_macro* {
+       return this->find_macro(name);
+     }
+
+     /**
+     * @brief 解析済みのマクロ定義をそのまま登録する
+     * @details 記録済みの処理結果の再生に使う、再定義のチェックは行わない
+     * @param name マクロ名、macroと同じだけ生存している必要がある
+     * @param macro マクロ定義、置換リストのトークンが参照する行も同じだけ生存している必要がある
+     */
+     void restore_macro(std::u8string_view name, const unified_macro& macro) {
+       this->note_modified(name);
+       ++m_generation;
+
+       unified_macro copy{ macro, &kusabira::def_mr, [](const auto& value) { return value; } };
+       if (auto pos = m_macros.find(name); pos != m_macros.end()) {
+         m_macros.erase(pos);
+       }
+       m_macros.emplace(name, std::move(copy));
      }
 
      /**
      * @brief #undefディレクティブを実行する
      */
      void unregister_macro(std::u8string_view macro_name) {
+       this->note_modified(macro_name);
+       ++m_generation;
+
        //消す、登録してあったかは関係ない
        m_macros.erase(macro_name);
+
+       //基底環境のマクロは消せないので、見えなくする
+       if (m_base != nullptr and m_base->find(macro_name) != nullptr) {
+         m_hidden_base.emplace(macro_name);
+       }
+     }
+
+     /**
+     * @brief 共有している基底のマクロ環境を取得する
+     * @return 基底環境、無ければnullptr
+     */
+     fn base_environment() const noexcept -> const std::shared_ptr<const macro_environment>& {
+       return m_base;
+     }
+
+     /**
+     * @brief 見えている全てのマクロについて処理を行う
+     * @details この翻訳単位で定義されたもの、基底環境のもの（#undefされておらず、上書きもされていないもの）の順に列挙する
+     * @param f マクロ名とマクロを受け取る関数
+     */
+     template<typename F>
+     void for_each_macro(F&& f) const {
+       for (const auto& [name, macro] : m_macros) {
+         f(name, macro);
+       }
+
+       if (m_base == nullptr) return;
+
+       for (const auto& [name, macro] : m_base->macros()) {
+         if (m_macros.contains(name) or m_hidden_base.contains(name)) continue;
+         f(name, macro);
+       }
+     }
+
+     /**
+     * @brief #lineディレクティブによる行番号変更の対応を取得する
+     */
+     fn line_map() const noexcept -> const std::pmr::map<std::size_t, std::size_t>& {
+       return m_line_map;
+     }
+
+     /**
+     * @brief #lineディレクティブによって変更されたファイル名を取得する
+     * @return 変更されていなければ無効値
+     */
+     fn replaced_filename() const -> std::optional<fs::path> {
+       if (m_replace_filename == m_filename.filename()) return std::nullopt;
+       return m_replace_filename;
      }
 
      /**
      * @brief #lineディレクティブによる行数変更
      */
      void change_line(std::size_t true_line_num, std::size_t new_line_num) {
+       if (m_observe_depth != 0) ++m_observer.line_control;
        m_line_map.emplace_hint(m_line_map.end(), std::make_pair(true_line_num, new_line_num));
      }
 
@@ -1511,7 +2591,37 @@ namespace kusabira::PP {
      * @brief #lineディレクティブによるファイル名変更
      */
      void change_filename(std::u8string_view new_filename) {
+       if (m_observe_depth != 0) ++m_observer.line_control;
        m_replace_filename = new_filename;
      }
+
+     /**
+     * @brief 処理中のソースファイルに関する状態
+     */
+     struct source_file_state {
+       fs::path filename;
+       fs::path replace_filename;
+       std::pmr::map<std::size_t, std::size_t> line_map;
+     };
+
+     /**
+     * @brief 新しく処理を始めるソースファイルの状態を作る
+     * @param filename ファイルパス
+     */
+     sfn new_source_file(const fs::path& filename) -> source_file_state {
+       return { filename, filename.filename(), std::pmr::map<std::size_t, std::size_t>{ &kusabira::def_mr } };
+     }
+
+     /**
+     * @brief 処理中のソースファイルを切り替える
+     * @details インクルードしたヘッダの処理の開始と終了で使用する、__FILE__の値と#lineの状態が切り替わる
+     * @param state 切り替え先のファイルの状態
+     * @return 切り替える前のファイルの状態
+     */
+     fn switch_source_file(source_file_state state) -> source_file_state {
+       source_file_state prev{ std::exchange(m_filename, std::move(state.filename)), std::exchange(m_replace_filename, std::move(state.replace_filename)), std::move(m_line_map) };
+       m_line_map = std::move(state.line_map);
+       return prev;
+     }
   };
 }
\ No newline at end of file
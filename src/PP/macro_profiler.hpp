@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../common.hpp"
+
+// 1にするとマクロ毎の展開の統計を取る、0なら記録のコードは生成されない
+#ifndef KUSABIRA_MACRO_PROFILE
+#define KUSABIRA_MACRO_PROFILE 0
+#endif
+
+namespace kusabira::PP {
+
+  /**
+  * @brief マクロ展開の統計を取るか否か
+  */
+  inline constexpr bool macro_profile_enabled = KUSABIRA_MACRO_PROFILE != 0;
+
+  /**
+  * @brief 1つのマクロの展開の統計
+  */
+  struct macro_profile_entry {
+    // 展開された回数
+    std::uint64_t calls = 0;
+    // 展開にかかった時間の合計、中で展開された他のマクロの時間も含む
+    std::chrono::nanoseconds time{};
+    // このマクロの展開の中で入れ子になったマクロ展開の最大の深さ、他のマクロを展開しなければ1
+    std::uint32_t max_depth = 0;
+    // 入力トークン数（マクロ名と実引数）の合計
+    std::uint64_t tokens_in = 0;
+    // 出力トークン数（再スキャン後の置換結果）の合計
+    std::uint64_t tokens_out = 0;
+
+    /**
+    * @brief 入力トークン数に対する出力トークン数の比
+    */
+    fn amplification() const noexcept -> double {
+      return tokens_in == 0 ? 0.0 : static_cast<double>(tokens_out) / static_cast<double>(tokens_in);
+    }
+  };
+
+  /**
+  * @brief マクロ名毎の統計
+  */
+  using macro_profile_table = std::map<std::u8string, macro_profile_entry, std::less<>>;
+
+  template<bool Enabled>
+  class basic_scoped_macro_profile;
+
+  /**
+  * @brief 1回のマクロ展開を記録するスコープガード、統計を取らないなら何もしない
+  */
+  using scoped_macro_profile = basic_scoped_macro_profile<macro_profile_enabled>;
+
+  namespace detail {
+    // スレッド毎の統計
+    inline thread_local macro_profile_table tls_macro_profile{};
+    // このスレッドで展開中の一番内側のマクロ
+    inline thread_local basic_scoped_macro_profile<true>* tls_active_macro_profile = nullptr;
+  }
+
+  /**
+  * @brief 統計を取らない時、何もしない
+  */
+  template<>
+  class basic_scoped_macro_profile<false> {
+  public:
+    constexpr explicit basic_scoped_macro_profile(std::u8string_view) noexcept {}
+
+    template<typename Args>
+    constexpr basic_scoped_macro_profile(std::u8string_view, const Args&) noexcept {}
+
+    constexpr void set_output(std::size_t) const noexcept {}
+
+    basic_scoped_macro_profile(const basic_scoped_macro_profile&) = delete;
+    basic_scoped_macro_profile& operator=(const basic_scoped_macro_profile&) = delete;
+  };
+
+  /**
+  * @brief スコープの間を1回のマクロ展開として記録する
+  * @details 出力トークン数はset_output()で設定する
+  */
+  template<>
+  class basic_scoped_macro_profile<true> {
+    using clock = std::chrono::steady_clock;
+
+    std::u8string_view m_name;
+    std::uint64_t m_tokens_in;
+    std::uint64_t m_tokens_out = 0;
+    // 自身を1とした、入れ子になった展開の最大の深さ
+    std::uint32_t m_depth = 1;
+    basic_scoped_macro_profile* m_parent;
+    clock::time_point m_begin;
+
+  public:
+
+    /**
+    * @brief オブジェクトマクロの展開
+    * @param name マクロ名、スコープの間有効であること
+    */
+    explicit basic_scoped_macro_profile(std::u8string_view name) noexcept
+      : m_name{name}
+      , m_tokens_in{1}
+      , m_parent{std::exchange(detail::tls_active_macro_profile, this)}
+      , m_begin{clock::now()}
+    {}
+
+    /**
+    * @brief 関数マクロの展開
+    * @param name マクロ名、スコープの間有効であること
+    * @param args 実引数のトークン列の列
+    */
+    template<typename Args>
+    basic_scoped_macro_profile(std::u8string_view name, const Args& args) noexcept
+      : basic_scoped_macro_profile{name}
+    {
+      for (const auto& arg : args) {
+        m_tokens_in += std::ranges::size(arg);
+      }
+    }
+
+    ~basic_scoped_macro_profile() {
+      const auto elapsed = clock::now() - m_begin;
+
+      auto& table = detail::tls_macro_profile;
+      auto pos = table.find(m_name);
+      if (pos == table.end()) {
+        pos = table.emplace(std::u8string{m_name}, macro_profile_entry{}).first;
+      }
+
+      auto& entry = pos->second;
+      ++entry.calls;
+      entry.time += elapsed;
+      entry.max_depth = std::max(entry.max_depth, m_depth);
+      entry.tokens_in += m_tokens_in;
+      entry.tokens_out += m_tokens_out;
+
+      detail::tls_active_macro_profile = m_parent;
+      if (m_parent != nullptr) {
+        m_parent->m_depth = std::max(m_parent->m_depth, m_depth + 1);
+      }
+    }
+
+    /**
+    * @brief 展開結果のトークン数を設定する
+    */
+    void set_output(std::size_t tokens) noexcept {
+      m_tokens_out = tokens;
+    }
+
+    basic_scoped_macro_profile(const basic_scoped_macro_profile&) = delete;
+    basic_scoped_macro_profile& operator=(const basic_scoped_macro_profile&) = delete;
+  };
+
+  static_assert(std::is_empty_v<basic_scoped_macro_profile<false>>);
+
+  /**
+  * @brief このスレッドの統計を取得する
+  */
+  ifn current_macro_profile() noexcept -> const macro_profile_table& {
+    return detail::tls_macro_profile;
+  }
+
+  /**
+  * @brief このスレッドの統計を消去する、翻訳単位の処理の開始時に呼ぶ
+  */
+  inline void reset_macro_profile() {
+    detail::tls_macro_profile.clear();
+  }
+
+  /**
+  * @brief 統計の並べ替えのキー
+  */
+  enum class macro_profile_order : std::uint8_t {
+    amplification,  // 入力トークン数に対する出力トークン数の比
+    time,           // 時間の合計
+    calls,          // 展開回数
+  };
+
+  /**
+  * @brief 統計を降順に並べた表にする
+  * @param table 統計
+  * @param filename 翻訳単位のファイル名
+  * @param order 並べ替えのキー
+  * @param limit 出力する最大の行数
+  * @return 出力する文字列
+  */
+  ifn format_macro_profile_report(const macro_profile_table& table, std::string_view filename, macro_profile_order order = macro_profile_order::amplification, std::size_t limit = 50) -> std::string {
+    using value_t = macro_profile_table::value_type;
+
+    std::vector<const value_t*> rows{};
+    rows.reserve(table.size());
+    for (const auto& row : table) rows.push_back(&row);
+
+    auto key = [order](const value_t* row) -> double {
+      switch (order) {
+        case macro_profile_order::time: return static_cast<double>(row->second.time.count());
+        case macro_profile_order::calls: return static_cast<double>(row->second.calls);
+        default: return row->second.amplification();
+      }
+    };
+    // 同じ値なら名前順
+    std::ranges::stable_sort(rows, [&key](const value_t* lhs, const value_t* rhs) { return key(lhs) > key(rhs); });
+
+    std::string report = "===-- kusabira macro profile: ";
+    report.append(filename).append(" --===\n");
+
+    char buf[192]{};
+    std::snprintf(buf, sizeof(buf), "  %-32s %10s %12s %6s %12s %12s %8s\n", "macro", "calls", "time[ms]", "depth", "tokens in", "tokens out", "ratio");
+    report.append(buf);
+
+    for (const auto* row : rows | std::views::take(limit)) {
+      const auto& [name, entry] = *row;
+      const double ms = std::chrono::duration<double, std::milli>(entry.time).count();
+
+      std::snprintf(buf, sizeof(buf), "  %-32.*s %10llu %12.3f %6u %12llu %12llu %8.2f\n", static_cast<int>(name.size()), reinterpret_cast<const char*>(name.data()),
+                    static_cast<unsigned long long>(entry.calls), ms, static_cast<unsigned>(entry.max_depth),
+                    static_cast<unsigned long long>(entry.tokens_in), static_cast<unsigned long long>(entry.tokens_out), entry.amplification());
+      report.append(buf);
+    }
+
+    if (limit < rows.size()) {
+      std::snprintf(buf, sizeof(buf), "  ... %zu more macros\n", rows.size() - limit);
+      report.append(buf);
+    }
+
+    return report;
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <span>
+#include <optional>
+#include <system_error>
+#include <random>
+#include <unordered_map>
+
+#include "../common.hpp"
+#include "pp_directive_manager.hpp"
+#include "token_cache.hpp"
+
+namespace kusabira::PP::macro_snapshot_format {
+
+  /*
+  * マクロスナップショットファイルのレイアウト（全て実行環境のエンディアン）
+  * [header][line_map_entry * line_map_count][lines section][macros section][string table]
+  * lines section  : [line_record][std::uint64_t * offset_count] の繰り返し
+  * macros section : [macro_record][string_ref * param_count][token * token_count][correspond_record * correspond_count][token（エラーがある場合）] の繰り返し
+  * token          : [token_record][token * composed_count]、構成トークンを前順で並べる
+  * 行に含まれるトークン文字列は行文字列上の位置で、それ以外は文字列テーブル上の位置で参照する
+  */
+
+  inline constexpr char magic[8] = {'K', 'S', 'B', 'R', 'M', 'S', 'N', '\0'};
+
+  // フォーマットを変更したらインクリメントする
+  inline constexpr std::uint32_t version = 1;
+
+  // 行を参照しないトークンの行番号
+  inline constexpr std::uint32_t no_line = std::uint32_t(-1);
+
+  // 構成トークンの入れ子の深さの上限、壊れたファイルで再帰が深くならないようにする
+  inline constexpr std::size_t max_composed_depth = 256;
+
+  struct string_ref {
+    std::uint64_t first;
+    std::uint64_t length;
+  };
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t token_record_size;
+    // header以降全体のハッシュ値
+    std::uint64_t content_hash;
+    std::uint64_t line_map_count;
+    std::uint64_t line_count;
+    std::uint64_t lines_size;
+    std::uint64_t macro_count;
+    std::uint64_t macros_size;
+    std::uint64_t strtab_size;
+    std::uint64_t has_replaced_filename;
+    string_ref replaced_filename;
+  };
+
+  struct line_map_entry {
+    std::uint64_t true_line_num;
+    std::uint64_t new_line_num;
+  };
+
+  struct line_record {
+    std::uint64_t phisic_line_num;
+    std::uint64_t logical_line_num;
+    string_ref str;
+    std::uint64_t offset_count;
+  };
+
+  enum token_flags : std::uint8_t {
+    generated = 1,
+    // トークン文字列が行文字列上にある
+    str_in_line = 2
+  };
+
+  struct token_record {
+    std::uint64_t column;
+    // str_in_lineならば行文字列上、そうでなければ文字列テーブル上の位置
+    string_ref str;
+    std::uint32_t line_index;
+    std::uint32_t composed_count;
+    pp_token_category category;
+    std::uint8_t flags;
+    std::uint8_t padding[6];
+  };
+
+  struct macro_record {
+    string_ref name;
+    std::uint32_t param_count;
+    std::uint32_t token_count;
+    std::uint32_t correspond_count;
+    std::int32_t error_context;
+    std::uint8_t is_func;
+    std::uint8_t is_va;
+    std::uint8_t has_error;
+    std::uint8_t padding[5];
+  };
+
+  struct correspond_record {
+    std::uint64_t token_index;
+    std::uint64_t arg_index;
+    // unified_macro::correspond_tの残りのbool値をビット毎に詰めたもの
+    std::uint64_t flags;
+  };
+
+  static_assert(sizeof(token_record) == 40);
+  static_assert(std::is_trivially_copyable_v<header> and std::is_trivially_copyable_v<token_record> and std::is_trivially_copyable_v<macro_record>);
+
+} // namespace kusabira::PP::macro_snapshot_format
+
+namespace kusabira::PP {
+
+  /**
+  * @brief マクロ定義の状態をバイト列に書き出す
+  * @details 置換リストの解析結果（仮引数との対応）も含めて保存し、読み込み時に再解析しない
+  */
+  class macro_snapshot_writer {
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    std::vector<char> m_lines{};
+    std::vector<char> m_macros{};
+    std::u8string m_strtab{};
+    // 書き出し済みの行 -> 行番号
+    std::unordered_map<const logical_line*, std::uint32_t> m_line_index{};
+    std::uint64_t m_macro_count = 0;
+
+    template<typename T>
+    sfn put(std::vector<char>& buffer, const T& value) {
+      const auto pos = buffer.size();
+      buffer.resize(pos + sizeof(T));
+      std::memcpy(buffer.data() + pos, &value, sizeof(T));
+    }
+
+    fn put_string(std::u8string_view str) -> macro_snapshot_format::string_ref {
+      macro_snapshot_format::string_ref ref{m_strtab.size(), str.length()};
+      m_strtab.append(str);
+      return ref;
+    }
+
+    /**
+    * @brief 行を書き出し済みにして、その番号を得る
+    */
+    fn line_index(line_iterator line) -> std::uint32_t {
+      const logical_line* ptr = &*line;
+
+      if (auto pos = m_line_index.find(ptr); pos != m_line_index.end()) {
+        return (*pos).second;
+      }
+
+      const auto index = std::uint32_t(m_line_index.size());
+      m_line_index.emplace(ptr, index);
+
+      put(m_lines, macro_snapshot_format::line_record{ptr->phisic_line_num, ptr->logical_line_num, this->put_string(ptr->line), ptr->line_offset.size()});
+      for (std::uint64_t offset : ptr->line_offset) {
+        put(m_lines, offset);
+      }
+
+      return index;
+    }
+
+    void put_token(const pp_token& pptoken) {
+      using namespace macro_snapshot_format;
+
+      token_record rec{};
+      rec.column = pptoken.column;
+      rec.category = pptoken.category;
+      rec.line_index = no_line;
+      rec.composed_count = std::uint32_t(std::ranges::distance(pptoken.composed_tokens));
+
+      const auto str = pptoken.token.to_view();
+
+      if (pptoken.is_generated) {
+        rec.flags = token_flags::generated;
+        rec.str = this->put_string(str);
+      } else {
+        rec.line_index = this->line_index(pptoken.srcline_ref);
+
+        // 行の部分文字列ならば行上の位置だけを記録する
+        const auto& line = (*pptoken.srcline_ref).line;
+        const std::less_equal<const char8_t*> le{};
+        if (le(line.data(), str.data()) and le(str.data() + str.size(), line.data() + line.size())) {
+          rec.flags = token_flags::str_in_line;
+          rec.str = {std::uint64_t(str.data() - line.data()), str.length()};
+        } else {
+          rec.str = this->put_string(str);
+        }
+      }
+
+      put(m_macros, rec);
+      for (const auto& composed : pptoken.composed_tokens) {
+        this->put_token(composed);
+      }
+    }
+
+  public:
+
+    /**
+    * @brief マクロ1つを書き出す
+    * @param name マクロ名
+    * @param macro マクロ
+    */
+    void add(std::u8string_view name, const unified_macro& macro) {
+      using namespace macro_snapshot_format;
+
+      const auto& err = macro.is_ready();
+
+      macro_record rec{};
+      rec.name = this->put_string(name);
+      rec.param_count = std::uint32_t(macro.params().size());
+      rec.token_count = std::uint32_t(macro.replacement_list().size());
+      rec.correspond_count = std::uint32_t(macro.correspond().size());
+      rec.is_func = macro.is_function();
+      rec.is_va = macro.is_va();
+      rec.has_error = bool(err);
+      rec.error_context = err ? std::int32_t((*err).first) : 0;
+      put(m_macros, rec);
+
+      for (auto param : macro.params()) {
+        put(m_macros, this->put_string(param));
+      }
+      for (const auto& pptoken : macro.replacement_list()) {
+        this->put_token(pptoken);
+      }
+      for (const auto& [token_index, arg_index, b0, b1, b2, b3, b4, b5] : macro.correspond()) {
+        const std::uint64_t flags = std::uint64_t(b0) | std::uint64_t(b1) << 1 | std::uint64_t(b2) << 2 | std::uint64_t(b3) << 3 | std::uint64_t(b4) << 4 | std::uint64_t(b5) << 5;
+        put(m_macros, correspond_record{token_index, arg_index, flags});
+      }
+      if (err) {
+        this->put_token((*err).second);
+      }
+
+      ++m_macro_count;
+    }
+
+    /**
+    * @brief ファイルイメージを完成させる
+    * @param line_map #lineディレクティブによる行番号変更の対応
+    * @param replaced_filename #lineディレクティブによって変更されたファイル名
+    * @return スナップショットファイルの内容
+    */
+    fn finish(const std::pmr::map<std::size_t, std::size_t>& line_map, const std::optional<fs::path>& replaced_filename) -> std::vector<char> {
+      using namespace macro_snapshot_format;
+
+      header head{};
+      std::memcpy(head.magic, magic, sizeof(magic));
+      head.version = version;
+      head.token_record_size = sizeof(token_record);
+      head.line_map_count = line_map.size();
+      head.line_count = m_line_index.size();
+      head.lines_size = m_lines.size();
+      head.macro_count = m_macro_count;
+      head.macros_size = m_macros.size();
+      head.has_replaced_filename = replaced_filename.has_value();
+      if (replaced_filename) {
+        head.replaced_filename = this->put_string((*replaced_filename).u8string());
+      }
+      head.strtab_size = m_strtab.size();
+
+      std::vector<char> image(sizeof(header));
+      image.reserve(sizeof(header) + line_map.size() * sizeof(line_map_entry) + m_lines.size() + m_macros.size() + m_strtab.size());
+
+      for (const auto& [true_line, new_line] : line_map) {
+        put(image, line_map_entry{true_line, new_line});
+      }
+      image.insert(image.end(), m_lines.begin(), m_lines.end());
+      image.insert(image.end(), m_macros.begin(), m_macros.end());
+      image.insert(image.end(), reinterpret_cast<const char*>(m_strtab.data()), reinterpret_cast<const char*>(m_strtab.data() + m_strtab.size()));
+
+      head.content_hash = token_cache_format::fnv1a_64(std::span<const char>{image}.subspan(sizeof(header)));
+      std::memcpy(image.data(), &head, sizeof(header));
+
+      return image;
+    }
+  };
+
+  /**
+  * @brief バイト列からマクロ定義の状態を復元する
+  * @details 全ての範囲をチェックし、不正なデータに対しては失敗する
+  */
+  class macro_snapshot_reader {
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    std::span<const char> m_data;
+    std::size_t m_pos = 0;
+    std::shared_ptr<macro_environment> m_env = std::make_shared<macro_environment>();
+    std::u8string_view m_strtab{};
+    std::vector<line_iterator> m_lines{};
+
+    template<typename T>
+    fn get() -> std::optional<T> {
+      if (m_data.size() - m_pos < sizeof(T)) return std::nullopt;
+
+      T value;
+      std::memcpy(&value, m_data.data() + m_pos, sizeof(T));
+      m_pos += sizeof(T);
+      return value;
+    }
+
+    sfn substr(std::u8string_view str, const macro_snapshot_format::string_ref& ref) -> std::optional<std::u8string_view> {
+      if (str.length() < ref.first or str.length() - ref.first < ref.length) return std::nullopt;
+      return str.substr(ref.first, ref.length);
+    }
+
+    fn get_token(std::size_t depth) -> std::optional<pp_token> {
+      using namespace macro_snapshot_format;
+
+      if (max_composed_depth < depth) return std::nullopt;
+
+      const auto rec = this->get<token_record>();
+      if (not rec) return std::nullopt;
+      if (rec->category < pp_token_category::newline or pp_token_category::not_macro_name_identifier < rec->category) return std::nullopt;
+
+      const bool is_generated = rec->flags & token_flags::generated;
+      // 生成されたトークンは行を参照しない
+      if (is_generated and (rec->flags & token_flags::str_in_line)) return std::nullopt;
+      if (not is_generated and m_lines.size() <= rec->line_index) return std::nullopt;
+
+      const auto line = is_generated ? line_iterator{} : m_lines[rec->line_index];
+      const auto str = substr((rec->flags & token_flags::str_in_line) ? std::u8string_view{(*line).line} : m_strtab, rec->str);
+      if (not str) return std::nullopt;
+
+      std::optional<pp_token> result{std::in_place, rec->category, *str, rec->column, line, m_env->resource()};
+      result->is_generated = is_generated;
+
+      auto pos = result->composed_tokens.before_begin();
+      for (std::uint32_t i = 0; i < rec->composed_count; ++i) {
+        auto composed = this->get_token(depth + 1);
+        if (not composed) return std::nullopt;
+        pos = result->composed_tokens.insert_after(pos, *std::move(composed));
+      }
+
+      return result;
+    }
+
+    /**
+    * @brief 残りのバイト列にT型のレコードがcount個以上収まるか
+    */
+    template<typename T>
+    fn can_hold(std::uint64_t count) const noexcept -> bool {
+      return count <= (m_data.size() - m_pos) / sizeof(T);
+    }
+
+    fn get_macro() -> bool {
+      using namespace macro_snapshot_format;
+
+      const auto rec = this->get<macro_record>();
+      if (not rec) return false;
+      // 確保する前に、数が残りのバイト列と矛盾しないことを確かめる
+      if (not this->can_hold<string_ref>(rec->param_count) or not this->can_hold<correspond_record>(rec->correspond_count)) return false;
+      if (rec->has_error and (rec->error_context < std::int32_t(pp_parse_context::UnknownError) or std::int32_t(pp_parse_context::Newline_NotAppear) < rec->error_context)) return false;
+
+      const auto name = substr(m_strtab, rec->name);
+      if (not name) return false;
+
+      std::pmr::vector<std::u8string_view> params{m_env->resource()};
+      params.reserve(rec->param_count);
+      for (std::uint32_t i = 0; i < rec->param_count; ++i) {
+        const auto ref = this->get<string_ref>();
+        if (not ref) return false;
+        const auto param = substr(m_strtab, *ref);
+        if (not param) return false;
+        params.emplace_back(*param);
+      }
+
+      std::pmr::list<pp_token> tokens{m_env->resource()};
+      for (std::uint32_t i = 0; i < rec->token_count; ++i) {
+        auto pptoken = this->get_token(0);
+        if (not pptoken) return false;
+        tokens.emplace_back(*std::move(pptoken));
+      }
+
+      std::pmr::vector<unified_macro::correspond_t> correspond{m_env->resource()};
+      correspond.reserve(rec->correspond_count);
+      for (std::uint32_t i = 0; i < rec->correspond_count; ++i) {
+        const auto c = this->get<correspond_record>();
+        if (not c or rec->token_count <= c->token_index) return false;
+        const auto f = c->flags;
+        // 実引数の位置は仮引数（...を含む）の範囲内、仮引数ではない##の左辺のみ-1
+        const bool is_plain_concat = c->arg_index == std::uint64_t(-1) and (f & 0b1111) == 0b1000;
+        if (rec->param_count <= c->arg_index and not is_plain_concat) return false;
+        correspond.emplace_back(c->token_index, c->arg_index, f & 1, f >> 1 & 1, f >> 2 & 1, f >> 3 & 1, f >> 4 & 1, f >> 5 & 1);
+      }
+
+      std::optional<std::pair<pp_parse_context, pp_token>> err{};
+      if (rec->has_error) {
+        auto pptoken = this->get_token(0);
+        if (not pptoken) return false;
+        err.emplace(static_cast<pp_parse_context>(rec->error_context), *std::move(pptoken));
+      }
+
+      m_env->emplace(*name, unified_macro{std::move(params), std::move(tokens), bool(rec->is_va), bool(rec->is_func), std::move(correspond), std::move(err)});
+      return true;
+    }
+
+  public:
+
+    explicit macro_snapshot_reader(std::span<const char> data)
+      : m_data{data}
+    {}
+
+    /**
+    * @brief 復元する
+    * @return 失敗した場合は無効値
+    */
+    fn read() -> std::optional<macro_snapshot> {
+      using namespace macro_snapshot_format;
+
+      const auto head = this->get<header>();
+      if (not head) return std::nullopt;
+      if (std::memcmp(head->magic, magic, sizeof(magic)) != 0 or head->version != version or head->token_record_size != sizeof(token_record)) return std::nullopt;
+      if (token_cache_format::fnv1a_64(m_data.subspan(sizeof(header))) != head->content_hash) return std::nullopt;
+
+      // 各セクションのサイズが全体と一致していること
+      const auto body_size = m_data.size() - sizeof(header);
+      if (body_size / sizeof(line_map_entry) < head->line_map_count) return std::nullopt;
+      const std::uint64_t line_map_size = head->line_map_count * sizeof(line_map_entry);
+      if (body_size - line_map_size < head->strtab_size) return std::nullopt;
+      if (body_size - line_map_size - head->strtab_size != head->lines_size + head->macros_size) return std::nullopt;
+
+      // 文字列テーブルは環境へ1度にコピーする
+      const auto strtab_first = m_data.data() + (m_data.size() - head->strtab_size);
+      m_strtab = m_env->intern(std::u8string_view{reinterpret_cast<const char8_t*>(strtab_first), std::size_t(head->strtab_size)});
+
+      macro_snapshot result{};
+
+      for (std::uint64_t i = 0; i < head->line_map_count; ++i) {
+        const auto entry = *this->get<line_map_entry>();
+        result.line_map.emplace_hint(result.line_map.end(), entry.true_line_num, entry.new_line_num);
+      }
+
+      if (head->has_replaced_filename) {
+        const auto filename = substr(m_strtab, head->replaced_filename);
+        if (not filename) return std::nullopt;
+        result.replaced_filename.emplace(*filename);
+      }
+
+      const auto lines_end = m_pos + head->lines_size;
+      m_lines.reserve(std::min<std::uint64_t>(head->line_count, head->lines_size / sizeof(line_record)));
+      for (std::uint64_t i = 0; i < head->line_count; ++i) {
+        const auto rec = this->get<line_record>();
+        if (not rec or lines_end < m_pos) return std::nullopt;
+
+        const auto str = substr(m_strtab, rec->str);
+        if (not str or (lines_end - m_pos) / sizeof(std::uint64_t) < rec->offset_count) return std::nullopt;
+
+        std::vector<std::size_t> offsets(rec->offset_count);
+        for (auto& offset : offsets) offset = std::size_t(*this->get<std::uint64_t>());
+
+        m_lines.emplace_back(m_env->add_line(rec->phisic_line_num, rec->logical_line_num, *str, offsets));
+      }
+      if (m_pos != lines_end) return std::nullopt;
+
+      const auto macros_end = m_pos + head->macros_size;
+      m_data = m_data.first(macros_end);
+      m_env->reserve(head->macro_count);
+      for (std::uint64_t i = 0; i < head->macro_count; ++i) {
+        if (not this->get_macro()) return std::nullopt;
+      }
+      if (m_pos != macros_end) return std::nullopt;
+
+      result.macros = std::move(m_env);
+      return result;
+    }
+  };
+
+  /**
+  * @brief 現在のマクロ定義の状態をバイト列にする
+  * @details 基底環境のマクロも含めて、その時点で見えている全てのマクロを保存する
+  * @param macros マクロ定義を保持するオブジェクト
+  * @return スナップショットファイルの内容
+  */
+  ifn serialize_macro_snapshot(const macro_manager& macros) -> std::vector<char> {
+    macro_snapshot_writer writer{};
+
+    macros.for_each_macro([&writer](std::u8string_view name, const unified_macro& macro) {
+      writer.add(name, macro);
+    });
+
+    return writer.finish(macros.line_map(), macros.replaced_filename());
+  }
+
+  /**
+  * @brief 現在のマクロ定義の状態をファイルに保存する
+  * @details 一時ファイルに書いてから置き換えるので、読み込み側が書き込み途中のファイルを見ることは無い
+  * @param pp プリプロセッサ
+  * @param path 保存先
+  * @return 保存に成功したか否か
+  */
+  ifn save_macro_snapshot(const pp_directive_manager& pp, const fs::path& path) -> bool {
+    const auto image = serialize_macro_snapshot(pp.m_macro_manager);
+
+    auto tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(std::random_device{}());
+
+    std::error_code ec{};
+    {
+      std::ofstream ofs{tmp_path, std::ios::binary | std::ios::trunc};
+      ofs.write(image.data(), image.size());
+      if (not ofs) ec = std::make_error_code(std::errc::io_error);
+    }
+
+    if (not ec) fs::rename(tmp_path, path, ec);
+    if (ec) fs::remove(tmp_path, ec);
+
+    return not ec;
+  }
+
+  /**
+  * @brief バイト列からマクロ定義の状態を復元する
+  * @param data serialize_macro_snapshot()の結果
+  * @return 不正なデータならば無効値
+  */
+  ifn deserialize_macro_snapshot(std::span<const char> data) -> std::optional<macro_snapshot> {
+    return macro_snapshot_reader{data}.read();
+  }
+
+  /**
+  * @brief 保存しておいたマクロ定義の状態を読み込む
+  * @details 結果はpp_directive_manager/ll_paserの構築に使用する、複数の翻訳単位で共有できる
+  * @param path スナップショットファイル
+  * @return 読み込めないか不正なファイルならば無効値
+  */
+  ifn load_macro_snapshot(const fs::path& path) -> std::optional<macro_snapshot> {
+    std::ifstream ifs{path, std::ios::binary};
+    if (not ifs) return std::nullopt;
+
+    std::error_code ec{};
+    const auto size = fs::file_size(path, ec);
+    if (ec) return std::nullopt;
+
+    std::vector<char> data(size);
+    if (not ifs.read(data.data(), size)) return std::nullopt;
+
+    return deserialize_macro_snapshot(data);
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <span>
+#include <system_error>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "../common.hpp"
+#include "file_reader.hpp"
+#include "pp_automaton.hpp"
+#include "pp_tokenizer.hpp"
+#include "token_cache.hpp"
+
+namespace kusabira::PP::minimized_source_format {
+
+  /*
+  * ディレクティブだけに縮小したソースのレイアウト（全て実行環境のエンディアン）
+  * [header][line_record * line_count][std::uint64_t * offset_count][string table]
+  * 行レコードはトークンキャッシュと共通、行番号は元のソースのものを保持する
+  */
+
+  inline constexpr char magic[8] = {'K', 'S', 'B', 'R', 'M', 'I', 'N', '\0'};
+
+  // フォーマットか縮小の規則を変更したらインクリメントする
+  inline constexpr std::uint32_t version = 1;
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t line_record_size;
+    std::uint64_t content_hash;
+    std::uint64_t line_count;
+    std::uint64_t offset_count;
+    std::uint64_t strtab_size;
+  };
+
+  using line_record = token_cache_format::line_record;
+
+  static_assert(std::is_trivially_copyable_v<header>);
+
+  /**
+  * @brief ハッシュ値からキャッシュファイル名を作る
+  * @param hash ソースファイル内容のハッシュ値
+  * @return 16進16桁 + 拡張子のファイル名
+  */
+  ifn cache_filename(std::uint64_t hash) -> std::string {
+    auto name = token_cache_format::cache_filename(hash);
+    return name.replace(name.rfind('.'), std::string::npos, ".ksmn");
+  }
+}
+
+namespace kusabira::PP {
+
+  /**
+  * @brief プリプロセッシングディレクティブとモジュール宣言の行だけを残したソース
+  * @details 依存関係の走査に必要な行だけを保持し、行番号は元のソースのものを対応付けて保持する
+  * @details ヘッダのキャッシュとして複数の翻訳単位の走査で共有する、def_mrは使用しない
+  */
+  class minimized_source {
+    using header = minimized_source_format::header;
+    using line_record = minimized_source_format::line_record;
+
+    std::vector<char> m_buffer;
+
+  public:
+
+    minimized_source() = default;
+
+    /**
+    * @brief シリアライズ済みのバイト列から構築
+    * @param buffer バイト列、validate()で検査すること
+    */
+    explicit minimized_source(std::vector<char>&& buffer)
+      : m_buffer{std::move(buffer)}
+    {}
+
+    /**
+    * @brief キャッシュファイルを読み込む
+    * @param path キャッシュファイルのパス
+    * @param content_hash 期待するソースファイル内容のハッシュ値
+    * @return 妥当なキャッシュであればその内容、そうでなければnullopt
+    */
+    sfn open(const fs::path& path, std::uint64_t content_hash) -> std::optional<minimized_source> {
+      std::ifstream ifs{path, std::ios::binary};
+      if (not ifs) return std::nullopt;
+
+      std::error_code ec{};
+      const auto size = fs::file_size(path, ec);
+      if (ec or size < sizeof(header)) return std::nullopt;
+
+      std::vector<char> buffer(size);
+      if (not ifs.read(buffer.data(), size)) return std::nullopt;
+
+      minimized_source src{std::move(buffer)};
+      if (not src.validate(content_hash)) return std::nullopt;
+
+      return std::optional<minimized_source>{std::move(src)};
+    }
+
+    /**
+    * @brief 内容が縮小ソースとして妥当かを検査する
+    * @param content_hash 期待するソースファイル内容のハッシュ値
+    * @return 妥当ならtrue
+    */
+    fn validate(std::uint64_t content_hash) const noexcept -> bool {
+      if (m_buffer.size() < sizeof(header)) return false;
+
+      const auto& h = this->get_header();
+      if (std::memcmp(h.magic, minimized_source_format::magic, sizeof(h.magic)) != 0) return false;
+      if (h.version != minimized_source_format::version) return false;
+      if (h.line_record_size != sizeof(line_record)) return false;
+      if (h.content_hash != content_hash) return false;
+
+      const std::uint64_t rest = m_buffer.size() - sizeof(header);
+      if (rest / sizeof(line_record) < h.line_count) return false;
+      std::uint64_t expect = h.line_count * sizeof(line_record);
+      if ((rest - expect) / sizeof(std::uint64_t) < h.offset_count) return false;
+      expect += h.offset_count * sizeof(std::uint64_t);
+
+      if (rest - expect != h.strtab_size) return false;
+
+      for (const auto& line : this->lines()) {
+        if (h.strtab_size < line.str_first or h.strtab_size - line.str_first < line.str_length) return false;
+        if (h.offset_count < line.offset_first or h.offset_count - line.offset_first < line.offset_count) return false;
+      }
+
+      return true;
+    }
+
+    fn get_header() const noexcept -> const header& {
+      return *reinterpret_cast<const header*>(m_buffer.data());
+    }
+
+    fn lines() const noexcept -> std::span<const line_record> {
+      const auto& h = this->get_header();
+      return {reinterpret_cast<const line_record*>(m_buffer.data() + sizeof(header)), static_cast<std::size_t>(h.line_count)};
+    }
+
+    fn line_offsets() const noexcept -> std::span<const std::uint64_t> {
+      const auto& h = this->get_header();
+      const auto first = sizeof(header) + h.line_count * sizeof(line_record);
+      return {reinterpret_cast<const std::uint64_t*>(m_buffer.data() + first), static_cast<std::size_t>(h.offset_count)};
+    }
+
+    fn string_table() const noexcept -> std::u8string_view {
+      const auto& h = this->get_header();
+      return {reinterpret_cast<const char8_t*>(m_buffer.data() + (m_buffer.size() - h.strtab_size)), static_cast<std::size_t>(h.strtab_size)};
+    }
+
+    fn bytes() const noexcept -> std::span<const char> {
+      return m_buffer;
+    }
+
+    explicit operator bool() const noexcept {
+      return not m_buffer.empty();
+    }
+  };
+
+  /**
+  * @brief ソースファイルをディレクティブとモジュール宣言の行だけに縮小し、シリアライズする
+  * @details 行頭（空白とコメントを除く）が#の行と、module/import/exportで始まる行を残す
+  * @details 行頭のコメントと、次の行へ続くブロックコメント・生文字列リテラル以降は取り除く
+  * @tparam SrcReader ソースコードを行毎に読み込む処理を実装した型
+  * @tparam Automaton 入力トークンを識別するオートマトンの型
+  * @param srcpath ソースファイルのパス
+  * @param content_hash ソースファイル内容のハッシュ値
+  * @return シリアライズ済みのバイト列
+  */
+  template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+  ifn serialize_minimized_source(const fs::path& srcpath, std::uint64_t content_hash) -> std::vector<char> {
+    namespace fmt = minimized_source_format;
+    using namespace std::string_view_literals;
+
+    std::vector<fmt::line_record> lines{};
+    std::vector<std::uint64_t> offsets{};
+    std::pmr::u8string strtab{&kusabira::def_mr};
+
+    tokenizer<SrcReader, Automaton> tk{srcpath};
+
+    // 現在の行の状態
+    std::optional<pp_token::line_iterator> current{};
+    bool seen_token = false;
+    bool keep = false;
+    std::size_t first = 0;
+    std::size_t last = std::u8string_view::npos;
+
+    auto flush = [&] {
+      if (not current or not keep) return;
+
+      const auto& ll = **current;
+      const std::u8string_view str = std::u8string_view{ll.line}.substr(0, last).substr(first);
+
+      // 残した部分より前の行継続の数だけ物理行番号がずれる
+      std::size_t phisic_line = ll.phisic_line_num;
+      const auto offset_first = offsets.size();
+      for (auto offset : ll.line_offset) {
+        if (offset <= first) {
+          ++phisic_line;
+        } else if (offset < first + str.length()) {
+          offsets.push_back(offset - first);
+        }
+      }
+
+      lines.push_back({phisic_line, ll.logical_line_num, strtab.length(), str.length(), offset_first, offsets.size() - offset_first});
+      strtab.append(str);
+    };
+
+    while (auto token = tk.tokenize()) {
+      if (not current or *current != token->srcline_ref) {
+        flush();
+        current = token->srcline_ref;
+        seen_token = false;
+        keep = false;
+        last = std::u8string_view::npos;
+      }
+
+      const auto kind = token->category;
+      const auto str = token->token.to_view();
+
+      if (kind == pp_token_category::newline) continue;
+
+      if (not seen_token) {
+        if (kind == pp_token_category::whitespaces or kind == pp_token_category::block_comment or kind == pp_token_category::line_comment) continue;
+
+        seen_token = true;
+        first = token->column;
+        keep = (kind == pp_token_category::op_or_punc and str == u8"#"sv) or
+               (kind == pp_token_category::identifier and (str == u8"module"sv or str == u8"import"sv or str == u8"export"sv));
+        continue;
+      }
+
+      // 次の行へ続くものは、残した行だけを読む時に後続の行を巻き込むので取り除く
+      if (keep and last == std::u8string_view::npos) {
+        const bool open_comment = kind == pp_token_category::block_comment and (str.length() < 4 or not str.ends_with(u8"*/"sv));
+        if (open_comment or kind == pp_token_category::during_raw_string_literal) {
+          last = token->column;
+        }
+      }
+    }
+    flush();
+
+    fmt::header h{};
+    std::memcpy(h.magic, fmt::magic, sizeof(h.magic));
+    h.version = fmt::version;
+    h.line_record_size = sizeof(fmt::line_record);
+    h.content_hash = content_hash;
+    h.line_count = lines.size();
+    h.offset_count = offsets.size();
+    h.strtab_size = strtab.size();
+
+    std::vector<char> buffer{};
+    buffer.reserve(sizeof(h) + lines.size() * sizeof(fmt::line_record) + offsets.size() * sizeof(std::uint64_t) + strtab.size());
+
+    auto append = [&buffer](const void* p, std::size_t n) {
+      const auto first = static_cast<const char*>(p);
+      buffer.insert(buffer.end(), first, first + n);
+    };
+
+    append(&h, sizeof(h));
+    append(lines.data(), lines.size() * sizeof(fmt::line_record));
+    append(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    append(strtab.data(), strtab.size());
+
+    return buffer;
+  }
+
+  /**
+  * @brief 縮小したソースを取得する
+  * @details cache_dirが空でなければ、内容ハッシュをキーとしたキャッシュファイルを読み書きする
+  * @param srcpath ソースファイルのパス
+  * @param content_hash ソースファイル内容のハッシュ値
+  * @param cache_dir キャッシュディレクトリ、空ならディスクキャッシュを使わない
+  * @return 縮小したソース、ソースファイルが読めなければ空
+  */
+  template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+  ifn load_minimized_source(const fs::path& srcpath, std::uint64_t content_hash, const fs::path& cache_dir) -> minimized_source {
+    const auto cache_path = cache_dir.empty() ? fs::path{} : cache_dir / minimized_source_format::cache_filename(content_hash);
+
+    if (not cache_path.empty()) {
+      if (auto src = minimized_source::open(cache_path, content_hash); src) {
+        return *std::move(src);
+      }
+    }
+
+    minimized_source src{serialize_minimized_source<SrcReader, Automaton>(srcpath, content_hash)};
+
+    // 書き出しはベストエフォート、トークンキャッシュと同じく一時ファイルから置き換える
+    if (not cache_path.empty()) {
+      std::error_code ec{};
+      fs::create_directories(cache_dir, ec);
+      if (not ec) {
+        auto tmp_path = cache_path;
+        tmp_path += ".tmp" + std::to_string(std::random_device{}());
+
+        {
+          const auto bytes = src.bytes();
+          std::ofstream ofs{tmp_path, std::ios::binary | std::ios::trunc};
+          ofs.write(bytes.data(), bytes.size());
+          if (not ofs) ec = std::make_error_code(std::errc::io_error);
+        }
+
+        if (not ec) fs::rename(tmp_path, cache_path, ec);
+        if (ec) fs::remove(tmp_path, ec);
+      }
+    }
+
+    return src;
+  }
+
+  /**
+  * @brief 縮小したソースのキャッシュ
+  * @details 内容ハッシュをキーとしてメモリ上に保持し、キャッシュディレクトリが指定されていればディスクにも保存する
+  * @details 同じ内容のファイルはパスが異なっても共有される
+  */
+  class minimized_source_cache {
+    fs::path m_cache_dir;
+    std::unordered_map<std::uint64_t, std::shared_ptr<const minimized_source>> m_entries;
+    std::size_t m_hit_count = 0;
+    std::mutex m_mtx;
+
+  public:
+
+    /**
+    * @brief コンストラクタ
+    * @param cache_dir キャッシュディレクトリ、空ならメモリ上にのみ保持する
+    */
+    minimized_source_cache(fs::path cache_dir = {})
+      : m_cache_dir{std::move(cache_dir)}
+    {}
+
+    /**
+    * @brief ファイルに対応する縮小したソースを取得する
+    * @param path ソースファイルのパス
+    * @return 縮小したソース、ファイルが読めない場合はnullptr
+    */
+    template <concepts::src_reader SrcReader = filereader, concepts::tokenize_fsm Automaton = pp_tokenizer_sm>
+    fn get(const fs::path& path) -> std::shared_ptr<const minimized_source> {
+      const auto hash = hash_file_content(path);
+      if (not hash) return nullptr;
+
+      std::lock_guard lock{m_mtx};
+
+      if (auto it = m_entries.find(*hash); it != m_entries.end()) {
+        ++m_hit_count;
+        return (*it).second;
+      }
+
+      auto src = std::make_shared<const minimized_source>(load_minimized_source<SrcReader, Automaton>(path, *hash, m_cache_dir));
+      if (not *src) return nullptr;
+
+      m_entries.emplace(*hash, src);
+      return src;
+    }
+
+    /**
+    * @brief 保持しているソースの数
+    */
+    fn size() -> std::size_t {
+      std::lock_guard lock{m_mtx};
+      return m_entries.size();
+    }
+
+    /**
+    * @brief メモリ上の記録が使われた回数
+    */
+    fn hit_count() -> std::size_t {
+      std::lock_guard lock{m_mtx};
+      return m_hit_count;
+    }
+  };
+
+  /**
+  * @brief 縮小したソースから論理行を読み出す
+  * @details 行番号は元のソースのものになる
+  */
+  class minimized_reader {
+    using maybe_line = std::optional<logical_line>;
+
+    std::shared_ptr<const minimized_source> m_source;
+    std::size_t m_index = 0;
+
+  public:
+
+    /**
+    * @brief ソースファイルを縮小して読む、キャッシュは使用しない
+    * @param filepath ソースファイルのパス
+    */
+    minimized_reader(const fs::path& filepath)
+      : minimized_reader(minimized_source_cache{}.get(filepath))
+    {}
+
+    /**
+    * @brief 縮小済みのソースを読む
+    * @param source 縮小したソース、nullptrなら空のファイルとして扱う
+    */
+    minimized_reader(std::shared_ptr<const minimized_source> source)
+      : m_source{std::move(source)}
+    {}
+
+    fn readline() -> maybe_line {
+      if (m_source == nullptr or m_source->lines().size() <= m_index) return std::nullopt;
+
+      const auto& rec = m_source->lines()[m_index++];
+      const auto offsets = m_source->line_offsets().subspan(rec.offset_first, rec.offset_count);
+
+      maybe_line ll{std::in_place, rec.phisic_line_num, rec.logical_line_num};
+      ll->line = m_source->string_table().substr(rec.str_first, rec.str_length);
+      ll->line_offset.assign(offsets.begin(), offsets.end());
+
+      return ll;
+    }
+  };
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <string_view>
+
+#include "../common.hpp"
+
+// 1にすると処理段階毎の時間を計測する、0なら計測のコードは生成されない
+#ifndef KUSABIRA_PHASE_TIMER
+#define KUSABIRA_PHASE_TIMER 0
+#endif
+
+// 1にすると処理段階毎のメモリ確保を集計する（allocation_stats.hpp）、処理段階の追跡はここで行う
+#ifndef KUSABIRA_ALLOCATION_STATS
+#define KUSABIRA_ALLOCATION_STATS 0
+#endif
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 処理段階毎の時間計測が有効か否か
+  */
+  inline constexpr bool phase_timer_enabled = KUSABIRA_PHASE_TIMER != 0;
+
+  /**
+  * @brief 処理段階毎のメモリ確保の集計が有効か否か
+  */
+  inline constexpr bool allocation_stats_enabled = KUSABIRA_ALLOCATION_STATS != 0;
+
+  /**
+  * @brief 現在の処理段階を追跡するか否か、時間計測とメモリ確保の集計のどちらかが有効なら追跡する
+  */
+  inline constexpr bool phase_tracking_enabled = phase_timer_enabled or allocation_stats_enabled;
+
+  /**
+  * @brief 時間を計測する処理段階
+  */
+  enum class pp_phase : std::uint8_t {
+    file_read,      // ファイルの読み込み（filereader::readline）
+    tokenize,       // 字句解析（tokenizer::tokenize）
+    define,         // #defineの処理（ll_paser::control_line_define）
+    macro_expand,   // マクロ展開（macro_manager::objmacro/funcmacro）
+    if_evaluate,    // #if/#elifの定数式の評価（pp_constexpr）
+    output,         // 結果の出力（write_pp_tokens）
+  };
+
+  inline constexpr std::size_t pp_phase_count = 6;
+
+  /**
+  * @brief 処理段階の名前を取得する
+  */
+  ifn phase_name(pp_phase phase) -> std::string_view {
+    constexpr std::array<std::string_view, pp_phase_count> names = { "file read", "tokenize", "#define", "macro expansion", "#if evaluation", "output" };
+    return names[static_cast<std::size_t>(phase)];
+  }
+
+  /**
+  * @brief 処理段階毎の計測結果
+  * @details 時間は自分自身の時間で、入れ子になった他の計測区間の時間を含まない
+  */
+  struct phase_time_table {
+    std::array<std::chrono::nanoseconds, pp_phase_count> self_time{};
+    std::array<std::uint64_t, pp_phase_count> calls{};
+
+    fn total() const -> std::chrono::nanoseconds {
+      std::chrono::nanoseconds sum{};
+      for (auto t : self_time) sum += t;
+      return sum;
+    }
+  };
+
+  template<bool Enabled>
+  class basic_scoped_phase_timer;
+
+  /**
+  * @brief 処理段階の時間を計測するスコープガード、追跡が無効なら何もしない
+  */
+  using scoped_phase_timer = basic_scoped_phase_timer<phase_tracking_enabled>;
+
+  namespace detail {
+    // スレッド毎の計測結果、サーバーではリクエスト毎に1つのスレッドが1ファイルを処理する
+    inline thread_local phase_time_table tls_phase_times{};
+    // このスレッドで計測中の一番内側の区間
+    inline thread_local basic_scoped_phase_timer<true>* tls_active_phase_timer = nullptr;
+  }
+
+  /**
+  * @brief 計測が無効の時、何もしない
+  */
+  template<>
+  class basic_scoped_phase_timer<false> {
+  public:
+    constexpr explicit basic_scoped_phase_timer(pp_phase) noexcept {}
+
+    basic_scoped_phase_timer(const basic_scoped_phase_timer&) = delete;
+    basic_scoped_phase_timer& operator=(const basic_scoped_phase_timer&) = delete;
+  };
+
+  /**
+  * @brief スコープの間の時間を処理段階に加算する
+  * @details 入れ子になった場合、内側の区間の間は外側の区間の計測を止める
+  */
+  template<>
+  class basic_scoped_phase_timer<true> {
+    using clock = std::chrono::steady_clock;
+
+    pp_phase m_phase;
+    clock::time_point m_resume;
+    basic_scoped_phase_timer* m_parent;
+
+  public:
+
+    explicit basic_scoped_phase_timer(pp_phase phase) noexcept
+      : m_phase{phase}
+      , m_resume{clock::now()}
+      , m_parent{std::exchange(detail::tls_active_phase_timer, this)}
+    {
+      if (m_parent != nullptr) {
+        detail::tls_phase_times.self_time[static_cast<std::size_t>(m_parent->m_phase)] += m_resume - m_parent->m_resume;
+      }
+      ++detail::tls_phase_times.calls[static_cast<std::size_t>(m_phase)];
+    }
+
+    ~basic_scoped_phase_timer() {
+      const auto now = clock::now();
+      detail::tls_phase_times.self_time[static_cast<std::size_t>(m_phase)] += now - m_resume;
+
+      detail::tls_active_phase_timer = m_parent;
+      if (m_parent != nullptr) {
+        m_parent->m_resume = now;
+      }
+    }
+
+    fn phase() const noexcept -> pp_phase {
+      return m_phase;
+    }
+
+    basic_scoped_phase_timer(const basic_scoped_phase_timer&) = delete;
+    basic_scoped_phase_timer& operator=(const basic_scoped_phase_timer&) = delete;
+  };
+
+  static_assert(std::is_empty_v<basic_scoped_phase_timer<false>>);
+
+  /**
+  * @brief このスレッドの計測結果を取得する
+  */
+  ifn current_phase_times() noexcept -> const phase_time_table& {
+    return detail::tls_phase_times;
+  }
+
+  /**
+  * @brief このスレッドの現在の処理段階を取得する
+  * @return どの段階の中でもない（もしくは追跡が無効）なら無効値
+  */
+  ifn current_phase() noexcept -> std::optional<pp_phase> {
+    if (auto* timer = detail::tls_active_phase_timer; timer != nullptr) return timer->phase();
+    return std::nullopt;
+  }
+
+  /**
+  * @brief このスレッドの計測結果を消去する、翻訳単位の処理の開始時に呼ぶ
+  */
+  inline void reset_phase_times() noexcept {
+    detail::tls_phase_times = phase_time_table{};
+  }
+
+  /**
+  * @brief 計測結果を表にする
+  * @param table 計測結果
+  * @param filename 翻訳単位のファイル名
+  * @return 出力する文字列
+  */
+  ifn format_phase_time_report(const phase_time_table& table, std::string_view filename) -> std::string {
+    const auto total = table.total();
+    const double total_ms = std::chrono::duration<double, std::milli>(total).count();
+
+    std::string report = "===-- kusabira phase time report: ";
+    report.append(filename).append(" --===\n");
+
+    char buf[128]{};
+    std::snprintf(buf, sizeof(buf), "  %-18s %12s %8s %12s\n", "phase", "self[ms]", "%", "calls");
+    report.append(buf);
+
+    for (std::size_t i = 0; i < pp_phase_count; ++i) {
+      const double ms = std::chrono::duration<double, std::milli>(table.self_time[i]).count();
+      const double ratio = total_ms <= 0.0 ? 0.0 : ms / total_ms * 100.0;
+      const auto name = phase_name(static_cast<pp_phase>(i));
+
+      std::snprintf(buf, sizeof(buf), "  %-18.*s %12.3f %7.1f%% %12llu\n", static_cast<int>(name.size()), name.data(), ms, ratio, static_cast<unsigned long long>(table.calls[i]));
+      report.append(buf);
+    }
+
+    std::snprintf(buf, sizeof(buf), "  %-18s %12.3f %7.1f%%\n", "total", total_ms, 100.0);
+    report.append(buf);
+
+    return report;
+  }
+
+} // namespace kusabira::PP
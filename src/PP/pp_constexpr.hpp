@@ -6,9 +6,12 @@
 #include <utility>
 #include <variant>
 #include <cctype>
+#include <array>
+#include <limits>
 
 #include "../common.hpp"
 #include "../report_output.hpp"
+#include "phase_timer.hpp"
 
 namespace kusabira::PP::inline free_func{
 
@@ -207,7 +210,14 @@ namespace kusabira::PP::inline free_func{
   }
 
 
-  ifn character_literal_to_integral(std::u8string_view input_str) -> std::pair<int, pp_parse_context> {
+  /**
+  * @brief 文字リテラルの値を求める
+  * @param input_str 文字リテラル全体（encoding-prefixを含む）
+  * @return {値, 結果}、結果は成功時空、マルチキャラクタリテラルの時PPConstexpr_MultiCharacter、それ以外はエラー
+  * @details 単純・8進・16進エスケープシーケンスとユニバーサル文字名をデコードする
+  * @details マルチキャラクタリテラルの値は最後の文字の値とする
+  */
+  ifn character_literal_to_integral(std::u8string_view input_str) -> std::pair<std::intmax_t, pp_parse_context> {
     // 事前条件
     assert(not empty(input_str));
     assert(input_str.back() == u8'\'');
@@ -215,91 +225,387 @@ namespace kusabira::PP::inline free_func{
     // 'の次の位置
     const auto start_pos = input_str.find_first_of(u8'\'') + 1;
     // 閉じの'は含めない
-    auto char_str = input_str.substr(start_pos, input_str.length() - start_pos - 1);
-    // encoding-prefixはソース文字集合から指定した実行時文字集合へ変換する指定なので無視でいい（？
-    //auto prefix_str = input_str.substr(0, start_pos - 1);
+    const auto char_str = input_str.substr(start_pos, input_str.length() - start_pos - 1);
+    // encoding-prefixが無ければ通常の文字リテラル、charは符号付きとして扱う
+    const bool is_ordinary = start_pos == 1;
 
     if (empty(char_str)) {
       // 空の文字リテラル、エラー
       return { -1, pp_parse_context::PPConstexpr_EmptyCharacter };
     }
-    
-    if (size(char_str) == 1) {
-      // 単純な文字リテラル
-      // UTF-8エンコーディングであり、その値を整数値として読み取り
-      return { static_cast<int>(char_str.front()), {} };
+
+    constexpr auto hex_digit = [](char8_t c) -> int {
+      if (u8'0' <= c and c <= u8'9') return c - u8'0';
+      if (u8'a' <= c and c <= u8'f') return c - u8'a' + 10;
+      if (u8'A' <= c and c <= u8'F') return c - u8'A' + 10;
+      return -1;
+    };
+
+    std::intmax_t value = 0;
+    std::size_t char_count = 0;
+    auto it = char_str.begin();
+    const auto last = char_str.end();
+
+    while (it != last) {
+      ++char_count;
+
+      if (*it != u8'\\') {
+        // エスケープされていない文字、UTF-8の1文字をコードポイントへ変換
+        const auto lead = static_cast<std::uint32_t>(*it++);
+        int trail = lead < 0x80 ? 0 : lead < 0xE0 ? 1 : lead < 0xF0 ? 2 : 3;
+        std::uint32_t cp = trail == 0 ? lead : lead & (0x3Fu >> trail);
+        for (; 0 < trail and it != last; --trail, ++it) {
+          cp = (cp << 6) | (static_cast<std::uint32_t>(*it) & 0x3Fu);
+        }
+        value = cp;
+        continue;
+      }
+
+      // バックスラッシュの次
+      if (++it == last) return { -1, pp_parse_context::PPConstexpr_Invalid };
+      const char8_t c = *it++;
+
+      switch (c) {
+      case u8'a': value = 7; break;
+      case u8'b': value = 8; break;
+      case u8't': value = 9; break;
+      case u8'n': value = 10; break;
+      case u8'v': value = 11; break;
+      case u8'f': value = 12; break;
+      case u8'r': value = 13; break;
+      case u8'x':
+      {
+        // 16進エスケープシーケンス、桁数に制限はない
+        if (it == last or hex_digit(*it) < 0) return { -1, pp_parse_context::PPConstexpr_Invalid };
+        std::uintmax_t num = 0;
+        for (; it != last and 0 <= hex_digit(*it); ++it) {
+          num = (num << 4) | static_cast<std::uintmax_t>(hex_digit(*it));
+          if (0xFFFFFFFFu < num) return { -1, pp_parse_context::PPConstexpr_OutOfRange };
+        }
+        // 通常の文字リテラルではcharの値として読む
+        value = (is_ordinary and num <= 0xFF) ? static_cast<signed char>(num) : static_cast<std::intmax_t>(num);
+        break;
+      }
+      case u8'u': [[fallthrough]];
+      case u8'U':
+      {
+        // ユニバーサル文字名、値はそのコードポイント
+        const int digits = c == u8'u' ? 4 : 8;
+        std::uint32_t cp = 0;
+        for (int i = 0; i < digits; ++i, ++it) {
+          if (it == last or hex_digit(*it) < 0) return { -1, pp_parse_context::PPConstexpr_Invalid };
+          cp = (cp << 4) | static_cast<std::uint32_t>(hex_digit(*it));
+        }
+        value = cp;
+        break;
+      }
+      default:
+        if (u8'0' <= c and c <= u8'7') {
+          // 8進エスケープシーケンス、最大3桁
+          std::uint32_t num = c - u8'0';
+          for (int i = 1; i < 3 and it != last and u8'0' <= *it and *it <= u8'7'; ++i, ++it) {
+            num = (num << 3) | static_cast<std::uint32_t>(*it - u8'0');
+          }
+          value = (is_ordinary and num <= 0xFF) ? static_cast<signed char>(num) : static_cast<std::intmax_t>(num);
+        } else {
+          // ' " ? \ と条件付きエスケープシーケンス、文字そのものの値とする
+          value = c;
+        }
+        break;
+      }
     }
 
-    constexpr auto npos = std::u8string_view::npos;
-    auto esc_pos = char_str.find_last_of('\\');
+    if (1 < char_count) {
+      return { value, pp_parse_context::PPConstexpr_MultiCharacter };
+    }
+    return { value, {} };
+  }
+}
+
+namespace kusabira::PP::detail {
+
+  /**
+  * @brief プリプロセス時の定数式に現れる演算子
+  */
+  enum class pp_operator : std::uint8_t {
+    // 単項演算子
+    unary_plus,
+    unary_minus,
+    bit_not,
+    logical_not,
+    // 二項演算子
+    mul,
+    div,
+    mod,
+    add,
+    sub,
+    lshift,
+    rshift,
+    less,
+    greater,
+    less_eq,
+    greater_eq,
+    equal,
+    not_equal,
+    bit_and,
+    bit_xor,
+    bit_or,
+    logical_and,
+    logical_or,
+    // 条件演算子、?を読んだ後:を読むとcolonに置き換える
+    question,
+    colon,
+    comma,
+    // 開き括弧、演算子スタックの番兵として使う
+    lparen,
+    // 演算子ではない
+    invalid
+  };
+
+  /**
+  * @brief 演算子の結合の強さ、大きいほど強く結合する
+  */
+  cfn precedence(pp_operator op) noexcept -> std::uint8_t {
+    switch (op) {
+    case pp_operator::unary_plus:  [[fallthrough]];
+    case pp_operator::unary_minus: [[fallthrough]];
+    case pp_operator::bit_not:     [[fallthrough]];
+    case pp_operator::logical_not: return 14;
+    case pp_operator::mul: [[fallthrough]];
+    case pp_operator::div: [[fallthrough]];
+    case pp_operator::mod: return 13;
+    case pp_operator::add: [[fallthrough]];
+    case pp_operator::sub: return 12;
+    case pp_operator::lshift: [[fallthrough]];
+    case pp_operator::rshift: return 11;
+    case pp_operator::less:       [[fallthrough]];
+    case pp_operator::greater:    [[fallthrough]];
+    case pp_operator::less_eq:    [[fallthrough]];
+    case pp_operator::greater_eq: return 10;
+    case pp_operator::equal:     [[fallthrough]];
+    case pp_operator::not_equal: return 9;
+    case pp_operator::bit_and: return 8;
+    case pp_operator::bit_xor: return 7;
+    case pp_operator::bit_or:  return 6;
+    case pp_operator::logical_and: return 5;
+    case pp_operator::logical_or:  return 4;
+    case pp_operator::question: [[fallthrough]];
+    case pp_operator::colon:    return 3;
+    case pp_operator::comma: return 2;
+    default: return 0;
+    }
+  }
 
-    if (esc_pos == npos) {
-      // エスケープシーケンスのないマルチキャラクタリテラル
-      return { static_cast<int>(char_str.back()), pp_parse_context::PPConstexpr_MultiCharacter };
+  /**
+  * @brief 前置の位置に現れた記号を単項演算子として読む
+  */
+  cfn to_unary_operator(std::u8string_view token) noexcept -> pp_operator {
+    if (token.length() != 1) return pp_operator::invalid;
+
+    switch (token.front()) {
+    case u8'+': return pp_operator::unary_plus;
+    case u8'-': return pp_operator::unary_minus;
+    case u8'~': return pp_operator::bit_not;
+    case u8'!': return pp_operator::logical_not;
+    case u8'(': return pp_operator::lparen;
+    default: return pp_operator::invalid;
     }
+  }
+
+  /**
+  * @brief オペランドの後に現れた記号を二項演算子として読む
+  * @details 閉じ括弧はここでは扱わない
+  */
+  cfn to_binary_operator(std::u8string_view token) noexcept -> pp_operator {
+    if (token.length() == 1) {
+      switch (token.front()) {
+      case u8'*': return pp_operator::mul;
+      case u8'/': return pp_operator::div;
+      case u8'%': return pp_operator::mod;
+      case u8'+': return pp_operator::add;
+      case u8'-': return pp_operator::sub;
+      case u8'<': return pp_operator::less;
+      case u8'>': return pp_operator::greater;
+      case u8'&': return pp_operator::bit_and;
+      case u8'^': return pp_operator::bit_xor;
+      case u8'|': return pp_operator::bit_or;
+      case u8'?': return pp_operator::question;
+      case u8':': return pp_operator::colon;
+      case u8',': return pp_operator::comma;
+      default: return pp_operator::invalid;
+      }
+    }
+    if (token.length() == 2) {
+      const char8_t c1 = token[0], c2 = token[1];
+
+      if (c1 == u8'<' and c2 == u8'<') return pp_operator::lshift;
+      if (c1 == u8'>' and c2 == u8'>') return pp_operator::rshift;
+      if (c1 == u8'<' and c2 == u8'=') return pp_operator::less_eq;
+      if (c1 == u8'>' and c2 == u8'=') return pp_operator::greater_eq;
+      if (c1 == u8'=' and c2 == u8'=') return pp_operator::equal;
+      if (c1 == u8'!' and c2 == u8'=') return pp_operator::not_equal;
+      if (c1 == u8'&' and c2 == u8'&') return pp_operator::logical_and;
+      if (c1 == u8'|' and c2 == u8'|') return pp_operator::logical_or;
+    }
+    return pp_operator::invalid;
+  }
+
+  /**
+  * @brief 代替トークンを演算子として読む
+  * @details 代替トークンは識別子として字句解析されているが、0に置換される識別子ではない
+  * @param is_prefix 前置の位置（オペランドが来るべき位置）に現れたか否か
+  * @return 代替トークンではない識別子の場合はnullopt
+  */
+  cfn alternative_operator(std::u8string_view token, bool is_prefix) noexcept -> std::optional<pp_operator> {
+    using namespace std::string_view_literals;
+
+    if (token == u8"not"sv)    return is_prefix ? pp_operator::logical_not : pp_operator::invalid;
+    if (token == u8"compl"sv)  return is_prefix ? pp_operator::bit_not : pp_operator::invalid;
+    if (token == u8"and"sv)    return is_prefix ? pp_operator::invalid : pp_operator::logical_and;
+    if (token == u8"or"sv)     return is_prefix ? pp_operator::invalid : pp_operator::logical_or;
+    if (token == u8"bitand"sv) return is_prefix ? pp_operator::invalid : pp_operator::bit_and;
+    if (token == u8"bitor"sv)  return is_prefix ? pp_operator::invalid : pp_operator::bit_or;
+    if (token == u8"xor"sv)    return is_prefix ? pp_operator::invalid : pp_operator::bit_xor;
+    if (token == u8"not_eq"sv) return is_prefix ? pp_operator::invalid : pp_operator::not_equal;
+    // 代入演算子の代替トークンは定数式に現れてはならない
+    if (token == u8"and_eq"sv or token == u8"or_eq"sv or token == u8"xor_eq"sv) return pp_operator::invalid;
+
+    return std::nullopt;
+  }
+
+  /**
+  * @brief 定数式の値
+  * @details intmax_t/uintmax_tのどちらとして扱うかを保持し、値は2の補数表現のビット列として持つ
+  */
+  struct pp_value {
+    std::uintmax_t bits;
+    bool is_unsigned;
+
+    sfn from_signed(std::intmax_t n) noexcept -> pp_value {
+      return { static_cast<std::uintmax_t>(n), false };
+    }
+
+    sfn from_bool(bool b) noexcept -> pp_value {
+      return { std::uintmax_t(b), false };
+    }
+
+    fn as_signed() const noexcept -> std::intmax_t {
+      return static_cast<std::intmax_t>(bits);
+    }
+
+    fn is_negative() const noexcept -> bool {
+      return not is_unsigned and as_signed() < 0;
+    }
+  };
+
+  /**
+  * @brief 単項演算子を適用する
+  */
+  ifn apply_unary(pp_operator op, pp_value v) noexcept -> pp_value {
+    switch (op) {
+    case pp_operator::unary_minus: return { std::uintmax_t(0) - v.bits, v.is_unsigned };
+    case pp_operator::bit_not:     return { ~v.bits, v.is_unsigned };
+    case pp_operator::logical_not: return pp_value::from_bool(v.bits == 0);
+    default:                       return v;
+    }
+  }
+
+  /**
+  * @brief シフト演算を適用する
+  * @details 結果の型は左辺の型、負のシフト量は逆方向へのシフトとし、ビット幅以上のシフトは全てのビットを押し出す
+  */
+  ifn apply_shift(bool is_left, pp_value lhs, pp_value rhs) noexcept -> pp_value {
+    constexpr std::uintmax_t width = std::numeric_limits<std::uintmax_t>::digits;
 
-    // ここでは、エスケープシーケンスを含んだマルチキャラクタリテラル、か1つのエスケープシーケンス、かのどちらか
-    // 一番最後に現れるバックスラッシュを探索し、その位置からエスケープシーケンスの読み取りを試みる
-    // 1. 読み終わり、文字の残りもなければそのエスケープシーケンスをデコードして終わり
-    // 2. 途中でエスケープシーケンスが終わりなお文字が残っていたら（それは1文字のはず）、その1文字をデコードする
-    // 1の場合にエスケープシーケンスの位置が先頭でないならマルチキャラクタリテラル
-    // 2の場合は常にマルチキャラクタリテラル
+    std::uintmax_t count = rhs.bits;
+    if (rhs.is_negative()) {
+      is_left = not is_left;
+      count = std::uintmax_t(0) - rhs.bits;
+    }
 
-    if (char_str[esc_pos - 1] == u8'\\') {
-      // バックスラッシュのエスケープを拾う
-      esc_pos -= 1;
+    if (is_left) {
+      return { width <= count ? 0 : lhs.bits << count, lhs.is_unsigned };
     }
-    auto esc_char = char_str.substr(esc_pos + 1);
-
-    if (size(esc_char) == 1) {
-      // エスケープシーケンスが1文字しかないなら普通のやつ
-      // 8進エスケープシーケンス、あるいは単純エスケープシーケンス
-      // 条件付きエスケープシーケンスもここ
-      const auto c = esc_char.front();
-
-      if (u8'0' <= c and c <= u8'7') {
-        // 1桁の8進エスケープシーケンス
-        // 0~7の数値に変換
-        int num = c - u8'0';
-        return {num, {}};
+    if (lhs.is_unsigned) {
+      return { width <= count ? 0 : lhs.bits >> count, true };
+    }
+    // 符号付き整数の右シフトは算術シフト
+    return pp_value::from_signed(lhs.as_signed() >> (width <= count ? width - 1 : count));
+  }
+
+  /**
+  * @brief 二項演算子を適用する
+  * @details 通常の算術変換によって、どちらかが符号なしなら符号なし整数として演算する
+  * @details 符号付き整数のオーバーフローはラップアラウンドする
+  * @param division_by_zero ゼロ除算が起きたらtrueにする
+  */
+  ifn apply_binary(pp_operator op, pp_value lhs, pp_value rhs, bool& division_by_zero) noexcept -> pp_value {
+    const bool is_unsigned = lhs.is_unsigned or rhs.is_unsigned;
+
+    switch (op) {
+    case pp_operator::mul: return { lhs.bits * rhs.bits, is_unsigned };
+    case pp_operator::add: return { lhs.bits + rhs.bits, is_unsigned };
+    case pp_operator::sub: return { lhs.bits - rhs.bits, is_unsigned };
+    case pp_operator::div: [[fallthrough]];
+    case pp_operator::mod:
+    {
+      if (rhs.bits == 0) {
+        division_by_zero = true;
+        return { 0, is_unsigned };
       }
+      const bool is_div = op == pp_operator::div;
 
-      switch (c) {
-      case u8'\a':
-        return {7, {}};
-      case u8'\b':
-        return {8, {}};
-      case u8'\t':
-        return {9, {}};
-      case u8'\n':
-        return {10, {}};
-      case u8'\v':
-        return {11, {}};
-      case u8'\f':
-        return {12, {}};
-      case u8'\r':
-        return {13, {}};
-      case u8'\'': [[fallthrough]];
-      case u8'\"': [[fallthrough]];
-      case u8'\?': [[fallthrough]];
-      case u8'\\': [[fallthrough]];
-      default:
-        // 条件付きエスケープシーケンス
-        return {static_cast<int>(c), {}};
+      if (is_unsigned) {
+        return { is_div ? lhs.bits / rhs.bits : lhs.bits % rhs.bits, true };
       }
+      // INTMAX_MIN / -1 はオーバーフローする
+      if (lhs.as_signed() == std::numeric_limits<std::intmax_t>::min() and rhs.as_signed() == -1) {
+        return { is_div ? lhs.bits : 0, false };
+      }
+      return pp_value::from_signed(is_div ? lhs.as_signed() / rhs.as_signed() : lhs.as_signed() % rhs.as_signed());
     }
-    // 2文字以上あるなら、16進エスケープシーケンスか8進エスケープシーケンス
-    // もしくはエスケープシーケンスの後に何か文字があるケース
-    if (esc_char.front() == u8'x') {
-      // 16進エスケープシーケンス
-    } else {
-      // 2~3桁の8進エスケープシーケンス
-      
+    case pp_operator::lshift: return apply_shift(true, lhs, rhs);
+    case pp_operator::rshift: return apply_shift(false, lhs, rhs);
+    case pp_operator::less:       return pp_value::from_bool(is_unsigned ? lhs.bits < rhs.bits : lhs.as_signed() < rhs.as_signed());
+    case pp_operator::greater:    return pp_value::from_bool(is_unsigned ? lhs.bits > rhs.bits : lhs.as_signed() > rhs.as_signed());
+    case pp_operator::less_eq:    return pp_value::from_bool(is_unsigned ? lhs.bits <= rhs.bits : lhs.as_signed() <= rhs.as_signed());
+    case pp_operator::greater_eq: return pp_value::from_bool(is_unsigned ? lhs.bits >= rhs.bits : lhs.as_signed() >= rhs.as_signed());
+    case pp_operator::equal:     return pp_value::from_bool(lhs.bits == rhs.bits);
+    case pp_operator::not_equal: return pp_value::from_bool(lhs.bits != rhs.bits);
+    case pp_operator::bit_and: return { lhs.bits & rhs.bits, is_unsigned };
+    case pp_operator::bit_xor: return { lhs.bits ^ rhs.bits, is_unsigned };
+    case pp_operator::bit_or:  return { lhs.bits | rhs.bits, is_unsigned };
+    case pp_operator::logical_and: return pp_value::from_bool(lhs.bits != 0 and rhs.bits != 0);
+    case pp_operator::logical_or:  return pp_value::from_bool(lhs.bits != 0 or rhs.bits != 0);
+    case pp_operator::comma: return rhs;
+    default: return rhs;
     }
-
-    // エスケープシーケンスの後に何か文字があった
-    return {static_cast<int>(esc_char.back()), {}};
   }
+
+  /**
+  * @brief 演算子スタックの要素
+  */
+  struct pp_operator_entry {
+    // 演算子のトークン（エラー報告用）
+    const pp_token* token;
+    pp_operator op;
+    // この演算子を読む前の評価状態、&& || ?: の短絡評価から戻る時に復元する
+    bool outer_evaluated;
+  };
+
+  /**
+  * @brief 定数式の入れ子の深さの上限、演算子と値のスタックはこの長さの配列で確保する
+  */
+  inline constexpr std::size_t max_nest_depth = 256;
+
+  /**
+  * @brief defined演算子の既定の判定、どの識別子もマクロではないとする
+  */
+  struct no_macro_defined {
+    cfn operator()(std::u8string_view) const noexcept -> bool {
+      return false;
+    }
+  };
 }
 
 namespace kusabira::PP {
@@ -310,128 +616,375 @@ namespace kusabira::PP {
   /**
   * @brief プリプロセッシングディレクティブの実行に必要な程度の定数式を処理する
   * @details C++の意味論で解釈される構文は考慮しなくて良い
-  * @details トークンの消費責任は常に呼び出し側にある
-  * @details 内部で再帰的にパース処理を呼び出すときは消費してから呼び出す
-  * @details 一方、処理を終えて戻るときは消費しきらずに戻る
+  * @details マクロ展開済みのトークン列を先頭から1度だけ走査し、値と演算子の2つのスタックによる優先順位法で評価する
+  * @details 再帰せず、スタックは固定長配列なので評価中に動的確保は行わない
+  * @details 符号付整数はintmax_t、符号なし整数はuintmax_tとして扱い、識別子（true/false、代替トークンを除く）は0に置換する
+  * @tparam Reporter エラー出力先の型
+  * @tparam DefinedPred defined演算子の判定に使う、識別子を受け取りマクロとして定義されているかを返す関数オブジェクトの型
   */
-  template<typename Reporter>
+  template<typename Reporter, typename DefinedPred = detail::no_macro_defined>
   struct pp_constexpr {
 
     const Reporter& reporter;
     const fs::path& filename;
+    [[no_unique_address]] DefinedPred is_defined{};
 
     void err_report(const PP::pp_token& token, pp_parse_context context) const {
       this->reporter.pp_err_report(this->filename, token, context);
     }
 
-    template<std::bidirectional_iterator I>
-    auto reach_end(I it) const {
-      --it;
-      this->err_report(*it, pp_parse_context::PPConstexpr_Invalid);
-      return kusabira::error(false);
-    }
-
-    template<std::ranges::bidirectional_range Tokens>
-      requires std::same_as<std::iter_value_t<std::ranges::iterator_t<Tokens>>, pp_token>
+    template<std::ranges::forward_range Tokens>
+      requires std::same_as<std::ranges::range_value_t<Tokens>, pp_token>
     fn operator()(const Tokens& token_list) const -> std::optional<bool> {
       // 事前条件、空でないこと
-      assert(not empty(token_list));
-
-      auto it = std::ranges::begin(token_list);
-      auto last = std::ranges::end(token_list);
+      assert(not std::ranges::empty(token_list));
 
-      auto succeed = this->conditional_expression(it, last);
+      auto succeed = this->evaluate(token_list);
 
       // エラー報告は済んでいるものとする
       if (not succeed) return std::nullopt;
 
-      // 全部消費してるよね？
-      ++it;
-      assert(it == last);
-
       // 0 == false, それ以外 == true
       return std::visit([](std::integral auto n) -> bool { return n != 0; }, *std::move(succeed));
     }
 
-    template<std::bidirectional_iterator I, std::sentinel_for<I> S>
-    fn conditional_expression(I& it, S last) const -> pp_constexpr_result {
-      return this->primary_expressions(it, last);
-    }
+    /**
+    * @brief 定数式を評価する
+    * @param token_list 定数式を構成するプリプロセッシングトークン列（マクロ展開済み）
+    * @return {評価結果の値 | false（エラーは報告済み）}
+    */
+    template<std::ranges::forward_range Tokens>
+      requires std::same_as<std::ranges::range_value_t<Tokens>, pp_token>
+    fn evaluate(const Tokens& token_list) const -> pp_constexpr_result {
+      using namespace std::string_view_literals;
+      using detail::pp_operator;
+      using detail::pp_value;
+      [[maybe_unused]] scoped_phase_timer timer{pp_phase::if_evaluate};
+
+      // 値と演算子のスタック
+      std::array<pp_value, detail::max_nest_depth> values;
+      std::array<detail::pp_operator_entry, detail::max_nest_depth> ops;
+      std::size_t value_num = 0;
+      std::size_t op_num = 0;
+
+      // 短絡評価で評価されない部分式を読んでいる間はfalse
+      bool evaluated = true;
+      // 次に読むべきものがオペランドか否か
+      bool expect_operand = true;
+      // 開き括弧の入れ子数
+      std::size_t paren_depth = 0;
+      // 最後に読んだトークン
+      const pp_token* current = nullptr;
+
+      auto invalid = [this](const pp_token& token, pp_parse_context context = pp_parse_context::PPConstexpr_Invalid) {
+        this->err_report(token, context);
+        return kusabira::error(false);
+      };
+
+      // スタックトップの演算子を適用する
+      auto reduce = [&]() -> bool {
+        const auto entry = ops[--op_num];
+
+        switch (entry.op) {
+        case pp_operator::unary_plus:  [[fallthrough]];
+        case pp_operator::unary_minus: [[fallthrough]];
+        case pp_operator::bit_not:     [[fallthrough]];
+        case pp_operator::logical_not:
+          values[value_num - 1] = detail::apply_unary(entry.op, values[value_num - 1]);
+          return true;
+        case pp_operator::colon:
+        {
+          // [条件, 真の値, 偽の値]、2つの値は通常の算術変換を受ける
+          const auto false_val = values[--value_num];
+          const auto true_val = values[--value_num];
+          const bool is_unsigned = true_val.is_unsigned or false_val.is_unsigned;
+          auto& cond = values[value_num - 1];
+          cond = { cond.bits != 0 ? true_val.bits : false_val.bits, is_unsigned };
+          evaluated = entry.outer_evaluated;
+          return true;
+        }
+        case pp_operator::question:
+          // :が現れなかった
+          this->err_report(*entry.token, pp_parse_context::PPConstexpr_Invalid);
+          return false;
+        case pp_operator::lparen:
+          // 閉じ括弧が現れなかった
+          this->err_report(*current, pp_parse_context::PPConstexpr_MissingCloseParent);
+          return false;
+        default:
+        {
+          const auto rhs = values[--value_num];
+          auto& lhs = values[value_num - 1];
+          bool division_by_zero = false;
+          lhs = detail::apply_binary(entry.op, lhs, rhs, division_by_zero);
+
+          if (entry.op == pp_operator::logical_and or entry.op == pp_operator::logical_or) {
+            evaluated = entry.outer_evaluated;
+          } else if (division_by_zero and evaluated) {
+            // 評価されない部分式でのゼロ除算はエラーではない
+            this->err_report(*entry.token, pp_parse_context::PPConstexpr_DivideByZero);
+            return false;
+          }
+          return true;
+        }
+        }
+      };
 
-    
-    
-    template<std::bidirectional_iterator I, std::sentinel_for<I> S>
-    fn primary_expressions(I& it, S last) const -> pp_constexpr_result {
-      // 考慮すべきはliteralと(conditional-expression)の2種類
+      // 演算子を積む、入れ子が深すぎる場合はエラー
+      auto push_op = [&](const pp_token& token, pp_operator op) -> bool {
+        if (op_num == ops.size()) {
+          this->err_report(token, pp_parse_context::PPConstexpr_NestTooDeep);
+          return false;
+        }
+        ops[op_num++] = { &token, op, evaluated };
+        return true;
+      };
+
+      auto push_value = [&](const pp_token& token, pp_value v) -> bool {
+        if (value_num == values.size()) {
+          this->err_report(token, pp_parse_context::PPConstexpr_NestTooDeep);
+          return false;
+        }
+        values[value_num++] = v;
+        expect_operand = false;
+        return true;
+      };
+
+      // 二項演算子を読んだ時、それより強く結合する演算子を適用してから積む
+      auto binary_op = [&](const pp_token& token, pp_operator op) -> bool {
+        const auto prec = detail::precedence(op);
+        // 条件演算子は右結合、それ以外は左結合
+        const bool is_right_assoc = op == pp_operator::question;
+
+        // ?と:の間は括弧の中と同じく1つの完全な式
+        while (0 < op_num and ops[op_num - 1].op != pp_operator::lparen and ops[op_num - 1].op != pp_operator::question) {
+          const auto top_prec = detail::precedence(ops[op_num - 1].op);
+          if (top_prec < prec or (top_prec == prec and is_right_assoc)) break;
+          if (not reduce()) return false;
+        }
 
-      if (it == last) {
-        return this->reach_end(it);
-      }
+        if (not push_op(token, op)) return false;
+        expect_operand = true;
 
-      const auto token_cat = deref(it).category;
-
-      // 整数型と文字型を考慮
-      if (token_cat == pp_token_category::pp_number) {
-        // pp_numberの読み取り
-        // 整数値のみがwell-formed、浮動小数点数値はエラー
-        auto val = decode_integral_ppnumber(deref(it).token);
-
-        return std::visit<pp_constexpr_result>(overloaded{
-                                                   []<std::integral Int>(Int n) {
-                                                     return kusabira::ok(std::variant<std::intmax_t, std::uintmax_t>{std::in_place_type<Int>, n});
-                                                   },
-                                                   [this, &it](pp_parse_context err_context) {
-                                                     this->err_report(*it, err_context);
-                                                     return kusabira::error(false);
-                                                   }},
-                                               std::move(val));
-      } else if (token_cat == pp_token_category::charcter_literal) {
-        auto token_str = deref(it).token.to_view();
-
-        if (auto len = size(token_str); len < 3) {
-          // 空の文字リテラル、エラー
-          this->err_report(*it, pp_parse_context::PPConstexpr_EmptyCharacter);
-          return kusabira::error(false);
-        } else if (3 < len) {
-          // マルチキャラクタリテラルに関する警告を表示、エラーにはしない?
-          this->reporter.pp_err_report(this->filename, *it, pp_parse_context::PPConstexpr_MultiCharacter, report::report_category::warning);
+        // 左辺の値によって右辺が評価されるかが決まる
+        const bool lhs_is_true = values[value_num - 1].bits != 0;
+        if (op == pp_operator::logical_and or op == pp_operator::question) {
+          evaluated = evaluated and lhs_is_true;
+        } else if (op == pp_operator::logical_or) {
+          evaluated = evaluated and not lhs_is_true;
+        }
+        return true;
+      };
+
+      const auto last = std::ranges::end(token_list);
+
+      for (auto it = std::ranges::begin(token_list); it != last; ++it) {
+        const pp_token& token = *it;
+        current = &token;
+
+        // ホワイトスペースは無視
+        if (token.category <= pp_token_category::block_comment) continue;
+
+        const auto token_str = token.token.to_view();
+
+        if (expect_operand) {
+          // オペランドか前置演算子が来る
+          switch (token.category) {
+          case pp_token_category::pp_number:
+          {
+            // 整数値のみがwell-formed、浮動小数点数値はエラー
+            const auto val = decode_integral_ppnumber(token_str);
+
+            if (auto* err_context = std::get_if<pp_parse_context>(&val); err_context != nullptr) {
+              return invalid(token, *err_context);
+            }
+            const auto v = std::holds_alternative<std::uintmax_t>(val) ? pp_value{std::get<std::uintmax_t>(val), true} : pp_value::from_signed(std::get<std::intmax_t>(val));
+            if (not push_value(token, v)) return kusabira::error(false);
+            continue;
+          }
+          case pp_token_category::charcter_literal:
+          {
+            auto v = this->character_value(token);
+            if (not v) return kusabira::error(false);
+            if (not push_value(token, *v)) return kusabira::error(false);
+            continue;
+          }
+          case pp_token_category::identifier: [[fallthrough]];
+          case pp_token_category::not_macro_name_identifier:
+          {
+            if (token_str == u8"defined"sv) {
+              auto v = this->defined_operator(it, last);
+              if (not v) return kusabira::error(false);
+              if (not push_value(token, *v)) return kusabira::error(false);
+              continue;
+            }
+            if (token_str == u8"true"sv or token_str == u8"false"sv) {
+              if (not push_value(token, pp_value::from_bool(token_str == u8"true"sv))) return kusabira::error(false);
+              continue;
+            }
+            if (auto alt_op = detail::alternative_operator(token_str, true); alt_op) {
+              if (*alt_op == pp_operator::invalid) return invalid(token);
+              if (not push_op(token, *alt_op)) return kusabira::error(false);
+              continue;
+            }
+            // 残った識別子は0に置換される
+            if (not push_value(token, pp_value::from_signed(0))) return kusabira::error(false);
+            continue;
+          }
+          case pp_token_category::op_or_punc:
+          {
+            const auto op = detail::to_unary_operator(token_str);
+            if (op == pp_operator::invalid) return invalid(token);
+            if (not push_op(token, op)) return kusabira::error(false);
+            if (op == pp_operator::lparen) ++paren_depth;
+            continue;
+          }
+          default:
+            return invalid(token);
+          }
         }
 
-        // マルチキャラクタリテラル対応のために、最後の文字を取り出す
-        // ToDo:エスケープシーケンス考慮が必要
-        char8_t c = *std::ranges::prev(token_str.end(), 2);
+        // 二項演算子か閉じ括弧が来る
+        auto op = pp_operator::invalid;
+
+        if (token.category == pp_token_category::identifier or token.category == pp_token_category::not_macro_name_identifier) {
+          op = detail::alternative_operator(token_str, false).value_or(pp_operator::invalid);
+        } else if (token.category == pp_token_category::op_or_punc) {
+          if (token_str == u8")"sv) {
+            // 対応する開き括弧までを適用する
+            while (0 < op_num and ops[op_num - 1].op != pp_operator::lparen) {
+              if (not reduce()) return kusabira::error(false);
+            }
+            if (op_num == 0) return invalid(token);
+            --op_num;
+            --paren_depth;
+            continue;
+          }
+          op = detail::to_binary_operator(token_str);
+        }
 
-        return kusabira::ok(std::variant<std::intmax_t, std::uintmax_t>{std::in_place_index<0>, static_cast<int>(c)});
+        switch (op) {
+        case pp_operator::invalid:
+          return invalid(token);
+        case pp_operator::colon:
+        {
+          // 対応する?までを適用する
+          while (0 < op_num and ops[op_num - 1].op != pp_operator::question and ops[op_num - 1].op != pp_operator::lparen) {
+            if (not reduce()) return kusabira::error(false);
+          }
+          if (op_num == 0 or ops[op_num - 1].op != pp_operator::question) return invalid(token);
+
+          auto& entry = ops[op_num - 1];
+          entry.op = pp_operator::colon;
+          // 条件が偽の場合のみ:の後ろが評価される
+          evaluated = entry.outer_evaluated and values[value_num - 2].bits == 0;
+          expect_operand = true;
+          continue;
+        }
+        case pp_operator::comma:
+          // 括弧の中か?と:の間でなければ、カンマ演算子は条件式の構文に含まれない
+          if (paren_depth == 0 and std::none_of(ops.begin(), ops.begin() + op_num, [](const auto& entry) { return entry.op == pp_operator::question; })) {
+            return invalid(token);
+          }
+          [[fallthrough]];
+        default:
+          if (not binary_op(token, op)) return kusabira::error(false);
+        }
       }
 
-      // ()に囲まれた式
-      else if (token_cat == pp_token_category::op_or_punc and deref(it).token == u8"(") {
-        
-        // "("を消費してから、中身を読みに行く
-        ++it;
-        auto succeed = this->conditional_expression(it, last);
+      // 式が途中で終わっている
+      if (expect_operand) {
+        assert(current != nullptr);
+        return invalid(*current);
+      }
 
-        if (not succeed) return kusabira::error(false);
+      // 残りの演算子を全て適用
+      while (0 < op_num) {
+        if (not reduce()) return kusabira::error(false);
+      }
 
-        ++it;
+      assert(value_num == 1);
 
-        // 対応する閉じ括弧が出現していない
-        if (it == last or deref(it).token != u8")") {
-          if (it == last) --it;
+      if (values[0].is_unsigned) {
+        return kusabira::ok(std::variant<std::intmax_t, std::uintmax_t>{std::in_place_index<1>, values[0].bits});
+      }
+      return kusabira::ok(std::variant<std::intmax_t, std::uintmax_t>{std::in_place_index<0>, values[0].as_signed()});
+    }
 
-          this->err_report(*it, pp_parse_context::PPConstexpr_MissingCloseParent);
-          return kusabira::error(false);
+  private:
+
+    /**
+    * @brief 文字リテラルの値を求める
+    */
+    fn character_value(const pp_token& token) const -> std::optional<detail::pp_value> {
+      const auto [value, context] = character_literal_to_integral(token.token.to_view());
+
+      if (context == pp_parse_context::PPConstexpr_MultiCharacter) {
+        // マルチキャラクタリテラルに関する警告を表示、エラーにはしない
+        this->reporter.pp_err_report(this->filename, token, context, report::report_category::warning);
+      } else if (context != pp_parse_context{}) {
+        this->err_report(token, context);
+        return std::nullopt;
+      }
+
+      return detail::pp_value::from_signed(value);
+    }
+
+    /**
+    * @brief defined演算子を処理する
+    * @details defined identifier もしくは defined ( identifier ) の形をとる
+    * @param it definedを指すイテレータ、オペランドの最後のトークンを指して戻る
+    */
+    template<std::forward_iterator I, std::sentinel_for<I> S>
+    fn defined_operator(I& it, S last) const -> std::optional<detail::pp_value> {
+      using namespace std::string_view_literals;
+
+      const pp_token* prev = &*it;
+
+      // 次の非ホワイトスペーストークンへ進める
+      auto next = [&]() -> bool {
+        do {
+          ++it;
+        } while (it != last and deref(it).category <= pp_token_category::block_comment);
+
+        if (it == last) {
+          this->err_report(*prev, pp_parse_context::PPConstexpr_Invalid);
+          return false;
         }
+        prev = &*it;
+        return true;
+      };
+
+      auto is_identifier = [](const pp_token& token) {
+        return token.category == pp_token_category::identifier or token.category == pp_token_category::not_macro_name_identifier;
+      };
+
+      if (not next()) return std::nullopt;
 
-        return kusabira::ok(std::move(succeed));
+      const bool has_paren = deref(it).category == pp_token_category::op_or_punc and deref(it).token == u8"("sv;
+      if (has_paren and not next()) return std::nullopt;
+
+      if (not is_identifier(*it)) {
+        this->err_report(*it, pp_parse_context::PPConstexpr_Invalid);
+        return std::nullopt;
       }
+      const bool found = this->is_defined(deref(it).token.to_view());
 
-      // それ以外の出現はエラー
-      this->err_report(*it, pp_parse_context::PPConstexpr_Invalid);
-      return kusabira::error(false);
+      if (has_paren) {
+        if (not next()) return std::nullopt;
+        if (deref(it).category != pp_token_category::op_or_punc or deref(it).token != u8")"sv) {
+          this->err_report(*it, pp_parse_context::PPConstexpr_MissingCloseParent);
+          return std::nullopt;
+        }
+      }
+
+      return detail::pp_value::from_bool(found);
     }
   };
 
   template<typename R, typename P>
   pp_constexpr(R&, P&&) -> pp_constexpr<R>;
-}
\ No newline at end of file
+
+  template<typename R, typename P, typename D>
+  pp_constexpr(R&, P&&, D) -> pp_constexpr<R, D>;
+}
@@ -102,9 +102,30 @@ namespace kusabira::PP {
       , m_macro_manager{ filename }
     {}
 
+    pp_directive_manager(const fs::path& filename, std::shared_ptr<const macro_environment> base)
+      : m_filename{filename}
+      , m_macro_manager{ filename, std::move(base) }
+    {}
+
+    pp_directive_manager(const fs::path& filename, const macro_snapshot& snapshot)
+      : m_filename{filename}
+      , m_macro_manager{ filename, snapshot }
+    {}
+
     void newline() {
     }
 
+    /**
+    * @brief 処理中のソースファイルを切り替える
+    * @details インクルードしたヘッダの処理の開始と終了で使用する、診断メッセージのファイル名と__FILE__、#lineの状態が切り替わる
+    * @param state 切り替え先のファイルの状態
+    * @return 切り替える前のファイルの状態
+    */
+    fn switch_source_file(macro_manager::source_file_state state) -> macro_manager::source_file_state {
+      m_filename = state.filename;
+      return m_macro_manager.switch_source_file(std::move(state));
+    }
+
     template<typename TokensIterator, typename TokensSentinel>
     fn include(TokensIterator& it, TokensSentinel end) -> std::pmr::list<pp_token> {
       //未実装
@@ -144,11 +165,11 @@ namespace kusabira::PP {
     }
 
     template<typename Reporter>
-    fn expand_funcmacro(Reporter& reporter, const pp_token& macro_name, const std::pmr::vector<std::pmr::list<pp_token>>& args) const -> std::tuple<bool, bool, std::pmr::list<pp_token>, std::pmr::unordered_set<std::u8string_view>> {
+    fn expand_funcmacro(Reporter& reporter, const pp_token& macro_name, const macro_args& args) const -> std::tuple<bool, bool, std::pmr::list<pp_token>, std::pmr::unordered_set<std::u8string_view>> {
       return m_macro_manager.funcmacro<false>(reporter, macro_name, args);
     }
     template<typename Reporter>
-    fn expand_funcmacro(Reporter& reporter, const pp_token& macro_name, const std::pmr::vector<std::pmr::list<pp_token>>& args, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
+    fn expand_funcmacro(Reporter& reporter, const pp_token& macro_name, const macro_args& args, std::pmr::unordered_set<std::u8string_view>& outer_macro) const -> std::tuple<bool, bool, std::pmr::list<pp_token>> {
       return m_macro_manager.funcmacro<false>(reporter, macro_name, args, outer_macro);
     }
 
@@ -161,6 +182,15 @@ namespace kusabira::PP {
       return m_macro_manager.is_macro(id_str);
     }
 
+    /**
+    * @brief 識別子がマクロとして定義されているかを調べる
+    * @param id_str 識別子の文字列
+    * @return マクロとして定義されていればtrue
+    */
+    fn is_defined(std::u8string_view id_str) const -> bool {
+      return m_macro_manager.is_defined(id_str);
+    }
+
     /**
     * @brief #undefディレクティブを実行する
     */
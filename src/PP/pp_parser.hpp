@@ -7,6 +7,7 @@
 #include <cassert>
 #include <algorithm>
 #include <ranges>
+#include <functional>
 
 #include "../common.hpp"
 #include "file_reader.hpp"
@@ -14,6 +15,13 @@
 #include "pp_tokenizer.hpp"
 #include "pp_directive_manager.hpp"
 #include "pp_constexpr.hpp"
+#include "if_condition_memo.hpp"
+#include "header_cache.hpp"
+#include "dependency_scan.hpp"
+#include "minimized_source.hpp"
+#include "time_trace.hpp"
+#include "include_tree.hpp"
+#include "include_usage.hpp"
 #include "vocabulary/scope.hpp"
 #include "vocabulary/concat.hpp"
 
@@ -113,14 +121,52 @@ namespace kusabira::PP {
     using pptoken_t = std::iter_value_t<iterator>;
     using pptoken_list_t = std::pmr::list<pptoken_t>;
     using reporter = typename ReporterFactory::reporter_t;
+    // インクルードするヘッダを読むトークナイザ
+    using header_tokenizer = kusabira::PP::tokenizer<kusabira::PP::filereader, kusabira::PP::pp_tokenizer_sm>;
+    // 依存関係の走査時に、縮小したヘッダを読むトークナイザ
+    using minimized_tokenizer = kusabira::PP::tokenizer<kusabira::PP::minimized_reader, kusabira::PP::pp_tokenizer_sm>;
 
   private:
 
     Tokenizer m_tokenizer;
     pp_directive_manager m_preprocessor;
     fs::path m_filename;
+    report::report_lang m_lang;
     reporter m_reporter;
     pptoken_list_t m_pptoken_list{&kusabira::def_mr};
+    // #if/#elifの評価結果のメモ、nullptrならメモ化しない
+    std::shared_ptr<if_condition_memo> m_if_memo = std::make_shared<if_condition_memo>();
+    // メモ上でのこのファイルのID
+    std::uint32_t m_file_id = m_if_memo->file_id(m_filename);
+    // ヘッダの処理結果のキャッシュ、nullptrならキャッシュしない
+    std::shared_ptr<header_cache> m_header_cache = nullptr;
+    // 出力とマクロ定義のトークンが参照している、インクルードしたヘッダの行を保持するもの
+    std::pmr::vector<std::shared_ptr<const void>> m_sources{ &kusabira::def_mr };
+    // インクルードするファイルの探索設定
+    std::shared_ptr<const include_options> m_include_options = std::make_shared<include_options>();
+    // インクルードの入れ子の深さ、翻訳単位のファイルは0
+    std::size_t m_include_depth = 0;
+    // 依存関係の走査のみを行うか否か、trueならテキスト行を読み飛ばし出力を生成しない
+    bool m_scan_only = false;
+    // このファイルの依存関係
+    dependency_info m_dependencies{ .source = m_filename };
+    // 依存関係の走査時に使用する縮小したソースのキャッシュ、nullptrなら元のファイルを読む
+    std::shared_ptr<minimized_source_cache> m_minimized_cache = nullptr;
+    // 依存関係を宣言する部分を読み終えた時に呼ばれる関数、falseを返すとそこで処理を止める
+    std::function<bool(const dependency_info&)> m_preamble_handler{};
+    // 依存関係を宣言する部分（最初のテキスト行まで）を読んでいるか否か
+    bool m_in_preamble = true;
+    // 依存関係を宣言する部分だけを読んで止めたか否か
+    bool m_preamble_stopped = false;
+    // インクルードの木でのこのファイルのノード、nullptrなら記録しない
+    include_node* m_include_node = nullptr;
+    // 処理した行数と、無効なグループとして読み飛ばした行数
+    std::uint64_t m_line_count = 0;
+    std::uint64_t m_skipped_line_count = 0;
+    // 無効なグループの入れ子の深さ
+    std::size_t m_false_group_depth = 0;
+    // #include毎の寄与を記録するもの、nullptrなら記録しない
+    include_usage_tracker* m_include_usage = nullptr;
 
   public:
 
@@ -134,17 +180,339 @@ namespace kusabira::PP {
       : m_tokenizer{std::move(tokenizer)}
       , m_preprocessor{filepath}
       , m_filename{std::move(filepath)}
+      , m_lang{lang}
       , m_reporter(ReporterFactory::create(lang))
     {}
 
+    /**
+    * @brief 定義済みのマクロ環境を共有して構築する
+    * @param tokenizer トークナイザー実装オブジェクト、所有権を引き取る
+    * @param filepath ソースファイルパス
+    * @param base 基底のマクロ環境、この翻訳単位での#define/#undefはこれに影響しない
+    * @param lang 出力メッセージの言語指定
+    */
+    ll_paser(Tokenizer&& tokenizer, fs::path filepath, std::shared_ptr<const macro_environment> base, report::report_lang lang = report::report_lang::ja)
+      : m_tokenizer{std::move(tokenizer)}
+      , m_preprocessor{filepath, std::move(base)}
+      , m_filename{std::move(filepath)}
+      , m_lang{lang}
+      , m_reporter(ReporterFactory::create(lang))
+    {}
+
+    /**
+    * @brief 保存しておいたマクロ定義の状態から開始する
+    * @param tokenizer トークナイザー実装オブジェクト、所有権を引き取る
+    * @param filepath ソースファイルパス
+    * @param snapshot 開始時点のマクロ定義の状態
+    * @param lang 出力メッセージの言語指定
+    */
+    ll_paser(Tokenizer&& tokenizer, fs::path filepath, const macro_snapshot& snapshot, report::report_lang lang = report::report_lang::ja)
+      : m_tokenizer{std::move(tokenizer)}
+      , m_preprocessor{filepath, snapshot}
+      , m_filename{std::move(filepath)}
+      , m_lang{lang}
+      , m_reporter(ReporterFactory::create(lang))
+    {}
+
+    /**
+    * @brief 別のファイルのプリプロセッサの状態を引き継いで構築する
+    * @details インクルードしたヘッダの処理に使う、処理後にrelease_preprocessor()で状態を返す
+    * @param tokenizer トークナイザー実装オブジェクト、所有権を引き取る
+    * @param filepath ソースファイルパス
+    * @param preprocessor 引き継ぐプリプロセッサの状態
+    * @param lang 出力メッセージの言語指定
+    */
+    ll_paser(Tokenizer&& tokenizer, fs::path filepath, pp_directive_manager&& preprocessor, report::report_lang lang = report::report_lang::ja)
+      : m_tokenizer{std::move(tokenizer)}
+      , m_preprocessor{std::move(preprocessor)}
+      , m_filename{std::move(filepath)}
+      , m_lang{lang}
+      , m_reporter(ReporterFactory::create(lang))
+    {}
+
+    /**
+    * @brief プリプロセッサの状態を取得する
+    * @details マクロ定義の状態を保存する場合などに使用する
+    */
+    fn get_preprocessor() const noexcept -> const pp_directive_manager& {
+      return m_preprocessor;
+    }
+
+    /**
+    * @brief #if/#elifの評価結果のメモを差し替える
+    * @details 同じヘッダを処理する複数のパーサで共有すると、互いの評価結果を利用できる
+    * @param memo 使用するメモ、nullptrならメモ化を行わない
+    */
+    void set_if_condition_memo(std::shared_ptr<if_condition_memo> memo) {
+      m_if_memo = std::move(memo);
+      if (m_if_memo != nullptr) {
+        m_file_id = m_if_memo->file_id(m_filename);
+      }
+    }
+
+    /**
+    * @brief #if/#elifの評価結果のメモを取得する
+    */
+    fn get_if_condition_memo() const noexcept -> const std::shared_ptr<if_condition_memo>& {
+      return m_if_memo;
+    }
+
+    /**
+    * @brief ヘッダの処理結果のキャッシュを設定する
+    * @details 既定ではキャッシュしない（1度しかインクルードされないヘッダでは複製の分だけ遅くなる）
+    * @details 複数の翻訳単位で共有すると、互いの処理結果を利用できる
+    * @param cache 使用するキャッシュ、nullptrならキャッシュしない
+    */
+    void set_header_cache(std::shared_ptr<header_cache> cache) {
+      m_header_cache = std::move(cache);
+    }
+
+    /**
+    * @brief ヘッダの処理結果のキャッシュを取得する
+    */
+    fn get_header_cache() const noexcept -> const std::shared_ptr<header_cache>& {
+      return m_header_cache;
+    }
+
+    /**
+    * @brief インクルードするファイルの探索設定を差し替える
+    * @param options 探索設定
+    */
+    void set_include_options(std::shared_ptr<const include_options> options) {
+      m_include_options = std::move(options);
+    }
+
+    /**
+    * @brief インクルードの入れ子の深さを設定する
+    * @details インクルードしたヘッダを処理するパーサに設定する
+    * @param depth このファイルの入れ子の深さ
+    */
+    void set_include_depth(std::size_t depth) noexcept {
+      m_include_depth = depth;
+    }
+
+    /**
+    * @brief 依存関係の走査のみを行うかを設定する
+    * @details trueの場合、ディレクティブとモジュール宣言・インポート宣言の行だけを処理し、テキスト行はトークナイズせずに読み飛ばす
+    * @details フェーズ4の結果は生成されない、依存関係はget_dependencies()で取得する
+    * @param scan_only 依存関係の走査のみを行うならtrue
+    */
+    void set_scan_only(bool scan_only) noexcept {
+      m_scan_only = scan_only;
+    }
+
+    /**
+    * @brief 依存関係の走査時に、インクルードしたヘッダを読むのに使用する縮小したソースのキャッシュを設定する
+    * @details 設定されていれば、ヘッダはディレクティブとモジュール宣言の行だけに縮小したものを読む
+    * @param cache キャッシュ、nullptrなら元のファイルを読む
+    */
+    void set_minimized_source_cache(std::shared_ptr<minimized_source_cache> cache) noexcept {
+      m_minimized_cache = std::move(cache);
+    }
+
+    /**
+    * @brief 依存関係を宣言する部分を読み終えた時に呼ばれる関数を設定する
+    * @details 依存関係を宣言する部分は、ファイル先頭から最初の空でないテキスト行の手前まで（グローバルモジュールフラグメント、モジュール宣言、インポート宣言の並び）
+    * @details 関数はそこまでの依存関係を受け取り、falseを返すと以降を読まずに処理を終える
+    * @param handler 呼び出す関数
+    */
+    void set_preamble_handler(std::function<bool(const dependency_info&)> handler) {
+      m_preamble_handler = std::move(handler);
+    }
+
+    /**
+    * @brief インクルードの木を記録するようにする
+    * @details start()の処理時間・出力トークン数・行数と、インクルードしたヘッダのノードを記録する
+    * @param node このファイルのノード、start()が終わるまで有効であること
+    */
+    void set_include_node(include_node* node) noexcept {
+      m_include_node = node;
+    }
+
+    /**
+    * @brief #include毎に、ヘッダが翻訳単位に寄与したか（マクロが使われたか、トークンを出力したか）を記録するようにする
+    * @details 翻訳単位のパーサに設定すると、start()の終わりに結果がtrackerに入る
+    * @details ヘッダのマクロ定義の有無を正しく記録するため、翻訳単位全体でマクロテーブルへの問い合わせを記録する
+    * @param tracker 記録先、start()が終わるまで有効であること
+    */
+    void set_include_usage_tracker(include_usage_tracker* tracker) noexcept {
+      m_include_usage = tracker;
+    }
+
+    /**
+    * @brief マクロ展開の入れ子の深さ、1つのマクロ呼び出しで生成するトークン数、出力トークン数、処理時間の上限を設定する
+    * @details 上限を超えると診断メッセージを出力してエラーとなる、インクルードしたヘッダの処理にも引き継がれる
+    * @param limits 上限
+    */
+    void set_expansion_limits(const expansion_limits& limits) noexcept {
+      m_preprocessor.m_macro_manager.budget().set_limits(limits);
+    }
+
+    /**
+    * @brief マクロ展開と出力の上限と、使った量を引き継ぐ
+    * @details ヘッダユニットの処理の分も翻訳単位に数えるために使用する
+    * @param budget 引き継ぐもの
+    */
+    void set_expansion_budget(const expansion_budget& budget) noexcept {
+      m_preprocessor.m_macro_manager.budget() = budget;
+    }
+
+    /**
+    * @brief マクロ展開と出力の上限と、使った量を取得する
+    */
+    fn get_expansion_budget() const noexcept -> const expansion_budget& {
+      return m_preprocessor.m_macro_manager.budget();
+    }
+
+    /**
+    * @brief このファイルの依存関係を取得する
+    * @details インクルードしたヘッダのものを含む
+    */
+    fn get_dependencies() const noexcept -> const dependency_info& {
+      return m_dependencies;
+    }
+
     fn get_phase4_result() const -> const pptoken_list_t& {
       return m_pptoken_list;
     }
 
+    /**
+    * @brief プリプロセッサの状態を取り出す
+    * @details 以降このパーサは使用できない
+    */
+    fn release_preprocessor() -> pp_directive_manager {
+      return std::move(m_preprocessor);
+    }
+
+    /**
+    * @brief フェーズ4の結果を取り出す
+    */
+    fn release_phase4_result() -> pptoken_list_t {
+      return std::move(m_pptoken_list);
+    }
+
+    /**
+    * @brief ヘッダファイルを現在のマクロ定義の状態でプリプロセスし、結果を出力の末尾に追加する
+    * @details ヘッダ内での#define/#undefはこのパーサのマクロ定義に反映される
+    * @details キャッシュに同じマクロ定義の状態で処理した結果があれば、パースせずにそれを再生する
+    * @param path ヘッダファイルのパス
+    * @param directive 診断メッセージの位置とする#includeのトークン、nullptrなら出力の上限を超えても診断メッセージを出さない
+    */
+    fn include_file(const fs::path& path, const pptoken_t* directive = nullptr) -> parse_result {
+      if (m_include_usage == nullptr) return this->include_file_impl(path, directive);
+
+      const auto& macros = m_preprocessor.m_macro_manager;
+      const auto index = m_include_usage->open(path, m_include_depth + 1, macros.observed().current());
+
+      // 出力の末尾の位置を覚えておき、ヘッダの出力だけを数える
+      const bool was_empty = m_pptoken_list.empty();
+      const auto last = was_empty ? m_pptoken_list.end() : std::prev(m_pptoken_list.end());
+
+      auto status = this->include_file_impl(path, directive);
+
+      const auto first = was_empty ? m_pptoken_list.begin() : std::next(last);
+      m_include_usage->close(index, macros.observed().current(), count_output_tokens(first, m_pptoken_list.end()));
+
+      return status;
+    }
+
+  private:
+
+    /**
+    * @brief include_file()の本体、寄与の記録はinclude_file()で行う
+    */
+    fn include_file_impl(const fs::path& path, const pptoken_t* directive) -> parse_result {
+      auto& macros = m_preprocessor.m_macro_manager;
+      // 依存関係の走査では出力が無いので、キャッシュを使わない
+      // #include毎の寄与を調べる時も、入れ子のヘッダを記録するために毎回処理する
+      const bool use_cache = m_header_cache != nullptr and not m_scan_only and m_include_usage == nullptr;
+
+      if (use_cache) {
+        if (auto cached = m_header_cache->find(path, macros); cached != nullptr) {
+          const auto prev_size = m_pptoken_list.size();
+          m_header_cache->replay(*cached, macros, m_pptoken_list);
+          m_sources.emplace_back(cached->storage);
+
+          if (m_include_node != nullptr) {
+            auto& node = m_include_node->add_include(path);
+            node.tokens = m_pptoken_list.size() - prev_size;
+            node.from_cache = true;
+          }
+
+          m_dependencies.add_include(path);
+          for (const auto& nested : cached->includes) {
+            m_dependencies.add_include(nested);
+          }
+
+          // 再生したトークンも出力の上限に数える
+          if (auto error = macros.budget().output(m_pptoken_list.size() - prev_size); error) {
+            if (directive == nullptr) return kusabira::error(pp_err_info{ pptoken_t{pp_token_category::empty}, *error });
+
+            m_reporter->pp_err_report(m_filename, *directive, *error);
+            return kusabira::error(pp_err_info{ *directive, *error });
+          }
+          return kusabira::ok(pp_parse_status::Complete);
+        }
+      }
+
+      if (not fs::is_regular_file(path)) {
+        return kusabira::error(pp_err_info{ pptoken_t{pp_token_category::empty}, pp_parse_context::ControlLine });
+      }
+
+      // ヘッダでの参照と変更を記録する
+      std::optional<macro_observer::mark> observe_start{};
+      if (use_cache) {
+        observe_start = macros.observe_begin();
+      }
+      kusabira::vocabulary::scope_exit observer_guard = [&macros, &observe_start] {
+        if (observe_start) macros.observe_end();
+      };
+
+      if (m_scan_only and m_minimized_cache != nullptr) {
+        // 依存関係の走査では、ディレクティブだけに縮小したソースを読む
+        return this->parse_header(minimized_tokenizer{minimized_reader{m_minimized_cache->get(path)}}, path, observe_start);
+      }
+
+      return this->parse_header(header_tokenizer{path}, path, observe_start);
+    }
+
+  public:
+
     fn start() -> parse_result {
       auto it = std::ranges::begin(m_tokenizer);
       auto se = std::ranges::end(m_tokenizer);
 
+      // トレースを記録していなければファイル名を作らない
+      const std::u8string trace_name = time_trace_enabled() ? m_filename.generic_u8string() : std::u8string{};
+      [[maybe_unused]] scoped_trace_span span{trace_kind::source, trace_name};
+
+      const auto start_time = std::chrono::steady_clock::now();
+      kusabira::vocabulary::scope_exit node_guard = [this, start_time] {
+        if (m_include_node == nullptr) return;
+        m_include_node->path = m_filename;
+        m_include_node->inclusive_time = std::chrono::steady_clock::now() - start_time;
+        m_include_node->tokens = m_pptoken_list.size();
+        m_include_node->lines = m_line_count;
+        m_include_node->skipped_lines = m_skipped_line_count;
+      };
+
+      // 上限は翻訳単位の処理全体に対するもの
+      if (m_include_depth == 0) {
+        m_preprocessor.m_macro_manager.budget().start();
+      }
+
+      // 翻訳単位の全体で、マクロテーブルへの問い合わせと変更を記録する
+      const bool track_usage = m_include_usage != nullptr and m_include_depth == 0;
+      if (track_usage) {
+        [[maybe_unused]] auto mark = m_preprocessor.m_macro_manager.observe_begin();
+      }
+      kusabira::vocabulary::scope_exit usage_guard = [this, track_usage] {
+        if (not track_usage) return;
+        auto& macros = m_preprocessor.m_macro_manager;
+        m_include_usage->analyze(macros.observed());
+        macros.observe_end();
+      };
+
       //空のファイル判定
       if (it == se) return pp_parse_status::EndOfFile;
       if (auto kind = (*it).category; kind == pp_token_category::whitespaces or kind == pp_token_category::block_comment) {
@@ -152,25 +520,15 @@ namespace kusabira::PP {
         SKIP_WHITESPACE(it, se);
       }
 
-      //モジュールファイルを識別
-      if (auto& top_token = *it; top_token.category == pp_token_category::identifier) {
-        using namespace std::string_view_literals;
+      // モジュール宣言とインポート宣言はgroup_part()で行毎に処理するので、モジュールファイルも通常のファイルと同じく読む
+      auto status = this->group(it, se);
 
-        if (auto str = top_token.token.to_view(); str == u8"module" or str == u8"export") {
-          //モジュールファイルとして読むため、終了後はそのまま終わり
-          return this->module_file(it, se);
-        }
+      // テキスト行が無ければ、ファイル全体が依存関係を宣言する部分だった
+      if (status and not m_preamble_stopped) {
+        [[maybe_unused]] bool cont = this->end_preamble();
       }
 
-      //通常のファイル
-      return this->group(it, se);
-    }
-
-    fn module_file([[maybe_unused]] iterator& it, [[maybe_unused]] sentinel end) -> parse_result {
-      //未実装
-      assert(false);
-      //モジュール宣言とかを生成する
-      return {pp_parse_status::Complete};
+      return status;
     }
 
     fn group(iterator& it, sentinel end) -> parse_result {
@@ -178,6 +536,10 @@ namespace kusabira::PP {
 
       //ここでEOFチェックする意味ある？？？
       while (it != end and status == pp_parse_status::Complete) {
+        if (auto error = m_preprocessor.m_macro_manager.budget().check_deadline(); error) {
+          m_reporter->pp_err_report(m_filename, deref(it), *error);
+          return kusabira::error(pp_err_info{ deref(it), *error });
+        }
         status = group_part(it, end);
       }
 
@@ -212,20 +574,25 @@ namespace kusabira::PP {
         // #に続く識別子、何かしらのプリプロセッシングディレクティブ
         if (std::u8string_view id_token = deref(it).token; id_token == u8"if" or id_token == u8"ifdef" or id_token == u8"ifndef") {
           // if-sectionへ
+          [[maybe_unused]] scoped_trace_span span{trace_kind::directive, id_token};
           return this->if_section(it, end);
         } else if (id_token == u8"elif" or id_token == u8"else" or id_token == u8"endif") {
           // if-sectionの内部でif-group読取中のelif等の出現、group読取の終了
           return kusabira::ok(pp_parse_status::FollowingSharpToken);
         } else {
           // control-lineへ
+          [[maybe_unused]] scoped_trace_span span{trace_kind::directive, id_token};
           return this->control_line(it, end);
         }
-      } else if (token.category == pp_token_category::identifier and 
-                 (token.token == u8"import"sv or token.token == u8"export"sv) )
+      } else if (token.category == pp_token_category::identifier and
+                 (token.token == u8"import"sv or token.token == u8"export"sv or token.token == u8"module"sv))
       {
-        // モジュールのインポート宣言
-        // pp-importに直接行ってもいい気がする
-        return this->control_line(it, end);
+        if (m_scan_only) {
+          // 依存関係の走査では、モジュール宣言とインポート宣言から依存関係だけを読み取る
+          return this->scan_module_line(it, end);
+        }
+        // モジュール宣言とインポート宣言
+        return this->module_line(it, end);
       }
 
       // text-lineへ
@@ -240,8 +607,7 @@ namespace kusabira::PP {
       auto tokenstr = (*it).token.to_view();
 
       if (tokenstr == u8"include") {
-        //#include、未実装
-        assert(false);
+        return this->control_line_include(it, end);
       } else if (tokenstr == u8"define") {
         return this->control_line_define(it, end);
       } else if (tokenstr == u8"undef") {
@@ -306,8 +672,531 @@ namespace kusabira::PP {
       return this->newline(it, end);
     }
 
+    /**
+    * @brief インクルードしたヘッダを別のパーサで処理し、結果を取り込む
+    * @tparam HeaderTokenizer ヘッダを読むトークナイザの型
+    * @param tokenizer ヘッダを読むトークナイザ
+    * @param path ヘッダファイルのパス
+    * @param observe_start ヘッダキャッシュのための記録の開始位置、記録していなければ無効値
+    */
+    template <typename HeaderTokenizer>
+    fn parse_header(HeaderTokenizer tokenizer, const fs::path& path, const std::optional<macro_observer::mark>& observe_start) -> parse_result {
+      auto& macros = m_preprocessor.m_macro_manager;
+
+      // プリプロセッサの状態はヘッダのパーサに一時的に移す
+      auto preprocessor = std::move(m_preprocessor);
+      auto includer_file = preprocessor.switch_source_file(macro_manager::new_source_file(path));
+
+      using header_paser = ll_paser<HeaderTokenizer, ReporterFactory>;
+      auto header = std::make_shared<header_paser>(std::move(tokenizer), path, std::move(preprocessor), m_lang);
+      header->set_if_condition_memo(m_if_memo);
+      header->set_header_cache(m_header_cache);
+      header->set_include_options(m_include_options);
+      header->set_include_depth(m_include_depth + 1);
+      header->set_scan_only(m_scan_only);
+      header->set_minimized_source_cache(m_minimized_cache);
+      header->set_include_usage_tracker(m_include_usage);
+      if (m_include_node != nullptr) {
+        header->set_include_node(&m_include_node->add_include(path));
+      }
+
+      const auto status = header->start();
+      m_preprocessor = header->release_preprocessor();
+      [[maybe_unused]] auto header_file = m_preprocessor.switch_source_file(std::move(includer_file));
+
+      if (not status) {
+        // エラー情報のトークンはヘッダの行を参照している
+        m_sources.emplace_back(std::move(header));
+        return status;
+      }
+
+      const auto& header_deps = header->get_dependencies();
+      m_dependencies.add_include(path);
+      m_dependencies.merge(header_deps);
+
+      auto output = header->release_phase4_result();
+      if (observe_start) {
+        [[maybe_unused]] auto stored = m_header_cache->store(path, macros, *observe_start, output, header_deps.includes);
+      }
+
+      m_pptoken_list.splice(m_pptoken_list.end(), std::move(output));
+      m_sources.emplace_back(std::move(header));
+
+      return kusabira::ok(pp_parse_status::Complete);
+    }
+
+    /**
+    * @brief #includeディレクティブを処理する
+    * @details ヘッダ名が直接書かれていなければ、マクロ展開した結果をヘッダ名として読み取る
+    * @param it includeを指すイテレータ
+    * @param end トークン列の終端
+    */
+    fn control_line_include(iterator& it, sentinel end) -> parse_result {
+      // 診断メッセージのためにinclude自体を保存しておく
+      const auto include_token = deref(it);
+      SKIP_WHITESPACE(it, end);
+
+      auto header_name = this->read_header_name(it, end);
+
+      if (header_name) {
+        if (auto result = this->newline(it, end); not result) {
+          return result;
+        }
+      } else {
+        pptoken_list_t header_token_list{ &kusabira::def_mr };
+
+        if (auto result = this->pp_tokens<true, false>(it, end, header_token_list); not result) {
+          return result;
+        }
+        header_name = header_name_from_tokens(header_token_list);
+      }
+
+      if (not header_name) {
+        m_reporter->pp_err_report(m_filename, include_token, pp_parse_context::ControlLine_Include);
+        return kusabira::error(pp_err_info{ include_token, pp_parse_context::ControlLine_Include });
+      }
+
+      if (m_include_options->max_depth <= m_include_depth) {
+        m_reporter->pp_err_report(m_filename, include_token, pp_parse_context::Include_TooDeep);
+        return kusabira::error(pp_err_info{ include_token, pp_parse_context::Include_TooDeep });
+      }
+
+      const auto& [name, lookup] = *header_name;
+      const auto path = m_include_options->find(name, lookup, m_filename);
+
+      if (not path) {
+        m_reporter->pp_err_report(m_filename, include_token, pp_parse_context::Include_NotFound);
+        return kusabira::error(pp_err_info{ include_token, pp_parse_context::Include_NotFound });
+      }
+
+      return this->include_file(*path, &include_token);
+    }
+
+    using header_name_t = std::pair<std::pmr::u8string, include_lookup>;
+
+    /**
+    * @brief ソースに直接書かれたヘッダ名を読み取る
+    * @details "..."は文字列リテラルとして、<...>は>までの行の文字列をそのまま読み取る
+    * @param it ヘッダ名の先頭を指すイテレータ、ヘッダ名だった場合はその次のトークンを指して戻る
+    * @param end トークン列の終端
+    * @return {ヘッダ名, 探索方法}、ヘッダ名ではなければ無効値
+    */
+    fn read_header_name(iterator& it, sentinel end) -> std::optional<header_name_t> {
+      const auto& token = deref(it);
+      const auto str = token.token.to_view();
+
+      if (token.category == pp_token_category::string_literal and str.starts_with(u8'"')) {
+        header_name_t header_name{ std::pmr::u8string{ str.substr(1, str.length() - 2), &kusabira::def_mr }, include_lookup::quote };
+        ++it;
+        return header_name;
+      }
+
+      if (token.category == pp_token_category::op_or_punc and str == u8"<") {
+        const std::u8string_view line = (*token.srcline_ref).line;
+        const auto first = token.column + 1;
+        const auto last = line.find(u8'>', first);
+        if (last == std::u8string_view::npos) return std::nullopt;
+
+        header_name_t header_name{ std::pmr::u8string{ line.substr(first, last - first), &kusabira::def_mr }, include_lookup::angle };
+
+        // >までのトークンを読み飛ばす
+        do {
+          ++it;
+        } while (it != end and deref(it).category != pp_token_category::newline and deref(it).column <= last);
+
+        return header_name;
+      }
+
+      return std::nullopt;
+    }
+
+    /**
+    * @brief マクロ展開後のプリプロセッシングトークン列からヘッダ名を構成する
+    * @details <...>の間のトークンは空白を挟まずに連結する
+    * @param list マクロ展開後のトークン列
+    * @return {ヘッダ名, 探索方法}、ヘッダ名を構成できなければ無効値
+    */
+    sfn header_name_from_tokens(const pptoken_list_t& list) -> std::optional<header_name_t> {
+      if (list.empty()) return std::nullopt;
+
+      const auto& front = list.front();
+      const auto& back = list.back();
+
+      if (list.size() == 1 and front.category == pp_token_category::string_literal and front.token.to_view().starts_with(u8'"')) {
+        const auto str = front.token.to_view();
+        return header_name_t{ std::pmr::u8string{ str.substr(1, str.length() - 2), &kusabira::def_mr }, include_lookup::quote };
+      }
+
+      if (2 < list.size() and front.category == pp_token_category::op_or_punc and front.token == u8"<" and back.category == pp_token_category::op_or_punc and back.token == u8">") {
+        std::pmr::u8string name{ &kusabira::def_mr };
+        for (const auto& pptoken : list | std::views::drop(1) | std::views::take(list.size() - 2)) {
+          name.append(pptoken.token.to_view());
+        }
+        return header_name_t{ std::move(name), include_lookup::angle };
+      }
+
+      return std::nullopt;
+    }
+
+    /**
+    * @brief 依存関係の走査時に、モジュール宣言とインポート宣言の行から依存関係を読み取る
+    * @details 読み取れない形の行はテキスト行として読み飛ばす
+    * @param it 行頭のexport/import/moduleを指すイテレータ、行末の改行の次を指して戻る
+    * @param end トークン列の終端
+    */
+    fn scan_module_line(iterator& it, sentinel end) -> parse_result {
+      bool is_export = false;
+
+      if (deref(it).token == u8"export") {
+        is_export = true;
+        SKIP_WHITESPACE(it, end);
+
+        // export宣言など
+        if (auto str = deref(it).token.to_view(); deref(it).category != pp_token_category::identifier or (str != u8"import" and str != u8"module")) {
+          return this->text_line(it, end);
+        }
+      }
+
+      const auto keyword = deref(it);
+      const bool is_import = keyword.token == u8"import";
+      SKIP_WHITESPACE(it, end);
+
+      if (is_import) {
+        if (auto header_name = this->read_header_name(it, end); header_name) {
+          // ヘッダユニットのインポート、見つからなくても依存関係には残す
+          auto& [name, lookup] = *header_name;
+          auto path = m_include_options->find(name, lookup, m_filename);
+          this->add_required_module(name, lookup, path.value_or(fs::path{}));
+
+          if (path) {
+            if (auto result = this->import_header_unit(*path, keyword); not result) {
+              return result;
+            }
+          }
+        } else if (auto name = this->read_module_name(it, end); not name) {
+          return kusabira::error(std::move(name).error());
+        } else if (not name->empty()) {
+          this->add_required_module(std::move(*name), include_lookup::none, {});
+        }
+      } else {
+        auto name = this->read_module_name(it, end);
+        if (not name) return kusabira::error(std::move(name).error());
+        this->set_provided_module(std::move(*name), is_export);
+      }
+
+      // 属性やセミコロンなど、行の残りは読み飛ばす
+      return this->skip_text_line(it, end);
+    }
+
+    /**
+    * @brief モジュール宣言とインポート宣言の行を処理する
+    * @details export/module/importはそれぞれのキーワードのトークンに置き換え、モジュール名はマクロ展開せずに、行の残りはマクロ展開して出力する
+    * @details インポートしたヘッダユニットのマクロ定義は、このファイルのマクロ定義に取り込む
+    * @details キーワードの後に続くトークンがモジュール名やヘッダ名の先頭になりえない行は、テキスト行として処理する
+    * @param it 行頭のexport/import/moduleを指すイテレータ、行末の改行の次を指して戻る
+    * @param end トークン列の終端
+    */
+    fn module_line(iterator& it, sentinel end) -> parse_result {
+      using namespace std::string_view_literals;
+
+      std::optional<pptoken_t> export_token{};
+
+      if (deref(it).token == u8"export") {
+        export_token.emplace(deref(it));
+        SKIP_WHITESPACE(it, end);
+
+        // export宣言など
+        if (auto str = deref(it).token.to_view(); deref(it).category != pp_token_category::identifier or (str != u8"import" and str != u8"module")) {
+          if (not this->end_preamble()) return kusabira::ok(pp_parse_status::EndOfFile);
+          m_pptoken_list.emplace_back(std::move(*export_token));
+          return this->text_line(it, end);
+        }
+      }
+
+      auto keyword = deref(it);
+      const bool is_import = keyword.token == u8"import";
+      SKIP_WHITESPACE(it, end);
+
+      // 続くトークンによってはディレクティブではない（import = 1;など）
+      const auto& next = deref(it);
+      const auto next_str = next.token.to_view();
+      const bool is_directive = is_import ?
+        (next.category == pp_token_category::identifier or (next.category == pp_token_category::string_literal and next_str.starts_with(u8'"')) or next_str == u8"<"sv or next_str == u8":"sv) :
+        (next.category == pp_token_category::identifier or next_str == u8":"sv or next_str == u8";"sv);
+
+      if (not is_directive) {
+        if (not this->end_preamble()) return kusabira::ok(pp_parse_status::EndOfFile);
+        if (export_token) m_pptoken_list.emplace_back(std::move(*export_token));
+        m_pptoken_list.emplace_back(std::move(keyword));
+        return this->text_line(it, end);
+      }
+
+      if (export_token) {
+        export_token->category = pp_token_category::export_keyword;
+        m_pptoken_list.emplace_back(std::move(*export_token));
+      }
+      keyword.category = is_import ? pp_token_category::import_keyword : pp_token_category::module_keyword;
+      // 宣言全体の末尾を調べるための目印
+      const auto keyword_pos = m_pptoken_list.insert(m_pptoken_list.end(), keyword);
+
+      std::optional<header_name_t> header_name{};
+      std::u8string module_name{};
+
+      if (is_import and next.category != pp_token_category::identifier and next_str != u8":"sv) {
+        // ヘッダユニットのインポート、直接書かれていなければマクロ展開して読み取る
+        const auto first = next;
+        header_name = this->read_header_name(it, end);
+
+        if (header_name) {
+          const std::u8string_view line = (*first.srcline_ref).line;
+          m_pptoken_list.emplace_back(pp_token_category::header_name, line.substr(first.column, header_name->first.length() + 2), first.column, first.srcline_ref);
+        }
+      } else if (auto macro = m_preprocessor.is_macro(next_str); is_import and macro and not *macro) {
+        // オブジェクト形式マクロで始まるものはヘッダ名に展開される
+      } else {
+        pptoken_list_t name_tokens{ &kusabira::def_mr };
+        auto name = this->read_module_name(it, end, &name_tokens);
+        if (not name) return kusabira::error(std::move(name).error());
+        module_name = std::move(*name);
+
+        // モジュール名を構成するトークンはオブジェクト形式マクロであってはならない
+        for (auto& pptoken : name_tokens) {
+          if (pptoken.category != pp_token_category::identifier) continue;
+          if (auto is_func = m_preprocessor.is_macro(pptoken.token.to_view()); is_func and not *is_func) {
+            m_reporter->pp_err_report(m_filename, pptoken, pp_parse_context::Module_NameIsMacro);
+            return kusabira::error(pp_err_info{ std::move(pptoken), pp_parse_context::Module_NameIsMacro });
+          }
+        }
+        m_pptoken_list.splice(m_pptoken_list.end(), std::move(name_tokens));
+      }
+
+      // 行の残りはマクロ展開する
+      if (auto result = this->pp_tokens<true, false>(it, end, m_pptoken_list); not result) {
+        return result;
+      }
+
+      // キーワードの次から改行の手前まで
+      pptoken_list_t rest{ &kusabira::def_mr };
+      rest.splice(rest.end(), m_pptoken_list, std::next(keyword_pos), std::prev(m_pptoken_list.end()));
+
+      if (is_import and not header_name and module_name.empty()) {
+        header_name = this->merge_header_name_tokens(rest);
+      }
+
+      // 宣言は;で終わる
+      const bool is_complete = not rest.empty() and rest.back().category == pp_token_category::op_or_punc and rest.back().token == u8";"sv and (header_name or not module_name.empty() or not is_import);
+      m_pptoken_list.splice(std::prev(m_pptoken_list.end()), std::move(rest));
+
+      if (not is_complete) {
+        m_reporter->pp_err_report(m_filename, keyword, pp_parse_context::Module_InvalidDeclaration);
+        return kusabira::error(pp_err_info{ std::move(keyword), pp_parse_context::Module_InvalidDeclaration });
+      }
+
+      if (not is_import) {
+        this->set_provided_module(std::move(module_name), export_token.has_value());
+        return kusabira::ok(pp_parse_status::Complete);
+      }
+
+      if (not header_name) {
+        this->add_required_module(std::move(module_name), include_lookup::none, {});
+        return kusabira::ok(pp_parse_status::Complete);
+      }
+
+      const auto& [name, lookup] = *header_name;
+      const auto path = m_include_options->find(name, lookup, m_filename);
+
+      if (not path) {
+        m_reporter->pp_err_report(m_filename, keyword, pp_parse_context::Import_HeaderNotFound);
+        return kusabira::error(pp_err_info{ std::move(keyword), pp_parse_context::Import_HeaderNotFound });
+      }
+
+      this->add_required_module(name, lookup, *path);
+      return this->import_header_unit(*path, keyword);
+    }
+
+    /**
+    * @brief マクロ展開後のトークン列の先頭にあるヘッダ名を、1つのheader-nameトークンにまとめる
+    * @param list マクロ展開後のトークン列
+    * @return {ヘッダ名, 探索方法}、先頭がヘッダ名でなければ無効値
+    */
+    fn merge_header_name_tokens(pptoken_list_t& list) -> std::optional<header_name_t> {
+      if (list.empty()) return std::nullopt;
+
+      auto& front = list.front();
+      const auto str = front.token.to_view();
+
+      if (front.category == pp_token_category::string_literal and str.starts_with(u8'"')) {
+        front.category = pp_token_category::header_name;
+        return header_name_t{ std::pmr::u8string{ str.substr(1, str.length() - 2), &kusabira::def_mr }, include_lookup::quote };
+      }
+
+      if (front.category != pp_token_category::op_or_punc or str != u8"<") return std::nullopt;
+
+      const auto close = std::ranges::find_if(list, [](const auto& pptoken) {
+        return pptoken.category == pp_token_category::op_or_punc and pptoken.token == u8">";
+      });
+      if (close == list.end()) return std::nullopt;
+
+      std::pmr::u8string name{ &kusabira::def_mr };
+      for (auto pos = std::next(list.begin()); pos != close; ++pos) {
+        name.append((*pos).token.to_view());
+      }
+
+      std::pmr::u8string header_str{ u8"<", &kusabira::def_mr };
+      header_str.append(name).append(u8">");
+
+      pptoken_t header_token{ pp_token_category::header_name };
+      header_token.token = std::move(header_str);
+
+      list.erase(list.begin(), std::next(close));
+      list.push_front(std::move(header_token));
+
+      return header_name_t{ std::move(name), include_lookup::angle };
+    }
+
+    /**
+    * @brief ヘッダユニットをインポートする
+    * @details ヘッダユニットは基底のマクロ環境だけで別のパーサで処理し、そこで定義されたマクロをこのファイルのマクロ定義に取り込む
+    * @details ヘッダユニットの出力は取り込まない
+    * @param path ヘッダファイルのパス
+    * @param import_token 診断メッセージに使うimportのトークン
+    */
+    fn import_header_unit(const fs::path& path, const pptoken_t& import_token) -> parse_result {
+      if (m_include_options->max_depth <= m_include_depth) {
+        m_reporter->pp_err_report(m_filename, import_token, pp_parse_context::Include_TooDeep);
+        return kusabira::error(pp_err_info{ import_token, pp_parse_context::Include_TooDeep });
+      }
+
+      if (m_scan_only and m_minimized_cache != nullptr) {
+        return this->parse_header_unit(minimized_tokenizer{minimized_reader{m_minimized_cache->get(path)}}, path);
+      }
+      return this->parse_header_unit(header_tokenizer{path}, path);
+    }
+
+    /**
+    * @brief ヘッダユニットを別のパーサで処理し、マクロ定義を取り込む
+    * @tparam HeaderTokenizer ヘッダを読むトークナイザの型
+    * @param tokenizer ヘッダを読むトークナイザ
+    * @param path ヘッダファイルのパス
+    */
+    template <typename HeaderTokenizer>
+    fn parse_header_unit(HeaderTokenizer tokenizer, const fs::path& path) -> parse_result {
+      auto& macros = m_preprocessor.m_macro_manager;
+      const auto& base = macros.base_environment();
+
+      using header_paser = ll_paser<HeaderTokenizer, ReporterFactory>;
+      auto header = std::make_shared<header_paser>(std::move(tokenizer), path, base, m_lang);
+      // 上限と使った量を引き継ぎ、ヘッダユニットの処理の分も翻訳単位に数える
+      header->set_expansion_budget(macros.budget());
+      header->set_if_condition_memo(m_if_memo);
+      header->set_header_cache(m_header_cache);
+      header->set_include_options(m_include_options);
+      header->set_include_depth(m_include_depth + 1);
+      header->set_scan_only(m_scan_only);
+      header->set_minimized_source_cache(m_minimized_cache);
+      if (m_include_node != nullptr) {
+        header->set_include_node(&m_include_node->add_include(path));
+      }
+
+      const auto status = header->start();
+      macros.budget() = header->get_expansion_budget();
+
+      // マクロ定義と、エラー情報のトークンはヘッダの行を参照している
+      m_sources.emplace_back(header);
+
+      if (not status) return status;
+
+      // 基底環境のものを除いた、ヘッダユニットで定義されたマクロを取り込む
+      header->get_preprocessor().m_macro_manager.for_each_macro([&macros, &base](std::u8string_view name, const auto& macro) {
+        if (base != nullptr and base->find(name) == &macro) return;
+        macros.restore_macro(name, macro);
+      });
+
+      return kusabira::ok(pp_parse_status::Complete);
+    }
+
+    /**
+    * @brief インポートしたモジュールを依存関係に追加する
+    * @details モジュールパーティションの名前には所属するモジュールの名前を補う
+    * @param name モジュール名、ヘッダユニットの場合はヘッダ名
+    * @param lookup ヘッダユニットの場合はその探索方法
+    * @param path ヘッダユニットのファイル
+    */
+    void add_required_module(std::u8string_view name, include_lookup lookup, fs::path path) {
+      std::u8string logical_name{name};
+
+      if (lookup == include_lookup::none and name.starts_with(u8':') and m_dependencies.provided_module) {
+        const std::u8string_view primary = *m_dependencies.provided_module;
+        logical_name.insert(0, primary.substr(0, primary.find(u8':')));
+      }
+
+      m_dependencies.required_modules.push_back({ std::move(logical_name), lookup, std::move(path) });
+    }
+
+    /**
+    * @brief モジュール宣言で宣言したモジュールを依存関係に記録する
+    * @details グローバルモジュールフラグメントの開始（module;）とプライベートモジュールフラグメント（module :private;）は何も提供しない
+    * @param name モジュール名
+    * @param is_export export module宣言か否か
+    */
+    void set_provided_module(std::u8string name, bool is_export) {
+      if (name.empty() or name.starts_with(u8':')) return;
+
+      m_dependencies.provided_module = std::move(name);
+      m_dependencies.is_interface = is_export;
+    }
+
+    /**
+    * @brief 依存関係を宣言する部分の終わりを処理する
+    * @details 最初に呼ばれた時だけ、設定されている関数に依存関係を渡す
+    * @return 以降の処理を続けるならtrue
+    */
+    fn end_preamble() -> bool {
+      if (std::exchange(m_in_preamble, false) and m_preamble_handler) {
+        m_preamble_stopped = not m_preamble_handler(m_dependencies);
+      }
+      return not m_preamble_stopped;
+    }
+
+    /**
+    * @brief モジュール名（パーティション名を含む）を読み取る
+    * @param it モジュール名の先頭を指すイテレータ、モジュール名の次のトークンを指して戻る
+    * @param end トークン列の終端
+    * @param tokens nullptrでなければ、モジュール名を構成するトークンを追加する
+    * @return モジュール名、無ければ空文字列
+    * @details 識別子が.か:を挟まずに続く場合はエラー（module a b;など）
+    */
+    fn read_module_name(iterator& it, sentinel end, pptoken_list_t* tokens = nullptr) -> kusabira::expected<std::u8string, pp_err_info> {
+      std::u8string name{};
+      bool after_identifier = false;
+
+      for (; it != end; ++it) {
+        const auto& token = deref(it);
+
+        if (token.category == pp_token_category::whitespaces or token.category == pp_token_category::block_comment) continue;
+
+        if (token.category == pp_token_category::identifier or (token.category == pp_token_category::op_or_punc and (token.token == u8"." or token.token == u8":"))) {
+          const bool is_identifier = token.category == pp_token_category::identifier;
+
+          if (is_identifier and after_identifier) {
+            m_reporter->pp_err_report(m_filename, token, pp_parse_context::Module_InvalidDeclaration);
+            return kusabira::error(pp_err_info{ token, pp_parse_context::Module_InvalidDeclaration });
+          }
+          after_identifier = is_identifier;
+
+          name.append(token.token.to_view());
+          if (tokens != nullptr) tokens->push_back(token);
+          continue;
+        }
+        break;
+      }
+
+      return name;
+    }
+
     fn control_line_define(iterator &it, sentinel end) -> parse_result {
       using namespace std::string_view_literals;
+      [[maybe_unused]] scoped_phase_timer timer{pp_phase::define};
       //ホワイトスペース列を読み飛ばす
       SKIP_WHITESPACE(it, end);
 
@@ -488,25 +1377,38 @@ namespace kusabira::PP {
       // #if*を処理
       // [パース結果、ifの条件式の結果のbool値]
       auto [status, condition] = this->if_group(it, end);
+      // いずれかのグループを有効として処理したか
+      bool taken = condition;
 
       //#を読んだ上でここに来ているかをチェックするもの
       auto chack_status = [&status]() noexcept -> bool { return status == pp_parse_status::FollowingSharpToken; };
 
       //正常にここに戻った場合はすでに#を読んでいるはず
-      if (chack_status() and (*it).token == u8"elif"sv) {
+      while (chack_status() and (*it).token == u8"elif"sv) {
         //#elif
-        status = this->elif_groups(it, end);
+        if (taken) {
+          // 有効なグループは処理済み、残りは読み飛ばす
+          std::tie(status, std::ignore) = this->skip_group(it, end);
+        } else {
+          std::tie(status, taken) = this->elif_group(it, end);
+        }
       }
 
       if (chack_status() and (*it).token == u8"else"sv) {
         //#else
-        status = this->else_group(it, end);
+        if (taken) {
+          std::tie(status, std::ignore) = this->skip_group(it, end);
+        } else {
+          status = this->else_group(it, end);
+        }
       } 
       if (chack_status()) {
         //endif以外にありえない
         return this->endif_line(it, end);
       } else {
         //各セクションパース中のエラー、status == trueとなるときはどんな時だろう？
+        //依存関係を宣言する部分だけを読んで止めた時は、そのまま終了する
+        if (status and m_preamble_stopped) return status;
         return status ? make_error(it, pp_parse_context::IfSection) :
               status;
       }
@@ -514,68 +1416,26 @@ namespace kusabira::PP {
 
     fn if_group(iterator& it, sentinel end) -> std::pair<parse_result, bool> {
       const auto if_token = std::ranges::iter_move(it);
+      const logical_line& directive_line = *if_token.srcline_ref;
 
       // 事前条件
       assert(if_token.token.to_view().starts_with(u8"if"));
 
+      // ディレクティブ名の次へ
+      ++it;
+
       // if の条件部の判定結果
       bool branch_condition = false;
 
-      if (auto token = if_token.token.to_view(); size(token) == 3) {
+      if (auto token = if_token.token.to_view(); token == u8"if") {
         // #ifを処理
+        auto condition = this->if_condition(it, end, directive_line);
 
-        // ホワイトスペース列を読み飛ばす
-        it = skip_whitespaces_except_newline(std::move(it), end);
-
-        // 定数式の処理
-        pptoken_list_t constexpr_token_list{ &kusabira::def_mr };
-
-        // 定数式を構成するトークンをマクロ展開などを完了させて取得
-        // defindと__has_cpp_attributeと__has_­includeの呼び出しを除けば、整数定数式とならなければならない
-        // ここでのマクロ展開は、関数マクロの呼び出しが改行を超えることはない
-        //   マクロ展開前に#ifを完了するnew-lineが現れることが構文定義で制約されているため
-        //
-        // 1. defined式を除く識別子のマクロ展開を完了
-        //     - マクロ展開の結果definedが生成されたか、defined式の書式が定義に沿わない場合、未定義動作
-        // 2. defindと__has_cpp_attributeと__has_­includeを処理
-        //     - マクロ展開も含めてこの処理順は未規定（のはず？
-        // 3. 残った識別子のうち、true/falseを除くものを整数0に置換する
-        //     - 代替トークンはこの対象とならない
-        // 4. そのトークン列を通常の定数式として処理
-        //     - 符号付整数はintmax_t、符号なし整数はuintmax_tであるかのように扱われる
-        //     - 文字リテラルは整数値に変換される
-        //
-        // bool値はintegral promotionによって整数値として扱われる
-
-        // まず、改行までトークンをそのまま読み出す
-        /*for (; deref(it).category != pp_token_category::newline ; ++it) {
-          // definedを処理しておく
-          if (deref(it).token == u8"defined") {
-            
-          }
-          auto& pptoken = constexpr_token_list.emplace_back(std::ranges::iter_move(it));
-        }*/
-
-        auto completed = this->pp_tokens<true, false>(it, end, constexpr_token_list);
-
-        if (not completed) {
-          return {kusabira::error(std::move(completed).error()), false};
+        if (not condition) {
+          return {kusabira::error(std::move(condition).error()), false};
         }
 
-        // トークンが何もないということはない
-        if (empty(constexpr_token_list)) {
-          return {kusabira::error(pp_err_info{ std::ranges::iter_move(it), pp_parse_context::IfGroup_Invalid }), false};
-        }
-
-        pp_constexpr<std::remove_cvref_t<decltype(*m_reporter)>> constant_expr{ .reporter = *m_reporter, .filename = m_filename};
-
-        auto condition_opt = constant_expr(constexpr_token_list);
-
-        if (not condition_opt) {
-          return {kusabira::error(pp_err_info{ std::ranges::iter_move(it), pp_parse_context::IfGroup_Invalid }), false};
-        }
-
-        branch_condition = *condition_opt;
+        branch_condition = *condition;
       } else if (token == u8"ifdef" or token == u8"ifndef") {
         //#ifdef #ifndef
 
@@ -589,10 +1449,15 @@ namespace kusabira::PP {
           //識別子以外が出てきたらエラー
           return {make_error(it, pp_parse_context::IfGroup_Invalid), false};
         }
-        //識別子を#define名としてチェックする
+        //識別子を#define名としてチェックする、マクロテーブルを直接引くだけでトークン列も定数式も構成しない
+        const bool is_defined = m_preprocessor.is_defined(deref(it).token);
+        branch_condition = (token == u8"ifdef") == is_defined;
+        ++it;
 
         // 行末まで読み、後続のgroupを処理
-        [[maybe_unused]] auto result = this->newline(it, end);
+        if (auto result = this->newline(it, end); not result) {
+          return {std::move(result), false};
+        }
       } else {
         // #ifから始まるがifdefでもifndefでもない何か
         return {make_error(it, pp_parse_context::IfGroup_Mistake), false};
@@ -608,8 +1473,170 @@ namespace kusabira::PP {
       }
     }
 
+    /**
+    * @brief #if/#elifの条件式を読み取り、評価する
+    * @details 同じ位置の条件式を、参照するマクロの定義が同じ状態で評価済みならば、マクロ展開も評価もせずにその結果を使う
+    * @param it ディレクティブ名の次のトークン、行末の改行の次を指して戻る
+    * @param directive_line ディレクティブのある論理行
+    * @return {条件式の評価結果 | エラー情報}
+    */
+    fn if_condition(iterator& it, sentinel end, const logical_line& directive_line) -> kusabira::expected<bool, pp_err_info> {
+      using namespace std::string_view_literals;
+
+      auto& macros = m_preprocessor.m_macro_manager;
+
+      if (m_if_memo != nullptr) {
+        if (auto memo = m_if_memo->find(m_file_id, directive_line, macros); memo) {
+          // 条件式は読み飛ばして改行で終了
+          it = std::ranges::find_if(std::move(it), end, [](const auto& token) {
+            return token.category == pp_token_category::newline;
+          });
+          if (auto completed = this->newline(it, end); not completed) {
+            return kusabira::error(std::move(completed).error());
+          }
+          return kusabira::ok(*memo);
+        }
+      }
+
+      // 評価中に参照したマクロを記録する
+      std::optional<macro_observer::mark> observe_start{};
+      if (m_if_memo != nullptr) {
+        observe_start = macros.observe_begin();
+      }
+      kusabira::vocabulary::scope_exit observer_guard = [&macros, &observe_start] {
+        if (observe_start) macros.observe_end();
+      };
+
+      // 定数式の処理
+      pptoken_list_t constexpr_token_list{ &kusabira::def_mr };
+
+      // 定数式を構成するトークンをマクロ展開などを完了させて取得
+      // defindと__has_cpp_attributeと__has_­includeの呼び出しを除けば、整数定数式とならなければならない
+      // ここでのマクロ展開は、関数マクロの呼び出しが改行を超えることはない
+      //   マクロ展開前に#ifを完了するnew-lineが現れることが構文定義で制約されているため
+      //
+      // 1. defined式を除く識別子のマクロ展開を完了
+      //     - マクロ展開の結果definedが生成されたか、defined式の書式が定義に沿わない場合、未定義動作
+      // 2. defindと__has_cpp_attributeと__has_­includeを処理
+      //     - マクロ展開も含めてこの処理順は未規定（のはず？
+      // 3. 残った識別子のうち、true/falseを除くものを整数0に置換する
+      //     - 代替トークンはこの対象とならない
+      // 4. そのトークン列を通常の定数式として処理
+      //     - 符号付整数はintmax_t、符号なし整数はuintmax_tであるかのように扱われる
+      //     - 文字リテラルは整数値に変換される
+      //
+      // bool値はintegral promotionによって整数値として扱われる
+      // 2と3と4はpp_constexprが行う
+
+      it = skip_whitespaces_except_newline(std::move(it), end);
+
+      while (deref(it).category != pp_token_category::newline) {
+        const bool is_defined_op = deref(it).category == pp_token_category::identifier and deref(it).token == u8"defined"sv;
+
+        auto result = this->construct_next_pptoken<true, false>(it, end);
+        if (not result) {
+          return kusabira::error(std::move(result).error());
+        }
+        constexpr_token_list.splice(constexpr_token_list.end(), std::move(*result));
+
+        if (is_defined_op) {
+          // definedのオペランドはマクロ展開しない
+          if (auto operand = this->defined_operand(it, end, constexpr_token_list); not operand) {
+            return kusabira::error(std::move(operand).error());
+          }
+        }
+      }
+
+      // トークンが何もないということはない
+      if (empty(constexpr_token_list)) {
+        return kusabira::error(pp_err_info{ std::ranges::iter_move(it), pp_parse_context::IfGroup_Invalid });
+      }
+
+      // 改行で終了
+      if (auto completed = this->newline(it, end); not completed) {
+        return kusabira::error(std::move(completed).error());
+      }
+
+      pp_constexpr constant_expr{ *m_reporter, m_filename, [this](std::u8string_view name) -> bool {
+        return m_preprocessor.is_defined(name);
+      }};
+
+      auto condition_opt = constant_expr(constexpr_token_list);
+
+      if (not condition_opt) {
+        return kusabira::error(pp_err_info{ std::move(constexpr_token_list.front()), pp_parse_context::IfGroup_Invalid });
+      }
+
+      if (m_if_memo != nullptr) {
+        [[maybe_unused]] auto stored = m_if_memo->store(m_file_id, directive_line, macros, *observe_start, *condition_opt);
+      }
+
+      return kusabira::ok(*condition_opt);
+    }
+
+    /**
+    * @brief defined演算子のオペランドを、マクロ展開せずに読み取る
+    * @details defined identifier もしくは defined ( identifier ) 、書式のチェックはpp_constexprで行う
+    * @param it definedの次のトークン、オペランドの次を指して戻る
+    */
+    fn defined_operand(iterator& it, sentinel end, pptoken_list_t& list) -> kusabira::expected<pp_parse_status, pp_err_info> {
+      using namespace std::string_view_literals;
+
+      bool in_paren = false;
+      bool has_identifier = false;
+
+      while (deref(it).category != pp_token_category::newline) {
+        const auto category = deref(it).category;
+        const bool is_lparen = category == pp_token_category::op_or_punc and deref(it).token == u8"("sv;
+
+        auto result = this->construct_next_pptoken<false, false>(it, end);
+        if (not result) {
+          return kusabira::error(std::move(result).error());
+        }
+        list.splice(list.end(), std::move(*result));
+
+        // ホワイトスペースは読み飛ばされている
+        if (category <= pp_token_category::block_comment) continue;
+
+        if (is_lparen and not in_paren and not has_identifier) {
+          in_paren = true;
+          continue;
+        }
+        if (in_paren and not has_identifier and category == pp_token_category::identifier) {
+          has_identifier = true;
+          continue;
+        }
+        // 括弧なしの識別子か、閉じ括弧（もしくは不正なトークン）
+        break;
+      }
+
+      return kusabira::ok(pp_parse_status::Complete);
+    }
+
     fn group_false(iterator& it, sentinel end) -> std::pair<parse_result, bool> {
-      
+
+      // インクルードの木を記録する時は、読み飛ばした物理行を数える（入れ子の無効なグループは一番外側で数える）
+      std::optional<std::size_t> skip_begin{};
+      if (m_include_node != nullptr and m_false_group_depth == 0 and it != end) {
+        skip_begin = (*deref(it).srcline_ref).phisic_line_num;
+      }
+      ++m_false_group_depth;
+      kusabira::vocabulary::scope_exit skip_guard = [&, this] {
+        --m_false_group_depth;
+        if (skip_begin and it != end) {
+          const std::size_t skip_end = (*deref(it).srcline_ref).phisic_line_num;
+          if (*skip_begin < skip_end) m_skipped_line_count += skip_end - *skip_begin;
+        }
+      };
+
+      // 条件ディレクティブの索引を持つトークナイザなら、対応する#elif/#else/#endifまで直接進める
+      // 索引が使えなかった場合は、以下で1行ずつ読み飛ばす
+      if constexpr (requires { m_tokenizer.skip_inactive_group(); }) {
+        if (it != end) {
+          [[maybe_unused]] const bool skipped = m_tokenizer.skip_inactive_group();
+        }
+      }
+
       while (it != end) {
         it = skip_whitespaces_except_newline(std::move(it), end);
         
@@ -698,25 +1725,40 @@ namespace kusabira::PP {
       return { pp_parse_status::Complete, false};
     }
 
-    fn elif_groups(iterator& it, sentinel end) -> parse_result {
-      parse_result status{ pp_parse_status::Complete };
-
-      while (it != end and status == pp_parse_status::Complete) {
-        status = elif_group(it, end);
-      }
-
-      return status;
-    }
+    fn elif_group(iterator& it, sentinel end) -> std::pair<parse_result, bool> {
+      // 事前条件
+      assert(deref(it).token == u8"elif");
 
-    fn elif_group(iterator& it, sentinel end) -> parse_result {
       //#elifを処理
+      const logical_line& directive_line = *deref(it).srcline_ref;
+      ++it;
 
       //定数式を処理
+      auto condition = this->if_condition(it, end, directive_line);
 
-      //改行文字まで読みとばし
+      if (not condition) {
+        return {kusabira::error(std::move(condition).error()), false};
+      }
+
+      if (*condition) {
+        return {this->group(it, end), true};
+      } else {
+        return this->group_false(it, end);
+      }
+    }
 
+    /**
+    * @brief 既に有効なグループを処理した後の#elif/#elseグループを読み飛ばす
+    * @param it #elif/#elseを指すイテレータ、次の#elif/#else/#endifを指して戻る
+    */
+    fn skip_group(iterator& it, sentinel end) -> std::pair<parse_result, bool> {
+      // 行末まで飛ばす
+      it = std::ranges::find_if(std::move(it), end, [](const auto &token) {
+        return token.category == pp_token_category::newline;
+      });
+      ++it;
 
-      return this->group(it, end);
+      return this->group_false(it, end);
     }
 
     fn else_group(iterator& it, sentinel end) -> parse_result {
@@ -744,8 +1786,62 @@ namespace kusabira::PP {
     }
 
     fn text_line(iterator& it, sentinel end) -> parse_result {
+      // 空でないテキスト行で、依存関係を宣言する部分は終わる
+      if (deref(it).category != pp_token_category::newline and not this->end_preamble()) {
+        return kusabira::ok(pp_parse_status::EndOfFile);
+      }
+
+      if (m_scan_only) {
+        // 依存関係の走査ではテキスト行を処理しない
+        return this->skip_text_line(it, end);
+      }
+
+      // 上限を超えた時の診断メッセージのために、行頭の位置だけを覚えておく
+      const auto line_column = deref(it).column;
+      const auto line_ref = deref(it).srcline_ref;
+      const auto prev_size = m_pptoken_list.size();
+
       //1行分プリプロセッシングトークン列読み出し
-      return this->pp_tokens<true, false>(it, end, this->m_pptoken_list);
+      auto status = this->pp_tokens<true, false>(it, end, this->m_pptoken_list);
+
+      if (auto error = m_preprocessor.m_macro_manager.budget().output(m_pptoken_list.size() - prev_size); status and error) {
+        const pptoken_t line_head{ pp_token_category::empty, {}, line_column, line_ref };
+        m_reporter->pp_err_report(m_filename, line_head, *error);
+        return kusabira::error(pp_err_info{ line_head, *error });
+      }
+
+      return status;
+    }
+
+    /**
+    * @brief 行の残りをプリプロセッシングトークンを構成せずに読み飛ばす
+    * @details トークナイザが対応していれば、行の残りはトークナイズもせずに読み飛ばす
+    * @param it 行の途中のトークンを指すイテレータ、行末の改行の次を指して戻る
+    * @param end トークン列の終端
+    */
+    fn skip_text_line(iterator& it, sentinel end) -> parse_result {
+      if constexpr (requires { m_tokenizer.skip_line(); }) {
+        // 改行を読んだ後のトークナイザは次の行を指しているので、行の途中にいる時だけ使用できる
+        if (auto kind = deref(it).category; kind != pp_token_category::newline and kind != pp_token_category::during_raw_string_literal and m_tokenizer.skip_line()) {
+          ++it;
+          return this->newline(it, end);
+        }
+      }
+
+      while (it != end and deref(it).category != pp_token_category::newline) {
+        if (deref(it).category == pp_token_category::during_raw_string_literal) {
+          // 複数行にわたる生文字列リテラルの中の改行で止まらないようにする
+          [[maybe_unused]] auto rawstr = read_rawstring_tokens(it, end);
+          if (it == end) break;
+        }
+        ++it;
+      }
+
+      if (it == end) {
+        return kusabira::error(pp_err_info{ pptoken_t{pp_token_category::empty}, pp_parse_context::UnexpectedEOF });
+      }
+
+      return this->newline(it, end);
     }
 
     /**
@@ -963,7 +2059,7 @@ namespace kusabira::PP {
       return kusabira::ok(std::move(pptoken_list));
     }
 
-    using expecetd_macro_args = kusabira::expected<std::pmr::vector<pptoken_list_t>, pp_err_info>;
+    using expecetd_macro_args = kusabira::expected<macro_args, pp_err_info>;
 
     /**
     * @brief 関数マクロの実引数プリプロセッシングトークン列を読み出す
@@ -1017,16 +2113,17 @@ namespace kusabira::PP {
       // 実引数パース中のエラーを保持する
       std::optional<pp_err_info> err{};
 
-      auto args = parse_macro_args(it, end, [this, &err](Iterator& itr, Sentinel fin, auto& arg_list) -> bool {
+      auto args = parse_macro_args(it, end, [this, &err](Iterator& itr, Sentinel fin, macro_args& arg_list) -> bool {
         const auto cat = deref(itr).category;
 
         if (cat == pp_token_category::whitespaces) {
           // マクロ引数先頭のホワイトスペースはスキップされているため、空で無いことを仮定できる
-          assert(not std::ranges::empty(arg_list));
+          assert(not std::ranges::empty(arg_list.pending()));
 
           // マクロ引数中の空白文字の並びは1つに圧縮される
-          if (auto& prev_token = arg_list.back(); prev_token.category != pp_token_category::whitespaces) {
-            auto& wstoken = arg_list.emplace_back(std::move(*itr));
+          if (auto& prev_token = arg_list.pending().back(); prev_token.category != pp_token_category::whitespaces) {
+            arg_list.push_token(std::move(*itr));
+            auto& wstoken = arg_list.pending().back();
             if (1 < size(wstoken.token)) {
               // ホワイトスペース列を1つに圧縮
               wstoken.token = u8" "sv;
@@ -1037,12 +2134,13 @@ namespace kusabira::PP {
         }
         if (pp_token_category::newline <= cat and cat <= pp_token_category::block_comment) {
           // マクロ引数先頭のホワイトスペースはスキップされているため、空で無いことを仮定できる
-          assert(not std::ranges::empty(arg_list));
+          assert(not std::ranges::empty(arg_list.pending()));
 
           // 改行やコメントは1つのは空白文字として扱う、マクロ引数中の空白文字の並びは1つに圧縮される
-          if (auto& prev_token = arg_list.back(); prev_token.category != pp_token_category::whitespaces) {
+          if (auto& prev_token = arg_list.pending().back(); prev_token.category != pp_token_category::whitespaces) {
             // 今のトークンを元にして（ソースコンテキストの情報を受け継いで）ホワイトスペーストークンを生成
-            auto& gen_token = arg_list.emplace_back(std::move(*itr));
+            arg_list.push_token(std::move(*itr));
+            auto& gen_token = arg_list.pending().back();
             gen_token.category = pp_token_category::whitespaces;
             gen_token.token = u8" "sv;
           }
@@ -1052,7 +2150,7 @@ namespace kusabira::PP {
 
         //実引数となるプリプロセッシングトークンを構成する
         if (auto result = this->construct_next_pptoken<false, true>(itr, fin); result) {
-          arg_list.splice(arg_list.end(), std::move(*result));
+          arg_list.push_tokens(std::move(*result));
         } else {
           //エラーが起きてる
           err = std::move(result).error();
@@ -1102,82 +2200,82 @@ namespace kusabira::PP {
       expecetd_macro_args arg_list{};
       // 展開途中の関数マクロを探す
       std::optional<bool> is_funcmacro{};
-      // 未処理の先頭位置
-      auto untreated_pos = list.begin();
-
-      // ここにきている場合、関数マクロの呼び出し候補そのものは処理済みのリスト内で見つかるはず
-      do {
-        auto pos = std::ranges::find_if(untreated_pos, list.end(), [&](auto &token) {
-          is_funcmacro = m_preprocessor.is_macro(token.token);
-          return bool(is_funcmacro);
-        });
 
-        if (pos == list.end()) {
-          // 見つかるはずのマクロが見つからなかった
-          // 入力リストの中に必ず未処理の関数マクロがある、なければ他のマクロ処理部がおかしい
-          return kusabira::error(pp_err_info{ std::move(*it), pp_parse_context::ControlLine });
-        }
-        // 必ず関数マクロのはず（オブジェクトマクロは処理済みなので出てこない）
-        assert(*is_funcmacro);
+      // 展開結果の中でさらに呼び出しが閉じていなければ、その結果を入力として繰り返す
+      while (true) {
+        // 未処理の先頭位置
+        auto untreated_pos = list.begin();
 
-        // マクロ位置までのトークンを移動する
-        complete_list.splice(complete_list.end(), list, untreated_pos, pos);
+        // ここにきている場合、関数マクロの呼び出し候補そのものは処理済みのリスト内で見つかるはず
+        do {
+          auto pos = std::ranges::find_if(untreated_pos, list.end(), [&](auto &token) {
+            is_funcmacro = m_preprocessor.is_macro(token.token);
+            return bool(is_funcmacro);
+          });
 
-        // マクロ名を記録
-        // ムーブしたいがこれがマクロ呼び出しされているかはここではわからず、ループする可能性があるのでコピー
-        macro_name = *pos;
+          if (pos == list.end()) {
+            // 見つかるはずのマクロが見つからなかった
+            // 入力リストの中に必ず未処理の関数マクロがある、なければ他のマクロ処理部がおかしい
+            return kusabira::error(pp_err_info{ std::move(*it), pp_parse_context::ControlLine });
+          }
+          // 必ず関数マクロのはず（オブジェクトマクロは処理済みなので出てこない）
+          assert(*is_funcmacro);
 
-        // マクロ名の次に進める
-        if (++pos; pos == list.end()) {
-          // 終端に到達しているとき（リストの要素数が1のとき）、結合の必要はない
-          arg_list = this->funcmacro_args(it, se);
-        } else {
-          // リストの残りの関数マクロ呼び出しトークン列と未処理のPPトークン列を連結し、引数リストを構成する
-          arg_list = this->funcmacro_args(concat_ref(pos, list.end(), it, se));
-        }
+          // マクロ位置までのトークンを移動する
+          complete_list.splice(complete_list.end(), list, untreated_pos, pos);
 
-        // 処理済みの位置を更新
-        untreated_pos = pos;
+          // マクロ名を記録
+          // ムーブしたいがこれがマクロ呼び出しされているかはここではわからず、ループする可能性があるのでコピー
+          macro_name = *pos;
 
-        if (not arg_list) {
-          pp_err_info& errinfo = arg_list.error();
-          if (errinfo.context == pp_parse_context::Funcmacro_NotInvoke) {
-            //マクロの呼び出しではなかった時、マクロ名を単に識別子として処理
-            complete_list.emplace_back(std::move(macro_name));
-            //再スキャンする
-            continue;
+          // マクロ名の次に進める
+          if (++pos; pos == list.end()) {
+            // 終端に到達しているとき（リストの要素数が1のとき）、結合の必要はない
+            arg_list = this->funcmacro_args(it, se);
           } else {
-            //なんか途中でエラー、expectedを変換してそのまま返す
-            return std::move(arg_list).map([](auto &&) {
-              return pptoken_list_t{};
-            });
+            // リストの残りの関数マクロ呼び出しトークン列と未処理のPPトークン列を連結し、引数リストを構成する
+            arg_list = this->funcmacro_args(concat_ref(pos, list.end(), it, se));
           }
-        }
-      } while (not arg_list);
 
-      // 関数マクロ置換
-      auto [success, complete, funcmacro_result] = m_preprocessor.expand_funcmacro(*m_reporter, macro_name, *arg_list, outer_macro);
+          // 処理済みの位置を更新
+          untreated_pos = pos;
 
-      if (not success) {
-        // なんか途中でエラー、expectedを変換してそのまま返す
-        return kusabira::error(pp_err_info{ std::move(*it), pp_parse_context::ControlLine });
-      }
-      if (not complete) {
-        // resultに対して再帰的に再スキャンする
-        auto recursive_result = this->further_macro_replacement(std::move(funcmacro_result), it, se, outer_macro);
-        if (not recursive_result) {
-          return recursive_result;
+          if (not arg_list) {
+            pp_err_info& errinfo = arg_list.error();
+            if (errinfo.context == pp_parse_context::Funcmacro_NotInvoke) {
+              //マクロの呼び出しではなかった時、マクロ名を単に識別子として処理
+              complete_list.emplace_back(std::move(macro_name));
+              //再スキャンする
+              continue;
+            } else {
+              //なんか途中でエラー、expectedを変換してそのまま返す
+              return std::move(arg_list).map([](auto &&) {
+                return pptoken_list_t{};
+              });
+            }
+          }
+        } while (not arg_list);
+
+        // 関数マクロ置換
+        auto [success, complete, funcmacro_result] = m_preprocessor.expand_funcmacro(*m_reporter, macro_name, *arg_list, outer_macro);
+
+        if (not success) {
+          // なんか途中でエラー、expectedを変換してそのまま返す
+          return kusabira::error(pp_err_info{ std::move(*it), pp_parse_context::ControlLine });
         }
-        // 全てのマクロ処理が完了した結果（となるはず
-        funcmacro_result = std::move(*recursive_result);
-      }
 
-      // この関数で処理しているということは、入力リスト（list）の内部では収まらないマクロ呼び出しがあったということ
-      // したがって、マクロ呼び出しが完了すれば入力リストは消費され尽くしていて、未処理トークンはマクロ呼び出し完了点（閉じ括弧）の次で止まってる
-      // そのため、ここではマクロの置換結果として帰ってきたものだけを処理済みトークンとして扱えばいい
+        // この関数で処理しているということは、入力リスト（list）の内部では収まらないマクロ呼び出しがあったということ
+        // したがって、マクロ呼び出しが完了すれば入力リストは消費され尽くしていて、未処理トークンはマクロ呼び出し完了点（閉じ括弧）の次で止まってる
+        // そのため、ここではマクロの置換結果として帰ってきたものだけを処理済みトークンとして扱えばいい
+        if (complete) {
+          // 展開結果をsplice
+          complete_list.splice(complete_list.end(), std::move(funcmacro_result));
+          break;
+        }
 
-      // 展開結果をsplice
-      complete_list.splice(complete_list.end(), std::move(funcmacro_result));
+        // 結果に対して再スキャンする、ここまでの処理済みトークンはその前に来る
+        list = std::move(funcmacro_result);
+      }
 
       return kusabira::ok(std::move(complete_list));
     }
@@ -1200,8 +2298,12 @@ namespace kusabira::PP {
         return make_error(it, pp_parse_context::Newline_NotAppear);
       }
 
-      //改行を保存
-      this->m_pptoken_list.emplace_back(std::move(*it));
+      ++m_line_count;
+
+      //改行を保存、依存関係の走査時は出力しない
+      if (not m_scan_only) {
+        this->m_pptoken_list.emplace_back(std::move(*it));
+      }
       //次の行の頭のトークンへ進めて戻る
       ++it;
       return kusabira::ok(pp_parse_status::Complete);
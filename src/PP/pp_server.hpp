@@ -0,0 +1,724 @@
+#pragma once
+
+#if !__has_include(<sys/socket.h>) || !__has_include(<sys/un.h>)
+  #error "pp_server requires POSIX Unix-domain sockets."
+#endif
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <mutex>
+#include <unordered_map>
+#include <sstream>
+
+#include "../common.hpp"
+#include "../report_output.hpp"
+#include "token_cache.hpp"
+#include "pp_parser.hpp"
+#include "phase_timer.hpp"
+#include "time_trace.hpp"
+#include "macro_profiler.hpp"
+#include "allocation_stats.hpp"
+
+namespace kusabira::report::detail {
+
+  /**
+  * @brief ファイルディスクリプタへの出力
+  * @details 出力先はスレッド毎に切り替える、サーバーではクライアントから渡されたfdを設定する
+  */
+  struct fd_output {
+
+    inline static thread_local int fd = 2;
+
+    static void write_all(std::string_view str) {
+      while (not str.empty()) {
+        auto n = ::write(fd, str.data(), str.size());
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          return;
+        }
+        str.remove_prefix(static_cast<std::size_t>(n));
+      }
+    }
+
+    static void output_u8string(const std::u8string_view str) {
+      write_all({reinterpret_cast<const char*>(str.data()), str.size()});
+    }
+
+    template<typename... Args>
+    static void output(Args&&... args) {
+      std::ostringstream ss{};
+      (ss << ... << std::forward<Args>(args));
+      write_all(ss.view());
+    }
+
+    static void endl() {
+      write_all("\n");
+    }
+  };
+
+} // namespace kusabira::report::detail
+
+namespace kusabira::PP {
+
+  /**
+  * @brief プリプロセス結果の状態を表す
+  */
+  enum class pp_server_status : std::int32_t {
+    Success = 0,
+    Failed,         // プリプロセス中にエラーが発生した
+    FileNotFound,   // 入力ファイルが読めない
+    InvalidRequest, // リクエストが不正
+    OutputError     // 出力fdへの書き込みに失敗した
+  };
+
+  namespace pp_server_protocol {
+
+    /*
+    * 1接続1リクエスト
+    * クライアント -> サーバー : [request_header][パス文字列(UTF-8)]、1回目のsendmsgに出力先fdと診断出力先fdをSCM_RIGHTSで添付する
+    * サーバー -> クライアント : [reply]
+    * プリプロセス結果そのものは渡されたfdに直接書き込まれる
+    */
+
+    enum class request_kind : std::uint32_t {
+      preprocess = 0,
+      shutdown
+    };
+
+    struct request_header {
+      request_kind kind;
+      std::uint32_t path_length;
+    };
+
+    struct reply {
+      pp_server_status status;
+      std::uint32_t reserved;
+      std::uint64_t output_bytes;
+    };
+
+    // パス長の上限、不正なリクエストで巨大な領域を確保しないため
+    inline constexpr std::uint32_t max_path_length = 1u << 16;
+
+    /**
+    * @brief 指定バイト数を全て読む
+    * @return 全て読めたか否か
+    */
+    ifn read_all(int fd, void* buf, std::size_t size) -> bool {
+      auto p = static_cast<char*>(buf);
+      while (0 < size) {
+        auto n = ::read(fd, p, size);
+        if (n < 0 and errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+      }
+      return true;
+    }
+
+    /**
+    * @brief 指定バイト数を全て書き込む
+    * @return 全て書けたか否か
+    */
+    ifn write_all(int fd, const void* buf, std::size_t size) -> bool {
+      auto p = static_cast<const char*>(buf);
+      while (0 < size) {
+        auto n = ::write(fd, p, size);
+        if (n < 0 and errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+      }
+      return true;
+    }
+
+    /**
+    * @brief Unix-domain socketのアドレスを作る
+    * @return アドレス、パスが長すぎる場合はnullopt
+    */
+    ifn make_address(const fs::path& socket_path) -> std::optional<::sockaddr_un> {
+      ::sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+
+      const auto& native = socket_path.native();
+      if (sizeof(addr.sun_path) <= native.size()) return std::nullopt;
+      std::memcpy(addr.sun_path, native.c_str(), native.size() + 1);
+
+      return addr;
+    }
+
+    /**
+    * @brief リクエストヘッダとfdを送る
+    * @param sock 接続済みソケット
+    * @param header リクエストヘッダ
+    * @param fds 添付するfd（出力先と診断出力先）、負の値のものは添付しない
+    * @return 送信成否
+    */
+    ifn send_with_fds(int sock, const request_header& header, const int (&fds)[2]) -> bool {
+      ::msghdr msg{};
+      ::iovec iov{const_cast<request_header*>(&header), sizeof(header)};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      // 無効なfdは添付できないので、有効なものだけを詰める
+      int valid_fds[2]{};
+      std::size_t count = 0;
+      for (int fd : fds) {
+        if (0 <= fd) valid_fds[count++] = fd;
+      }
+
+      alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(valid_fds))]{};
+      if (0 < count) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), valid_fds, count * sizeof(int));
+      }
+
+      ssize_t n;
+      do {
+        n = ::sendmsg(sock, &msg, 0);
+      } while (n < 0 and errno == EINTR);
+
+      return n == static_cast<ssize_t>(sizeof(header));
+    }
+
+    /**
+    * @brief リクエストヘッダとfdを受け取る
+    * @param sock 接続済みソケット
+    * @param header 受け取ったヘッダの格納先
+    * @param fds 受け取ったfdの格納先、受け取れなかった場合は-1
+    * @return 受信成否
+    */
+    ifn recv_with_fds(int sock, request_header& header, int (&fds)[2]) -> bool {
+      fds[0] = fds[1] = -1;
+
+      ::msghdr msg{};
+      ::iovec iov{&header, sizeof(header)};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(fds))]{};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      ssize_t n;
+      do {
+        n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+      } while (n < 0 and errno == EINTR);
+
+      for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_RIGHTS) {
+          const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          std::memcpy(fds, CMSG_DATA(cmsg), std::min<std::size_t>(count, 2) * sizeof(int));
+        }
+      }
+
+      if (n <= 0) return false;
+      // ヘッダの残りが分割されて届いた場合
+      if (static_cast<std::size_t>(n) < sizeof(header)) {
+        return read_all(sock, reinterpret_cast<char*>(&header) + n, sizeof(header) - n);
+      }
+      return true;
+    }
+  }
+
+  /**
+  * @brief フェーズ4完了後のトークン列をテキストとして出力する
+  * @param tokens プリプロセッシングトークン列
+  * @param fd 出力先ファイルディスクリプタ
+  * @return 書き込んだバイト数、失敗した場合はnullopt
+  */
+  template<typename PPTokenList>
+  ifn write_pp_tokens(const PPTokenList& tokens, int fd) -> std::optional<std::uint64_t> {
+    // システムコール回数を抑えるため、ある程度まとめてから書き込む
+    constexpr std::size_t flush_size = 64 * 1024;
+    [[maybe_unused]] scoped_phase_timer timer{pp_phase::output};
+    std::string buffer{};
+    buffer.reserve(flush_size * 2);
+    std::uint64_t total = 0;
+
+    // 行頭もしくは直前がホワイトスペースか否か
+    bool is_separated = true;
+
+    for (const auto& token : tokens) {
+      switch (token.category) {
+        case pp_token_category::newline:
+          buffer.push_back('\n');
+          is_separated = true;
+          break;
+        case pp_token_category::placemarker_token:
+          break;
+        case pp_token_category::whitespaces:
+          if (not is_separated) buffer.push_back(' ');
+          is_separated = true;
+          break;
+        default:
+        {
+          // ホワイトスペースは保存されていないので、トークン同士が再びくっつかないように空白1つで区切る
+          if (not is_separated) buffer.push_back(' ');
+          const auto str = token.token.to_view();
+          buffer.append(reinterpret_cast<const char*>(str.data()), str.size());
+          is_separated = false;
+        }
+      }
+
+      if (flush_size <= buffer.size()) {
+        if (not pp_server_protocol::write_all(fd, buffer.data(), buffer.size())) return std::nullopt;
+        total += buffer.size();
+        buffer.clear();
+      }
+    }
+
+    if (not pp_server_protocol::write_all(fd, buffer.data(), buffer.size())) return std::nullopt;
+    total += buffer.size();
+
+    return total;
+  }
+
+  /**
+  * @brief サーバーが保持するヘッダ等のトークンキャッシュ
+  * @details パス・更新時刻・サイズが変わらない限り、ファイルを読まずにメモリ上のイメージを使い回す
+  */
+  class warm_token_cache {
+
+    struct entry {
+      fs::file_time_type mtime;
+      std::uintmax_t size;
+      std::shared_ptr<const token_cache_image> image;
+    };
+
+    fs::path m_cache_dir;
+    std::unordered_map<std::string, entry> m_entries;
+    std::mutex m_mtx;
+
+  public:
+
+    warm_token_cache(fs::path cache_dir)
+      : m_cache_dir{std::move(cache_dir)}
+    {}
+
+    /**
+    * @brief ファイルに対応するトークンキャッシュイメージを取得する
+    * @param path ソースファイルのパス
+    * @return イメージ、ファイルが読めない場合はnullptr
+    */
+    template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+    fn get(const fs::path& path) -> std::shared_ptr<const token_cache_image> {
+      std::error_code ec{};
+      const auto mtime = fs::last_write_time(path, ec);
+      if (ec) return nullptr;
+      const auto size = fs::file_size(path, ec);
+      if (ec) return nullptr;
+
+      std::lock_guard lock{m_mtx};
+
+      auto key = fs::absolute(path, ec).string();
+      if (ec) key = path.string();
+
+      if (auto it = m_entries.find(key); it != m_entries.end() and (*it).second.mtime == mtime and (*it).second.size == size) {
+        return (*it).second.image;
+      }
+
+      auto image = std::make_shared<const token_cache_image>(load_token_cache<SrcReader, Automaton>(path, m_cache_dir));
+      if (not *image) return nullptr;
+
+      m_entries.insert_or_assign(std::move(key), entry{mtime, size, image});
+      return image;
+    }
+
+    /**
+    * @brief 保持しているファイル数
+    */
+    fn size() -> std::size_t {
+      std::lock_guard lock{m_mtx};
+      return m_entries.size();
+    }
+  };
+
+  /**
+  * @brief 常駐してプリプロセスリクエストを受け付けるサーバー
+  * @details Unix-domain socketで待ち受け、クライアントから渡されたfdに結果を書き込む
+  * @details プリプロセッサの作業領域（kusabira::def_mr）はスレッドセーフではないので、リクエストは1つづつ処理する
+  * @tparam SrcReader キャッシュミス時に使用する、ソースコードを行毎に読み込む処理を実装した型
+  * @tparam Automaton キャッシュミス時に使用する、入力トークンを識別するオートマトンの型
+  */
+  template <concepts::src_reader SrcReader = filereader, concepts::tokenize_fsm Automaton = pp_tokenizer_sm>
+  class pp_server {
+    using tokenizer_t = cached_tokenizer<SrcReader, Automaton>;
+    using reporter_factory_t = report::reporter_factory<report::detail::fd_output>;
+
+    fs::path m_socket_path;
+    report::report_lang m_lang;
+    warm_token_cache m_token_cache;
+    // 全リクエストで共有する定義済みマクロ
+    std::shared_ptr<const macro_environment> m_macro_env{};
+    // 全リクエストで共有するインクルードするファイルの探索設定
+    std::shared_ptr<const include_options> m_include_options = std::make_shared<include_options>();
+    // 空でなければ、リクエスト毎のトレースをここに書き出す
+    fs::path m_time_trace_dir{};
+    // インクルードの木を診断メッセージとして出力するか否か、ディレクトリが空でなければJSONも書き出す
+    bool m_include_tree = false;
+    fs::path m_include_tree_dir{};
+    // #include毎の寄与を診断メッセージとして出力するか否か
+    bool m_include_usage = false;
+    // リクエスト毎のマクロ展開と出力の上限
+    expansion_limits m_limits{};
+    int m_listen_fd = -1;
+
+  public:
+
+    /**
+    * @brief コンストラクタ
+    * @param socket_path 待ち受けるUnix-domain socketのパス
+    * @param cache_dir トークンキャッシュを置くディレクトリ
+    * @param lang 診断メッセージの言語
+    */
+    pp_server(fs::path socket_path, fs::path cache_dir = default_token_cache_dir(), report::report_lang lang = report::report_lang::ja)
+      : m_socket_path{std::move(socket_path)}
+      , m_lang{lang}
+      , m_token_cache{std::move(cache_dir)}
+    {}
+
+    pp_server(const pp_server&) = delete;
+    pp_server& operator=(const pp_server&) = delete;
+
+    ~pp_server() {
+      this->close_listener();
+    }
+
+    /**
+    * @brief ソケットを作成し待ち受けを開始する
+    * @details 残っている古いソケットファイルは削除する
+    * @return 成否
+    */
+    fn listen() -> bool {
+      auto addr = pp_server_protocol::make_address(m_socket_path);
+      if (not addr) return false;
+
+      m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (m_listen_fd < 0) return false;
+
+      ::unlink(m_socket_path.c_str());
+      if (::bind(m_listen_fd, reinterpret_cast<const ::sockaddr*>(&*addr), sizeof(*addr)) != 0 or ::listen(m_listen_fd, SOMAXCONN) != 0) {
+        ::close(m_listen_fd);
+        m_listen_fd = -1;
+        return false;
+      }
+
+      return true;
+    }
+
+    /**
+    * @brief shutdownリクエストを受け取るまでリクエストを処理し続ける
+    * @details 終了時にはソケットを閉じ、以降の接続は受け付けない
+    */
+    void serve() {
+      assert(0 <= m_listen_fd);
+
+      kusabira::vocabulary::scope_exit listener_guard = [this] { this->close_listener(); };
+
+      while (true) {
+        int conn = ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+          if (errno == EINTR or errno == ECONNABORTED) continue;
+          return;
+        }
+
+        kusabira::vocabulary::scope_exit conn_guard = [conn] { ::close(conn); };
+
+        if (this->handle_connection(conn) == false) return;
+      }
+    }
+
+    /**
+    * @brief 1ファイルをプリプロセスし、結果をfdに書き込む
+    * @details サーバーを介さずに直接呼び出すこともできる、作業領域（kusabira::def_mr）は解放しないので必要なら呼び出し側で解放する
+    * @details プリプロセスに失敗した場合は途中までの結果を書き込まない
+    * @param path 入力ファイルパス
+    * @param out_fd プリプロセス結果の出力先
+    * @param err_fd 診断メッセージの出力先
+    * @return 状態と出力バイト数
+    */
+    fn preprocess(const fs::path& path, int out_fd, int err_fd) -> pp_server_protocol::reply {
+      using pp_server_protocol::reply;
+
+      auto image = m_token_cache.template get<SrcReader, Automaton>(path);
+      if (image == nullptr) return reply{pp_server_status::FileNotFound, 0, 0};
+
+      // 診断出力先をこのスレッドだけ切り替える
+      const int prev_fd = std::exchange(report::detail::fd_output::fd, err_fd);
+      kusabira::vocabulary::scope_exit fd_guard = [prev_fd] { report::detail::fd_output::fd = prev_fd; };
+
+      if constexpr (phase_timer_enabled) {
+        reset_phase_times();
+      }
+      if constexpr (macro_profile_enabled) {
+        reset_macro_profile();
+      }
+      std::optional<scoped_arena_accounting> accounting{};
+      if constexpr (allocation_stats_enabled) {
+        accounting.emplace();
+      }
+
+      std::optional<time_trace_ring> trace{};
+      std::optional<time_trace_session> trace_session{};
+      if (not m_time_trace_dir.empty()) {
+        trace_session.emplace(trace.emplace());
+      }
+
+      include_node include_tree{ .path = path };
+      include_usage_tracker include_usage{};
+
+      reply result{pp_server_status::Success, 0, 0};
+      {
+        ll_paser<tokenizer_t, reporter_factory_t> parser{tokenizer_t{std::move(image)}, path, m_macro_env, m_lang};
+        parser.set_include_options(m_include_options);
+        if (m_include_tree) {
+          parser.set_include_node(&include_tree);
+        }
+        if (m_include_usage) {
+          parser.set_include_usage_tracker(&include_usage);
+        }
+        parser.set_expansion_limits(m_limits);
+
+        if (auto status = parser.start(); not status) {
+          result.status = pp_server_status::Failed;
+        } else if (auto written = write_pp_tokens(parser.get_phase4_result(), out_fd); written) {
+          result.output_bytes = *written;
+        } else {
+          result.status = pp_server_status::OutputError;
+        }
+      }
+
+      // 計測が有効なら、翻訳単位毎の内訳を診断メッセージの出力先に書く
+      if constexpr (phase_timer_enabled) {
+        const auto report = format_phase_time_report(current_phase_times(), path.string());
+        (void)pp_server_protocol::write_all(err_fd, report.data(), report.size());
+      }
+      if constexpr (macro_profile_enabled) {
+        const auto report = format_macro_profile_report(current_macro_profile(), path.string());
+        (void)pp_server_protocol::write_all(err_fd, report.data(), report.size());
+      }
+      if constexpr (allocation_stats_enabled) {
+        const auto report = format_allocation_report(accounting->table(), path.string());
+        (void)pp_server_protocol::write_all(err_fd, report.data(), report.size());
+      }
+
+      if (trace) {
+        trace_session.reset();
+        std::ofstream ofs{m_time_trace_dir / (path.filename().string() + ".json"), std::ios::binary};
+        trace->write_json(ofs);
+      }
+
+      if (m_include_tree) {
+        const auto report = format_include_tree(include_tree);
+        (void)pp_server_protocol::write_all(err_fd, report.data(), report.size());
+
+        if (not m_include_tree_dir.empty()) {
+          std::ofstream ofs{m_include_tree_dir / (path.filename().string() + ".includes.json"), std::ios::binary};
+          write_include_tree_json(include_tree, ofs);
+        }
+      }
+
+      if (m_include_usage) {
+        const auto report = format_include_usage_report(include_usage.includes(), path.string());
+        (void)pp_server_protocol::write_all(err_fd, report.data(), report.size());
+      }
+
+      return result;
+    }
+
+    /**
+    * @brief 各リクエストの開始時点で定義されているマクロを設定する
+    * @param env 定義済みマクロの環境、リクエスト毎にコピーされることはない
+    */
+    void set_environment(std::shared_ptr<const macro_environment> env) {
+      m_macro_env = std::move(env);
+    }
+
+    /**
+    * @brief インクルードするファイルの探索設定を設定する
+    * @param options 探索設定、全リクエストで共有される
+    */
+    void set_include_options(std::shared_ptr<const include_options> options) {
+      m_include_options = std::move(options);
+    }
+
+    /**
+    * @brief リクエスト毎にChrome/Perfetto形式のトレースを書き出すようにする
+    * @details <dir>/<入力ファイル名>.json に、ファイル・ディレクティブ・時間のかかったマクロ展開の区間を記録する
+    * @param dir 書き出し先ディレクトリ、空なら記録しない
+    */
+    void set_time_trace_dir(fs::path dir) {
+      m_time_trace_dir = std::move(dir);
+    }
+
+    /**
+    * @brief リクエスト毎にインクルードの木と各ファイルの処理時間・出力トークン数・行数を出力するようにする
+    * @details 表は診断メッセージの出力先に書き、json_dirが空でなければ <json_dir>/<入力ファイル名>.includes.json にも書き出す
+    * @param enable 出力するか否か
+    * @param json_dir JSONの書き出し先ディレクトリ
+    */
+    void set_include_tree_report(bool enable, fs::path json_dir = {}) {
+      m_include_tree = enable;
+      m_include_tree_dir = std::move(json_dir);
+    }
+
+    /**
+    * @brief リクエスト毎に、各#includeが翻訳単位に寄与したかを出力するようにする
+    * @details ヘッダのマクロが展開されたか#if等で調べられたか、ヘッダがトークンを出力したかを調べ、何も寄与していないものを示す表を診断メッセージの出力先に書く
+    * @param enable 出力するか否か
+    */
+    void set_include_usage_report(bool enable) noexcept {
+      m_include_usage = enable;
+    }
+
+    /**
+    * @brief リクエスト毎のマクロ展開の入れ子の深さ、生成トークン数、出力トークン数、処理時間の上限を設定する
+    * @details 上限を超えたリクエストは診断メッセージを出力して失敗する
+    * @param limits 上限、0の項目は無制限
+    */
+    void set_expansion_limits(const expansion_limits& limits) noexcept {
+      m_limits = limits;
+    }
+
+    /**
+    * @brief 保持しているトークンキャッシュを取得する
+    */
+    fn token_cache() -> warm_token_cache& {
+      return m_token_cache;
+    }
+
+  private:
+
+    /**
+    * @brief 待ち受けソケットを閉じ、ソケットファイルを削除する
+    */
+    void close_listener() noexcept {
+      if (0 <= m_listen_fd) {
+        ::close(m_listen_fd);
+        ::unlink(m_socket_path.c_str());
+        m_listen_fd = -1;
+      }
+    }
+
+    /**
+    * @brief 1接続分のリクエストを処理する
+    * @return サーバーを継続するか否か
+    */
+    fn handle_connection(int conn) -> bool {
+      using namespace pp_server_protocol;
+
+      request_header header{};
+      int fds[2]{-1, -1};
+      const bool received = recv_with_fds(conn, header, fds);
+
+      kusabira::vocabulary::scope_exit fds_guard = [&fds] {
+        for (int fd : fds) if (0 <= fd) ::close(fd);
+      };
+
+      if (not received) return true;
+      if (header.kind == request_kind::shutdown) {
+        reply r{pp_server_status::Success, 0, 0};
+        (void)write_all(conn, &r, sizeof(r));
+        return false;
+      }
+
+      reply r{pp_server_status::InvalidRequest, 0, 0};
+
+      if (header.kind == request_kind::preprocess and header.path_length <= max_path_length and 0 <= fds[0]) {
+        std::string path(header.path_length, '\0');
+        if (read_all(conn, path.data(), path.size())) {
+          // 診断出力先が渡されなければ捨てる
+          r = this->preprocess(fs::path{std::move(path)}, fds[0], 0 <= fds[1] ? fds[1] : fds[0]);
+          // 1リクエスト分の作業領域を解放する、キャッシュはdef_mrを使用していない
+          kusabira::def_mr.release();
+        }
+      }
+
+      (void)write_all(conn, &r, sizeof(r));
+      return true;
+    }
+  };
+
+
+  /**
+  * @brief サーバーに接続する
+  * @return 接続済みソケット、失敗した場合は-1
+  */
+  ifn pp_client_connect(const fs::path& socket_path) -> int {
+    auto addr = pp_server_protocol::make_address(socket_path);
+    if (not addr) return -1;
+
+    int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+
+    if (::connect(sock, reinterpret_cast<const ::sockaddr*>(&*addr), sizeof(*addr)) != 0) {
+      ::close(sock);
+      return -1;
+    }
+
+    return sock;
+  }
+
+  /**
+  * @brief サーバーにプリプロセスを依頼する
+  * @param socket_path サーバーのソケットパス
+  * @param src 入力ファイルパス、サーバーのカレントディレクトリに依存しないように絶対パスにして送る
+  * @param out_fd プリプロセス結果の出力先
+  * @param err_fd 診断メッセージの出力先
+  * @return サーバーからの応答、通信に失敗した場合はnullopt
+  */
+  ifn pp_client_request(const fs::path& socket_path, const fs::path& src, int out_fd, int err_fd) -> std::optional<pp_server_protocol::reply> {
+    using namespace pp_server_protocol;
+
+    int sock = pp_client_connect(socket_path);
+    if (sock < 0) return std::nullopt;
+    kusabira::vocabulary::scope_exit sock_guard = [sock] { ::close(sock); };
+
+    std::error_code ec{};
+    auto abs_path = fs::absolute(src, ec);
+    const auto path = (ec ? src : abs_path).string();
+    if (max_path_length < path.size()) return std::nullopt;
+
+    const request_header header{request_kind::preprocess, static_cast<std::uint32_t>(path.size())};
+    const int fds[2]{out_fd, err_fd};
+
+    if (not send_with_fds(sock, header, fds)) return std::nullopt;
+    if (not write_all(sock, path.data(), path.size())) return std::nullopt;
+
+    reply r{};
+    if (not read_all(sock, &r, sizeof(r))) return std::nullopt;
+
+    return r;
+  }
+
+  /**
+  * @brief サーバーに終了を依頼する
+  * @param socket_path サーバーのソケットパス
+  * @return 依頼に成功したか否か
+  */
+  ifn pp_client_shutdown(const fs::path& socket_path) -> bool {
+    using namespace pp_server_protocol;
+
+    int sock = pp_client_connect(socket_path);
+    if (sock < 0) return false;
+    kusabira::vocabulary::scope_exit sock_guard = [sock] { ::close(sock); };
+
+    const request_header header{request_kind::shutdown, 0};
+    if (not write_all(sock, &header, sizeof(header))) return false;
+
+    reply r{};
+    return read_all(sock, &r, sizeof(r));
+  }
+}
@@ -9,6 +9,7 @@
 #include <string>
 
 #include "common.hpp"
+#include "phase_timer.hpp"
 
 namespace kusabira::PP::concepts {
 
@@ -132,6 +133,7 @@ namespace kusabira::PP::inline tokenizer_v2 {
     */
     fn tokenize() -> std::optional<pp_token> {
       using kusabira::PP::pp_token_category;
+      [[maybe_unused]] scoped_phase_timer timer{pp_phase::tokenize};
 
       //読み込み終了のお知らせ
       if (m_is_terminate == true) return std::nullopt;
@@ -178,6 +180,26 @@ namespace kusabira::PP::inline tokenizer_v2 {
       return std::optional<pp_token>{std::in_place, m_accepter.input_newline(), token_str, length, m_line_pos};;
     }
 
+    /**
+    * @brief 現在の行の残りをトークナイズせずに読み飛ばす
+    * @details 次に切り出すトークンはその行の改行になる
+    * @details 行をまたぐ可能性のあるブロックコメントと生文字列リテラルが残りにある場合は何もしない
+    * @return 読み飛ばしたらtrue
+    */
+    fn skip_line() -> bool {
+      if (m_is_terminate == true) return false;
+      if (m_is_endline == true) return true;
+
+      const auto& line = (*m_line_pos).line;
+      const auto rest = std::u8string_view{line}.substr(std::distance(line.cbegin(), m_pos));
+      if (rest.find(u8"/*") != std::u8string_view::npos or rest.find(u8"R\"") != std::u8string_view::npos) return false;
+
+      m_pos = m_end;
+      m_is_endline = true;
+
+      return true;
+    }
+
   private:
 
     // トークナイズ結果一つ分を一時保存しておく、イテレータを可搬かつ軽量にするため
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../common.hpp"
+#include "../json_output.hpp"
+
+namespace kusabira::PP {
+
+  /**
+  * @brief トレースに記録する区間の種類
+  */
+  enum class trace_kind : std::uint8_t {
+    source,     // 1ファイルの処理（インクルードされたヘッダを含む）
+    directive,  // 1つのディレクティブの処理
+    macro,      // 1つのマクロの展開、閾値以上の時間がかかったものだけ
+  };
+
+  /**
+  * @brief トレースの区間の種類の名前を取得する
+  */
+  ifn trace_kind_name(trace_kind kind) -> std::string_view {
+    constexpr std::string_view names[] = { "Source", "Directive", "Macro" };
+    return names[static_cast<std::size_t>(kind)];
+  }
+
+  /**
+  * @brief トレースの1区間
+  */
+  struct trace_event {
+    trace_kind kind;
+    // ファイル名、ディレクティブ名、マクロ名
+    std::u8string detail;
+    // トレース開始からの経過時間
+    std::chrono::nanoseconds begin;
+    std::chrono::nanoseconds duration;
+  };
+
+  /**
+  * @brief 1スレッド分のトレースを保持するリングバッファ
+  * @details 容量を超えたら古い区間から上書きする。区間は終了時に記録されるので、外側の区間（ファイル）ほど残りやすい
+  */
+  class time_trace_ring {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<trace_event> m_events;
+    std::size_t m_capacity;
+    // 次に書き込む位置
+    std::size_t m_head = 0;
+    // 上書きされて失われた区間の数
+    std::uint64_t m_dropped = 0;
+    clock::time_point m_origin = clock::now();
+    std::chrono::nanoseconds m_macro_threshold;
+
+  public:
+
+    /**
+    * @param capacity 保持する区間の最大数
+    * @param macro_threshold これより短いマクロ展開は記録しない
+    */
+    explicit time_trace_ring(std::size_t capacity = 1 << 16, std::chrono::nanoseconds macro_threshold = std::chrono::microseconds{50})
+      : m_capacity{capacity == 0 ? 1 : capacity}
+      , m_macro_threshold{macro_threshold}
+    {
+      m_events.reserve(m_capacity);
+    }
+
+    fn origin() const noexcept -> clock::time_point {
+      return m_origin;
+    }
+
+    fn macro_threshold() const noexcept -> std::chrono::nanoseconds {
+      return m_macro_threshold;
+    }
+
+    fn dropped() const noexcept -> std::uint64_t {
+      return m_dropped;
+    }
+
+    fn size() const noexcept -> std::size_t {
+      return m_events.size();
+    }
+
+    /**
+    * @brief 区間を記録する
+    */
+    void push(trace_event&& event) {
+      if (m_events.size() < m_capacity) {
+        m_events.emplace_back(std::move(event));
+        return;
+      }
+      m_events[m_head] = std::move(event);
+      m_head = (m_head + 1) % m_capacity;
+      ++m_dropped;
+    }
+
+    /**
+    * @brief 記録した順に区間を走査する
+    */
+    template<typename F>
+    void for_each(F&& f) const {
+      for (std::size_t i = 0; i < m_events.size(); ++i) {
+        f(m_events[(m_head + i) % m_events.size()]);
+      }
+    }
+
+    /**
+    * @brief Chrome/Perfettoのトレースイベント形式（JSON）で出力する
+    * @param os 出力先
+    * @param tid トレース上のスレッド番号
+    */
+    void write_json(std::ostream& os, std::uint32_t tid = 0) const {
+      using us = std::chrono::duration<double, std::micro>;
+
+      os << "{\"traceEvents\":[";
+      bool first = true;
+
+      this->for_each([&](const trace_event& event) {
+        if (not first) os << ',';
+        first = false;
+
+        os << "\n{\"pid\":1,\"tid\":" << tid << ",\"ph\":\"X\",\"cat\":\"kusabira\",\"name\":\"" << trace_kind_name(event.kind) << '"'
+           << ",\"ts\":" << us{event.begin}.count() << ",\"dur\":" << us{event.duration}.count() << ",\"args\":{\"detail\":";
+        detail::write_json_string(event.detail, os);
+        os << "}}";
+      });
+
+      os << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":" << m_dropped << "}}\n";
+    }
+  };
+
+  namespace detail {
+    // このスレッドで記録中のトレース、記録していなければnullptr
+    inline thread_local time_trace_ring* tls_time_trace = nullptr;
+  }
+
+  /**
+  * @brief スコープの間、このスレッドのトレースをringに記録する
+  */
+  class time_trace_session {
+    time_trace_ring* m_prev;
+
+  public:
+
+    explicit time_trace_session(time_trace_ring& ring) noexcept
+      : m_prev{std::exchange(detail::tls_time_trace, &ring)}
+    {}
+
+    ~time_trace_session() {
+      detail::tls_time_trace = m_prev;
+    }
+
+    time_trace_session(const time_trace_session&) = delete;
+    time_trace_session& operator=(const time_trace_session&) = delete;
+  };
+
+  /**
+  * @brief スコープの間を1区間としてトレースに記録する
+  * @details トレースを記録していないスレッドでは時刻も取得しない
+  */
+  class scoped_trace_span {
+    using clock = std::chrono::steady_clock;
+
+    time_trace_ring* m_ring;
+    trace_kind m_kind;
+    std::u8string_view m_detail;
+    clock::time_point m_begin{};
+
+  public:
+
+    /**
+    * @param kind 区間の種類
+    * @param detail 区間の説明、スコープの間有効であること
+    */
+    scoped_trace_span(trace_kind kind, std::u8string_view detail) noexcept
+      : m_ring{detail::tls_time_trace}
+      , m_kind{kind}
+      , m_detail{detail}
+    {
+      if (m_ring != nullptr) m_begin = clock::now();
+    }
+
+    ~scoped_trace_span() {
+      if (m_ring == nullptr) return;
+
+      const auto duration = clock::now() - m_begin;
+      if (m_kind == trace_kind::macro and duration < m_ring->macro_threshold()) return;
+
+      m_ring->push(trace_event{ m_kind, std::u8string{m_detail}, m_begin - m_ring->origin(), duration });
+    }
+
+    scoped_trace_span(const scoped_trace_span&) = delete;
+    scoped_trace_span& operator=(const scoped_trace_span&) = delete;
+  };
+
+  /**
+  * @brief このスレッドでトレースを記録しているか
+  */
+  ifn time_trace_enabled() noexcept -> bool {
+    return detail::tls_time_trace != nullptr;
+  }
+
+} // namespace kusabira::PP
@@ -0,0 +1,759 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <span>
+#include <system_error>
+#include <random>
+#include <memory>
+#include <optional>
+#include <algorithm>
+
+#if __has_include(<sys/mman.h>)
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+  #define KUSABIRA_TOKEN_CACHE_MMAP
+#endif
+
+#include "../common.hpp"
+#include "file_reader.hpp"
+#include "pp_automaton.hpp"
+#include "pp_tokenizer.hpp"
+
+namespace kusabira::PP::token_cache_format {
+
+  /*
+  * トークンキャッシュファイルのレイアウト（全て実行環境のエンディアン）
+  * [header][line_record * line_count][std::uint64_t * offset_count][token_record * token_count][conditional_record * conditional_count][string table]
+  * 文字列テーブルは論理行文字列を順番に連結したもの、トークン文字列は行文字列の部分文字列として参照する
+  * 条件ディレクティブの索引は、#if/#ifdef/#ifndef/#elif/#else/#endifの位置と同じif-sectionの次のディレクティブの対応
+  */
+
+  inline constexpr char magic[8] = {'K', 'S', 'B', 'R', 'T', 'K', 'C', '\0'};
+
+  // フォーマットを変更したらインクリメントする
+  inline constexpr std::uint32_t version = 2;
+
+  struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t token_record_size;
+    std::uint64_t content_hash;
+    std::uint64_t line_count;
+    std::uint64_t offset_count;
+    std::uint64_t token_count;
+    std::uint64_t conditional_count;
+    std::uint64_t strtab_size;
+  };
+
+  struct line_record {
+    std::uint64_t phisic_line_num;
+    std::uint64_t logical_line_num;
+    // 文字列テーブル上の位置と長さ
+    std::uint64_t str_first;
+    std::uint64_t str_length;
+    // 行継続情報（logical_line::line_offset）の位置と個数
+    std::uint64_t offset_first;
+    std::uint64_t offset_count;
+  };
+
+  struct token_record {
+    // 所属する論理行のインデックス
+    std::uint32_t line_index;
+    // 論理行上での位置と長さ
+    std::uint32_t column;
+    std::uint32_t length;
+    pp_token_category category;
+    std::uint8_t padding[3];
+  };
+
+  struct conditional_record {
+    // ディレクティブの#トークンのインデックス
+    std::uint32_t token_index;
+    // 同じif-sectionの次の#elif/#else/#endifのレコードインデックス、無ければ自身
+    std::uint32_t next;
+  };
+
+  static_assert(std::is_trivially_copyable_v<header>);
+  static_assert(std::is_trivially_copyable_v<line_record>);
+  static_assert(std::is_trivially_copyable_v<token_record>);
+  static_assert(std::is_trivially_copyable_v<conditional_record>);
+  static_assert(sizeof(token_record) == 16);
+  static_assert(sizeof(conditional_record) == 8);
+
+  /**
+  * @brief バイト列のFNV-1a 64bitハッシュを求める
+  * @param bytes 入力バイト列
+  * @return ハッシュ値
+  */
+  cfn fnv1a_64(std::span<const char> bytes) noexcept -> std::uint64_t {
+    std::uint64_t hash = 14695981039346656037ull;
+
+    for (char c : bytes) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+  /**
+  * @brief ハッシュ値からキャッシュファイル名を作る
+  * @param hash ソースファイル内容のハッシュ値
+  * @return 16進16桁 + 拡張子のファイル名
+  */
+  ifn cache_filename(std::uint64_t hash) -> std::string {
+    constexpr char digits[] = "0123456789abcdef";
+    std::string name(16, '0');
+
+    for (auto i = 16; 0 < i; --i) {
+      name[i - 1] = digits[hash & 0xf];
+      hash >>= 4;
+    }
+
+    return name + ".kstc";
+  }
+
+  /**
+  * @brief トークン列から条件ディレクティブの索引を構築する
+  * @details ll_paserと同じく、行頭の#に続く識別子をディレクティブ名とみなす
+  */
+  class conditional_index_builder {
+    std::vector<conditional_record> m_records{};
+    // 開いているif-sectionの、最後のディレクティブのレコードインデックス
+    std::vector<std::uint32_t> m_open{};
+    // 行頭（ホワイトスペース以外のトークンがまだ現れていない）か否か
+    bool m_line_head = true;
+    // 行頭に現れた#のトークンインデックス
+    std::optional<std::uint32_t> m_sharp{};
+
+    /**
+    * @brief ディレクティブを記録し、開いているif-sectionの直前のディレクティブと対応付ける
+    */
+    void link(std::uint32_t sharp_index) {
+      const auto self = static_cast<std::uint32_t>(m_records.size());
+      m_records[m_open.back()].next = self;
+      m_records.push_back({sharp_index, self});
+    }
+
+  public:
+
+    /**
+    * @brief トークンを1つ入力する
+    * @param token トークン
+    * @param index ファイル先頭からのトークンインデックス
+    */
+    void input(const pp_token& token, std::uint32_t index) {
+      using namespace std::string_view_literals;
+
+      const auto category = token.category;
+
+      if (category == pp_token_category::newline) {
+        m_line_head = true;
+        m_sharp.reset();
+        return;
+      }
+      if (category == pp_token_category::whitespaces or category == pp_token_category::block_comment) return;
+
+      if (m_line_head) {
+        m_line_head = false;
+        if (category == pp_token_category::op_or_punc and token.token == u8"#"sv) m_sharp = index;
+        return;
+      }
+      if (not m_sharp) return;
+
+      const auto sharp_index = *std::exchange(m_sharp, std::nullopt);
+      if (category != pp_token_category::identifier) return;
+
+      const auto name = token.token.to_view();
+
+      if (name == u8"if"sv or name == u8"ifdef"sv or name == u8"ifndef"sv) {
+        const auto self = static_cast<std::uint32_t>(m_records.size());
+        m_records.push_back({sharp_index, self});
+        m_open.push_back(self);
+      } else if (m_open.empty()) {
+        // 対応する#if*が無い、パース時にエラーになる
+        return;
+      } else if (name == u8"elif"sv or name == u8"else"sv) {
+        this->link(sharp_index);
+        m_open.back() = static_cast<std::uint32_t>(m_records.size() - 1);
+      } else if (name == u8"endif"sv) {
+        this->link(sharp_index);
+        m_open.pop_back();
+      }
+    }
+
+    /**
+    * @brief 構築した索引を取得する
+    * @details 閉じられていないif-sectionのディレクティブは対応先を持たない（自身を指す）
+    */
+    fn finish() && -> std::vector<conditional_record> {
+      return std::move(m_records);
+    }
+  };
+}
+
+namespace kusabira::PP {
+
+  /**
+  * @brief 読み込み済みのトークンキャッシュを保持する
+  * @details 可能ならファイルをmmapし、そうでなければメモリ上のバッファを保持する
+  */
+  class token_cache_image {
+    using header = token_cache_format::header;
+    using line_record = token_cache_format::line_record;
+    using token_record = token_cache_format::token_record;
+    using conditional_record = token_cache_format::conditional_record;
+
+    // 保持している領域の先頭と長さ
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+    // mmapしているか否か
+    bool m_is_mapped = false;
+    // mmapしない場合の所有領域
+    std::vector<char> m_buffer;
+
+    void release() noexcept {
+#ifdef KUSABIRA_TOKEN_CACHE_MMAP
+      if (m_is_mapped) {
+        ::munmap(const_cast<char*>(m_data), m_size);
+      }
+#endif
+      m_data = nullptr;
+      m_size = 0;
+      m_is_mapped = false;
+      m_buffer.clear();
+    }
+
+  public:
+
+    token_cache_image() = default;
+
+    /**
+    * @brief メモリ上に構築したキャッシュイメージから構築
+    * @param buffer シリアライズ済みのバイト列
+    */
+    explicit token_cache_image(std::vector<char>&& buffer)
+      : m_buffer{std::move(buffer)}
+    {
+      m_data = m_buffer.data();
+      m_size = m_buffer.size();
+    }
+
+    token_cache_image(const token_cache_image&) = delete;
+    token_cache_image& operator=(const token_cache_image&) = delete;
+
+    token_cache_image(token_cache_image&& other) noexcept
+      : m_data{std::exchange(other.m_data, nullptr)}
+      , m_size{std::exchange(other.m_size, 0)}
+      , m_is_mapped{std::exchange(other.m_is_mapped, false)}
+      , m_buffer{std::move(other.m_buffer)}
+    {}
+
+    token_cache_image& operator=(token_cache_image&& other) noexcept {
+      if (this != &other) {
+        this->release();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_is_mapped = std::exchange(other.m_is_mapped, false);
+        m_buffer = std::move(other.m_buffer);
+      }
+      return *this;
+    }
+
+    ~token_cache_image() {
+      this->release();
+    }
+
+    /**
+    * @brief キャッシュファイルを開く
+    * @details POSIX環境ではmmapし、それ以外では全体を読み込む
+    * @param path キャッシュファイルのパス
+    * @param content_hash 期待するソースファイル内容のハッシュ値
+    * @return 妥当なキャッシュであればそのイメージ、そうでなければnullopt
+    */
+    sfn open(const fs::path& path, std::uint64_t content_hash) -> std::optional<token_cache_image> {
+      token_cache_image image{};
+
+#ifdef KUSABIRA_TOKEN_CACHE_MMAP
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return std::nullopt;
+
+      struct ::stat st{};
+      if (::fstat(fd, &st) != 0 or st.st_size < static_cast<off_t>(sizeof(header))) {
+        ::close(fd);
+        return std::nullopt;
+      }
+
+      void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      // マップした後はfdは不要
+      ::close(fd);
+      if (p == MAP_FAILED) return std::nullopt;
+
+      image.m_data = static_cast<const char*>(p);
+      image.m_size = static_cast<std::size_t>(st.st_size);
+      image.m_is_mapped = true;
+#else
+      std::ifstream ifs{path, std::ios::binary};
+      if (not ifs) return std::nullopt;
+
+      std::error_code ec{};
+      const auto size = fs::file_size(path, ec);
+      if (ec or size < sizeof(header)) return std::nullopt;
+
+      image.m_buffer.resize(size);
+      if (not ifs.read(image.m_buffer.data(), size)) return std::nullopt;
+
+      image.m_data = image.m_buffer.data();
+      image.m_size = image.m_buffer.size();
+#endif
+
+      if (not image.validate(content_hash)) return std::nullopt;
+
+      return std::optional<token_cache_image>{std::move(image)};
+    }
+
+    /**
+    * @brief イメージがキャッシュとして妥当かを検査する
+    * @param content_hash 期待するソースファイル内容のハッシュ値
+    * @return 妥当ならtrue
+    */
+    fn validate(std::uint64_t content_hash) const noexcept -> bool {
+      if (m_size < sizeof(header)) return false;
+
+      const auto& h = this->get_header();
+      if (std::memcmp(h.magic, token_cache_format::magic, sizeof(h.magic)) != 0) return false;
+      if (h.version != token_cache_format::version) return false;
+      if (h.token_record_size != sizeof(token_record)) return false;
+      if (h.content_hash != content_hash) return false;
+
+      // 各テーブルのサイズとファイルサイズが一致するか（巨大な値によるオーバーフローも弾く）
+      const std::uint64_t rest = m_size - sizeof(header);
+      if (rest / sizeof(line_record) < h.line_count) return false;
+      std::uint64_t expect = h.line_count * sizeof(line_record);
+      if ((rest - expect) / sizeof(std::uint64_t) < h.offset_count) return false;
+      expect += h.offset_count * sizeof(std::uint64_t);
+      if ((rest - expect) / sizeof(token_record) < h.token_count) return false;
+      expect += h.token_count * sizeof(token_record);
+      if ((rest - expect) / sizeof(conditional_record) < h.conditional_count) return false;
+      expect += h.conditional_count * sizeof(conditional_record);
+
+      if (rest - expect != h.strtab_size) return false;
+
+      // 各レコードが範囲内を指しているか
+      for (const auto& line : this->lines()) {
+        if (h.strtab_size < line.str_first or h.strtab_size - line.str_first < line.str_length) return false;
+        if (h.offset_count < line.offset_first or h.offset_count - line.offset_first < line.offset_count) return false;
+      }
+      std::uint32_t prev_index = 0;
+      for (const auto& token : this->tokens()) {
+        if (h.line_count <= token.line_index or token.line_index < prev_index) return false;
+        if (this->lines()[token.line_index].str_length < std::uint64_t(token.column) + token.length) return false;
+        prev_index = token.line_index;
+      }
+      std::uint32_t prev_token = 0;
+      for (const auto& cond : this->conditionals()) {
+        if (h.token_count <= cond.token_index or cond.token_index < prev_token) return false;
+        if (h.conditional_count <= cond.next) return false;
+        prev_token = cond.token_index;
+      }
+
+      return true;
+    }
+
+    fn get_header() const noexcept -> const header& {
+      return *reinterpret_cast<const header*>(m_data);
+    }
+
+    fn lines() const noexcept -> std::span<const line_record> {
+      const auto& h = this->get_header();
+      return {reinterpret_cast<const line_record*>(m_data + sizeof(header)), static_cast<std::size_t>(h.line_count)};
+    }
+
+    fn line_offsets() const noexcept -> std::span<const std::uint64_t> {
+      const auto& h = this->get_header();
+      const auto first = sizeof(header) + h.line_count * sizeof(line_record);
+      return {reinterpret_cast<const std::uint64_t*>(m_data + first), static_cast<std::size_t>(h.offset_count)};
+    }
+
+    fn tokens() const noexcept -> std::span<const token_record> {
+      const auto& h = this->get_header();
+      const auto first = sizeof(header) + h.line_count * sizeof(line_record) + h.offset_count * sizeof(std::uint64_t);
+      return {reinterpret_cast<const token_record*>(m_data + first), static_cast<std::size_t>(h.token_count)};
+    }
+
+    fn conditionals() const noexcept -> std::span<const conditional_record> {
+      const auto& h = this->get_header();
+      const auto first = sizeof(header) + h.line_count * sizeof(line_record) + h.offset_count * sizeof(std::uint64_t) + h.token_count * sizeof(token_record);
+      return {reinterpret_cast<const conditional_record*>(m_data + first), static_cast<std::size_t>(h.conditional_count)};
+    }
+
+    fn string_table() const noexcept -> std::u8string_view {
+      const auto& h = this->get_header();
+      return {reinterpret_cast<const char8_t*>(m_data + (m_size - h.strtab_size)), static_cast<std::size_t>(h.strtab_size)};
+    }
+
+    fn is_mapped() const noexcept -> bool {
+      return m_is_mapped;
+    }
+
+    explicit operator bool() const noexcept {
+      return m_data != nullptr;
+    }
+  };
+
+
+  /**
+  * @brief ソースファイルをトークナイズし、キャッシュイメージにシリアライズする
+  * @tparam SrcReader ソースコードを行毎に読み込む処理を実装した型
+  * @tparam Automaton 入力トークンを識別するオートマトンの型
+  * @param srcpath ソースファイルのパス
+  * @param content_hash ソースファイル内容のハッシュ値
+  * @return シリアライズ済みのバイト列
+  */
+  template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+  ifn serialize_token_stream(const fs::path& srcpath, std::uint64_t content_hash) -> std::vector<char> {
+    namespace fmt = token_cache_format;
+
+    std::vector<fmt::line_record> lines{};
+    std::vector<std::uint64_t> offsets{};
+    std::vector<fmt::token_record> tokens{};
+    std::pmr::u8string strtab{&kusabira::def_mr};
+    fmt::conditional_index_builder conditionals{};
+
+    tokenizer<SrcReader, Automaton> tk{srcpath};
+    // 前のトークンの所属する行
+    std::optional<pp_token::line_iterator> prev_line{};
+
+    while (auto token = tk.tokenize()) {
+      if (not prev_line or *prev_line != token->srcline_ref) {
+        // 新しい論理行に入った
+        const auto& ll = *token->srcline_ref;
+        lines.push_back({ll.phisic_line_num, ll.logical_line_num, strtab.length(), ll.line.length(), offsets.size(), ll.line_offset.size()});
+        offsets.insert(offsets.end(), ll.line_offset.begin(), ll.line_offset.end());
+        strtab.append(ll.line);
+        prev_line = token->srcline_ref;
+      }
+
+      const auto str = token->token.to_view();
+      // 行文字列内の位置を参照するので、長さ以外は行から復元できる
+      assert(str.empty() or str.data() == (*token->srcline_ref).line.data() + token->column);
+      assert(lines.size() <= std::numeric_limits<std::uint32_t>::max() and token->column <= std::numeric_limits<std::uint32_t>::max());
+
+      conditionals.input(*token, static_cast<std::uint32_t>(tokens.size()));
+      tokens.push_back({static_cast<std::uint32_t>(lines.size() - 1), static_cast<std::uint32_t>(token->column), static_cast<std::uint32_t>(str.length()), token->category, {}});
+    }
+
+    const auto conditional_records = std::move(conditionals).finish();
+
+    fmt::header h{};
+    std::memcpy(h.magic, fmt::magic, sizeof(h.magic));
+    h.version = fmt::version;
+    h.token_record_size = sizeof(fmt::token_record);
+    h.content_hash = content_hash;
+    h.line_count = lines.size();
+    h.offset_count = offsets.size();
+    h.token_count = tokens.size();
+    h.conditional_count = conditional_records.size();
+    h.strtab_size = strtab.size();
+
+    std::vector<char> buffer{};
+    buffer.reserve(sizeof(h) + lines.size() * sizeof(fmt::line_record) + offsets.size() * sizeof(std::uint64_t) + tokens.size() * sizeof(fmt::token_record) + conditional_records.size() * sizeof(fmt::conditional_record) + strtab.size());
+
+    auto append = [&buffer](const void* p, std::size_t n) {
+      const auto first = static_cast<const char*>(p);
+      buffer.insert(buffer.end(), first, first + n);
+    };
+
+    append(&h, sizeof(h));
+    append(lines.data(), lines.size() * sizeof(fmt::line_record));
+    append(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    append(tokens.data(), tokens.size() * sizeof(fmt::token_record));
+    append(conditional_records.data(), conditional_records.size() * sizeof(fmt::conditional_record));
+    append(strtab.data(), strtab.size());
+
+    return buffer;
+  }
+
+  /**
+  * @brief ファイル内容のハッシュ値を計算する
+  * @param srcpath ソースファイルのパス
+  * @return ハッシュ値、読み込めなければnullopt
+  */
+  ifn hash_file_content(const fs::path& srcpath) -> std::optional<std::uint64_t> {
+    std::ifstream ifs{srcpath, std::ios::binary};
+    if (not ifs) return std::nullopt;
+
+    std::error_code ec{};
+    const auto size = fs::file_size(srcpath, ec);
+    if (ec) return std::nullopt;
+
+    std::vector<char> content(size);
+    if (not ifs.read(content.data(), size)) return std::nullopt;
+
+    return token_cache_format::fnv1a_64(content);
+  }
+
+  /**
+  * @brief 既定のキャッシュディレクトリを取得する
+  * @details 環境変数KUSABIRA_TOKEN_CACHE_DIRがあればそこ、なければ一時ディレクトリ以下
+  * @return キャッシュディレクトリのパス
+  */
+  ifn default_token_cache_dir() -> fs::path {
+    if (const char* dir = std::getenv("KUSABIRA_TOKEN_CACHE_DIR"); dir != nullptr and *dir != '\0') {
+      return fs::path{dir};
+    }
+
+    std::error_code ec{};
+    auto tmp = fs::temp_directory_path(ec);
+    if (ec) return fs::path{"kusabira_token_cache"};
+
+    return tmp / "kusabira_token_cache";
+  }
+
+  /**
+  * @brief ソースファイルに対応するトークンキャッシュを取得する
+  * @details キャッシュディレクトリに内容ハッシュをキーとしたキャッシュがあればそれを開き、なければトークナイズしてキャッシュを書き出す
+  * @details キャッシュの書き出しに失敗してもメモリ上のイメージは有効
+  * @param srcpath ソースファイルのパス
+  * @param cache_dir キャッシュディレクトリ
+  * @return キャッシュイメージ、ソースファイルが読めなければ空のイメージ
+  */
+  template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+  ifn load_token_cache(const fs::path& srcpath, const fs::path& cache_dir) -> token_cache_image {
+    const auto hash = hash_file_content(srcpath);
+    if (not hash) return {};
+
+    const auto cache_path = cache_dir / token_cache_format::cache_filename(*hash);
+
+    if (auto image = token_cache_image::open(cache_path, *hash); image) {
+      return *std::move(image);
+    }
+
+    auto buffer = serialize_token_stream<SrcReader, Automaton>(srcpath, *hash);
+
+    // 書き出しはベストエフォート、一時ファイルに書いてから置き換えることで並列実行時に壊れたキャッシュを読まないようにする
+    std::error_code ec{};
+    fs::create_directories(cache_dir, ec);
+    if (not ec) {
+      auto tmp_path = cache_path;
+      tmp_path += ".tmp" + std::to_string(std::random_device{}());
+
+      {
+        std::ofstream ofs{tmp_path, std::ios::binary | std::ios::trunc};
+        ofs.write(buffer.data(), buffer.size());
+        if (not ofs) ec = std::make_error_code(std::errc::io_error);
+      }
+
+      if (not ec) fs::rename(tmp_path, cache_path, ec);
+      if (ec) fs::remove(tmp_path, ec);
+    }
+
+    return token_cache_image{std::move(buffer)};
+  }
+
+
+  /**
+  * @brief トークンキャッシュからプリプロセッシングトークンを読み出す
+  * @details tokenizerと同じインターフェースを持ち、ll_paserのトークナイザとして使用できる
+  * @details 内容が変化していないファイルについては字句解析をスキップする
+  * @tparam SrcReader キャッシュミス時に使用する、ソースコードを行毎に読み込む処理を実装した型
+  * @tparam Automaton キャッシュミス時に使用する、入力トークンを識別するオートマトンの型
+  */
+  template <concepts::src_reader SrcReader, concepts::tokenize_fsm Automaton>
+  class cached_tokenizer {
+    using line_iterator = std::pmr::forward_list<logical_line>::const_iterator;
+
+    //キャッシュイメージ
+    std::shared_ptr<const token_cache_image> m_image;
+    //行バッファ
+    std::pmr::forward_list<logical_line> m_lines;
+    //最後に展開した行
+    line_iterator m_line_pos;
+    //展開済みの行数
+    std::size_t m_line_count = 0;
+    //次に読むトークンのインデックス
+    std::size_t m_token_index = 0;
+
+    /**
+    * @brief 次の論理行をキャッシュから行バッファに展開する
+    */
+    void materialize_line() {
+      const auto& rec = m_image->lines()[m_line_count];
+      const auto offsets = m_image->line_offsets().subspan(rec.offset_first, rec.offset_count);
+
+      auto it = m_lines.emplace_after(m_line_pos, rec.phisic_line_num, rec.logical_line_num);
+      (*it).line = m_image->string_table().substr(rec.str_first, rec.str_length);
+      (*it).line_offset.assign(offsets.begin(), offsets.end());
+      m_line_pos = it;
+
+      ++m_line_count;
+    }
+
+    void init() {
+      //tokenizerと同じく、ムーブ後にもイテレータが有効であるように最初の行を読んでおく
+      if (*m_image and 0 < m_image->lines().size()) this->materialize_line();
+    }
+
+  public:
+
+    cached_tokenizer(fs::path srcpath)
+      : cached_tokenizer(srcpath, default_token_cache_dir())
+    {}
+
+    cached_tokenizer(const fs::path& srcpath, const fs::path& cache_dir)
+      : cached_tokenizer(std::make_shared<const token_cache_image>(load_token_cache<SrcReader, Automaton>(srcpath, cache_dir)))
+    {}
+
+    /**
+    * @brief 読み込み済みのキャッシュイメージから構築する
+    * @details 複数のトークナイザで1つのイメージを共有できる
+    * @param image キャッシュイメージ、nullptrであってはならない
+    */
+    cached_tokenizer(std::shared_ptr<const token_cache_image> image)
+      : m_image{std::move(image)}
+      , m_lines{&kusabira::def_mr}
+      , m_line_pos{m_lines.before_begin()}
+    {
+      assert(m_image != nullptr);
+      this->init();
+    }
+
+    cached_tokenizer(const cached_tokenizer&) = delete;
+    cached_tokenizer& operator=(const cached_tokenizer&) = delete;
+
+    cached_tokenizer(cached_tokenizer&&) = default;
+    cached_tokenizer& operator=(cached_tokenizer&&) = default;
+
+    /**
+    * @brief キャッシュイメージを取得する
+    */
+    fn image() const noexcept -> const token_cache_image& {
+      return *m_image;
+    }
+
+    /**
+    * @brief トークンを一つ読み出す
+    * @return 読み出したトークンのoptional
+    */
+    fn tokenize() -> std::optional<pp_token> {
+      if (not *m_image) return std::nullopt;
+
+      const auto tokens = m_image->tokens();
+      if (tokens.size() <= m_token_index) return std::nullopt;
+
+      const auto& rec = tokens[m_token_index++];
+
+      //トークンの行まで進める、トークンは行順に並んでいる
+      while (m_line_count <= rec.line_index) this->materialize_line();
+
+      const auto& line = (*m_line_pos).line;
+      std::u8string_view token_str{};
+      if (rec.length != 0) {
+        token_str = std::u8string_view{line.data() + rec.column, rec.length};
+      }
+
+      return std::optional<pp_token>{std::in_place, rec.category, token_str, rec.column, m_line_pos};
+    }
+
+    /**
+    * @brief 無効なグループを、条件ディレクティブの索引を使って読み飛ばす
+    * @details 現在のトークンは、グループを開始した#if系/#elif/#elseの次の行の先頭にあるものとする
+    * @details 読み飛ばした行は行バッファに展開しない
+    * @return 対応する#elif/#else/#endifの#まで進めたらtrue、索引が使えなければfalse（位置は変わらない）
+    */
+    fn skip_inactive_group() -> bool {
+      if (not m_elem or m_token_index == 0) return false;
+
+      const auto tokens = m_image->tokens();
+      const auto conditionals = m_image->conditionals();
+      // 現在のトークン
+      const auto current = m_token_index - 1;
+
+      // 現在位置より前にある最後の条件ディレクティブが、このグループを開始したもの
+      const auto pos = std::ranges::partition_point(conditionals, [current](const auto& rec) { return rec.token_index < current; });
+      if (pos == conditionals.begin()) return false;
+
+      const auto& opener = *std::ranges::prev(pos);
+      // ディレクティブの直後の行でなければ索引と位置が対応していない
+      if (tokens[opener.token_index].line_index + 1 != tokens[current].line_index) return false;
+
+      const auto& partner = conditionals[opener.next];
+      // 対応するディレクティブが無い
+      if (partner.token_index <= current) return false;
+
+      // 間の行は展開せずに飛ばす
+      if (const std::size_t target_line = tokens[partner.token_index].line_index; m_line_count < target_line) {
+        m_line_count = target_line;
+      }
+      m_token_index = partner.token_index;
+      m_elem = this->tokenize();
+
+      return true;
+    }
+
+  private:
+
+    // トークン読み出し結果一つ分を一時保存しておく
+    std::optional<pp_token> m_elem = std::nullopt;
+
+    void iter_increment() {
+      this->m_elem = this->tokenize();
+    }
+
+    class cached_tokenizer_iterator {
+      cached_tokenizer* m_parent = nullptr;
+
+    public:
+      using iterator_concept = std::input_iterator_tag;
+      using difference_type = std::ptrdiff_t;
+      using value_type = pp_token;
+
+      cached_tokenizer_iterator() = default;
+
+      explicit cached_tokenizer_iterator(cached_tokenizer& parent) : m_parent{std::addressof(parent)}
+      {}
+
+      cached_tokenizer_iterator(const cached_tokenizer_iterator&) = delete;
+      cached_tokenizer_iterator &operator=(const cached_tokenizer_iterator &) = delete;
+
+      cached_tokenizer_iterator(cached_tokenizer_iterator&&) = default;
+      cached_tokenizer_iterator &operator=(cached_tokenizer_iterator&&) = default;
+
+      fn operator*() const -> value_type& {
+        return *(m_parent->m_elem);
+      }
+
+      auto operator++() -> cached_tokenizer_iterator& {
+        m_parent->iter_increment();
+        return *this;
+      }
+
+      void operator++(int) {
+        ++*this;
+      }
+
+      fn operator==(std::default_sentinel_t) const noexcept -> bool {
+        return m_parent == nullptr or m_parent->m_elem == std::nullopt;
+      }
+    };
+
+  public:
+
+    using iterator = cached_tokenizer_iterator;
+
+    ffn begin(cached_tokenizer& self) -> cached_tokenizer_iterator {
+      self.iter_increment();
+      return cached_tokenizer_iterator{self};
+    }
+
+    ffn end(cached_tokenizer&) -> std::default_sentinel_t {
+      return {};
+    }
+  };
+}
@@ -11,6 +11,7 @@
 #include <iterator>
 #include <concepts>
 #include <unordered_set>
+#include <utility>
 
 #ifdef __EDG__
   #include "../subprojects/tlexpected/include/tl/expected.hpp"
@@ -39,7 +40,60 @@ namespace kusabira {
   template<typename T, typename E>
   using expected = tl::expected<T, E>;
 
-  inline std::pmr::monotonic_buffer_resource def_mr{1024ul};
+  /**
+  * @brief 作業領域のmemory_resource
+  * @details 中身はmonotonic_buffer_resourceで、確保を集計するための前段のmemory_resourceを差し込める
+  */
+  class arena_resource final : public std::pmr::memory_resource {
+    std::pmr::monotonic_buffer_resource m_arena;
+    // 差し込まれた前段、上流にはbase()を使うこと
+    std::pmr::memory_resource* m_front = nullptr;
+
+  public:
+
+    explicit arena_resource(std::size_t initial_size)
+      : m_arena{initial_size}
+    {}
+
+    /**
+    * @brief 実際に確保を行うmemory_resourceを取得する
+    */
+    fn base() noexcept -> std::pmr::memory_resource* {
+      return &m_arena;
+    }
+
+    /**
+    * @brief 前段のmemory_resourceを差し込む
+    * @param front base()を上流に持つmemory_resource、nullptrなら外す
+    * @return 以前に差し込まれていたもの
+    */
+    auto set_front(std::pmr::memory_resource* front) noexcept -> std::pmr::memory_resource* {
+      return std::exchange(m_front, front);
+    }
+
+    /**
+    * @brief 確保した全ての領域を解放する
+    */
+    void release() {
+      m_arena.release();
+    }
+
+  private:
+
+    fn do_allocate(std::size_t bytes, std::size_t alignment) -> void* override {
+      return (m_front != nullptr ? m_front : &m_arena)->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+      (m_front != nullptr ? m_front : &m_arena)->deallocate(p, bytes, alignment);
+    }
+
+    fn do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override {
+      return this == &other;
+    }
+  };
+
+  inline arena_resource def_mr{1024ul};
 
   template<typename... Fs>
   struct overloaded : Fs... {
@@ -113,11 +167,11 @@ namespace kusabira::PP {
     //1行毎の文字列長、このvectorの長さ=継続行数
     std::pmr::vector<std::size_t> line_offset;
 
-    logical_line(std::size_t pline_num, std::size_t lline_num)
-        : line{&kusabira::def_mr}
+    logical_line(std::size_t pline_num, std::size_t lline_num, std::pmr::memory_resource* mr = &kusabira::def_mr)
+        : line{mr}
         , phisic_line_num{pline_num}
         , logical_line_num{lline_num}
-        , line_offset{&kusabira::def_mr}
+        , line_offset{mr}
     {}
 
     logical_line(logical_line &&) = default;
@@ -278,13 +332,14 @@ namespace kusabira::PP {
       * @param view トークン文字列、std::stringを入れたいときは初期化後に明示的に代入する
       * @param col 論理行上での位置（先頭からの文字数）
       * @param line 論理行オブジェクトへの参照（イテレータ）
+      * @param mr 構成トークン列に使用するmemory_resource
       */
-      pp_token(pp_token_category cat, std::u8string_view view, std::size_t col, line_iterator line)
+      pp_token(pp_token_category cat, std::u8string_view view, std::size_t col, line_iterator line, std::pmr::memory_resource* mr = &kusabira::def_mr)
         : category{ cat }
         , token{ view }
         , column{ col }
         , srcline_ref{ std::move(line) }
-        , composed_tokens{ &kusabira::def_mr}
+        , composed_tokens{ mr }
       {}
 
       /**
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string_view>
+
+namespace kusabira::PP::detail {
+
+  /**
+  * @brief JSONの文字列として出力する
+  */
+  inline void write_json_string(std::u8string_view str, std::ostream& os) {
+    os.put('"');
+    for (char8_t c : str) {
+      switch (c) {
+        case u8'"': os << "\\\""; break;
+        case u8'\\': os << "\\\\"; break;
+        case u8'\n': os << "\\n"; break;
+        case u8'\t': os << "\\t"; break;
+        default:
+          if (c < 0x20) {
+            char buf[8]{};
+            std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+            os << buf;
+          } else {
+            os.put(static_cast<char>(c));
+          }
+      }
+    }
+    os.put('"');
+  }
+}
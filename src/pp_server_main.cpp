@@ -0,0 +1,348 @@
+#include <charconv>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
+#include "PP/pp_server.hpp"
+#include "PP/macro_environment_builder.hpp"
+
+/*
+* プリプロセスサーバーとその薄いクライアント
+* kusabira_ppd serve <socket> [cache_dir] [-I<dir>...] [-iquote<dir>...] [-DNAME[=VALUE]...] [--predefined=<file>...] [--time-trace=<dir>] [--include-tree[=<dir>]] [--include-usage]
+*                    [--max-expansion-depth=<n>] [--max-expansion-tokens=<n>] [--max-output-tokens=<n>] [--time-limit=<ms>]
+*                                         : サーバーとして起動、-Dと--predefined（gcc -dM -Eの出力形式）のマクロは全リクエストで定義済みになる
+*                                           -Iと-iquoteのインクルードパスは全リクエストで使われる
+*                                           --time-traceを指定すると、リクエスト毎に<dir>/<ファイル名>.jsonへChrome/Perfetto形式のトレースを書く
+*                                           --include-treeを指定すると、リクエスト毎にインクルードの木と各ファイルのコストを診断メッセージとして書く
+*                                           <dir>を指定すると、<dir>/<ファイル名>.includes.jsonにJSONでも書く
+*                                           --include-usageを指定すると、リクエスト毎に各#includeが使われたか（何も寄与していないヘッダ）を診断メッセージとして書く
+*                                           --max-*と--time-limitは、リクエスト毎のマクロ展開の入れ子の深さ・1つのマクロ呼び出しで生成するトークン数・
+*                                           出力トークン数・処理時間[ms]の上限、超えたリクエストは失敗する（0は無制限）
+* kusabira_ppd stop <socket>              : サーバーを終了させる
+* kusabira_ppd <socket> <file>            : サーバーにプリプロセスを依頼し、結果を標準出力に書く
+* kusabira_ppd scan <file> [-I<dir>...] [-iquote<dir>...] [-DNAME[=VALUE]...] [--predefined=<file>...]
+*                  [--target=<obj>] [--depfile=<path>] [--p1689=<path>] [--cache-dir=<dir>] [--preamble-only] [--time-trace=<path>]
+*                  [--include-tree[=<path>]]
+*                                         : ディレクティブだけを処理して依存関係を求め、depfileとP1689形式で書き出す
+*                                           出力先の指定が無ければdepfileを標準出力に書く
+*                                           --cache-dirを指定すると、ディレクティブだけに縮小したソースをそこに保存して再利用する
+*                                           --preamble-onlyを指定すると、翻訳単位の最初のテキスト行（モジュール宣言とインポート宣言の並びの後）で走査を止める
+*                                           --time-traceを指定すると、走査のトレースを<path>にChrome/Perfetto形式で書く
+*                                           --include-treeを指定すると、インクルードの木を標準エラー出力に、<path>を指定すればJSONでも書く
+*/
+
+namespace {
+
+  int usage() {
+    std::cerr << "usage: kusabira_ppd serve <socket> [cache_dir] [-I<dir>...] [-iquote<dir>...] [-DNAME[=VALUE]...] [--predefined=<file>...] [--time-trace=<dir>] [--include-tree[=<dir>]] [--include-usage]\n"
+              << "                          [--max-expansion-depth=<n>] [--max-expansion-tokens=<n>] [--max-output-tokens=<n>] [--time-limit=<ms>]\n"
+              << "       kusabira_ppd stop <socket>\n"
+              << "       kusabira_ppd <socket> <file>\n"
+              << "       kusabira_ppd scan <file> [-I<dir>...] [-iquote<dir>...] [-DNAME[=VALUE]...] [--predefined=<file>...]\n"
+              << "                         [--target=<obj>] [--depfile=<path>] [--p1689=<path>] [--cache-dir=<dir>] [--preamble-only] [--time-trace=<path>]\n"
+              << "                         [--include-tree[=<path>]]" << std::endl;
+    return 2;
+  }
+
+  /**
+  * @brief --name=<n>形式の数値の引数を読む
+  * @return 読めなければnullopt
+  */
+  std::optional<std::size_t> parse_count(std::string_view arg, std::string_view name) {
+    if (not arg.starts_with(name)) return std::nullopt;
+    arg.remove_prefix(name.size());
+
+    std::size_t value = 0;
+    auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    if (ec != std::errc{} or ptr != arg.data() + arg.size()) return std::nullopt;
+    return value;
+  }
+
+  /**
+  * @brief 依存関係の走査を行う
+  */
+  int scan(int argc, char* argv[]) {
+    using namespace std::string_view_literals;
+    namespace fs = std::filesystem;
+    namespace PP = kusabira::PP;
+
+    const fs::path source = argv[2];
+    fs::path target = fs::path{source}.replace_extension(".o");
+    fs::path depfile{}, p1689{}, cache_dir{}, time_trace{}, include_tree_json{};
+    bool preamble_only = false;
+    bool include_tree = false;
+
+    PP::macro_environment_builder builder{};
+    auto options = std::make_shared<PP::include_options>();
+
+    for (int i = 3; i < argc; ++i) {
+      std::string_view arg = argv[i];
+
+      if (arg.starts_with("--predefined=")) {
+        arg.remove_prefix(13);
+        if (auto result = builder.load_definitions(arg); not result) {
+          std::cerr << "kusabira_ppd: failed to load " << arg << " (line " << result.error() << ")" << std::endl;
+          return 2;
+        }
+      } else if (arg.starts_with("--target=")) {
+        target = arg.substr(9);
+      } else if (arg.starts_with("--depfile=")) {
+        depfile = arg.substr(10);
+      } else if (arg.starts_with("--p1689=")) {
+        p1689 = arg.substr(8);
+      } else if (arg.starts_with("--cache-dir=")) {
+        cache_dir = arg.substr(12);
+      } else if (arg.starts_with("--time-trace=")) {
+        time_trace = arg.substr(13);
+      } else if (arg == "--include-tree"sv) {
+        include_tree = true;
+      } else if (arg.starts_with("--include-tree=")) {
+        include_tree = true;
+        include_tree_json = arg.substr(15);
+      } else if (arg == "--preamble-only"sv) {
+        preamble_only = true;
+      } else if (arg.starts_with("-iquote")) {
+        options->quote_dirs.emplace_back(arg.substr(7));
+      } else if (arg.starts_with("-I")) {
+        options->angle_dirs.emplace_back(arg.substr(2));
+      } else if (arg.starts_with("-D")) {
+        arg.remove_prefix(2);
+        if (not builder.define(std::u8string_view{reinterpret_cast<const char8_t*>(arg.data()), arg.size()})) {
+          std::cerr << "kusabira_ppd: invalid macro definition " << argv[i] << std::endl;
+          return 2;
+        }
+      } else {
+        return usage();
+      }
+    }
+
+    if (not fs::is_regular_file(source)) {
+      std::cerr << "kusabira_ppd: " << source << " not found" << std::endl;
+      return 1;
+    }
+
+    // ヘッダは、ディレクティブだけに縮小したものを読む
+    using minimized_tokenizer_t = PP::tokenizer<PP::minimized_reader, PP::pp_tokenizer_sm>;
+    using file_tokenizer_t = PP::tokenizer<PP::filereader, PP::pp_tokenizer_sm>;
+    using reporter_factory_t = kusabira::report::reporter_factory<kusabira::report::detail::fd_output>;
+
+    auto cache = std::make_shared<PP::minimized_source_cache>(std::move(cache_dir));
+
+    auto run = [&](auto& parser) -> std::optional<PP::dependency_info> {
+      parser.set_include_options(std::move(options));
+      parser.set_scan_only(true);
+      parser.set_minimized_source_cache(std::move(cache));
+
+      if (preamble_only) {
+        parser.set_preamble_handler([](const PP::dependency_info&) { return false; });
+      }
+
+      if constexpr (PP::phase_timer_enabled) {
+        PP::reset_phase_times();
+      }
+      if constexpr (PP::macro_profile_enabled) {
+        PP::reset_macro_profile();
+      }
+      std::optional<PP::scoped_arena_accounting> accounting{};
+      if constexpr (PP::allocation_stats_enabled) {
+        accounting.emplace();
+      }
+
+      std::optional<PP::time_trace_ring> trace{};
+      std::optional<PP::time_trace_session> trace_session{};
+      if (not time_trace.empty()) {
+        trace_session.emplace(trace.emplace());
+      }
+
+      PP::include_node tree{ .path = source };
+      if (include_tree) {
+        parser.set_include_node(&tree);
+      }
+
+      const auto status = parser.start();
+
+      if (include_tree) {
+        std::cerr << PP::format_include_tree(tree);
+
+        if (not include_tree_json.empty()) {
+          std::ofstream ofs{include_tree_json, std::ios::binary};
+          PP::write_include_tree_json(tree, ofs);
+          if (not ofs) std::cerr << "kusabira_ppd: failed to write " << include_tree_json << std::endl;
+        }
+      }
+
+      if (trace) {
+        trace_session.reset();
+        std::ofstream ofs{time_trace, std::ios::binary};
+        trace->write_json(ofs);
+        if (not ofs) std::cerr << "kusabira_ppd: failed to write " << time_trace << std::endl;
+      }
+
+      if constexpr (PP::phase_timer_enabled) {
+        std::cerr << PP::format_phase_time_report(PP::current_phase_times(), source.string());
+      }
+      if constexpr (PP::macro_profile_enabled) {
+        std::cerr << PP::format_macro_profile_report(PP::current_macro_profile(), source.string());
+      }
+      if constexpr (PP::allocation_stats_enabled) {
+        std::cerr << PP::format_allocation_report(accounting->table(), source.string());
+      }
+
+      if (not status) return std::nullopt;
+      return parser.get_dependencies();
+    };
+
+    std::optional<PP::dependency_info> result{};
+    if (preamble_only) {
+      // 縮小したソースにはテキスト行が残らないので、翻訳単位は元のファイルを読む
+      PP::ll_paser<file_tokenizer_t, reporter_factory_t> parser{file_tokenizer_t{source}, source, builder.build()};
+      result = run(parser);
+    } else {
+      PP::ll_paser<minimized_tokenizer_t, reporter_factory_t> parser{minimized_tokenizer_t{PP::minimized_reader{cache->get(source)}}, source, builder.build()};
+      result = run(parser);
+    }
+
+    if (not result) return 1;
+    const auto& deps = *result;
+
+    auto write = [](const fs::path& path, auto&& writer) -> bool {
+      std::ofstream ofs{path, std::ios::binary};
+      writer(ofs);
+      return bool(ofs);
+    };
+
+    if (not depfile.empty() and not write(depfile, [&](std::ostream& os) { PP::write_depfile(deps, target, os); })) {
+      std::cerr << "kusabira_ppd: failed to write " << depfile << std::endl;
+      return 1;
+    }
+    if (not p1689.empty() and not write(p1689, [&](std::ostream& os) { PP::write_p1689(deps, target, os); })) {
+      std::cerr << "kusabira_ppd: failed to write " << p1689 << std::endl;
+      return 1;
+    }
+    if (depfile.empty() and p1689.empty()) {
+      PP::write_depfile(deps, target, std::cout);
+    }
+
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  using namespace std::string_view_literals;
+  namespace fs = std::filesystem;
+
+  if (argc < 3) return usage();
+
+  if (argv[1] == "serve"sv) {
+    fs::path cache_dir = kusabira::PP::default_token_cache_dir();
+    bool has_cache_dir = false;
+    fs::path time_trace_dir{}, include_tree_dir{};
+    bool include_tree = false, include_usage = false;
+    kusabira::PP::macro_environment_builder builder{};
+    kusabira::PP::expansion_limits limits{};
+    auto options = std::make_shared<kusabira::PP::include_options>();
+
+    for (int i = 3; i < argc; ++i) {
+      std::string_view arg = argv[i];
+
+      if (arg.starts_with("--predefined=")) {
+        arg.remove_prefix(13);
+        if (auto result = builder.load_definitions(arg); not result) {
+          std::cerr << "kusabira_ppd: failed to load " << arg << " (line " << result.error() << ")" << std::endl;
+          return 2;
+        }
+        continue;
+      }
+
+      if (arg.starts_with("--time-trace=")) {
+        time_trace_dir = arg.substr(13);
+        continue;
+      }
+
+      if (arg == "--include-tree"sv or arg.starts_with("--include-tree=")) {
+        include_tree = true;
+        if (arg.starts_with("--include-tree=")) include_tree_dir = arg.substr(15);
+        continue;
+      }
+
+      if (arg == "--include-usage"sv) {
+        include_usage = true;
+        continue;
+      }
+
+      if (arg.starts_with("--max-") or arg.starts_with("--time-limit=")) {
+        if (auto n = parse_count(arg, "--max-expansion-depth="); n) {
+          limits.max_depth = *n;
+        } else if (auto n = parse_count(arg, "--max-expansion-tokens="); n) {
+          limits.max_expansion_tokens = *n;
+        } else if (auto n = parse_count(arg, "--max-output-tokens="); n) {
+          limits.max_output_tokens = *n;
+        } else if (auto n = parse_count(arg, "--time-limit="); n) {
+          limits.time_limit = std::chrono::milliseconds{*n};
+        } else {
+          std::cerr << "kusabira_ppd: invalid limit " << arg << std::endl;
+          return 2;
+        }
+        continue;
+      }
+
+      if (arg.starts_with("-iquote")) {
+        options->quote_dirs.emplace_back(arg.substr(7));
+        continue;
+      }
+
+      if (arg.starts_with("-I")) {
+        options->angle_dirs.emplace_back(arg.substr(2));
+        continue;
+      }
+
+      if (arg.starts_with("-D")) {
+        arg.remove_prefix(2);
+        if (not builder.define(std::u8string_view{reinterpret_cast<const char8_t*>(arg.data()), arg.size()})) {
+          std::cerr << "kusabira_ppd: invalid macro definition " << argv[i] << std::endl;
+          return 2;
+        }
+        continue;
+      }
+
+      // 位置引数はキャッシュディレクトリ1つだけ、不明なオプションはエラー
+      if (arg.starts_with("-") or has_cache_dir) return usage();
+      cache_dir = arg;
+      has_cache_dir = true;
+    }
+
+    kusabira::PP::pp_server<> server{argv[2], std::move(cache_dir)};
+    server.set_environment(builder.build());
+    server.set_include_options(std::move(options));
+    server.set_time_trace_dir(std::move(time_trace_dir));
+    server.set_include_tree_report(include_tree, std::move(include_tree_dir));
+    server.set_include_usage_report(include_usage);
+    server.set_expansion_limits(limits);
+
+    if (not server.listen()) {
+      std::cerr << "kusabira_ppd: failed to listen on " << argv[2] << std::endl;
+      return 1;
+    }
+
+    server.serve();
+    return 0;
+  }
+
+  if (argv[1] == "scan"sv) {
+    return scan(argc, argv);
+  }
+
+  if (argv[1] == "stop"sv) {
+    return kusabira::PP::pp_client_shutdown(argv[2]) ? 0 : 1;
+  }
+
+  // 標準出力と標準エラー出力をそのままサーバーに渡す
+  auto reply = kusabira::PP::pp_client_request(argv[1], argv[2], STDOUT_FILENO, STDERR_FILENO);
+  if (not reply) {
+    std::cerr << "kusabira_ppd: failed to communicate with the server " << argv[1] << std::endl;
+    return 1;
+  }
+
+  return static_cast<int>(reply->status);
+}
@@ -41,6 +41,8 @@ namespace kusabira::PP {
     PPConstexpr_InvalidArgument,      // #ifの条件式の整数リテラルの書式がおかしい（8進リテラルに89があるとか）
     PPConstexpr_EmptyCharacter,      // #ifの条件式の文字リテラルが空
     PPConstexpr_MultiCharacter,      // #ifの条件式のマルチキャラクタリテラルを警告
+    PPConstexpr_DivideByZero,        // #ifの条件式でゼロ除算が行われた
+    PPConstexpr_NestTooDeep,         // #ifの条件式の入れ子が深すぎる
 
     ControlLine,
     Define_No_Identifier,       // #defineの後に識別子が現れなかった
@@ -62,6 +64,16 @@ namespace kusabira::PP {
     ControlLine_Line_ManyToken, // #lineディレクティブの後ろに不要なトークンが付いてる（警告）
     ControlLine_Error,          // #errorディレクティブによる終了
     ControlLine_Pragma,         // #pragmaディレクティブ中のエラー
+    ControlLine_Include,        // #includeディレクティブのヘッダ名が正しくない
+    Include_NotFound,           // #includeで指定されたファイルが見つからない
+    Include_TooDeep,            // #includeの入れ子が深すぎる
+    Module_InvalidDeclaration,  // モジュール宣言・インポート宣言が;と改行で終わっていない
+    Module_NameIsMacro,         // モジュール名にオブジェクト形式マクロの名前が使われている
+    Import_HeaderNotFound,      // インポートするヘッダユニットが見つからない
+    Macro_NestTooDeep,          // マクロ展開の入れ子が深すぎる
+    Macro_TooManyTokens,        // 1つのマクロ呼び出しの展開で生成したトークンが多すぎる
+    Output_TooManyTokens,       // 翻訳単位の出力トークンが多すぎる
+    TimeLimit_Exceeded,         // 翻訳単位の処理が制限時間を超えた
 
     EndifLine_Mistake,  // #endifがくるべき所に別のものが来ている
     EndifLine_Invalid,  // #endif ~ 改行までの間に不正なトークンが現れている
@@ -166,11 +178,27 @@ namespace kusabira::report {
             {PP::pp_parse_context::ControlLine_Undef, u8"Specify the macro name."},
             {PP::pp_parse_context::ControlLine_Line_Num, u8"The number specified for the #LINE directive is incorrect. Please specify a number in the range of std::size_t."},
             {PP::pp_parse_context::ControlLine_Line_ManyToken, u8"There is an unnecessary token after the #line directive."},
+            {PP::pp_parse_context::ControlLine_Include, u8"The #include directive does not specify a valid header name."},
+            {PP::pp_parse_context::Include_NotFound, u8"The file specified by the #include directive was not found."},
+            {PP::pp_parse_context::Include_TooDeep, u8"#include is nested too deeply."},
+            {PP::pp_parse_context::Module_InvalidDeclaration, u8"A module declaration or import declaration must end with ';' followed by a line break."},
+            {PP::pp_parse_context::Module_NameIsMacro, u8"An identifier in a module name must not be defined as an object-like macro."},
+            {PP::pp_parse_context::Import_HeaderNotFound, u8"The header unit specified by the import declaration was not found."},
+            {PP::pp_parse_context::Macro_NestTooDeep, u8"Macro expansion is nested too deeply."},
+            {PP::pp_parse_context::Macro_TooManyTokens, u8"This macro invocation expands to too many tokens."},
+            {PP::pp_parse_context::Output_TooManyTokens, u8"The preprocessing result has too many tokens."},
+            {PP::pp_parse_context::TimeLimit_Exceeded, u8"Preprocessing of this translation unit exceeded the time limit."},
             {PP::pp_parse_context::Newline_NotAppear, u8"An unexpected token appears before a line break."},
             {PP::pp_parse_context::PPConstexpr_MissingCloseParent, u8"Could not find the corresponding closing parenthesis ')'."},
             {PP::pp_parse_context::PPConstexpr_Invalid, u8"This token cannot be processed by a constant expression during preprocessing."},
             {PP::pp_parse_context::PPConstexpr_EmptyCharacter, u8"It is an empty character constant."},
-            {PP::pp_parse_context::PPConstexpr_MultiCharacter, u8"Multicharacter literal use only the last character."}};
+            {PP::pp_parse_context::PPConstexpr_MultiCharacter, u8"Multicharacter literal use only the last character."},
+            {PP::pp_parse_context::PPConstexpr_FloatingPointNumber, u8"Floating point numbers cannot be used in a constant expression during preprocessing."},
+            {PP::pp_parse_context::PPConstexpr_UDL, u8"User-defined literals cannot be used in a constant expression during preprocessing."},
+            {PP::pp_parse_context::PPConstexpr_OutOfRange, u8"The integer literal is too large to be represented by any integer type."},
+            {PP::pp_parse_context::PPConstexpr_InvalidArgument, u8"The integer literal is malformed."},
+            {PP::pp_parse_context::PPConstexpr_DivideByZero, u8"Division by zero in a constant expression during preprocessing."},
+            {PP::pp_parse_context::PPConstexpr_NestTooDeep, u8"The constant expression is nested too deeply."}};
 
 //Windowsのみ、コンソール出力のために少し調整を行う
 //コンソールのコードページを変更し、UTF-8を直接出力する
@@ -303,11 +331,27 @@ namespace kusabira::report {
       {PP::pp_parse_context::Funcmacro_ReplacementFail, u8"マクロ展開時、実引数に含まれているマクロの置換に失敗しました。"},
       {PP::pp_parse_context::ControlLine_Line_Num , u8"#lineディレクティブに指定された数値が不正です。std::size_tの範囲内の数値を指定してください。"},
       {PP::pp_parse_context::ControlLine_Line_ManyToken , u8"#lineディレクティブの後に不要なトークンがあります。"},
+      {PP::pp_parse_context::ControlLine_Include, u8"#includeディレクティブに有効なヘッダ名が指定されていません。"},
+      {PP::pp_parse_context::Include_NotFound, u8"#includeで指定されたファイルが見つかりません。"},
+      {PP::pp_parse_context::Include_TooDeep, u8"#includeの入れ子が深すぎます。"},
+      {PP::pp_parse_context::Module_InvalidDeclaration, u8"モジュール宣言とインポート宣言は;と改行で終わる必要があります。"},
+      {PP::pp_parse_context::Module_NameIsMacro, u8"モジュール名の識別子はオブジェクト形式マクロとして定義されていてはなりません。"},
+      {PP::pp_parse_context::Import_HeaderNotFound, u8"インポート宣言で指定されたヘッダユニットが見つかりません。"},
+      {PP::pp_parse_context::Macro_NestTooDeep, u8"マクロ展開の入れ子が深すぎます。"},
+      {PP::pp_parse_context::Macro_TooManyTokens, u8"このマクロ呼び出しの展開で生成されるトークンが多すぎます。"},
+      {PP::pp_parse_context::Output_TooManyTokens, u8"プリプロセスの結果のトークンが多すぎます。"},
+      {PP::pp_parse_context::TimeLimit_Exceeded, u8"この翻訳単位のプリプロセスが制限時間を超えました。"},
       {PP::pp_parse_context::Newline_NotAppear, u8"改行の前に予期しないトークンが現れています。"},
       {PP::pp_parse_context::PPConstexpr_MissingCloseParent, u8"対応する閉じ括弧')'が見つかりませんでした。"},
       {PP::pp_parse_context::PPConstexpr_Invalid, u8"プリプロセス時の定数式ではこのトークンは処理できません。"},
       {PP::pp_parse_context::PPConstexpr_EmptyCharacter, u8"文字リテラルが空です。"},
-      {PP::pp_parse_context::PPConstexpr_MultiCharacter, u8"マルチキャラクタリテラルは、最後の文字だけが使用されます。"}
+      {PP::pp_parse_context::PPConstexpr_MultiCharacter, u8"マルチキャラクタリテラルは、最後の文字だけが使用されます。"},
+      {PP::pp_parse_context::PPConstexpr_FloatingPointNumber, u8"プリプロセス時の定数式では浮動小数点数は使用できません。"},
+      {PP::pp_parse_context::PPConstexpr_UDL, u8"プリプロセス時の定数式ではユーザー定義リテラルは使用できません。"},
+      {PP::pp_parse_context::PPConstexpr_OutOfRange, u8"整数リテラルの値が大きすぎて、どの整数型でも表現できません。"},
+      {PP::pp_parse_context::PPConstexpr_InvalidArgument, u8"整数リテラルの書式が正しくありません。"},
+      {PP::pp_parse_context::PPConstexpr_DivideByZero, u8"プリプロセス時の定数式でゼロ除算が行われています。"},
+      {PP::pp_parse_context::PPConstexpr_NestTooDeep, u8"定数式の入れ子が深すぎます。"}
     };
 
     fn pp_context_to_message_impl(PP::pp_parse_context context) const -> std::u8string_view override {
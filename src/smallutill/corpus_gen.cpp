@@ -0,0 +1,90 @@
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+#include "../../bench/corpus_generator.hpp"
+
+/*
+* プリプロセッサの処理速度を計るための入力を生成する
+* corpus_gen <kind|all> <output> [--seed=N] [--size=BYTES] [--depth=N] [--repeat=N]
+*   kind : plain_code, xmacro_table, nested_if, repetition_macro, raw_string, token_paste
+*   allを指定すると、<output>ディレクトリに全種類を<kind>.cppとして書き出す
+*   同じ引数からは常に同じ内容が生成されるので、生成したファイルはリポジトリに入れずに計測時に生成する
+*/
+
+namespace {
+
+  int usage() {
+    std::cerr << "usage: corpus_gen <kind|all> <output> [--seed=N] [--size=BYTES] [--depth=N] [--repeat=N]\n"
+              << "  kind: ";
+    for (auto kind : kusabira::bench::all_corpus_kinds) {
+      std::cerr << kusabira::bench::corpus_name(kind) << ' ';
+    }
+    std::cerr << std::endl;
+    return 2;
+  }
+
+  bool write_file(const std::filesystem::path& path, const std::string& content) {
+    std::ofstream ofs{path, std::ios::binary};
+    ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
+    if (not ofs) {
+      std::cerr << "corpus_gen: failed to write " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  namespace fs = std::filesystem;
+
+  if (argc < 3) return usage();
+
+  const std::string_view kind_name = argv[1];
+  const fs::path output = argv[2];
+  kusabira::bench::corpus_options options{};
+
+  auto parse_number = [](std::string_view arg, auto& value) -> bool {
+    auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    return ec == std::errc{} and ptr == arg.data() + arg.size();
+  };
+
+  for (int i = 3; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    bool valid = false;
+
+    if (arg.starts_with("--seed=")) {
+      valid = parse_number(arg.substr(7), options.seed);
+    } else if (arg.starts_with("--size=")) {
+      valid = parse_number(arg.substr(7), options.target_bytes);
+    } else if (arg.starts_with("--depth=")) {
+      valid = parse_number(arg.substr(8), options.nest_depth);
+    } else if (arg.starts_with("--repeat=")) {
+      valid = parse_number(arg.substr(9), options.repeat_count);
+    } else {
+      return usage();
+    }
+
+    if (not valid) {
+      std::cerr << "corpus_gen: invalid option " << arg << std::endl;
+      return 2;
+    }
+  }
+
+  if (kind_name == "all") {
+    std::error_code ec{};
+    fs::create_directories(output, ec);
+
+    for (auto kind : kusabira::bench::all_corpus_kinds) {
+      if (not write_file(output / (std::string{kusabira::bench::corpus_name(kind)} + ".cpp"), kusabira::bench::generate_corpus(kind, options))) return 1;
+    }
+    return 0;
+  }
+
+  const auto kind = kusabira::bench::parse_corpus_kind(kind_name);
+  if (not kind) return usage();
+
+  return write_file(output, kusabira::bench::generate_corpus(*kind, options)) ? 0 : 1;
+}
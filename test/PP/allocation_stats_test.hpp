@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "PP/allocation_stats.hpp"
+#include "test/PP/pp_paser_test.hpp"
+
+namespace kusabira_test::allocation_stats_test {
+
+  using kusabira::PP::pp_phase;
+  using enabled_timer = kusabira::PP::basic_scoped_phase_timer<true>;
+
+  TEST_CASE("counting memory resource test") {
+    kusabira::PP::counting_memory_resource counter{std::pmr::new_delete_resource()};
+
+    {
+      std::pmr::vector<char> outside{&counter};
+      outside.reserve(100);
+      {
+        [[maybe_unused]] enabled_timer timer{pp_phase::tokenize};
+        std::pmr::vector<char> v1{&counter};
+        v1.reserve(16);
+        {
+          [[maybe_unused]] enabled_timer inner{pp_phase::macro_expand};
+          std::pmr::vector<char> v2{&counter};
+          v2.reserve(64);
+
+          CHECK_EQ(counter.table().live_bytes, 180u);
+        }
+        std::pmr::vector<char> v3{&counter};
+        v3.reserve(8);
+      }
+    }
+
+    const auto& table = counter.table();
+    const auto& tokenize = table.phases[static_cast<std::size_t>(pp_phase::tokenize)];
+    const auto& expand = table.phases[static_cast<std::size_t>(pp_phase::macro_expand)];
+    const auto& other = table.phases[kusabira::PP::pp_phase_count];
+
+    CHECK_EQ(tokenize.allocations, 2u);
+    CHECK_EQ(tokenize.bytes, 24u);
+    CHECK_EQ(expand.allocations, 1u);
+    CHECK_EQ(expand.bytes, 64u);
+    CHECK_EQ(other.allocations, 1u);
+    CHECK_EQ(other.bytes, 100u);
+
+    CHECK_EQ(table.total().allocations, 4u);
+    CHECK_EQ(table.total().bytes, 188u);
+    CHECK_EQ(table.deallocations, 4u);
+    CHECK_EQ(table.live_bytes, 0u);
+    CHECK_EQ(table.high_water, 180u);
+
+    const auto report = kusabira::PP::format_allocation_report(table, "/kusabira/test.cpp");
+    CHECK_NE(report.find("/kusabira/test.cpp"), std::string::npos);
+    CHECK_NE(report.find("tokenize                      2            0.0    12.8%       12.0"), std::string::npos);
+    CHECK_NE(report.find("macro expansion               1            0.1    34.0%       64.0"), std::string::npos);
+    CHECK_NE(report.find("total                         4            0.2   100.0%       47.0"), std::string::npos);
+    CHECK_NE(report.find("high-water 0.2 KiB, 4 deallocations"), std::string::npos);
+
+    counter.reset();
+    CHECK_EQ(counter.table().total().allocations, 0u);
+  }
+
+  TEST_CASE("arena accounting test") {
+    using pp_parsing_test::string_reader;
+    using pp_parsing_test::test_tokenizer;
+    using pp_parsing_test::test_paser;
+
+    std::uint64_t allocations = 0;
+    {
+      kusabira::PP::scoped_arena_accounting accounting{};
+
+      string_reader reader{"/kusabira/test_allocation.cpp"};
+      reader.setlines(u8"#define F(x) x + x", u8"int n = F(1);");
+
+      test_paser parser{test_tokenizer{std::move(reader)}, "/kusabira/test_allocation.cpp"};
+      REQUIRE_UNARY(bool(parser.start()));
+
+      allocations = accounting.table().total().allocations;
+      CHECK_UNARY(0u < allocations);
+      CHECK_UNARY(0u < accounting.table().high_water);
+    }
+
+    {
+      kusabira::PP::scoped_arena_accounting accounting{};
+      std::pmr::u8string str{u8"outside of the phases, long enough to allocate", &kusabira::def_mr};
+      CHECK_EQ(accounting.table().phases[kusabira::PP::pp_phase_count].allocations, 1u);
+    }
+
+    // スコープを抜けたら外れている
+    CHECK_EQ(kusabira::def_mr.set_front(nullptr), nullptr);
+  }
+}
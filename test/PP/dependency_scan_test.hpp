@@ -0,0 +1,202 @@
+#pragma once
+
+#include <sstream>
+
+#include "doctest/doctest.h"
+#include "PP/dependency_scan.hpp"
+#include "test/PP/pp_paser_test.hpp"
+#include "test/PP/header_cache_test.hpp"
+
+namespace kusabira_test::dependency_scan_test {
+
+  using kusabira::PP::pp_token_category;
+  using kusabira::PP::include_lookup;
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+  using header_cache_test::result_strings;
+
+  using file_tokenizer = kusabira::PP::tokenizer<kusabira::PP::filereader, kusabira::PP::pp_tokenizer_sm>;
+  using file_paser = kusabira::PP::ll_paser<file_tokenizer, kusabira::report::reporter_factory<report::test_out>>;
+
+  /**
+  * @brief テスト用ディレクトリからの相対パスで依存ファイルを取り出す
+  */
+  inline auto relative_includes(const kusabira::PP::dependency_info& deps, const std::filesystem::path& dir) -> std::vector<std::string> {
+    std::vector<std::string> result{};
+    for (const auto& path : deps.includes) {
+      result.emplace_back(path.lexically_relative(dir).generic_string());
+    }
+    return result;
+  }
+
+  TEST_CASE("include directive test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir / "sys");
+
+    const auto path = dir / "main.cpp";
+    file_paser parser{file_tokenizer{path}, path};
+    parser.set_include_options(options);
+
+    REQUIRE_UNARY(bool(parser.start()));
+
+    // インクルードしたヘッダの結果が含まれ、マクロも定義されている
+    const auto result = [&parser] {
+      std::vector<std::u8string> result{};
+      for (const auto& pptoken : parser.get_phase4_result()) {
+        if (pptoken.category == pp_token_category::newline or pptoken.category == pp_token_category::whitespaces) continue;
+        result.emplace_back(pptoken.token.to_view());
+      }
+      return result;
+    }();
+
+    CHECK_UNARY(std::ranges::find(result, u8"nested"sv) != result.end());
+    CHECK_UNARY(std::ranges::find(result, u8"by_macro"sv) != result.end());
+    CHECK_UNARY(std::ranges::find(result, u8"LOCAL_VALUE"sv) == result.end());
+    CHECK_UNARY(std::ranges::find(result, u8"SYS_VALUE"sv) == result.end());
+    CHECK_UNARY(parser.get_preprocessor().is_defined(u8"LOCAL_VALUE"sv));
+
+    // 現れた順で重複しない
+    CHECK_EQ(relative_includes(parser.get_dependencies(), dir), (std::vector<std::string>{"local.hpp", "sub/nested.hpp", "sys/sys_header.hpp", "sub/by_macro.hpp"}));
+  }
+
+  TEST_CASE("include directive error test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+
+    auto parse = [&dir](auto&&... lines) {
+      string_reader str_reader{(dir / "error.cpp").string()};
+      str_reader.setlines(lines...);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, dir / "error.cpp"};
+      return bool(parser.start());
+    };
+
+    // <...>形式はインクルード元のディレクトリを探さない
+    CHECK_UNARY(parse(u8"#include \"local.hpp\""sv));
+    CHECK_UNARY_FALSE(parse(u8"#include <local.hpp>"sv));
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+
+    // 存在しないファイル
+    CHECK_UNARY_FALSE(parse(u8"#include \"not_exist.hpp\""sv));
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+
+    // ヘッダ名にならない
+    CHECK_UNARY_FALSE(parse(u8"#include local.hpp"sv));
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    CHECK_UNARY_FALSE(parse(u8"#include"sv));
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+
+    // 自分自身を無限にインクルードする
+    CHECK_UNARY_FALSE(parse(u8"#include \"recursive.hpp\""sv));
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+  }
+
+  TEST_CASE("dependency scan test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir / "sys");
+
+    // 依存関係はプリプロセスした場合と同じになり、出力は生成されない
+    {
+      const auto path = dir / "main.cpp";
+      file_paser parser{file_tokenizer{path}, path};
+      parser.set_include_options(options);
+      parser.set_scan_only(true);
+      parser.set_header_cache(std::make_shared<kusabira::PP::header_cache>());
+
+      REQUIRE_UNARY(bool(parser.start()));
+      CHECK_UNARY(parser.get_phase4_result().empty());
+      CHECK_EQ(relative_includes(parser.get_dependencies(), dir), (std::vector<std::string>{"local.hpp", "sub/nested.hpp", "sys/sys_header.hpp", "sub/by_macro.hpp"}));
+      CHECK_UNARY_FALSE(parser.get_dependencies().provided_module.has_value());
+    }
+
+    // モジュール宣言とインポート宣言
+    {
+      const auto path = dir / "module.cpp";
+      file_paser parser{file_tokenizer{path}, path};
+      parser.set_include_options(options);
+      parser.set_scan_only(true);
+
+      REQUIRE_UNARY(bool(parser.start()));
+
+      const auto& deps = parser.get_dependencies();
+      CHECK_EQ(relative_includes(deps, dir), std::vector<std::string>{"sub/nested.hpp"});
+      REQUIRE_UNARY(deps.provided_module.has_value());
+      CHECK_UNARY(*deps.provided_module == u8"kusabira.scan:part");
+      CHECK_UNARY(deps.is_interface);
+
+      REQUIRE_EQ(deps.required_modules.size(), 5u);
+      CHECK_UNARY(deps.required_modules[0].logical_name == u8"std");
+      CHECK_UNARY(deps.required_modules[1].logical_name == u8"kusabira.util");
+      CHECK_UNARY(deps.required_modules[2].logical_name == u8"kusabira.scan:other");
+      CHECK_EQ(deps.required_modules[2].lookup, include_lookup::none);
+
+      CHECK_UNARY(deps.required_modules[3].logical_name == u8"local.hpp");
+      CHECK_EQ(deps.required_modules[3].lookup, include_lookup::quote);
+      CHECK_EQ(deps.required_modules[3].source_path, dir / "local.hpp");
+      CHECK_UNARY(deps.required_modules[4].logical_name == u8"sys_header.hpp");
+      CHECK_EQ(deps.required_modules[4].lookup, include_lookup::angle);
+      CHECK_EQ(deps.required_modules[4].source_path, dir / "sys" / "sys_header.hpp");
+    }
+  }
+
+  TEST_CASE("dependency output test") {
+    using namespace std::string_view_literals;
+
+    kusabira::PP::dependency_info deps{ .source = "src/a b.cpp" };
+    deps.add_include("inc/x.hpp");
+    deps.add_include("inc/$y.hpp");
+    deps.add_include("inc/x.hpp");
+
+    {
+      std::ostringstream os{};
+      kusabira::PP::write_depfile(deps, "a.o", os);
+      CHECK_EQ(os.str(), "a.o: \\\n  src/a\\ b.cpp \\\n  inc/x.hpp \\\n  inc/$$y.hpp\n\ninc/x.hpp:\n\ninc/$$y.hpp:\n");
+    }
+
+    deps.provided_module = u8"m:part";
+    deps.is_interface = true;
+    deps.required_modules.push_back({ u8"std", include_lookup::none, {} });
+    deps.required_modules.push_back({ u8"h\"q.hpp", include_lookup::quote, "inc/h\"q.hpp" });
+
+    {
+      std::ostringstream os{};
+      kusabira::PP::write_p1689(deps, "a.o", os);
+      CHECK_EQ(os.str(), R"({
+  "version": 1,
+  "revision": 0,
+  "rules": [
+    {
+      "primary-output": "a.o",
+      "provides": [
+        {
+          "logical-name": "m:part",
+          "is-interface": true,
+          "source-path": "src/a b.cpp"
+        }
+      ],
+      "requires": [
+        {
+          "logical-name": "std"
+        },
+        {
+          "logical-name": "h\"q.hpp",
+          "lookup-method": "include-quote",
+          "source-path": "inc/h\"q.hpp"
+        }
+      ]
+    }
+  ]
+}
+)");
+    }
+  }
+
+} // namespace kusabira_test::dependency_scan_test
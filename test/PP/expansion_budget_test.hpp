@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "PP/expansion_budget.hpp"
+#include "PP/header_cache.hpp"
+#include "test/PP/pp_paser_test.hpp"
+
+namespace kusabira_test::expansion_budget_test {
+
+  using kusabira::PP::pp_parse_context;
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+
+  TEST_CASE("expansion budget test") {
+    using namespace std::chrono_literals;
+
+    kusabira::PP::expansion_budget budget{};
+    budget.set_limits({ .max_depth = 2, .max_expansion_tokens = 10, .max_output_tokens = 5 });
+    budget.start();
+
+    {
+      kusabira::PP::scoped_expansion_depth d1{budget};
+      CHECK_UNARY_FALSE(d1.error().has_value());
+      CHECK_UNARY_FALSE(budget.produce(6).has_value());
+      {
+        kusabira::PP::scoped_expansion_depth d2{budget};
+        CHECK_UNARY_FALSE(d2.error().has_value());
+        {
+          kusabira::PP::scoped_expansion_depth d3{budget};
+          CHECK_EQ(d3.error(), pp_parse_context::Macro_NestTooDeep);
+        }
+      }
+      // 入れ子の展開の分も数える
+      CHECK_EQ(budget.produce(5), pp_parse_context::Macro_TooManyTokens);
+    }
+    {
+      // 最も外側の展開毎に数え直す
+      kusabira::PP::scoped_expansion_depth d1{budget};
+      CHECK_UNARY_FALSE(budget.produce(10).has_value());
+    }
+
+    CHECK_UNARY_FALSE(budget.output(5).has_value());
+    CHECK_EQ(budget.output(1), pp_parse_context::Output_TooManyTokens);
+    CHECK_EQ(budget.output_tokens(), 6u);
+
+    // 期限
+    budget.set_limits({ .time_limit = 1ms });
+    budget.start();
+    std::this_thread::sleep_for(2ms);
+
+    std::optional<pp_parse_context> expired{};
+    for (int i = 0; i < 64 and not expired; ++i) expired = budget.check_deadline();
+    CHECK_EQ(expired, pp_parse_context::TimeLimit_Exceeded);
+
+    // 0は無制限
+    budget.set_limits({ .max_depth = 0, .max_expansion_tokens = 0, .max_output_tokens = 0 });
+    budget.start();
+    kusabira::PP::scoped_expansion_depth d{budget};
+    CHECK_UNARY_FALSE(d.error().has_value());
+    CHECK_UNARY_FALSE(budget.produce(std::size_t(1) << 40).has_value());
+    CHECK_UNARY_FALSE(budget.output(std::size_t(1) << 40).has_value());
+  }
+
+  TEST_CASE("expansion limits test") {
+    using namespace std::literals;
+
+    // 溜まっているログを消す
+    [[maybe_unused]] auto trash = kusabira_test::report::test_out::extract_string();
+
+    auto run = [](const std::vector<std::u8string>& lines, const kusabira::PP::expansion_limits& limits) {
+      string_reader reader{"test/expansion_limits.cpp"};
+      reader.setlines(std::span<const std::u8string>{lines});
+
+      test_paser parser{test_tokenizer{std::move(reader)}, "test/expansion_limits.cpp"};
+      parser.set_expansion_limits(limits);
+      auto status = parser.start();
+
+      return status ? std::nullopt : std::optional<pp_parse_context>{status.error().context};
+    };
+
+    // 入れ子の深さ
+    {
+      const std::vector<std::u8string> lines = { u8"#define A B", u8"#define B C", u8"#define C D", u8"#define D E", u8"#define E 1", u8"int n = A;" };
+
+      // マクロの処理中のエラーは報告済みとして返る
+      CHECK_EQ(run(lines, { .max_depth = 4 }), pp_parse_context::ControlLine);
+
+      // 上限を超えたマクロ名（Dの置換リストのE）の位置で報告される
+      const auto log = kusabira_test::report::test_out::extract_string();
+      CHECK_UNARY(log.starts_with(u8"expansion_limits.cpp:4:10: error:"sv));
+
+      CHECK_EQ(run(lines, { .max_depth = 5 }), std::nullopt);
+    }
+
+    // 指数的に膨らむマクロ
+    {
+      std::vector<std::u8string> lines = { u8"#define X1(a) a a" };
+      for (int i = 1; i < 16; ++i) {
+        const auto n = std::to_string(i), m = std::to_string(i + 1);
+        lines.emplace_back(u8"#define X" + std::u8string{m.begin(), m.end()} + u8"(a) X" + std::u8string{n.begin(), n.end()} + u8"(X" + std::u8string{n.begin(), n.end()} + u8"(a))");
+      }
+      lines.emplace_back(u8"X16(0)");
+
+      CHECK_EQ(run(lines, { .max_expansion_tokens = 1000 }), pp_parse_context::ControlLine);
+
+      const auto log = kusabira_test::report::test_out::extract_string();
+      CHECK_UNARY(log.starts_with(u8"expansion_limits.cpp:"sv));
+      CHECK_NE(log.find(u8"error:"sv), std::u8string::npos);
+    }
+
+    // 出力トークン数
+    {
+      const std::vector<std::u8string> lines(10, u8"int a = 1;");
+
+      CHECK_EQ(run(lines, { .max_output_tokens = 20 }), pp_parse_context::Output_TooManyTokens);
+      [[maybe_unused]] auto log = kusabira_test::report::test_out::extract_string();
+
+      CHECK_EQ(run(lines, {}), std::nullopt);
+    }
+
+    // キャッシュから再生したヘッダのトークンも数える
+    {
+      const auto header = kusabira::test::get_testfiles_dir() / "PP" / "header_cache.hpp";
+      auto cache = std::make_shared<kusabira::PP::header_cache>();
+
+      auto make_parser = [&cache]() {
+        string_reader reader{"test/expansion_limits.cpp"};
+        reader.setlines(u8"#define VALUE 2"sv);
+
+        auto parser = std::make_unique<test_paser>(test_tokenizer{std::move(reader)}, "test/expansion_limits.cpp");
+        parser->set_header_cache(cache);
+        REQUIRE_UNARY(bool(parser->start()));
+        return parser;
+      };
+
+      REQUIRE_UNARY(bool(make_parser()->include_file(header)));
+      REQUIRE_EQ(cache->size(), 1u);
+
+      auto parser = make_parser();
+      parser->set_expansion_limits({ .max_output_tokens = 3 });
+      auto status = parser->include_file(header);
+
+      CHECK_EQ(cache->hit_count(), 1u);
+      REQUIRE_UNARY_FALSE(bool(status));
+      CHECK_EQ(status.error().context, pp_parse_context::Output_TooManyTokens);
+    }
+  }
+}
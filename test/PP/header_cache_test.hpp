@@ -0,0 +1,143 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "PP/header_cache.hpp"
+#include "test/PP/pp_paser_test.hpp"
+#include "test/PP/pp_filereader_test.hpp"
+
+namespace kusabira_test::header_cache_test {
+
+  using kusabira::PP::pp_token_category;
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+
+  /**
+  * @brief 改行を除いたプリプロセス結果
+  */
+  inline auto result_strings(const test_paser& parser) -> std::vector<std::u8string> {
+    std::vector<std::u8string> result{};
+    for (const auto& pptoken : parser.get_phase4_result()) {
+      if (pptoken.category == pp_token_category::newline) continue;
+      result.emplace_back(pptoken.token.to_view());
+    }
+    return result;
+  }
+
+  TEST_CASE("header cache test") {
+    using namespace std::string_view_literals;
+
+    const auto header = kusabira::test::get_testfiles_dir() / "PP" / "header_cache.hpp";
+    auto cache = std::make_shared<kusabira::PP::header_cache>();
+
+    const std::vector<std::u8string> big = {u8"int", u8"big", u8"=", u8"2", u8";"};
+
+    // 翻訳単位の先頭部分を処理したパーサを作る
+    auto make_parser = [&cache](auto&&... lines) {
+      string_reader str_reader{"test/header_cache.cpp"};
+      str_reader.setlines(lines...);
+
+      auto parser = std::make_unique<test_paser>(test_tokenizer{std::move(str_reader)}, "test/header_cache.cpp");
+      parser->set_header_cache(cache);
+      REQUIRE_UNARY(bool(parser->start()));
+      return parser;
+    };
+
+    // 最初は処理して記録する
+    {
+      auto parser = make_parser(u8"#define VALUE 2"sv, u8"#define TEMP 1"sv);
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(result_strings(*parser), big);
+
+      // インクルードガードが定義された状態は別の記録になる
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(result_strings(*parser), big);
+
+      const auto& pp = parser->get_preprocessor();
+      CHECK_UNARY(pp.is_defined(u8"FROM_HEADER"sv));
+      CHECK_UNARY_FALSE(pp.is_defined(u8"TEMP"sv));
+      CHECK_EQ(cache->size(), 1u);
+      CHECK_EQ(cache->hit_count(), 0u);
+    }
+
+    // 同じマクロ定義の状態では記録を再生する
+    {
+      auto parser = make_parser(u8"#define TEMP 0"sv, u8"#define VALUE 2"sv, u8"#define OTHER"sv);
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(cache->hit_count(), 1u);
+      CHECK_EQ(result_strings(*parser), big);
+
+      // マクロ定義への副作用も再生されている
+      const auto& pp = parser->get_preprocessor();
+      CHECK_UNARY(pp.is_defined(u8"KUSABIRA_HEADER_CACHE_TEST"sv));
+      CHECK_UNARY(pp.is_defined(u8"FROM_HEADER"sv));
+      CHECK_UNARY_FALSE(pp.is_defined(u8"TEMP"sv));
+      CHECK_UNARY(pp.is_defined(u8"OTHER"sv));
+
+      const auto from_header = pp.m_macro_manager.find_definition(u8"FROM_HEADER");
+      REQUIRE_UNARY(from_header != nullptr);
+      CHECK_UNARY(from_header->is_function());
+      CHECK_EQ(from_header->params().size(), 1u);
+
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(cache->hit_count(), 2u);
+      CHECK_EQ(result_strings(*parser), big);
+    }
+
+    // 参照するマクロの定義が異なる
+    {
+      auto parser = make_parser(u8"#define VALUE 1"sv);
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(cache->hit_count(), 2u);
+      CHECK_EQ(result_strings(*parser), (std::vector<std::u8string>{u8"int", u8"small", u8"=", u8"1", u8";"}));
+    }
+
+    // ヘッダ内の#defineが以前の定義と衝突する
+    {
+      auto parser = make_parser(u8"#define VALUE 2"sv, u8"#define FROM_HEADER(x) x"sv);
+      CHECK_UNARY_FALSE(bool(parser->include_file(header)));
+      CHECK_EQ(cache->hit_count(), 2u);
+      CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    }
+
+    // 記録の再生は外側の記録にも残る
+    {
+      auto parser = make_parser(u8"#define VALUE 2"sv);
+      auto& macros = const_cast<kusabira::PP::macro_manager&>(parser->get_preprocessor().m_macro_manager);
+
+      const auto start = macros.observe_begin();
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      macros.observe_end();
+      CHECK_EQ(cache->hit_count(), 3u);
+
+      const auto& observed = macros.observed();
+      const auto names = std::span{observed.names}.subspan(start.names);
+      CHECK_UNARY(std::ranges::find(names, u8"VALUE"sv) != names.end());
+      CHECK_UNARY(std::ranges::find(names, u8"KUSABIRA_HEADER_CACHE_TEST"sv) != names.end());
+      CHECK_EQ(observed.modified.size() - start.modified, 3u);
+    }
+
+    // 既定ではキャッシュしない
+    {
+      string_reader str_reader{"test/header_cache.cpp"};
+      test_paser parser{test_tokenizer{std::move(str_reader)}, "test/header_cache.cpp"};
+      CHECK_EQ(parser.get_header_cache(), nullptr);
+    }
+
+    // キャッシュを使わない
+    {
+      auto parser = make_parser(u8"#define VALUE 2"sv);
+      parser->set_header_cache(nullptr);
+      REQUIRE_UNARY(bool(parser->include_file(header)));
+      CHECK_EQ(result_strings(*parser), big);
+      CHECK_EQ(cache->hit_count(), 3u);
+    }
+
+    // 存在しないファイル
+    {
+      auto parser = make_parser(u8"#define VALUE 2"sv);
+      CHECK_UNARY_FALSE(bool(parser->include_file(kusabira::test::get_testfiles_dir() / "PP" / "not_exist.hpp")));
+    }
+  }
+
+} // namespace kusabira_test::header_cache_test
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "PP/if_condition_memo.hpp"
+#include "PP/pp_directive_manager.hpp"
+#include "test/PP/pp_paser_test.hpp"
+
+namespace kusabira_test::if_condition_memo_test {
+
+  using kusabira::PP::pp_token;
+  using kusabira::PP::pp_token_category;
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+
+  TEST_CASE("macro fingerprint test") {
+    using namespace std::string_view_literals;
+
+    auto reporter = kusabira::report::reporter_factory<report::test_out>::create();
+    kusabira::PP::pp_directive_manager pp1{"/kusabira/test_fingerprint1.hpp"};
+    kusabira::PP::pp_directive_manager pp2{"/kusabira/test_fingerprint2.hpp"};
+
+    std::pmr::forward_list<kusabira::PP::logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+    (*pos).line = u8"A B 1 2";
+
+    const pp_token a{pp_token_category::identifier, u8"A", 0, pos};
+    const pp_token b{pp_token_category::identifier, u8"B", 2, pos};
+    std::pmr::list<pp_token> one{{pp_token{pp_token_category::pp_number, u8"1", 4, pos}}, &kusabira::def_mr};
+    std::pmr::list<pp_token> two{{pp_token{pp_token_category::pp_number, u8"2", 6, pos}}, &kusabira::def_mr};
+
+    // 未定義は0
+    CHECK_EQ(pp1.m_macro_manager.definition_fingerprint(u8"A"), 0u);
+
+    const auto generation = pp1.m_macro_manager.generation();
+    REQUIRE_UNARY(pp1.define(*reporter, a, one));
+    REQUIRE_UNARY(pp1.define(*reporter, b, two));
+    REQUIRE_UNARY(pp2.define(*reporter, a, one));
+    CHECK_NE(pp1.m_macro_manager.generation(), generation);
+
+    // 同じ定義は別のテーブルでも同じ値になる
+    CHECK_NE(pp1.m_macro_manager.definition_fingerprint(u8"A"), 0u);
+    CHECK_EQ(pp1.m_macro_manager.definition_fingerprint(u8"A"), pp2.m_macro_manager.definition_fingerprint(u8"A"));
+    CHECK_NE(pp1.m_macro_manager.definition_fingerprint(u8"A"), pp1.m_macro_manager.definition_fingerprint(u8"B"));
+    CHECK_NE(pp1.m_macro_manager.table_id(), pp2.m_macro_manager.table_id());
+
+    // 再定義すると変わる
+    pp2.undef(u8"A"sv);
+    CHECK_EQ(pp2.m_macro_manager.definition_fingerprint(u8"A"), 0u);
+    REQUIRE_UNARY(pp2.define(*reporter, a, two));
+    CHECK_EQ(pp2.m_macro_manager.definition_fingerprint(u8"A"), pp1.m_macro_manager.definition_fingerprint(u8"B"));
+  }
+
+  TEST_CASE("if condition memo test") {
+    using namespace std::string_view_literals;
+
+    auto memo = std::make_shared<kusabira::PP::if_condition_memo>();
+
+    // 同じファイルを別々のパーサで処理する、改行を除いたプリプロセス結果
+    auto parse = [&memo](auto&&... lines) -> std::vector<std::u8string> {
+      string_reader str_reader{"test/if_memo.cpp"};
+      str_reader.setlines(lines...);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, "test/if_memo.cpp"};
+      parser.set_if_condition_memo(memo);
+
+      auto status = parser.start();
+      REQUIRE_UNARY(bool(status));
+
+      std::vector<std::u8string> result{};
+      for (const auto& pptoken : parser.get_phase4_result()) {
+        if (pptoken.category == pp_token_category::newline) continue;
+        result.emplace_back(pptoken.token.to_view());
+      }
+      return result;
+    };
+
+    constexpr auto if_line = u8"#if ADD(A, B) > 0"sv;
+
+    // 最初は評価して記録する
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a + b"sv, if_line, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"x"});
+    CHECK_EQ(memo->size(), 1u);
+    CHECK_EQ(memo->hit_count(), 0u);
+
+    // 同じマクロ定義の下ではメモを使う
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a + b"sv, if_line, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"x"});
+    CHECK_EQ(memo->hit_count(), 1u);
+
+    // 参照しないマクロの定義は影響しない
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a + b"sv, if_line, u8"x"sv, u8"#endif"sv, u8"#define C 0"sv), std::vector<std::u8string>{u8"x"});
+    CHECK_EQ(memo->hit_count(), 2u);
+
+    // 参照するマクロの定義が異なる
+    CHECK_EQ(parse(u8"#define A 0"sv, u8"#define ADD(a, b) a + b"sv, if_line, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"y"});
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a - b"sv, if_line, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"x"});
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a - b"sv, if_line, u8"x"sv, u8"#define B 1"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"x"});
+    CHECK_EQ(parse(u8"#define B 1"sv, u8"#define ADD(a, b) a - b"sv, if_line, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"y"});
+    CHECK_EQ(memo->hit_count(), 3u);
+
+    // 同じ行でも内容が異なれば使わない
+    CHECK_EQ(parse(u8"#define A 1"sv, u8"#define ADD(a, b) a + b"sv, u8"#if ADD(A, B) > 1"sv, u8"x"sv, u8"#else"sv, u8"y"sv, u8"#endif"sv), std::vector<std::u8string>{u8"y"});
+    CHECK_EQ(memo->hit_count(), 3u);
+
+    // #elifとdefined
+    {
+      const auto before = memo->size();
+      CHECK_EQ(parse(u8"#if defined A"sv, u8"a"sv, u8"a"sv, u8"#elif defined(B) || C"sv, u8"b"sv, u8"#endif"sv), std::vector<std::u8string>{});
+      CHECK_EQ(memo->size(), before + 2);
+      CHECK_EQ(parse(u8"#if defined A"sv, u8"a"sv, u8"a"sv, u8"#elif defined(B) || C"sv, u8"b"sv, u8"#endif"sv), std::vector<std::u8string>{});
+      CHECK_EQ(memo->hit_count(), 5u);
+      CHECK_EQ(parse(u8"#if defined A"sv, u8"a"sv, u8"a"sv, u8"#elif defined(B) || C"sv, u8"b"sv, u8"#endif"sv, u8"#define B"sv), std::vector<std::u8string>{});
+      CHECK_EQ(memo->hit_count(), 7u);
+    }
+
+    // 事前定義マクロを参照したものは記録しない
+    {
+      const auto before = memo->size();
+      CHECK_EQ(parse(u8"#if __LINE__ == 1"sv, u8"a"sv, u8"#endif"sv), std::vector<std::u8string>{u8"a"});
+      CHECK_EQ(memo->size(), before);
+    }
+
+    // メモを使わない
+    {
+      string_reader str_reader{"test/if_memo.cpp"};
+      str_reader.setlines(u8"#define A 1"sv, u8"#define ADD(a, b) a + b"sv, if_line, u8"x"sv, u8"#endif"sv);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, "test/if_memo.cpp"};
+      parser.set_if_condition_memo(nullptr);
+      CHECK_UNARY(bool(parser.start()));
+      CHECK_EQ(memo->hit_count(), 7u);
+    }
+  }
+
+  TEST_CASE("if condition memo generation test") {
+    using namespace std::string_view_literals;
+
+    auto reporter = kusabira::report::reporter_factory<report::test_out>::create();
+    kusabira::PP::pp_directive_manager pp{"/kusabira/test_memo.hpp"};
+    auto& macros = pp.m_macro_manager;
+    kusabira::PP::if_condition_memo memo{};
+
+    std::pmr::forward_list<kusabira::PP::logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 1, 1);
+    (*pos).line = u8"#if X";
+
+    const pp_token x{pp_token_category::identifier, u8"X", 4, pos};
+    std::pmr::list<pp_token> replist{{pp_token{pp_token_category::pp_number, u8"1", 0, pos}}, &kusabira::def_mr};
+
+    const auto file = memo.file_id("/kusabira/test_memo.hpp");
+    CHECK_EQ(memo.file_id("/kusabira/test_memo.hpp"), file);
+    CHECK_NE(memo.file_id("/kusabira/test_other.hpp"), file);
+
+    // Xを参照してfalseになった
+    auto start = macros.observe_begin();
+    CHECK_UNARY_FALSE(bool(pp.is_macro(u8"X"sv)));
+    macros.observe_end();
+    REQUIRE_EQ(macros.observed().names.size(), 1u);
+    CHECK_UNARY(memo.store(file, *pos, macros, start, false));
+
+    CHECK_EQ(memo.find(file, *pos, macros), std::optional<bool>{false});
+    CHECK_EQ(memo.find(memo.file_id("/kusabira/test_other.hpp"), *pos, macros), std::nullopt);
+
+    // Xが定義されると使えない
+    REQUIRE_UNARY(pp.define(*reporter, x, replist));
+    CHECK_EQ(memo.find(file, *pos, macros), std::nullopt);
+
+    // Xを#undefすると元に戻る
+    pp.undef(u8"X"sv);
+    CHECK_EQ(memo.find(file, *pos, macros), std::optional<bool>{false});
+
+    // 記録中にメモを使うと、参照したマクロが記録に残る
+    start = macros.observe_begin();
+    CHECK_EQ(memo.find(file, *pos, macros), std::optional<bool>{false});
+    macros.observe_end();
+    CHECK_EQ(macros.observed().names.size(), 1u);
+    CHECK_EQ(macros.observed().names.front(), u8"X"sv);
+
+    // 事前定義マクロ
+    start = macros.observe_begin();
+    CHECK_UNARY(bool(pp.is_macro(u8"__FILE__"sv)));
+    macros.observe_end();
+    CHECK_UNARY_FALSE(memo.store(file, *pos, macros, start, true));
+  }
+
+} // namespace kusabira_test::if_condition_memo_test
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <sstream>
+
+#include "doctest/doctest.h"
+#include "PP/include_tree.hpp"
+#include "test/PP/pp_paser_test.hpp"
+
+namespace kusabira_test::include_tree_test {
+
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+
+  TEST_CASE("include tree test") {
+    using namespace std::chrono_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    const auto path = dir / "tree.cpp";
+
+    string_reader reader{path};
+    reader.setlines(u8"#include \"local.hpp\"",
+                    u8"#if 0",
+                    u8"skipped 1",
+                    u8"skipped 2",
+                    u8"#else",
+                    u8"int a;",
+                    u8"#endif",
+                    u8"#include \"local.hpp\"",
+                    u8"int b;");
+
+    test_paser parser{test_tokenizer{std::move(reader)}, path};
+    kusabira::PP::include_node tree{};
+    parser.set_include_node(&tree);
+
+    REQUIRE_UNARY(bool(parser.start()));
+
+    CHECK_EQ(tree.path, path);
+    CHECK_EQ(tree.tokens, parser.get_phase4_result().size());
+    CHECK_EQ(tree.skipped_lines, 2u);
+    REQUIRE_EQ(tree.includes.size(), 2u);
+
+    // 1回目は中身を処理し、ネストしたヘッダのノードを持つ
+    const auto& first = tree.includes[0];
+    CHECK_EQ(first.path, dir / "local.hpp");
+    REQUIRE_EQ(first.includes.size(), 1u);
+    CHECK_EQ(first.includes[0].path.filename(), "nested.hpp");
+    CHECK_EQ(first.skipped_lines, 0u);
+    CHECK_UNARY(0u < first.lines);
+    CHECK_EQ(first.exclusive_tokens(), first.tokens - first.includes[0].tokens);
+
+    // 2回目はインクルードガードで中身を読み飛ばす
+    const auto& second = tree.includes[1];
+    CHECK_EQ(second.path, dir / "local.hpp");
+    CHECK_UNARY(second.includes.empty());
+    CHECK_EQ(second.skipped_lines, 6u);
+
+    // 時間は入れ子のヘッダを含む
+    CHECK_UNARY(first.includes[0].inclusive_time <= first.inclusive_time);
+    CHECK_UNARY(first.inclusive_time + second.inclusive_time <= tree.inclusive_time);
+    CHECK_EQ(tree.exclusive_time(), tree.inclusive_time - first.inclusive_time - second.inclusive_time);
+    CHECK_EQ(tree.exclusive_tokens(), tree.tokens - first.tokens - second.tokens);
+  }
+
+  TEST_CASE("include tree report test") {
+    using namespace std::chrono_literals;
+
+    kusabira::PP::include_node tree{ .path = "main.cpp", .inclusive_time = 3ms, .tokens = 100, .lines = 20, .skipped_lines = 4 };
+    auto& header = tree.add_include("a \"b\".hpp");
+    header.inclusive_time = 2ms;
+    header.tokens = 70;
+    header.lines = 10;
+    header.add_include("c.hpp").from_cache = true;
+
+    const auto text = kusabira::PP::format_include_tree(tree);
+    CHECK_NE(text.find("===-- kusabira include tree: main.cpp --==="), std::string::npos);
+    CHECK_NE(text.find("       3.000      1.000        100         30       20        4  main.cpp\n"), std::string::npos);
+    CHECK_NE(text.find("       2.000      2.000         70         70       10        0    a \"b\".hpp\n"), std::string::npos);
+    CHECK_NE(text.find("      c.hpp (cached)\n"), std::string::npos);
+
+    std::ostringstream os{};
+    kusabira::PP::write_include_tree_json(tree, os);
+
+    CHECK_EQ(os.str(),
+      "{\"file\":\"main.cpp\",\"inclusive_ms\":3,\"exclusive_ms\":1,\"tokens\":100,\"exclusive_tokens\":30,\"lines\":20,\"skipped_lines\":4,\"cached\":false,\"includes\":["
+        "{\"file\":\"a \\\"b\\\".hpp\",\"inclusive_ms\":2,\"exclusive_ms\":2,\"tokens\":70,\"exclusive_tokens\":70,\"lines\":10,\"skipped_lines\":0,\"cached\":false,\"includes\":["
+          "{\"file\":\"c.hpp\",\"inclusive_ms\":0,\"exclusive_ms\":0,\"tokens\":0,\"exclusive_tokens\":0,\"lines\":0,\"skipped_lines\":0,\"cached\":true,\"includes\":[]}]}]}\n");
+  }
+}
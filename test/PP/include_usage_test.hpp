@@ -0,0 +1,94 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "PP/include_usage.hpp"
+#include "test/PP/pp_paser_test.hpp"
+
+namespace kusabira_test::include_usage_test {
+
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+
+  TEST_CASE("include usage test") {
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    const auto path = dir / "usage.cpp";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir / "sys");
+    // ヘッダキャッシュを共有していても、記録する時は再生しない
+    auto cache = std::make_shared<kusabira::PP::header_cache>();
+
+    for (int i = 0; i < 2; ++i) {
+      string_reader reader{path};
+      reader.setlines(u8"#include \"local.hpp\"",
+                      u8"#include <sys_header.hpp>",
+                      u8"#include \"unused.hpp\"",
+                      u8"#include \"sub/by_macro.hpp\"",
+                      u8"#undef KUSABIRA_SCAN_UNUSED",
+                      u8"#define KUSABIRA_SCAN_UNUSED 3",
+                      u8"int u = KUSABIRA_SCAN_UNUSED;",
+                      u8"#if SYS_VALUE == 2",
+                      u8"int v = LOCAL_VALUE;",
+                      u8"#endif");
+
+      test_paser parser{test_tokenizer{std::move(reader)}, path};
+      parser.set_include_options(options);
+      parser.set_header_cache(cache);
+
+      kusabira::PP::include_usage_tracker tracker{};
+      parser.set_include_usage_tracker(&tracker);
+
+      REQUIRE_UNARY(bool(parser.start()));
+
+      const auto& includes = tracker.includes();
+      REQUIRE_EQ(includes.size(), 6u);
+
+      // 出力したトークンとLOCAL_VALUEで使われている、インクルードガードは数えない
+      CHECK_EQ(includes[0].path, dir / "local.hpp");
+      CHECK_EQ(includes[0].depth, 1u);
+      CHECK_EQ(includes[0].tokens, 5u);
+      CHECK_EQ(includes[0].macros, 2u);
+      REQUIRE_EQ(includes[0].used_macros.size(), 1u);
+      CHECK_EQ(includes[0].used_macros[0], u8"LOCAL_VALUE");
+
+      CHECK_EQ(includes[1].path.filename(), "nested.hpp");
+      CHECK_EQ(includes[1].depth, 2u);
+      CHECK_UNARY(includes[1].used());
+
+      // #ifで調べられただけでも使われている
+      CHECK_EQ(includes[2].path.filename(), "sys_header.hpp");
+      CHECK_EQ(includes[2].tokens, 0u);
+      REQUIRE_EQ(includes[2].used_macros.size(), 1u);
+      CHECK_EQ(includes[2].used_macros[0], u8"SYS_VALUE");
+
+      // 定義したマクロは、使われる前に再定義されている
+      CHECK_EQ(includes[3].path.filename(), "unused.hpp");
+      CHECK_EQ(includes[3].macros, 1u);
+      CHECK_UNARY_FALSE(includes[3].used());
+
+      CHECK_EQ(includes[4].path.filename(), "by_macro.hpp");
+      CHECK_UNARY(includes[4].used());
+
+      // 2回目のlocal.hppは何もしていない
+      CHECK_EQ(includes[5].path, dir / "local.hpp");
+      CHECK_EQ(includes[5].depth, 2u);
+      CHECK_EQ(includes[5].tokens, 0u);
+      CHECK_EQ(includes[5].macros, 0u);
+      CHECK_UNARY_FALSE(includes[5].used());
+    }
+  }
+
+  TEST_CASE("include usage report test") {
+    std::vector<kusabira::PP::include_usage> includes{};
+    includes.push_back({ .path = "a.hpp", .depth = 1, .tokens = 0, .macros = 5, .used_macros = { u8"A", u8"B", u8"C", u8"D" } });
+    includes.push_back({ .path = "b.hpp", .depth = 2, .tokens = 0, .macros = 1 });
+    includes.push_back({ .path = "c.hpp", .depth = 1, .tokens = 12 });
+
+    const auto report = kusabira::PP::format_include_usage_report(includes, "main.cpp");
+    CHECK_NE(report.find("===-- kusabira include usage: main.cpp --==="), std::string::npos);
+    CHECK_NE(report.find("  used              0        5        4  a.hpp (A, B, C, ...)\n"), std::string::npos);
+    CHECK_NE(report.find("  UNUSED            0        1        0    b.hpp\n"), std::string::npos);
+    CHECK_NE(report.find("  used             12        0        0  c.hpp\n"), std::string::npos);
+    CHECK_NE(report.find("  1 of 3 includes contribute nothing\n"), std::string::npos);
+  }
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <fstream>
+
+#include "doctest/doctest.h"
+#include "PP/pp_directive_manager.hpp"
+#include "PP/macro_environment_builder.hpp"
+#include "../report_output_test.hpp"
+#include "test/PP/pp_filereader_test.hpp"
+
+namespace kusabira_test::preprocessor {
+
+  /**
+  * @brief マクロ展開結果をホワイトスペースを除いた文字列の列にする
+  */
+  inline auto macro_result_strings(const std::pmr::list<kusabira::PP::pp_token>& list) -> std::vector<std::u8string> {
+    std::vector<std::u8string> result{};
+    for (const auto& pptoken : list) {
+      if (pptoken.category == kusabira::PP::pp_token_category::whitespaces) continue;
+      result.emplace_back(pptoken.token.to_view());
+    }
+    return result;
+  }
+
+  TEST_CASE("macro_environment_builder test") {
+    kusabira::PP::macro_environment_builder builder{};
+
+    CHECK_UNARY(builder.define(u8"N"));
+    CHECK_UNARY(builder.define(u8"EMPTY="));
+    CHECK_UNARY(builder.define(u8"VAL=4 + 2"));
+    CHECK_UNARY(builder.define(u8"ADD(a, b)=a + b"));
+    CHECK_UNARY(builder.define(u8"VA(...)=__VA_ARGS__"));
+    CHECK_UNARY(builder.define_directive(u8"STR \"str\"  /* comment */ x"));
+
+    // 不正な定義
+    CHECK_UNARY_FALSE(builder.define(u8"1N"));
+    CHECK_UNARY_FALSE(builder.define(u8"F(a,=a"));
+    CHECK_UNARY_FALSE(builder.define(u8"G(a b)=a"));
+    CHECK_UNARY_FALSE(builder.define(u8"H(..., a)=a"));
+    CHECK_UNARY_FALSE(builder.define(u8"S(a)=# b"));
+
+    const auto& env = builder.environment();
+    CHECK_EQ(env.size(), 6u);
+
+    REQUIRE_UNARY(env.find(u8"N") != nullptr);
+    CHECK_UNARY_FALSE(env.find(u8"N")->is_function());
+    REQUIRE_UNARY(env.find(u8"ADD") != nullptr);
+    CHECK_UNARY(env.find(u8"ADD")->is_function());
+    REQUIRE_UNARY(env.find(u8"VA") != nullptr);
+    CHECK_UNARY(env.find(u8"VA")->is_function());
+    CHECK_UNARY(env.find(u8"S") == nullptr);
+
+    builder.undef(u8"EMPTY");
+    CHECK_UNARY(env.find(u8"EMPTY") == nullptr);
+
+    auto base = builder.build();
+    CHECK_EQ(base->size(), 5u);
+    // ビルダーは空から再開する
+    CHECK_EQ(builder.environment().size(), 0u);
+  }
+
+  TEST_CASE("shared macro environment test") {
+    using kusabira::PP::pp_token;
+    using kusabira::PP::pp_token_category;
+    using namespace std::string_view_literals;
+
+    auto reporter = kusabira::report::reporter_factory<report::test_out>::create();
+
+    std::shared_ptr<const kusabira::PP::macro_environment> base{};
+    {
+      kusabira::PP::macro_environment_builder builder{};
+      REQUIRE_UNARY(builder.define(u8"N"));
+      REQUIRE_UNARY(builder.define(u8"VAL=4 + 2"));
+      REQUIRE_UNARY(builder.define(u8"ADD(a, b)=a + b"));
+      REQUIRE_UNARY(builder.define(u8"TWICE(x)=ADD(x, x)"));
+      base = builder.build();
+    }
+
+    kusabira::PP::pp_directive_manager pp1{"/kusabira/test_env1.hpp", base};
+    kusabira::PP::pp_directive_manager pp2{"/kusabira/test_env2.hpp", base};
+    // 環境はコピーされない
+    CHECK_EQ(base.use_count(), 3);
+
+    std::pmr::forward_list<kusabira::PP::logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+    (*pos).line = u8"N VAL TWICE(1) M";
+
+    const pp_token n{pp_token_category::identifier, u8"N", 0, pos};
+    const pp_token val{pp_token_category::identifier, u8"VAL", 2, pos};
+    const pp_token twice{pp_token_category::identifier, u8"TWICE", 6, pos};
+    const pp_token m{pp_token_category::identifier, u8"M", 15, pos};
+
+    // 基底環境のマクロが見える
+    for (auto* pp : {&pp1, &pp2}) {
+      auto is_func = pp->is_macro(u8"N"sv);
+      REQUIRE_UNARY(bool(is_func));
+      CHECK_UNARY_FALSE(*is_func);
+
+      is_func = pp->is_macro(u8"TWICE"sv);
+      REQUIRE_UNARY(bool(is_func));
+      CHECK_UNARY(*is_func);
+
+      const auto [success, complete, list, memo] = pp->expand_objmacro(*reporter, val);
+      REQUIRE_UNARY(success);
+      CHECK_UNARY(complete);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"4", u8"+", u8"2"});
+    }
+
+    // 基底環境のマクロから基底環境のマクロを展開する
+    {
+      std::pmr::vector<std::pmr::list<pp_token>> args{&kusabira::def_mr};
+      args.emplace_back(std::pmr::list<pp_token>{{pp_token{pp_token_category::pp_number, u8"1", 12, pos}}, &kusabira::def_mr});
+
+      const auto [success, complete, list, memo] = pp1.expand_funcmacro(*reporter, twice, args);
+      REQUIRE_UNARY(success);
+      CHECK_UNARY(complete);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"1", u8"+", u8"1"});
+    }
+
+    // 一方での#undefは基底環境と他方に影響しない
+    pp1.undef(u8"N"sv);
+    CHECK_UNARY_FALSE(bool(pp1.is_macro(u8"N"sv)));
+    CHECK_UNARY(bool(pp2.is_macro(u8"N"sv)));
+    CHECK_UNARY_FALSE(pp1.is_defined(u8"N"sv));
+    CHECK_UNARY(pp2.is_defined(u8"N"sv));
+    CHECK_UNARY(pp1.is_defined(u8"ADD"sv));
+    CHECK_UNARY(base->find(u8"N") != nullptr);
+
+    // 一方での#defineも他方に影響しない
+    {
+      std::pmr::list<pp_token> replist{&kusabira::def_mr};
+      replist.emplace_back(pp_token_category::pp_number, u8"2", 0, pos);
+      CHECK_UNARY(pp1.define(*reporter, n, replist));
+      CHECK_UNARY(pp1.define(*reporter, m, replist));
+
+      const auto [success, complete, list, memo] = pp1.expand_objmacro(*reporter, n);
+      REQUIRE_UNARY(success);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"2"});
+
+      CHECK_UNARY_FALSE(bool(pp2.is_macro(u8"M"sv)));
+      CHECK_UNARY(pp1.is_defined(u8"M"sv));
+      CHECK_UNARY_FALSE(pp2.is_defined(u8"M"sv));
+      // 事前定義マクロ
+      CHECK_UNARY(pp2.is_defined(u8"__LINE__"sv));
+
+      const auto [success2, complete2, list2, memo2] = pp2.expand_objmacro(*reporter, n);
+      REQUIRE_UNARY(success2);
+      CHECK_EQ(macro_result_strings(list2), std::vector<std::u8string>{u8"1"});
+    }
+
+    // 基底環境のマクロの再定義、同一ならok
+    {
+      std::pmr::list<pp_token> replist{&kusabira::def_mr};
+      replist.emplace_back(pp_token_category::pp_number, u8"4", 0, pos);
+      replist.emplace_back(pp_token_category::whitespaces, u8" ", 1, pos);
+      replist.emplace_back(pp_token_category::op_or_punc, u8"+", 2, pos);
+      replist.emplace_back(pp_token_category::whitespaces, u8" ", 3, pos);
+      replist.emplace_back(pp_token_category::pp_number, u8"2", 4, pos);
+      CHECK_UNARY(pp2.define(*reporter, val, replist));
+      CHECK_UNARY(report::test_out::extract_string().empty());
+
+      replist.pop_back();
+      replist.emplace_back(pp_token_category::pp_number, u8"3", 4, pos);
+      CHECK_UNARY_FALSE(pp2.define(*reporter, val, replist));
+      CHECK_UNARY_FALSE(report::test_out::extract_string().empty());
+
+      // 基底環境は変化しない
+      const auto [success, complete, list, memo] = pp2.expand_objmacro(*reporter, val);
+      REQUIRE_UNARY(success);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"4", u8"+", u8"2"});
+    }
+
+    // 基底環境は参照している間生存する
+    base.reset();
+    CHECK_UNARY(bool(pp2.is_macro(u8"ADD"sv)));
+  }
+
+  TEST_CASE("load predefined macro definitions test") {
+    using kusabira::PP::pp_token;
+    using kusabira::PP::pp_token_category;
+
+    kusabira::PP::macro_environment_builder builder{};
+
+    // gcc -dM -Eの出力の一部
+    const auto result = builder.load_definitions(kusabira::test::get_testfiles_dir() / "PP" / "predefined_macros.h");
+    REQUIRE_UNARY(bool(result));
+    CHECK_EQ(*result, 20u);
+
+    const auto base = builder.build();
+    CHECK_EQ(base->size(), 18u);
+    CHECK_UNARY(base->find(u8"__GNUC__") != nullptr);
+    CHECK_UNARY(base->find(u8"__INT_WIDTH__") != nullptr);
+    CHECK_UNARY(base->find(u8"__LP64__") == nullptr);
+    REQUIRE_UNARY(base->find(u8"__UINT64_C") != nullptr);
+    CHECK_UNARY(base->find(u8"__UINT64_C")->is_function());
+
+    auto reporter = kusabira::report::reporter_factory<report::test_out>::create();
+    kusabira::PP::pp_directive_manager pp{"/kusabira/test_predefined.hpp", base};
+
+    std::pmr::forward_list<kusabira::PP::logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+    (*pos).line = u8"__BYTE_ORDER__ __UINT64_C(1) __VERSION__";
+
+    {
+      const pp_token macro{pp_token_category::identifier, u8"__BYTE_ORDER__", 0, pos};
+      const auto [success, complete, list, memo] = pp.expand_objmacro(*reporter, macro);
+      REQUIRE_UNARY(success);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"1234"});
+    }
+    {
+      const pp_token macro{pp_token_category::identifier, u8"__UINT64_C", 15, pos};
+      std::pmr::vector<std::pmr::list<pp_token>> args{&kusabira::def_mr};
+      args.emplace_back(std::pmr::list<pp_token>{{pp_token{pp_token_category::pp_number, u8"1", 26, pos}}, &kusabira::def_mr});
+
+      const auto [success, complete, list, memo] = pp.expand_funcmacro(*reporter, macro, args);
+      REQUIRE_UNARY(success);
+      CHECK_EQ(macro_result_strings(list), std::vector<std::u8string>{u8"1UL"});
+    }
+    {
+      const pp_token macro{pp_token_category::identifier, u8"__VERSION__", 29, pos};
+      const auto [success, complete, list, memo] = pp.expand_objmacro(*reporter, macro);
+      REQUIRE_UNARY(success);
+      REQUIRE_EQ(list.size(), 1u);
+      CHECK_EQ(list.front().category, pp_token_category::string_literal);
+    }
+
+    // 存在しないファイル
+    {
+      const auto err = builder.load_definitions(kusabira::test::get_testfiles_dir() / "PP" / "not_exist.h");
+      REQUIRE_UNARY_FALSE(bool(err));
+      CHECK_EQ(err.error(), 0u);
+    }
+    // #define以外の行があるとその行番号を返す
+    {
+      const auto err = builder.load_definitions(kusabira::test::get_testfiles_dir() / "PP" / "parse_macro.cpp");
+      REQUIRE_UNARY_FALSE(bool(err));
+      CHECK_EQ(err.error(), 3u);
+    }
+    // #undefの後ろには識別子1つだけ
+    {
+      const auto path = std::filesystem::temp_directory_path() / "kusabira_undef_test.h";
+      {
+        std::ofstream ofs{path};
+        ofs << "#define A 1\n#undef A\n#undef A junk\n";
+      }
+      const auto err = builder.load_definitions(path);
+      REQUIRE_UNARY_FALSE(bool(err));
+      CHECK_EQ(err.error(), 3u);
+      std::filesystem::remove(path);
+    }
+  }
+
+} // namespace kusabira_test::preprocessor
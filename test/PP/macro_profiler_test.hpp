@@ -0,0 +1,110 @@
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include "doctest/doctest.h"
+#include "PP/macro_profiler.hpp"
+
+namespace kusabira_test::macro_profiler_test {
+
+  using enabled_profile = kusabira::PP::basic_scoped_macro_profile<true>;
+
+  TEST_CASE("disabled macro profile test") {
+    static_assert(std::is_empty_v<kusabira::PP::basic_scoped_macro_profile<false>>);
+
+    kusabira::PP::reset_macro_profile();
+    {
+      kusabira::PP::basic_scoped_macro_profile<false> profile{u8"F", std::vector<std::list<int>>{{1, 2}}};
+      profile.set_output(10);
+    }
+    CHECK_UNARY(kusabira::PP::current_macro_profile().empty());
+  }
+
+  TEST_CASE("nested macro profile test") {
+    kusabira::PP::reset_macro_profile();
+
+    // F(a b, c) -> G(a b) c -> (ONE) a b c
+    {
+      const std::vector<std::list<int>> f_args = {{0, 0}, {0}};
+      enabled_profile f{u8"F", f_args};
+      {
+        const std::vector<std::list<int>> g_args = {{0, 0}};
+        enabled_profile g{u8"G", g_args};
+        {
+          enabled_profile one{u8"ONE"};
+          one.set_output(1);
+        }
+        g.set_output(5);
+      }
+      f.set_output(6);
+    }
+    {
+      enabled_profile one{u8"ONE"};
+      one.set_output(1);
+    }
+
+    const auto& table = kusabira::PP::current_macro_profile();
+    REQUIRE_EQ(table.size(), 3u);
+
+    const auto& f = table.find(u8"F")->second;
+    CHECK_EQ(f.calls, 1u);
+    CHECK_EQ(f.max_depth, 3u);
+    CHECK_EQ(f.tokens_in, 4u);
+    CHECK_EQ(f.tokens_out, 6u);
+    CHECK_EQ(f.amplification(), 1.5);
+
+    const auto& g = table.find(u8"G")->second;
+    CHECK_EQ(g.calls, 1u);
+    CHECK_EQ(g.max_depth, 2u);
+    CHECK_EQ(g.tokens_in, 3u);
+    CHECK_EQ(g.tokens_out, 5u);
+
+    const auto& one = table.find(u8"ONE")->second;
+    CHECK_EQ(one.calls, 2u);
+    CHECK_EQ(one.max_depth, 1u);
+    CHECK_EQ(one.tokens_in, 2u);
+    CHECK_EQ(one.tokens_out, 2u);
+
+    // 時間は入れ子のマクロの分も含む
+    CHECK_UNARY(g.time <= f.time);
+
+    kusabira::PP::reset_macro_profile();
+    CHECK_UNARY(kusabira::PP::current_macro_profile().empty());
+  }
+
+  TEST_CASE("macro profile report test") {
+    using namespace std::chrono_literals;
+    using kusabira::PP::macro_profile_order;
+
+    kusabira::PP::macro_profile_table table{};
+    table[u8"SLOW"] = { .calls = 1, .time = 5ms, .max_depth = 1, .tokens_in = 1, .tokens_out = 1 };
+    table[u8"WIDE"] = { .calls = 2, .time = 1ms, .max_depth = 4, .tokens_in = 4, .tokens_out = 400 };
+    table[u8"OFTEN"] = { .calls = 9, .time = 2ms, .max_depth = 2, .tokens_in = 9, .tokens_out = 18 };
+
+    auto order_of = [](const std::string& report) {
+      return std::vector<std::size_t>{ report.find("SLOW"), report.find("WIDE"), report.find("OFTEN") };
+    };
+
+    {
+      const auto report = kusabira::PP::format_macro_profile_report(table, "/kusabira/test.cpp");
+      const auto pos = order_of(report);
+
+      CHECK_NE(report.find("/kusabira/test.cpp"), std::string::npos);
+      CHECK_UNARY(pos[1] < pos[2]);
+      CHECK_UNARY(pos[2] < pos[0]);
+      CHECK_NE(report.find("WIDE                                      2        1.000      4            4          400   100.00"), std::string::npos);
+    }
+    {
+      const auto pos = order_of(kusabira::PP::format_macro_profile_report(table, "", macro_profile_order::time));
+      CHECK_UNARY(pos[0] < pos[2]);
+      CHECK_UNARY(pos[2] < pos[1]);
+    }
+    {
+      const auto report = kusabira::PP::format_macro_profile_report(table, "", macro_profile_order::calls, 1);
+      CHECK_NE(report.find("OFTEN"), std::string::npos);
+      CHECK_EQ(report.find("WIDE"), std::string::npos);
+      CHECK_NE(report.find("... 2 more macros"), std::string::npos);
+    }
+  }
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "PP/pp_parser.hpp"
+#include "PP/macro_snapshot.hpp"
+#include "PP/macro_environment_builder.hpp"
+#include "test/PP/pp_filereader_test.hpp"
+
+namespace kusabira_test::macro_snapshot_test {
+
+  namespace fs = std::filesystem;
+
+  using kusabira::PP::pp_token;
+  using kusabira::PP::pp_token_category;
+  using pp_tokenizer = kusabira::PP::tokenizer<kusabira::PP::filereader, kusabira::PP::pp_tokenizer_sm>;
+
+  /**
+  * @brief 2つのマクロが同じ解析結果を持っているか
+  */
+  inline auto is_same_macro(const kusabira::PP::unified_macro& lhs, const kusabira::PP::unified_macro& rhs) -> bool {
+    if (lhs.is_function() != rhs.is_function() or lhs.is_va() != rhs.is_va()) return false;
+    if (not lhs.is_identical(rhs.params(), rhs.replacement_list())) return false;
+    if (not std::ranges::equal(lhs.correspond(), rhs.correspond())) return false;
+
+    // トークンの位置情報も復元されている
+    return std::ranges::equal(lhs.replacement_list(), rhs.replacement_list(), [](const pp_token& l, const pp_token& r) {
+      if (l.column != r.column or l.is_generated != r.is_generated) return false;
+      if (l.is_generated) return true;
+      return (*l.srcline_ref).line == (*r.srcline_ref).line and (*l.srcline_ref).phisic_line_num == (*r.srcline_ref).phisic_line_num;
+    });
+  }
+
+  TEST_CASE("macro snapshot test") {
+    const auto testdir = kusabira::test::get_testfiles_dir() / "PP";
+    const auto prelude_path = testdir / "parse_macro.cpp";
+
+    std::vector<char> image{};
+    std::size_t macro_count = 0;
+
+    {
+      kusabira::PP::ll_paser prelude{pp_tokenizer{prelude_path}, prelude_path};
+      REQUIRE_UNARY(bool(prelude.start()));
+
+      const auto& macros = prelude.get_preprocessor().m_macro_manager;
+      image = kusabira::PP::serialize_macro_snapshot(macros);
+
+      auto snapshot = kusabira::PP::deserialize_macro_snapshot(image);
+      REQUIRE_UNARY(bool(snapshot));
+      REQUIRE_UNARY(snapshot->macros != nullptr);
+      CHECK_UNARY(snapshot->line_map.empty());
+      CHECK_UNARY_FALSE(snapshot->replaced_filename);
+
+      // 全てのマクロが解析結果ごと復元されている
+      macros.for_each_macro([&](std::u8string_view name, const kusabira::PP::unified_macro& macro) {
+        ++macro_count;
+        const auto restored = snapshot->macros->find(name);
+        REQUIRE_UNARY(restored != nullptr);
+        CHECK_UNARY(is_same_macro(macro, *restored));
+      });
+      CHECK_EQ(snapshot->macros->size(), macro_count);
+    }
+
+    // プリプロセッサの状態が破棄された後でも復元できる
+    auto snapshot = kusabira::PP::deserialize_macro_snapshot(image);
+    REQUIRE_UNARY(bool(snapshot));
+    CHECK_EQ(snapshot->macros->size(), macro_count);
+
+    // 復元した状態から別のファイルのプリプロセスを開始する
+    {
+      const auto src_path = testdir / "macro_snapshot_use.cpp";
+      kusabira::PP::ll_paser parser{pp_tokenizer{src_path}, src_path, *snapshot};
+
+      const auto status = parser.start();
+      REQUIRE_UNARY(bool(status));
+
+      constexpr std::u8string_view expect_token[] = {
+        u8"int", u8"vm", u8"=", u8"1", u8";", u8"",
+        u8"S", u8"bar", u8"=", u8"{", u8"1", u8",", u8"2", u8"}", u8";", u8"",
+        u8"\"hello\"", u8"\", world\"", u8"",
+        // xはプレリュードの最後で2に定義されている
+        u8"\"2 ## y\"", u8";", u8"",
+        u8"\"x\"", u8"printf", u8"(", u8"\"x\"", u8"\"1\"", u8"\"= %d, x\"", u8"\"2\"", u8"\"= %s\"", u8",", u8"x1", u8",", u8"x2", u8")", u8""
+      };
+
+      const auto& result = parser.get_phase4_result();
+      std::vector<std::u8string_view> tokens{};
+      for (const auto& pptoken : result) {
+        tokens.emplace_back(pptoken.token.to_view());
+      }
+
+      CHECK_UNARY(std::ranges::equal(tokens, expect_token));
+      CHECK_EQ(tokens.size(), std::size(expect_token));
+    }
+  }
+
+  TEST_CASE("macro snapshot line state test") {
+    kusabira::PP::pp_directive_manager pp{"/kusabira/test_snapshot.hpp"};
+    pp.m_macro_manager.change_line(10, 100);
+    pp.m_macro_manager.change_line(20, 1);
+    pp.m_macro_manager.change_filename(u8"renamed.hpp");
+
+    const auto image = kusabira::PP::serialize_macro_snapshot(pp.m_macro_manager);
+    const auto snapshot = kusabira::PP::deserialize_macro_snapshot(image);
+    REQUIRE_UNARY(bool(snapshot));
+    CHECK_EQ(snapshot->macros->size(), 0u);
+    CHECK_EQ(snapshot->line_map.size(), 2u);
+    CHECK_EQ(snapshot->line_map.at(10), 100u);
+    CHECK_EQ(snapshot->line_map.at(20), 1u);
+    REQUIRE_UNARY(bool(snapshot->replaced_filename));
+    CHECK_EQ(*snapshot->replaced_filename, fs::path{u8"renamed.hpp"});
+
+    // 復元先に引き継がれる
+    kusabira::PP::pp_directive_manager restored{"/kusabira/test_restored.hpp", *snapshot};
+    CHECK_UNARY(std::ranges::equal(restored.m_macro_manager.line_map(), pp.m_macro_manager.line_map()));
+    CHECK_EQ(restored.m_macro_manager.replaced_filename(), fs::path{u8"renamed.hpp"});
+  }
+
+  TEST_CASE("macro snapshot validation test") {
+    kusabira::PP::macro_environment_builder builder{};
+    REQUIRE_UNARY(builder.define(u8"ADD(a, b)=a + b"));
+    REQUIRE_UNARY(builder.define(u8"CAT(a, b)=a ## b"));
+    kusabira::PP::pp_directive_manager pp{"/kusabira/test_snapshot.hpp", builder.build()};
+
+    const auto image = kusabira::PP::serialize_macro_snapshot(pp.m_macro_manager);
+    REQUIRE_UNARY(bool(kusabira::PP::deserialize_macro_snapshot(image)));
+
+    // 途中で切れている
+    for (std::size_t size : {std::size_t(0), sizeof(kusabira::PP::macro_snapshot_format::header), image.size() - 1}) {
+      CHECK_UNARY_FALSE(kusabira::PP::deserialize_macro_snapshot(std::span<const char>{image}.first(size)));
+    }
+
+    // 内容が壊れている
+    for (std::size_t pos : {std::size_t(0), sizeof(kusabira::PP::macro_snapshot_format::header), image.size() / 2, image.size() - 1}) {
+      auto broken = image;
+      broken[pos] ^= 0x5a;
+      CHECK_UNARY_FALSE(kusabira::PP::deserialize_macro_snapshot(broken));
+    }
+
+    // 範囲の整合性が取れていないレコード、ハッシュは正しく付け直す
+    {
+      namespace format = kusabira::PP::macro_snapshot_format;
+
+      kusabira::PP::macro_environment_builder single{};
+      REQUIRE_UNARY(single.define(u8"ADD(a, b)=a + b"));
+      kusabira::PP::pp_directive_manager add_pp{"/kusabira/test_snapshot.hpp", single.build()};
+      const auto add_image = kusabira::PP::serialize_macro_snapshot(add_pp.m_macro_manager);
+      REQUIRE_UNARY(bool(kusabira::PP::deserialize_macro_snapshot(add_image)));
+
+      format::header head{};
+      std::memcpy(&head, add_image.data(), sizeof(head));
+      // [macro_record][string_ref * param_count][token * token_count][correspond_record * correspond_count]
+      const std::size_t macro_pos = sizeof(format::header) + head.line_map_count * sizeof(format::line_map_entry) + head.lines_size;
+      format::macro_record macro{};
+      std::memcpy(&macro, add_image.data() + macro_pos, sizeof(macro));
+      REQUIRE_EQ(macro.param_count, 2u);
+      REQUIRE_EQ(macro.correspond_count, 2u);
+      const std::size_t token_pos = macro_pos + sizeof(format::macro_record) + macro.param_count * sizeof(format::string_ref);
+      const std::size_t correspond_pos = token_pos + macro.token_count * sizeof(format::token_record);
+
+      // posにあるレコードを書き換えて読み込む
+      auto rewrite = [&](std::size_t pos, auto rec, auto&& modify) {
+        auto broken = add_image;
+        std::memcpy(&rec, broken.data() + pos, sizeof(rec));
+        modify(rec);
+        std::memcpy(broken.data() + pos, &rec, sizeof(rec));
+
+        auto h = head;
+        h.content_hash = kusabira::PP::token_cache_format::fnv1a_64(std::span<const char>{broken}.subspan(sizeof(format::header)));
+        std::memcpy(broken.data(), &h, sizeof(h));
+        return kusabira::PP::deserialize_macro_snapshot(broken);
+      };
+
+      // 変更しなければ読める
+      CHECK_UNARY(bool(rewrite(macro_pos, format::macro_record{}, [](auto&) {})));
+      // 残りのバイト数に収まらない個数
+      CHECK_UNARY_FALSE(rewrite(macro_pos, format::macro_record{}, [](auto& rec) { rec.param_count = std::uint32_t(-1); }));
+      CHECK_UNARY_FALSE(rewrite(macro_pos, format::macro_record{}, [](auto& rec) { rec.correspond_count = std::uint32_t(-1); }));
+      // 範囲外のpp_parse_context
+      CHECK_UNARY_FALSE(rewrite(macro_pos, format::macro_record{}, [](auto& rec) { rec.has_error = 1; rec.error_context = 1000; }));
+      // 仮引数の範囲外を指す実引数位置
+      CHECK_UNARY_FALSE(rewrite(correspond_pos, format::correspond_record{}, [](auto& rec) { rec.arg_index = 2; }));
+      CHECK_UNARY_FALSE(rewrite(correspond_pos, format::correspond_record{}, [](auto& rec) { rec.arg_index = std::uint64_t(-1); }));
+      // 行を参照する生成されたトークン
+      CHECK_UNARY_FALSE(rewrite(token_pos, format::token_record{}, [](auto& rec) { rec.flags = format::generated | format::str_in_line; }));
+    }
+
+    // ファイルへの保存と読み込み
+    const auto path = fs::temp_directory_path() / "kusabira_macro_snapshot_test.ksms";
+    REQUIRE_UNARY(kusabira::PP::save_macro_snapshot(pp, path));
+
+    const auto snapshot = kusabira::PP::load_macro_snapshot(path);
+    REQUIRE_UNARY(bool(snapshot));
+    CHECK_EQ(snapshot->macros->size(), 2u);
+    REQUIRE_UNARY(snapshot->macros->find(u8"CAT") != nullptr);
+    CHECK_UNARY(snapshot->macros->find(u8"CAT")->is_function());
+
+    fs::remove(path);
+    CHECK_UNARY_FALSE(kusabira::PP::load_macro_snapshot(path));
+  }
+
+} // namespace kusabira_test::macro_snapshot_test
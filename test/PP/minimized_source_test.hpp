@@ -0,0 +1,138 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "PP/minimized_source.hpp"
+#include "test/PP/dependency_scan_test.hpp"
+
+namespace kusabira_test::minimized_source_test {
+
+  using kusabira::PP::filereader;
+  using kusabira::PP::pp_tokenizer_sm;
+  using dependency_scan_test::file_tokenizer;
+  using dependency_scan_test::file_paser;
+  using dependency_scan_test::relative_includes;
+
+  TEST_CASE("minimize source test") {
+    using namespace std::string_view_literals;
+
+    const auto path = kusabira::test::get_testfiles_dir() / "PP" / "minimize.cpp";
+    const auto hash = kusabira::PP::hash_file_content(path);
+    REQUIRE_UNARY(hash.has_value());
+
+    const kusabira::PP::minimized_source src{kusabira::PP::serialize_minimized_source<filereader, pp_tokenizer_sm>(path, *hash)};
+    REQUIRE_UNARY(src.validate(*hash));
+    CHECK_UNARY_FALSE(src.validate(*hash + 1));
+
+    // {物理行番号, 論理行番号, 行文字列}
+    const std::vector<std::tuple<std::size_t, std::size_t, std::u8string_view>> expected = {
+      {2, 2, u8"#include \"a.hpp\""sv},
+      {3, 3, u8"# define X   1"sv},
+      {8, 7, u8"#if X"sv},
+      {12, 11, u8"#endif "sv},
+      {14, 13, u8"export module m;"sv},
+      {15, 14, u8"import std;"sv}
+    };
+
+    kusabira::PP::minimized_reader reader{std::make_shared<const kusabira::PP::minimized_source>(kusabira::PP::serialize_minimized_source<filereader, pp_tokenizer_sm>(path, *hash))};
+
+    for (const auto& [phisic, logical, str] : expected) {
+      auto line = reader.readline();
+      REQUIRE_UNARY(line.has_value());
+      CHECK_EQ(line->phisic_line_num, phisic);
+      CHECK_EQ(line->logical_line_num, logical);
+      CHECK_UNARY(line->line == str);
+    }
+    CHECK_UNARY_FALSE(reader.readline().has_value());
+
+    // 行継続の位置は残した部分の先頭からになる
+    const auto continued = src.lines()[1];
+    REQUIRE_EQ(continued.offset_count, 1u);
+    CHECK_EQ(src.line_offsets()[continued.offset_first], 11u);
+  }
+
+  TEST_CASE("minimized source cache test") {
+    const auto path = kusabira::test::get_testfiles_dir() / "PP" / "minimize.cpp";
+    const auto hash = kusabira::PP::hash_file_content(path);
+    REQUIRE_UNARY(hash.has_value());
+
+    const auto cache_dir = std::filesystem::temp_directory_path() / "kusabira_minimized_source_test";
+    std::filesystem::remove_all(cache_dir);
+
+    // 最初は縮小してディスクに書き出す
+    {
+      kusabira::PP::minimized_source_cache cache{cache_dir};
+      auto src = cache.get(path);
+      REQUIRE_UNARY(src != nullptr);
+      CHECK_EQ(src->lines().size(), 6u);
+      CHECK_UNARY(std::filesystem::exists(cache_dir / kusabira::PP::minimized_source_format::cache_filename(*hash)));
+
+      // 2回目はメモリ上のものを使う
+      CHECK_EQ(cache.get(path), src);
+      CHECK_EQ(cache.size(), 1u);
+      CHECK_EQ(cache.hit_count(), 1u);
+    }
+
+    // 別のキャッシュからはディスク上のものを読む
+    {
+      auto src = kusabira::PP::minimized_source::open(cache_dir / kusabira::PP::minimized_source_format::cache_filename(*hash), *hash);
+      REQUIRE_UNARY(src.has_value());
+      CHECK_EQ(src->lines().size(), 6u);
+
+      // 内容が変わっていたら使わない
+      CHECK_UNARY_FALSE(kusabira::PP::minimized_source::open(cache_dir / kusabira::PP::minimized_source_format::cache_filename(*hash), *hash + 1).has_value());
+    }
+
+    // 読めないファイル
+    {
+      kusabira::PP::minimized_source_cache cache{};
+      CHECK_EQ(cache.get(kusabira::test::get_testfiles_dir() / "PP" / "not_exist.cpp"), nullptr);
+    }
+
+    std::filesystem::remove_all(cache_dir);
+  }
+
+  TEST_CASE("dependency scan with minimized source test") {
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir / "sys");
+    auto cache = std::make_shared<kusabira::PP::minimized_source_cache>();
+
+    const std::vector<std::string> includes = {"local.hpp", "sub/nested.hpp", "sys/sys_header.hpp", "sub/by_macro.hpp"};
+
+    // 縮小したソースを読んでも依存関係は変わらない
+    for (auto i = 0; i < 2; ++i) {
+      const auto path = dir / "main.cpp";
+      file_paser parser{file_tokenizer{path}, path};
+      parser.set_include_options(options);
+      parser.set_scan_only(true);
+      parser.set_minimized_source_cache(cache);
+
+      REQUIRE_UNARY(bool(parser.start()));
+      CHECK_EQ(relative_includes(parser.get_dependencies(), dir), includes);
+    }
+
+    // 同じヘッダの縮小は1回だけ行う
+    CHECK_EQ(cache->size(), 4u);
+    CHECK_EQ(cache->hit_count(), 6u);
+
+    // 翻訳単位自体も縮小して読める
+    {
+      using minimized_paser = kusabira::PP::ll_paser<kusabira::PP::tokenizer<kusabira::PP::minimized_reader, pp_tokenizer_sm>, kusabira::report::reporter_factory<report::test_out>>;
+
+      const auto path = dir / "module.cpp";
+      minimized_paser parser{kusabira::PP::tokenizer<kusabira::PP::minimized_reader, pp_tokenizer_sm>{kusabira::PP::minimized_reader{cache->get(path)}}, path};
+      parser.set_include_options(options);
+      parser.set_scan_only(true);
+      parser.set_minimized_source_cache(cache);
+
+      REQUIRE_UNARY(bool(parser.start()));
+
+      const auto& deps = parser.get_dependencies();
+      CHECK_EQ(relative_includes(deps, dir), std::vector<std::string>{"sub/nested.hpp"});
+      REQUIRE_UNARY(deps.provided_module.has_value());
+      CHECK_UNARY(*deps.provided_module == u8"kusabira.scan:part");
+      CHECK_EQ(deps.required_modules.size(), 5u);
+    }
+  }
+
+} // namespace kusabira_test::minimized_source_test
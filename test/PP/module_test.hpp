@@ -0,0 +1,213 @@
+#pragma once
+
+#include "doctest/doctest.h"
+#include "test/PP/dependency_scan_test.hpp"
+
+namespace kusabira_test::module_test {
+
+  using kusabira::PP::pp_token_category;
+  using kusabira::PP::include_lookup;
+  using pp_parsing_test::string_reader;
+  using pp_parsing_test::test_tokenizer;
+  using pp_parsing_test::test_paser;
+  using dependency_scan_test::file_tokenizer;
+  using dependency_scan_test::file_paser;
+
+  /**
+  * @brief 改行を除いたフェーズ4の結果を{種別, 文字列}で取り出す
+  */
+  template<typename Paser>
+  auto significant_tokens(const Paser& parser) -> std::vector<std::pair<pp_token_category, std::u8string>> {
+    std::vector<std::pair<pp_token_category, std::u8string>> result{};
+    for (const auto& pptoken : parser.get_phase4_result()) {
+      if (pptoken.category == pp_token_category::newline) continue;
+      result.emplace_back(pptoken.category, pptoken.token.to_view());
+    }
+    return result;
+  }
+
+  TEST_CASE("module declaration test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "module";
+    const auto path = dir / "unit.cpp";
+    file_paser parser{file_tokenizer{path}, path};
+
+    REQUIRE_UNARY(bool(parser.start()));
+
+    const std::vector<std::pair<pp_token_category, std::u8string>> expected = {
+      {pp_token_category::module_keyword, u8"module"},
+      {pp_token_category::op_or_punc, u8";"},
+      {pp_token_category::export_keyword, u8"export"},
+      {pp_token_category::module_keyword, u8"module"},
+      {pp_token_category::identifier, u8"kusabira"},
+      {pp_token_category::op_or_punc, u8"."},
+      {pp_token_category::identifier, u8"test"},
+      {pp_token_category::op_or_punc, u8";"},
+      {pp_token_category::import_keyword, u8"import"},
+      {pp_token_category::identifier, u8"std"},
+      {pp_token_category::op_or_punc, u8";"},
+      {pp_token_category::import_keyword, u8"import"},
+      {pp_token_category::header_name, u8"\"header_unit.hpp\""},
+      {pp_token_category::op_or_punc, u8";"},
+      {pp_token_category::import_keyword, u8"import"},
+      {pp_token_category::op_or_punc, u8":"},
+      {pp_token_category::identifier, u8"part"},
+      {pp_token_category::op_or_punc, u8"["},
+      {pp_token_category::op_or_punc, u8"["},
+      {pp_token_category::identifier, u8"deprecated"},
+      {pp_token_category::op_or_punc, u8"]"},
+      {pp_token_category::op_or_punc, u8"]"},
+      {pp_token_category::op_or_punc, u8";"},
+      {pp_token_category::identifier, u8"export"},
+      {pp_token_category::identifier, u8"int"},
+      {pp_token_category::identifier, u8"value"},
+      {pp_token_category::op_or_punc, u8"="},
+      {pp_token_category::pp_number, u8"42"},
+      {pp_token_category::op_or_punc, u8"+"},
+      {pp_token_category::pp_number, u8"1"},
+      {pp_token_category::op_or_punc, u8";"}
+    };
+
+    // ヘッダユニットの出力は含まれない
+    CHECK_EQ(significant_tokens(parser), expected);
+
+    // ヘッダユニットのマクロを取り込んでいる
+    CHECK_UNARY(parser.get_preprocessor().is_defined(u8"UNIT_FUNC"sv));
+
+    const auto& deps = parser.get_dependencies();
+    REQUIRE_UNARY(deps.provided_module.has_value());
+    CHECK_UNARY(*deps.provided_module == u8"kusabira.test");
+    CHECK_UNARY(deps.is_interface);
+    CHECK_UNARY(deps.includes.empty());
+
+    REQUIRE_EQ(deps.required_modules.size(), 3u);
+    CHECK_UNARY(deps.required_modules[0].logical_name == u8"std");
+    CHECK_UNARY(deps.required_modules[1].logical_name == u8"header_unit.hpp");
+    CHECK_EQ(deps.required_modules[1].lookup, include_lookup::quote);
+    CHECK_EQ(deps.required_modules[1].source_path, dir / "header_unit.hpp");
+    CHECK_UNARY(deps.required_modules[2].logical_name == u8"kusabira.test:part");
+  }
+
+  TEST_CASE("import directive test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "module";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir);
+
+    auto parse = [&dir, &options](auto&&... lines) {
+      string_reader str_reader{(dir / "test.cpp").string()};
+      str_reader.setlines(lines...);
+
+      auto parser = std::make_unique<test_paser>(test_tokenizer{std::move(str_reader)}, dir / "test.cpp");
+      parser->set_include_options(options);
+      const bool result = bool(parser->start());
+      return std::make_pair(result, std::move(parser));
+    };
+
+    // マクロ展開によるヘッダ名
+    {
+      auto [result, parser] = parse(u8"#define HEADER <header_unit.hpp>"sv, u8"import HEADER;"sv, u8"int n = UNIT_VALUE;"sv);
+      REQUIRE_UNARY(result);
+
+      const auto tokens = significant_tokens(*parser);
+      REQUIRE_EQ(tokens.size(), 8u);
+      CHECK_EQ(tokens[0].first, pp_token_category::import_keyword);
+      CHECK_EQ(tokens[1], std::pair{pp_token_category::header_name, std::u8string{u8"<header_unit.hpp>"}});
+      CHECK_EQ(tokens[6], std::pair{pp_token_category::pp_number, std::u8string{u8"42"}});
+
+      REQUIRE_EQ(parser->get_dependencies().required_modules.size(), 1u);
+      CHECK_EQ(parser->get_dependencies().required_modules[0].lookup, include_lookup::angle);
+    }
+
+    // ディレクティブにならないimport/module
+    {
+      auto [result, parser] = parse(u8"int import = 1;"sv, u8"import = 2;"sv, u8"module.f();"sv);
+      REQUIRE_UNARY(result);
+
+      const auto tokens = significant_tokens(*parser);
+      REQUIRE_EQ(tokens.size(), 15u);
+      CHECK_EQ(tokens[5], std::pair{pp_token_category::identifier, std::u8string{u8"import"}});
+      CHECK_EQ(tokens[9], std::pair{pp_token_category::identifier, std::u8string{u8"module"}});
+      CHECK_UNARY(parser->get_dependencies().required_modules.empty());
+    }
+
+    // モジュール名にオブジェクト形式マクロは使えない
+    CHECK_UNARY_FALSE(parse(u8"#define M m"sv, u8"export module M;"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    CHECK_UNARY_FALSE(parse(u8"#define P p"sv, u8"import a.P;"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+
+    // 関数形式マクロは展開されない
+    CHECK_UNARY(parse(u8"#define M(x) x"sv, u8"export module M;"sv).first);
+
+    // ;で終わらない
+    CHECK_UNARY_FALSE(parse(u8"export module m"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    CHECK_UNARY_FALSE(parse(u8"import <header_unit.hpp> x"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+
+    // モジュール名の識別子は.か:で区切られていなければならない
+    CHECK_UNARY_FALSE(parse(u8"module a b;"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    CHECK_UNARY_FALSE(parse(u8"import foo /* */ bar;"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+    CHECK_UNARY(parse(u8"import foo . bar : baz;"sv).first);
+
+    // ヘッダユニットが見つからない
+    CHECK_UNARY_FALSE(parse(u8"import \"not_exist.hpp\";"sv).first);
+    CHECK_UNARY(kusabira_test::report::test_out::extract_string().length() > 0);
+  }
+
+  TEST_CASE("module preamble scan test") {
+    using namespace std::string_view_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "module";
+    const auto path = dir / "unit.cpp";
+
+    for (const bool scan_only : {false, true}) {
+      file_paser parser{file_tokenizer{path}, path};
+      parser.set_scan_only(scan_only);
+
+      std::size_t call_count = 0;
+      parser.set_preamble_handler([&call_count](const kusabira::PP::dependency_info& deps) {
+        ++call_count;
+        CHECK_UNARY(deps.provided_module.has_value());
+        CHECK_EQ(deps.required_modules.size(), 3u);
+        return false;
+      });
+
+      // 最初のテキスト行の手前で止まる
+      REQUIRE_UNARY(bool(parser.start()));
+      CHECK_EQ(call_count, 1u);
+      if (not scan_only) {
+        CHECK_EQ(significant_tokens(parser).size(), 23u);
+      }
+    }
+
+    // #ifの中で止まってもエラーにならない
+    {
+      string_reader str_reader{(dir / "test.cpp").string()};
+      str_reader.setlines(u8"import std;"sv, u8"#if 1"sv, u8"int n;"sv, u8"#endif"sv);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, dir / "test.cpp"};
+      parser.set_preamble_handler([](const auto&) { return false; });
+      CHECK_UNARY(bool(parser.start()));
+      CHECK_EQ(parser.get_dependencies().required_modules.size(), 1u);
+    }
+
+    // 続けた場合、テキスト行が無ければファイル終端で呼ばれる
+    {
+      string_reader str_reader{(dir / "test.cpp").string()};
+      str_reader.setlines(u8"import std;"sv);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, dir / "test.cpp"};
+      std::size_t call_count = 0;
+      parser.set_preamble_handler([&call_count](const auto&) { ++call_count; return true; });
+      CHECK_UNARY(bool(parser.start()));
+      CHECK_EQ(call_count, 1u);
+    }
+  }
+
+} // namespace kusabira_test::module_test
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <thread>
+
+#include "doctest/doctest.h"
+#include "PP/phase_timer.hpp"
+
+namespace kusabira_test::phase_timer_test {
+
+  using kusabira::PP::pp_phase;
+  using enabled_timer = kusabira::PP::basic_scoped_phase_timer<true>;
+
+  TEST_CASE("disabled phase timer test") {
+    static_assert(std::is_empty_v<kusabira::PP::basic_scoped_phase_timer<false>>);
+
+    kusabira::PP::reset_phase_times();
+    {
+      [[maybe_unused]] kusabira::PP::basic_scoped_phase_timer<false> timer{pp_phase::tokenize};
+    }
+
+    const auto& table = kusabira::PP::current_phase_times();
+    CHECK_EQ(table.calls[static_cast<std::size_t>(pp_phase::tokenize)], 0u);
+    CHECK_EQ(table.total().count(), 0);
+  }
+
+  TEST_CASE("nested phase timer test") {
+    using namespace std::chrono_literals;
+
+    kusabira::PP::reset_phase_times();
+    {
+      [[maybe_unused]] enabled_timer outer{pp_phase::define};
+      std::this_thread::sleep_for(2ms);
+      {
+        [[maybe_unused]] enabled_timer inner{pp_phase::macro_expand};
+        std::this_thread::sleep_for(20ms);
+      }
+      {
+        [[maybe_unused]] enabled_timer inner{pp_phase::macro_expand};
+      }
+    }
+
+    const auto& table = kusabira::PP::current_phase_times();
+    const auto define = table.self_time[static_cast<std::size_t>(pp_phase::define)];
+    const auto expand = table.self_time[static_cast<std::size_t>(pp_phase::macro_expand)];
+
+    CHECK_EQ(table.calls[static_cast<std::size_t>(pp_phase::define)], 1u);
+    CHECK_EQ(table.calls[static_cast<std::size_t>(pp_phase::macro_expand)], 2u);
+    CHECK_EQ(table.calls[static_cast<std::size_t>(pp_phase::output)], 0u);
+
+    // 内側の区間の時間は外側に含まれない
+    CHECK_UNARY(20ms <= expand);
+    CHECK_UNARY(2ms <= define);
+    CHECK_UNARY(define < expand);
+    CHECK_EQ(table.total(), define + expand);
+
+    // 別スレッドの計測結果とは混ざらない
+    std::thread{[] {
+      CHECK_EQ(kusabira::PP::current_phase_times().total().count(), 0);
+    }}.join();
+
+    kusabira::PP::reset_phase_times();
+    CHECK_EQ(kusabira::PP::current_phase_times().calls[static_cast<std::size_t>(pp_phase::define)], 0u);
+  }
+
+  TEST_CASE("phase time report test") {
+    using namespace std::chrono_literals;
+
+    kusabira::PP::phase_time_table table{};
+    table.self_time[static_cast<std::size_t>(pp_phase::tokenize)] = 3ms;
+    table.calls[static_cast<std::size_t>(pp_phase::tokenize)] = 42;
+    table.self_time[static_cast<std::size_t>(pp_phase::output)] = 1ms;
+    table.calls[static_cast<std::size_t>(pp_phase::output)] = 1;
+
+    const auto report = kusabira::PP::format_phase_time_report(table, "/kusabira/test.cpp");
+
+    CHECK_NE(report.find("/kusabira/test.cpp"), std::string::npos);
+    CHECK_NE(report.find("tokenize                  3.000    75.0%           42"), std::string::npos);
+    CHECK_NE(report.find("output                    1.000    25.0%            1"), std::string::npos);
+    CHECK_NE(report.find("file read                 0.000     0.0%            0"), std::string::npos);
+    CHECK_NE(report.find("total                     4.000   100.0%"), std::string::npos);
+  }
+}
@@ -502,13 +502,13 @@ namespace kusabira_test::cpp_constexpr_test {
       CHECK_UNARY(opt);
       CHECK_UNARY(*opt);
 
-      /*token_seq.clear();
-      token_seq.emplace_back(pp_token_category::charcter_literal, u8"'\0'", 0, pos);
+      token_seq.clear();
+      token_seq.emplace_back(pp_token_category::charcter_literal, u8R"('\0')", 0, pos);
 
-      auto opt = ce_calc(token_seq);
+      opt = ce_calc(token_seq);
 
       CHECK_UNARY(opt);
-      CHECK_UNARY_FALSE(*opt);*/
+      CHECK_UNARY_FALSE(*opt);
     }
 
     // ()に囲まれた式
@@ -537,4 +537,204 @@ namespace kusabira_test::cpp_constexpr_test {
       CHECK_UNARY(*opt);
     }
   }
-}
\ No newline at end of file
+
+  /**
+  * @brief 空白区切りの文字列から定数式のトークン列を作る
+  */
+  inline auto make_constexpr_tokens(std::u8string_view expr, std::pmr::forward_list<logical_line>::const_iterator line) -> std::vector<pp_token> {
+    std::vector<pp_token> tokens{};
+    std::size_t pos = 0;
+
+    while (pos < expr.length()) {
+      auto next = expr.find(u8' ', pos);
+      if (next == std::u8string_view::npos) next = expr.length();
+      auto str = expr.substr(pos, next - pos);
+
+      auto category = pp_token_category::op_or_punc;
+      if (u8'0' <= str.front() and str.front() <= u8'9') {
+        category = pp_token_category::pp_number;
+      } else if (str.back() == u8'\'') {
+        category = pp_token_category::charcter_literal;
+      } else if (str.front() == u8'_' or (u8'a' <= str.front() and str.front() <= u8'z') or (u8'A' <= str.front() and str.front() <= u8'Z')) {
+        category = pp_token_category::identifier;
+      }
+      tokens.emplace_back(category, str, pos, line);
+
+      pos = next + 1;
+    }
+
+    return tokens;
+  }
+
+  TEST_CASE("pp_constexpr operator test") {
+    auto reporter = kusabira::report::reporter_factory<kusabira_test::report::test_out>::create();
+    kusabira::PP::pp_constexpr ce_calc{*reporter, fs::path("cpp_constexpr_test.hpp")};
+
+    std::pmr::forward_list<logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+
+    auto signed_value = [&](std::u8string_view expr) -> std::intmax_t {
+      auto result = ce_calc.evaluate(make_constexpr_tokens(expr, pos));
+      REQUIRE_UNARY(bool(result));
+      REQUIRE_UNARY(std::holds_alternative<std::intmax_t>(*result));
+      return std::get<std::intmax_t>(*result);
+    };
+    auto unsigned_value = [&](std::u8string_view expr) -> std::uintmax_t {
+      auto result = ce_calc.evaluate(make_constexpr_tokens(expr, pos));
+      REQUIRE_UNARY(bool(result));
+      REQUIRE_UNARY(std::holds_alternative<std::uintmax_t>(*result));
+      return std::get<std::uintmax_t>(*result);
+    };
+
+    // 算術演算と優先順位
+    CHECK_EQ(signed_value(u8"1 + 2 * 3"), 7);
+    CHECK_EQ(signed_value(u8"( 1 + 2 ) * 3"), 9);
+    CHECK_EQ(signed_value(u8"10 - 4 - 3"), 3);
+    CHECK_EQ(signed_value(u8"100 / 10 / 5"), 2);
+    CHECK_EQ(signed_value(u8"17 % 5 + 1"), 3);
+    CHECK_EQ(signed_value(u8"- 7 / 2"), -3);
+    CHECK_EQ(signed_value(u8"- - 3"), 3);
+    CHECK_EQ(signed_value(u8"+ 3 - - 3"), 6);
+    CHECK_EQ(signed_value(u8"~ 0"), -1);
+    CHECK_EQ(signed_value(u8"! 0 + ! 5"), 1);
+
+    // シフト、ビット演算
+    CHECK_EQ(signed_value(u8"1 << 4 + 1"), 32);
+    CHECK_EQ(signed_value(u8"- 16 >> 2"), -4);
+    CHECK_EQ(signed_value(u8"1 << 64"), 0);
+    CHECK_EQ(signed_value(u8"8 << - 2"), 2);
+    CHECK_EQ(signed_value(u8"6 & 3 | 8 ^ 1"), 11);
+    CHECK_EQ(signed_value(u8"0xf0 bitand 0x3c bitor 1"), 0x31);
+    CHECK_EQ(signed_value(u8"compl 0 xor 1"), -2);
+
+    // 比較、論理演算
+    CHECK_EQ(signed_value(u8"1 < 2 == 2 > 1"), 1);
+    CHECK_EQ(signed_value(u8"3 <= 2 != 1"), 1);
+    CHECK_EQ(signed_value(u8"1 && 2 || 0"), 1);
+    CHECK_EQ(signed_value(u8"0 || 0 && 1"), 0);
+    CHECK_EQ(signed_value(u8"not 0 and 1 or 0"), 1);
+    CHECK_EQ(signed_value(u8"1 not_eq 1"), 0);
+
+    // 条件演算子は右結合
+    CHECK_EQ(signed_value(u8"1 ? 2 : 3"), 2);
+    CHECK_EQ(signed_value(u8"0 ? 2 : 0 ? 3 : 4"), 4);
+    CHECK_EQ(signed_value(u8"1 ? 0 ? 5 : 6 : 7"), 6);
+    CHECK_EQ(signed_value(u8"1 || 0 ? 8 : 9"), 8);
+    CHECK_EQ(signed_value(u8"( 1 , 2 )"), 2);
+    // ?と:の間は完全な式
+    CHECK_EQ(signed_value(u8"1 ? 2 , 0 : 4"), 0);
+    CHECK_EQ(signed_value(u8"0 ? 2 , 0 : 4"), 4);
+    CHECK_EQ(signed_value(u8"1 ? 1 ? 2 , 3 : 4 : 5"), 3);
+
+    // 識別子は0、true/falseは1/0
+    CHECK_EQ(signed_value(u8"UNKNOWN_MACRO + 1"), 1);
+    CHECK_EQ(signed_value(u8"true + true"), 2);
+    CHECK_EQ(signed_value(u8"false"), 0);
+    CHECK_EQ(signed_value(u8"'a' == 97"), 1);
+
+    // エスケープシーケンス
+    CHECK_EQ(signed_value(u8R"('\n' == 10)"), 1);
+    CHECK_EQ(signed_value(u8R"('\\' == 92)"), 1);
+    CHECK_EQ(signed_value(u8R"('\'' == 39)"), 1);
+    CHECK_EQ(signed_value(u8R"('\x41' == 65)"), 1);
+    CHECK_EQ(signed_value(u8R"('\101' == 65)"), 1);
+    CHECK_EQ(signed_value(u8R"('\0' == 0)"), 1);
+    CHECK_EQ(signed_value(u8R"('\xff' == - 1)"), 1);
+    CHECK_EQ(signed_value(u8R"(u'あ' == 0x3042)"), 1);
+
+    // defined、既定では全ての識別子は未定義
+    CHECK_EQ(signed_value(u8"defined X"), 0);
+    CHECK_EQ(signed_value(u8"! defined ( X )"), 1);
+
+    // 符号なし整数、通常の算術変換
+    CHECK_EQ(unsigned_value(u8"0u - 1"), std::numeric_limits<std::uintmax_t>::max());
+    CHECK_EQ(signed_value(u8"- 1 < 0u"), 0);
+    CHECK_EQ(signed_value(u8"- 1 < 0"), 1);
+    CHECK_EQ(unsigned_value(u8"1 ? 1 : 0u"), 1u);
+    CHECK_EQ(unsigned_value(u8"18446744073709551615"), std::numeric_limits<std::uintmax_t>::max());
+    CHECK_EQ(unsigned_value(u8"1u << 63 >> 63"), 1u);
+    CHECK_EQ(signed_value(u8"1 << 63 >> 63"), -1);
+    CHECK_EQ(signed_value(u8"9223372036854775807 + 1 < 0"), 1);
+    CHECK_EQ(signed_value(u8"( - 9223372036854775807 - 1 ) / - 1 < 0"), 1);
+
+    // 評価されない部分式でのゼロ除算はエラーにならない
+    CHECK_EQ(signed_value(u8"0 && 1 / 0"), 0);
+    CHECK_EQ(signed_value(u8"1 || 1 % 0"), 1);
+    CHECK_EQ(signed_value(u8"1 ? 2 : 1 / 0"), 2);
+    CHECK_EQ(signed_value(u8"0 ? 1 / 0 : 3"), 3);
+    CHECK_EQ(signed_value(u8"0 && ( 1 || 1 / 0 )"), 0);
+
+    // 深い入れ子
+    {
+      std::u8string expr{};
+      for (int i = 0; i < 100; ++i) expr += u8"( ";
+      expr += u8"1";
+      for (int i = 0; i < 100; ++i) expr += u8" )";
+      CHECK_EQ(signed_value(expr), 1);
+    }
+
+    CHECK_UNARY(report::test_out::extract_string().empty());
+  }
+
+  TEST_CASE("pp_constexpr error test") {
+    using kusabira::PP::pp_parse_context;
+
+    auto reporter = kusabira::report::reporter_factory<kusabira_test::report::test_out>::create(kusabira::report::report_lang::en_us);
+    kusabira::PP::pp_constexpr ce_calc{*reporter, fs::path("cpp_constexpr_test.hpp")};
+
+    std::pmr::forward_list<logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+
+    auto is_error = [&](std::u8string_view expr) -> bool {
+      auto result = ce_calc(make_constexpr_tokens(expr, pos));
+      // エラーは報告されている
+      CHECK_UNARY_FALSE(report::test_out::extract_string().empty());
+      return not result;
+    };
+
+    CHECK_UNARY(is_error(u8"1 +"));
+    CHECK_UNARY(is_error(u8"1 2"));
+    CHECK_UNARY(is_error(u8"* 1"));
+    CHECK_UNARY(is_error(u8"( 1"));
+    CHECK_UNARY(is_error(u8"1 )"));
+    CHECK_UNARY(is_error(u8"1 ? 2"));
+    CHECK_UNARY(is_error(u8"1 : 2"));
+    CHECK_UNARY(is_error(u8"1 , 2"));
+    CHECK_UNARY(is_error(u8"1 ? 2 : 3 , 4"));
+    CHECK_UNARY(is_error(u8"1 ? 2 , 3"));
+    CHECK_UNARY(is_error(u8"1 = 2"));
+    CHECK_UNARY(is_error(u8"1 / 0"));
+    CHECK_UNARY(is_error(u8"1 % ( 1 - 1 )"));
+    CHECK_UNARY(is_error(u8"1.0"));
+    CHECK_UNARY(is_error(u8"defined"));
+    CHECK_UNARY(is_error(u8"defined ( X"));
+    CHECK_UNARY(is_error(u8"defined ( 1 )"));
+    CHECK_UNARY(is_error(u8"1 and_eq 2"));
+
+    // 入れ子が深すぎる
+    {
+      std::u8string expr{};
+      for (std::size_t i = 0; i <= kusabira::PP::detail::max_nest_depth; ++i) expr += u8"( ";
+      expr += u8"1";
+      for (std::size_t i = 0; i <= kusabira::PP::detail::max_nest_depth; ++i) expr += u8" )";
+      CHECK_UNARY(is_error(expr));
+    }
+  }
+
+  TEST_CASE("pp_constexpr defined test") {
+    auto reporter = kusabira::report::reporter_factory<kusabira_test::report::test_out>::create();
+    kusabira::PP::pp_constexpr ce_calc{*reporter, fs::path("cpp_constexpr_test.hpp"), [](std::u8string_view name) {
+      return name == u8"FOO";
+    }};
+
+    std::pmr::forward_list<logical_line> ll{};
+    auto pos = ll.before_begin();
+    pos = ll.emplace_after(pos, 0, 0);
+
+    CHECK_UNARY(*ce_calc(make_constexpr_tokens(u8"defined FOO", pos)));
+    CHECK_UNARY(*ce_calc(make_constexpr_tokens(u8"defined ( FOO ) && ! defined BAR", pos)));
+    CHECK_UNARY_FALSE(*ce_calc(make_constexpr_tokens(u8"defined BAR || defined ( BAZ )", pos)));
+  }
+}
@@ -97,7 +97,7 @@ namespace kusabira_test::preprocessor {
       CHECK_EQ(args.size(), 3);
 
       it = std::ranges::begin(tokens);
-      for (auto& list : args) {
+      for (const auto& list : args) {
         CHECK_EQ(list.size(), 1);
         CHECK_UNARY(std::ranges::equal(list, std::ranges::subrange{it, std::ranges::next(it)}));
         it = std::ranges::next(it, 2);
@@ -209,10 +209,58 @@ namespace kusabira_test::preprocessor {
 
       CHECK_EQ(args.size(), 5);
 
-      for (auto& list : args) {
+      for (const auto& list : args) {
         CHECK_UNARY(std::ranges::empty(list));
       }
     }
+    {
+      // 実引数列を使いまわす
+      kusabira::PP::macro_args args{};
+
+      // M(a1, (a2, a3)) x
+      std::vector<pp_token> tokens{
+        pp_token{pp_token_category::identifier, u8"a1"},
+        pp_token{pp_token_category::op_or_punc, u8","},
+        pp_token{pp_token_category::op_or_punc, u8"("},
+        pp_token{pp_token_category::identifier, u8"a2"},
+        pp_token{pp_token_category::op_or_punc, u8","},
+        pp_token{pp_token_category::identifier, u8"a3"},
+        pp_token{pp_token_category::op_or_punc, u8")"},
+        pp_token{pp_token_category::op_or_punc, u8")"},
+        pp_token{pp_token_category::identifier, u8"x"}
+      };
+
+      auto copy_token = [](auto& itr, auto, kusabira::PP::macro_args& collected) {
+        collected.push_token(*itr);
+        ++itr;
+        return true;
+      };
+
+      auto it = std::ranges::begin(tokens);
+      REQUIRE_UNARY(kusabira::PP::parse_macro_args(it, tokens.end(), args, copy_token));
+
+      // 閉じかっこを指して終わる
+      CHECK_EQ(std::ranges::distance(std::ranges::begin(tokens), it), 7);
+      REQUIRE_EQ(args.size(), 2);
+      CHECK_UNARY(std::ranges::equal(args[0], std::ranges::subrange{tokens.begin(), tokens.begin() + 1}));
+      CHECK_UNARY(std::ranges::equal(args[1], std::ranges::subrange{tokens.begin() + 2, tokens.begin() + 7}));
+
+      // 閉じていない呼び出し M(a1, (a2, a3)
+      it = std::ranges::begin(tokens);
+      CHECK_UNARY_FALSE(kusabira::PP::parse_macro_args(it, tokens.begin() + 7, args, copy_token));
+      CHECK_EQ(it, tokens.begin() + 7);
+      CHECK_EQ(args.size(), 1);
+
+      // list表現からの変換
+      std::pmr::vector<std::pmr::list<pp_token>> lists{&kusabira::def_mr};
+      lists.emplace_back();
+      lists.emplace_back(std::initializer_list<pp_token>{tokens[3], tokens[4], tokens[5]});
+      const kusabira::PP::macro_args converted{lists};
+
+      REQUIRE_EQ(converted.size(), 2);
+      CHECK_UNARY(std::ranges::empty(converted[0]));
+      CHECK_UNARY(std::ranges::equal(converted.back(), lists[1]));
+    }
   }
 
   TEST_CASE("object like macro test") {
@@ -935,7 +983,8 @@ namespace kusabira_test::preprocessor {
 
       const auto& pptoken = str_list.front();
       CHECK_EQ(pptoken.category, pp_token_category::string_literal);
-      CHECK_EQ(5ull, std::distance(pptoken.composed_tokens.begin(), pptoken.composed_tokens.end()));
+      // 元のトークン列は有効な時だけ記録される
+      CHECK_EQ(kusabira::PP::token_provenance_enabled ? 5ull : 0ull, std::distance(pptoken.composed_tokens.begin(), pptoken.composed_tokens.end()));
       auto str = u8R"**("test, L\"abcd\\aaa\\\\ggg\\\"sv, 12345ull")**"sv;
       CHECK_UNARY(pptoken.token == str);
     }
@@ -989,9 +1038,46 @@ namespace kusabira_test::preprocessor {
 
       const auto& emptystr_token = str_list.front();
       CHECK_EQ(emptystr_token.category, pp_token_category::string_literal);
-      CHECK_EQ(1ull, std::distance(emptystr_token.composed_tokens.begin(), emptystr_token.composed_tokens.end()));
+      CHECK_EQ(kusabira::PP::token_provenance_enabled ? 1ull : 0ull, std::distance(emptystr_token.composed_tokens.begin(), emptystr_token.composed_tokens.end()));
       CHECK_UNARY(emptystr_token.token == u8R"("test")"sv);
     }
+
+    vec.clear();
+
+    // 全ての"と\がエスケープされる（文字リテラル中の"、16文字を超えるリテラルの途中と末尾）
+    vec.emplace_back(pp_token_category::charcter_literal, u8R"('"')"sv, 0, pos);
+    vec.emplace_back(pp_token_category::whitespaces, u8" "sv, 0, pos);
+    vec.emplace_back(pp_token_category::string_literal, u8R"("0123456789abcdef\\0123456789\"abcdef")"sv, 0, pos);
+    vec.emplace_back(pp_token_category::whitespaces, u8" "sv, 0, pos);
+    vec.emplace_back(pp_token_category::raw_string_literal, u8R"**(R"(0123456789abcdef0123456789abcdef")")**"sv, 0, pos);
+    vec.emplace_back(pp_token_category::whitespaces, u8" "sv, 0, pos);
+    vec.emplace_back(pp_token_category::identifier, u8R"(not_a_literal_longer_than_16)"sv, 0, pos);
+    {
+      auto str_list = kusabira::PP::pp_stringize<false>(vec);
+      REQUIRE_EQ(1ull, str_list.size());
+
+      const auto& pptoken = str_list.front();
+      auto str = u8R"**("'\"' \"0123456789abcdef\\\\0123456789\\\"abcdef\" R\"(0123456789abcdef0123456789abcdef\")\" not_a_literal_longer_than_16")**"sv;
+      CHECK_UNARY(pptoken.token == str);
+    }
+  }
+
+  TEST_CASE("stringize escape search test") {
+    using kusabira::PP::detail::find_stringize_escape;
+    using kusabira::PP::detail::count_stringize_escapes;
+
+    // 16文字単位の境界の前後に置いても見つかる
+    for (std::size_t n = 0; n < 40; ++n) {
+      std::u8string str(40, u8'a');
+      str[n] = (n % 2 == 0) ? u8'"' : u8'\\';
+
+      CHECK_EQ(find_stringize_escape(str, 0), n);
+      CHECK_EQ(find_stringize_escape(str, n + 1), str.size());
+      CHECK_EQ(count_stringize_escapes(str), 1u);
+    }
+
+    CHECK_EQ(find_stringize_escape(u8""sv, 0), 0u);
+    CHECK_EQ(count_stringize_escapes(u8R"("\\\\""")"sv), 8u);
   }
 
   TEST_CASE("# operator test") {
@@ -813,6 +813,12 @@ namespace pp_parsing_test
       (void)std::initializer_list<int>{(inserter(args), 0)...};
     }
 
+    void setlines(std::span<const std::u8string> lines) {
+      for (const auto& str : lines) {
+        src_lines.emplace_back(str);
+      }
+    }
+
     auto readline() -> std::optional<kusabira::PP::logical_line> {
       if (size(src_lines) <= index) return std::nullopt;
     
@@ -939,4 +945,173 @@ namespace pp_parsing_test
   }
 
 
+  TEST_CASE("if section test") {
+    using kusabira::PP::pp_token_category;
+    using namespace std::literals;
+
+    // 改行を除いたプリプロセス結果
+    auto parse = [](auto&&... lines) -> std::vector<std::u8string> {
+      string_reader str_reader{"test/if_section.cpp"};
+      str_reader.setlines(lines...);
+
+      test_paser parser{test_tokenizer{std::move(str_reader)}, "test/if_section.cpp"};
+
+      auto status = parser.start();
+      REQUIRE_UNARY(bool(status));
+
+      std::vector<std::u8string> result{};
+      for (const auto& pptoken : parser.get_phase4_result()) {
+        if (pptoken.category == pp_token_category::newline) continue;
+        result.emplace_back(pptoken.token.to_view());
+      }
+      return result;
+    };
+
+    // 条件式による分岐
+    {
+      auto result = parse(
+          u8"#define VERSION 3"sv,
+          u8"#if VERSION * 2 > 5 && !UNDEFINED"sv,
+          u8"a"sv,
+          u8"#else"sv,
+          u8"b"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"a"});
+    }
+    {
+      auto result = parse(
+          u8"#if 1 - 1"sv,
+          u8"a"sv,
+          u8"#else"sv,
+          u8"b"sv,
+          u8"#endif"sv,
+          u8"c"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"b", u8"c"});
+    }
+
+    // #elif、最初に真となったグループだけが有効
+    {
+      auto result = parse(
+          u8"#define N 2"sv,
+          u8"#if N == 1"sv,
+          u8"one"sv,
+          u8"#elif N == 2"sv,
+          u8"two"sv,
+          u8"#elif N >= 2"sv,
+          u8"more"sv,
+          u8"#else"sv,
+          u8"other"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"two"});
+    }
+    {
+      auto result = parse(
+          u8"#if 0"sv,
+          u8"one"sv,
+          u8"#elif 0"sv,
+          u8"two"sv,
+          u8"#else"sv,
+          u8"other"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"other"});
+    }
+
+    // definedのオペランドはマクロ展開されない
+    {
+      auto result = parse(
+          u8"#define FOO BAR"sv,
+          u8"#if defined FOO && defined(FOO) && !defined BAR"sv,
+          u8"a"sv,
+          u8"#endif"sv,
+          u8"#undef FOO"sv,
+          u8"#if defined(FOO)"sv,
+          u8"b"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"a"});
+    }
+
+    // #ifdef/#ifndef
+    {
+      auto result = parse(
+          u8"#ifndef GUARD_H"sv,
+          u8"#define GUARD_H"sv,
+          u8"a"sv,
+          u8"#endif"sv,
+          u8"#ifndef GUARD_H"sv,
+          u8"b"sv,
+          u8"#endif"sv,
+          u8"#ifdef GUARD_H"sv,
+          u8"c"sv,
+          u8"#else"sv,
+          u8"d"sv,
+          u8"#endif"sv,
+          u8"#ifdef __LINE__ // comment"sv,
+          u8"e"sv,
+          u8"#endif"sv,
+          u8"#undef GUARD_H"sv,
+          u8"#ifdef GUARD_H"sv,
+          u8"f"sv,
+          u8"#elif !defined(GUARD_H)"sv,
+          u8"g"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"a", u8"c", u8"e", u8"g"});
+    }
+
+    // 入れ子、無効なグループの中の#ifは評価しない
+    {
+      auto result = parse(
+          u8"#if 1"sv,
+          u8"#if 0"sv,
+          u8"a"sv,
+          u8"#elif 1 / 1"sv,
+          u8"b"sv,
+          u8"#else"sv,
+          u8"c"sv,
+          u8"#endif"sv,
+          u8"#else"sv,
+          u8"#if 1 / 0"sv,
+          u8"d"sv,
+          u8"#endif"sv,
+          u8"#endif"sv);
+      CHECK_EQ(result, std::vector<std::u8string>{u8"b"});
+    }
+  }
+
+  TEST_CASE("deep macro nesting test") {
+    using kusabira::PP::pp_token_category;
+
+    // 入れ子の展開はネイティブのスタックを消費しない
+    constexpr int depth = 20000;
+
+    auto name = [](char prefix, int n) {
+      const auto str = prefix + std::to_string(n);
+      return std::u8string(str.begin(), str.end());
+    };
+
+    std::vector<std::u8string> lines{};
+    for (int i = 0; i < depth; ++i) {
+      lines.push_back(u8"#define " + name('M', i) + u8" " + name('M', i + 1));
+      lines.push_back(u8"#define " + name('F', i) + u8"(x) " + name('F', i + 1) + u8"(x)");
+    }
+    lines.push_back(u8"#define " + name('M', depth) + u8" 42");
+    lines.push_back(u8"#define " + name('F', depth) + u8"(x) x");
+    lines.push_back(u8"#define G F0");
+    // Gの展開結果の呼び出しは次の行で閉じる
+    lines.push_back(u8"M0 F0(M0) G");
+    lines.push_back(u8"(0)");
+
+    string_reader str_reader{"test/deep_nesting.cpp"};
+    str_reader.setlines(lines);
+
+    test_paser parser{test_tokenizer{std::move(str_reader)}, "test/deep_nesting.cpp"};
+    REQUIRE_UNARY(bool(parser.start()));
+
+    std::vector<std::u8string> result{};
+    for (const auto& pptoken : parser.get_phase4_result()) {
+      if (pptoken.category == pp_token_category::newline) continue;
+      result.emplace_back(pptoken.token.to_view());
+    }
+    CHECK_EQ(result, std::vector<std::u8string>{u8"42", u8"42", u8"0"});
+  }
+
 } // namespace pp_parsing_test
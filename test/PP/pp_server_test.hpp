@@ -0,0 +1,162 @@
+#pragma once
+
+#if __has_include(<sys/socket.h>) && __has_include(<sys/un.h>)
+
+#include <fstream>
+#include <thread>
+#include <fcntl.h>
+
+#include "doctest/doctest.h"
+
+#include "PP/pp_server.hpp"
+#include "test/PP/pp_filereader_test.hpp"
+
+namespace pp_server_test {
+
+  namespace fs = std::filesystem;
+
+  /**
+  * @brief fdに書き込まれた内容を全て読み出す
+  */
+  inline auto read_fd_content(int fd) -> std::string {
+    std::string result{};
+    char buf[4096];
+
+    ::lseek(fd, 0, SEEK_SET);
+    for (auto n = ::read(fd, buf, sizeof(buf)); 0 < n; n = ::read(fd, buf, sizeof(buf))) {
+      result.append(buf, n);
+    }
+
+    return result;
+  }
+
+  TEST_CASE("pp_server test") {
+    const auto workdir = fs::temp_directory_path() / "kusabira_pp_server_test";
+    fs::remove_all(workdir);
+    fs::create_directories(workdir);
+
+    const auto socket_path = workdir / "ppd.sock";
+    const auto srcpath = kusabira::test::get_testfiles_dir() / "PP" / "parse_macro.cpp";
+
+    // <>のインクルードはサーバーの探索設定から探す
+    const auto include_src = workdir / "include.cpp";
+    {
+      std::ofstream ofs{include_src};
+      ofs << "#include <sys_header.hpp>\nint v = SYS_VALUE;\n";
+    }
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(kusabira::test::get_testfiles_dir() / "PP" / "scan" / "sys");
+
+    kusabira::PP::pp_server<> server{socket_path, workdir / "cache"};
+    server.set_include_options(std::move(options));
+    REQUIRE_UNARY(server.listen());
+    CHECK_UNARY(fs::exists(socket_path));
+
+    std::thread th{[&server] { server.serve(); }};
+
+    const auto out_path = (workdir / "out.txt").string();
+    const auto err_path = (workdir / "err.txt").string();
+
+    // 1回目、キャッシュは空
+    {
+      int out_fd = ::open(out_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      int err_fd = ::open(err_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      REQUIRE_LE(0, out_fd);
+      REQUIRE_LE(0, err_fd);
+
+      auto reply = kusabira::PP::pp_client_request(socket_path, srcpath, out_fd, err_fd);
+      REQUIRE_UNARY(reply);
+      CHECK_EQ(reply->status, kusabira::PP::pp_server_status::Success);
+
+      const auto output = read_fd_content(out_fd);
+      CHECK_EQ(reply->output_bytes, output.size());
+      // マクロが展開されている
+      CHECK_NE(output.find("int vm = 1 ;"), std::string::npos);
+      CHECK_EQ(output.find("#define"), std::string::npos);
+      CHECK_UNARY(read_fd_content(err_fd).empty());
+
+      ::close(out_fd);
+      ::close(err_fd);
+    }
+
+    CHECK_EQ(server.token_cache().size(), 1u);
+
+    // 2回目、キャッシュを使っても同じ結果になる
+    {
+      int out_fd = ::open(out_path.c_str(), O_RDWR | O_TRUNC);
+      REQUIRE_LE(0, out_fd);
+
+      // 診断出力先を渡さない場合は出力先と同じになる
+      auto reply = kusabira::PP::pp_client_request(socket_path, srcpath, out_fd, -1);
+      REQUIRE_UNARY(reply);
+      CHECK_EQ(reply->status, kusabira::PP::pp_server_status::Success);
+      CHECK_EQ(reply->output_bytes, read_fd_content(out_fd).size());
+
+      ::close(out_fd);
+    }
+
+    CHECK_EQ(server.token_cache().size(), 1u);
+
+    // インクルードを含むファイル
+    {
+      int out_fd = ::open(out_path.c_str(), O_RDWR | O_TRUNC);
+      int err_fd = ::open(err_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      REQUIRE_LE(0, out_fd);
+      REQUIRE_LE(0, err_fd);
+
+      auto reply = kusabira::PP::pp_client_request(socket_path, include_src, out_fd, err_fd);
+      REQUIRE_UNARY(reply);
+      CHECK_EQ(reply->status, kusabira::PP::pp_server_status::Success);
+      CHECK_NE(read_fd_content(out_fd).find("int v = 2 ;"), std::string::npos);
+      CHECK_UNARY(read_fd_content(err_fd).empty());
+
+      ::close(out_fd);
+      ::close(err_fd);
+    }
+
+    // 存在しないファイル
+    {
+      int out_fd = ::open(out_path.c_str(), O_RDWR | O_TRUNC);
+      REQUIRE_LE(0, out_fd);
+
+      auto reply = kusabira::PP::pp_client_request(socket_path, workdir / "not_exist.cpp", out_fd, out_fd);
+      REQUIRE_UNARY(reply);
+      CHECK_EQ(reply->status, kusabira::PP::pp_server_status::FileNotFound);
+      CHECK_EQ(reply->output_bytes, 0u);
+
+      ::close(out_fd);
+    }
+
+    CHECK_UNARY(kusabira::PP::pp_client_shutdown(socket_path));
+    th.join();
+
+    // 終了後は接続できない
+    CHECK_UNARY_FALSE(kusabira::PP::pp_client_request(socket_path, srcpath, 1, 2));
+
+    // 直接呼び出す、失敗した場合は途中までの結果を書かない
+    {
+      kusabira::PP::expansion_limits limits{};
+      limits.max_output_tokens = 1;
+      server.set_expansion_limits(limits);
+
+      int out_fd = ::open(out_path.c_str(), O_RDWR | O_TRUNC);
+      int err_fd = ::open(err_path.c_str(), O_RDWR | O_TRUNC);
+      REQUIRE_LE(0, out_fd);
+      REQUIRE_LE(0, err_fd);
+
+      const auto reply = server.preprocess(srcpath, out_fd, err_fd);
+      CHECK_EQ(reply.status, kusabira::PP::pp_server_status::Failed);
+      CHECK_EQ(reply.output_bytes, 0u);
+      CHECK_UNARY(read_fd_content(out_fd).empty());
+      CHECK_UNARY_FALSE(read_fd_content(err_fd).empty());
+
+      ::close(out_fd);
+      ::close(err_fd);
+    }
+
+    fs::remove_all(workdir);
+  }
+
+} // namespace pp_server_test
+
+#endif
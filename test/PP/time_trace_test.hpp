@@ -0,0 +1,111 @@
+#pragma once
+
+#include <sstream>
+
+#include "doctest/doctest.h"
+#include "PP/time_trace.hpp"
+#include "test/PP/dependency_scan_test.hpp"
+
+namespace kusabira_test::time_trace_test {
+
+  using kusabira::PP::trace_kind;
+  using kusabira::PP::trace_event;
+  using dependency_scan_test::file_tokenizer;
+  using dependency_scan_test::file_paser;
+
+  TEST_CASE("time trace ring test") {
+    using namespace std::chrono_literals;
+
+    kusabira::PP::time_trace_ring ring{3, 0ns};
+
+    // 記録していなければ何も残らない
+    {
+      [[maybe_unused]] kusabira::PP::scoped_trace_span span{trace_kind::directive, u8"define"};
+    }
+    CHECK_UNARY_FALSE(kusabira::PP::time_trace_enabled());
+    CHECK_EQ(ring.size(), 0u);
+
+    {
+      kusabira::PP::time_trace_session session{ring};
+      CHECK_UNARY(kusabira::PP::time_trace_enabled());
+
+      for (auto name : {u8"a", u8"b", u8"c", u8"d", u8"e"}) {
+        [[maybe_unused]] kusabira::PP::scoped_trace_span span{trace_kind::macro, name};
+      }
+    }
+    CHECK_UNARY_FALSE(kusabira::PP::time_trace_enabled());
+
+    // 古いものから上書きされる
+    CHECK_EQ(ring.size(), 3u);
+    CHECK_EQ(ring.dropped(), 2u);
+
+    std::vector<std::u8string> names{};
+    ring.for_each([&](const trace_event& event) { names.push_back(event.detail); });
+    CHECK_EQ(names, std::vector<std::u8string>{u8"c", u8"d", u8"e"});
+
+    // 閾値より短いマクロ展開は記録しない
+    kusabira::PP::time_trace_ring slow_only{8, 1h};
+    {
+      kusabira::PP::time_trace_session session{slow_only};
+      [[maybe_unused]] kusabira::PP::scoped_trace_span macro{trace_kind::macro, u8"FAST"};
+      [[maybe_unused]] kusabira::PP::scoped_trace_span directive{trace_kind::directive, u8"include"};
+    }
+    CHECK_EQ(slow_only.size(), 1u);
+  }
+
+  TEST_CASE("time trace preprocess test") {
+    using namespace std::chrono_literals;
+
+    const auto dir = kusabira::test::get_testfiles_dir() / "PP" / "scan";
+    auto options = std::make_shared<kusabira::PP::include_options>();
+    options->angle_dirs.push_back(dir / "sys");
+
+    kusabira::PP::time_trace_ring ring{1024, 0ns};
+    {
+      kusabira::PP::time_trace_session session{ring};
+
+      const auto path = dir / "main.cpp";
+      file_paser parser{file_tokenizer{path}, path};
+      parser.set_include_options(options);
+
+      REQUIRE_UNARY(bool(parser.start()));
+    }
+
+    std::vector<trace_event> events{};
+    ring.for_each([&](const trace_event& event) { events.push_back(event); });
+    REQUIRE_UNARY_FALSE(events.empty());
+
+    auto count = [&events](trace_kind kind, std::u8string_view detail) {
+      return std::ranges::count_if(events, [&](const auto& event) { return event.kind == kind and event.detail.ends_with(detail); });
+    };
+
+    // 翻訳単位の区間は最後に閉じる
+    CHECK_EQ(events.back().kind, trace_kind::source);
+    CHECK_UNARY(events.back().detail.ends_with(u8"main.cpp"));
+
+    // by_macro.hppからも読まれる
+    CHECK_EQ(count(trace_kind::source, u8"local.hpp"), 2);
+    CHECK_EQ(count(trace_kind::source, u8"sys_header.hpp"), 1);
+    CHECK_EQ(count(trace_kind::source, u8"by_macro.hpp"), 1);
+    CHECK_EQ(count(trace_kind::directive, u8"include"), 5);
+    CHECK_EQ(count(trace_kind::macro, u8"HEADER"), 1);
+    CHECK_EQ(count(trace_kind::macro, u8"LOCAL_VALUE"), 1);
+
+    // 外側の区間は内側の区間を含む
+    const auto& tu = events.back();
+    for (const auto& event : events) {
+      CHECK_UNARY(tu.begin <= event.begin);
+      CHECK_UNARY(event.begin + event.duration <= tu.begin + tu.duration);
+    }
+
+    std::ostringstream os{};
+    ring.write_json(os, 7);
+    const auto json = os.str();
+
+    CHECK_UNARY(json.starts_with("{\"traceEvents\":["));
+    CHECK_NE(json.find("\"tid\":7,\"ph\":\"X\",\"cat\":\"kusabira\",\"name\":\"Source\""), std::string::npos);
+    CHECK_NE(json.find("\"name\":\"Macro\""), std::string::npos);
+    CHECK_NE(json.find("\"args\":{\"detail\":\"include\"}"), std::string::npos);
+    CHECK_NE(json.find("\"dropped\":0"), std::string::npos);
+  }
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "doctest/doctest.h"
+
+#include "PP/token_cache.hpp"
+#include "test/PP/pp_filereader_test.hpp"
+
+namespace token_cache_test {
+
+  using kusabira::PP::filereader;
+  using kusabira::PP::pp_tokenizer_sm;
+
+  // ll_paserのトークナイザとして使用できる
+  static_assert(std::ranges::input_range<kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm>>);
+  static_assert(std::move_constructible<kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm>>);
+
+  TEST_CASE("token cache test") {
+    namespace fs = std::filesystem;
+
+    const auto srcpath = kusabira::test::get_testfiles_dir() / "PP" / "parse_macro.cpp";
+    REQUIRE_UNARY(fs::exists(srcpath));
+
+    // テスト毎にまっさらなキャッシュディレクトリを使う
+    const auto cache_dir = fs::temp_directory_path() / "kusabira_token_cache_test";
+    fs::remove_all(cache_dir);
+
+    const auto hash = kusabira::PP::hash_file_content(srcpath);
+    REQUIRE_UNARY(hash);
+    const auto cache_path = cache_dir / kusabira::PP::token_cache_format::cache_filename(*hash);
+
+    // 元のトークナイザと同じトークン列が得られるかをチェック
+    auto check = [&](auto& cached) {
+      kusabira::PP::tokenizer<filereader, pp_tokenizer_sm> tk{srcpath};
+      std::size_t count = 0;
+
+      while (auto expect = tk.tokenize()) {
+        auto token = cached.tokenize();
+        REQUIRE_UNARY(token);
+
+        CHECK_EQ(token->category, expect->category);
+        CHECK_UNARY(token->token == expect->token);
+        CHECK_EQ(token->column, expect->column);
+        CHECK_EQ(token->get_phline_pos(), expect->get_phline_pos());
+        CHECK_EQ(token->get_logicalline_num(), expect->get_logicalline_num());
+        CHECK_UNARY(token->get_line_string() == expect->get_line_string());
+        ++count;
+      }
+      CHECK_UNARY_FALSE(cached.tokenize());
+
+      return count;
+    };
+
+    // キャッシュミス、トークナイズしてキャッシュを書き出す
+    {
+      kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm> cached{srcpath, cache_dir};
+
+      CHECK_UNARY(bool(cached.image()));
+      CHECK_UNARY_FALSE(cached.image().is_mapped());
+      CHECK_UNARY(fs::exists(cache_path));
+      CHECK_UNARY(0u < check(cached));
+    }
+
+    // キャッシュヒット、ファイルから読み出す
+    {
+      kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm> cached{srcpath, cache_dir};
+
+      CHECK_UNARY(bool(cached.image()));
+#ifdef KUSABIRA_TOKEN_CACHE_MMAP
+      CHECK_UNARY(cached.image().is_mapped());
+#endif
+      // ムーブしてもトークンの参照先は有効
+      auto moved = std::move(cached);
+      CHECK_UNARY(0u < check(moved));
+    }
+
+    // 内容ハッシュが一致しないキャッシュは使われない
+    {
+      CHECK_UNARY(kusabira::PP::token_cache_image::open(cache_path, *hash));
+      CHECK_UNARY_FALSE(kusabira::PP::token_cache_image::open(cache_path, *hash + 1));
+    }
+
+    // 壊れたキャッシュは作り直される
+    {
+      fs::resize_file(cache_path, fs::file_size(cache_path) - 1);
+      CHECK_UNARY_FALSE(kusabira::PP::token_cache_image::open(cache_path, *hash));
+
+      kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm> cached{srcpath, cache_dir};
+      CHECK_UNARY_FALSE(cached.image().is_mapped());
+      CHECK_UNARY(0u < check(cached));
+      CHECK_UNARY(kusabira::PP::token_cache_image::open(cache_path, *hash));
+    }
+
+    // 範囲forで回せる
+    {
+      kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm> cached{kusabira::test::get_testfiles_dir() / "PP" / "pp_test.cpp", cache_dir};
+      std::size_t count = 0;
+
+      for ([[maybe_unused]] auto&& token : cached) {
+        ++count;
+      }
+
+      CHECK_EQ(count, 93 + 21); //トークン+改行
+    }
+
+    fs::remove_all(cache_dir);
+  }
+
+  TEST_CASE("token cache conditional index test") {
+    namespace fs = std::filesystem;
+    using kusabira::PP::pp_token_category;
+
+    const auto srcpath = kusabira::test::get_testfiles_dir() / "PP" / "conditional_index.cpp";
+    const auto cache_dir = fs::temp_directory_path() / "kusabira_token_cache_cond_test";
+    fs::remove_all(cache_dir);
+
+    using cached_tokenizer = kusabira::PP::cached_tokenizer<filereader, pp_tokenizer_sm>;
+
+    // #if系/#elif/#else/#endifの対応
+    {
+      cached_tokenizer cached{srcpath, cache_dir};
+      const auto conditionals = cached.image().conditionals();
+      REQUIRE_EQ(conditionals.size(), 13u);
+
+      constexpr std::uint32_t expect_next[] = {4, 2, 3, 3, 9, 8, 7, 7, 8, 10, 10, 12, 12};
+      for (std::size_t i = 0; i < conditionals.size(); ++i) {
+        CHECK_EQ(conditionals[i].next, expect_next[i]);
+
+        const auto& sharp = cached.image().tokens()[conditionals[i].token_index];
+        CHECK_EQ(sharp.category, pp_token_category::op_or_punc);
+      }
+    }
+
+    // 無効なグループを対応するディレクティブまで一度に飛ばす
+    {
+      cached_tokenizer cached{srcpath, cache_dir};
+      auto it = begin(cached);
+
+      // #if MODE == 1 の次の行まで進める
+      for (int newline = 0; newline < 2; ++it) {
+        if ((*it).category == pp_token_category::newline) ++newline;
+      }
+      CHECK_UNARY((*it).token == u8"one");
+
+      REQUIRE_UNARY(cached.skip_inactive_group());
+      CHECK_UNARY((*it).token == u8"#");
+      ++it;
+      CHECK_UNARY((*it).token == u8"elif");
+      CHECK_EQ((*it).get_logicalline_num(), 9u);
+
+      // ディレクティブの直後でなければ飛ばさない
+      ++it;
+      CHECK_UNARY_FALSE(cached.skip_inactive_group());
+    }
+
+    // 索引の有無でプリプロセス結果は変わらない
+    {
+      auto collect = [](auto&& parser) {
+        REQUIRE_UNARY(bool(parser.start()));
+
+        std::vector<std::u8string> tokens{};
+        for (const auto& pptoken : parser.get_phase4_result()) {
+          if (pptoken.category == pp_token_category::newline) continue;
+          tokens.emplace_back(pptoken.token.to_view());
+        }
+        return tokens;
+      };
+
+      const std::vector<std::u8string> expect{u8"two", u8"defined_mode", u8"text", u8"last"};
+      CHECK_EQ(collect(kusabira::PP::ll_paser{kusabira::PP::tokenizer<filereader, pp_tokenizer_sm>{srcpath}, srcpath}), expect);
+      CHECK_EQ(collect(kusabira::PP::ll_paser{cached_tokenizer{srcpath, cache_dir}, srcpath}), expect);
+    }
+
+    fs::remove_all(cache_dir);
+  }
+
+} // namespace token_cache_test
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <fstream>
+
+#include "doctest/doctest.h"
+#include "bench/corpus_generator.hpp"
+#include "test/PP/dependency_scan_test.hpp"
+
+namespace kusabira_test::corpus_generator_test {
+
+  using dependency_scan_test::file_tokenizer;
+  using dependency_scan_test::file_paser;
+
+  TEST_CASE("corpus generator test") {
+    namespace fs = std::filesystem;
+    using kusabira::bench::corpus_kind;
+
+    const kusabira::bench::corpus_options options{ .seed = 42, .target_bytes = 8 * 1024, .nest_depth = 8, .repeat_count = 16 };
+
+    // 同じシードからは同じ入力
+    CHECK_EQ(kusabira::bench::generate_corpus(corpus_kind::plain_code, options), kusabira::bench::generate_corpus(corpus_kind::plain_code, options));
+    CHECK_NE(kusabira::bench::generate_corpus(corpus_kind::plain_code, options), kusabira::bench::generate_corpus(corpus_kind::plain_code, { .seed = 43, .target_bytes = 8 * 1024 }));
+
+    const auto dir = fs::temp_directory_path() / "kusabira_corpus_generator_test";
+    fs::create_directories(dir);
+
+    // どの種類もエラー無くプリプロセスできる
+    for (auto kind : kusabira::bench::all_corpus_kinds) {
+      CAPTURE(kusabira::bench::corpus_name(kind));
+      CHECK_EQ(kusabira::bench::parse_corpus_kind(kusabira::bench::corpus_name(kind)), kind);
+
+      const auto content = kusabira::bench::generate_corpus(kind, options);
+      CHECK_LE(options.target_bytes, content.size());
+
+      const auto path = dir / (std::string{kusabira::bench::corpus_name(kind)} + ".cpp");
+      {
+        std::ofstream ofs{path, std::ios::binary};
+        ofs << content;
+      }
+
+      file_paser parser{file_tokenizer{path}, path};
+      CHECK_UNARY(bool(parser.start()));
+      CHECK_UNARY_FALSE(parser.get_phase4_result().empty());
+    }
+
+    CHECK_UNARY_FALSE(kusabira::bench::parse_corpus_kind("unknown").has_value());
+
+    fs::remove_all(dir);
+  }
+
+} // namespace kusabira_test::corpus_generator_test
@@ -0,0 +1,24 @@
+#define MODE 2
+#if MODE == 1
+one
+#if 1
+nested
+#else
+nested_else
+#endif
+#elif MODE == 2
+two
+#ifdef MODE
+  # if 0
+  skipped
+  # endif
+defined_mode
+#endif
+#else
+other
+#endif
+/* #if */ text
+#ifndef MODE
+never
+#endif
+last
@@ -0,0 +1,13 @@
+#ifndef KUSABIRA_HEADER_CACHE_TEST
+#define KUSABIRA_HEADER_CACHE_TEST
+
+#if VALUE > 1
+int big = VALUE;
+#else
+int small = VALUE;
+#endif
+
+#define FROM_HEADER(x) x + VALUE
+#undef TEMP
+
+#endif
@@ -0,0 +1,5 @@
+int vm = M;
+SDEF(bar, 1, 2);
+xglue(HIGH, LOW)
+join(x, y);
+str(x) debug(1, 2)
@@ -0,0 +1,16 @@
+// 縮小のテスト
+#include "a.hpp"
+  /* comment */ # define X \
+  1
+int x = X;
+/* 複数行の
+#include "in_comment.hpp"
+*/ #if X
+const char* s = R"(
+#include "in_raw_string.hpp"
+)";
+#endif /* 次の行へ続く
+#include "in_comment2.hpp" */
+export module m;
+import std;
+int y = 0; #define NOT_DIRECTIVE
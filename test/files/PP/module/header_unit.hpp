@@ -0,0 +1,3 @@
+#define UNIT_VALUE 42
+#define UNIT_FUNC(x) (x)
+int header_unit_output;
@@ -0,0 +1,7 @@
+module;
+#define IN_FRAGMENT 1
+export module kusabira.test;
+import std;
+import "header_unit.hpp";
+import :part [[deprecated]];
+export int value = UNIT_VALUE + IN_FRAGMENT;
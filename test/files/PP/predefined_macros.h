@@ -0,0 +1,21 @@
+#define __DBL_MIN_EXP__ (-1021)
+#define __CHAR_BIT__ 8
+#define __ORDER_LITTLE_ENDIAN__ 1234
+#define __DEC32_MAX__ 9.999999E96DF
+#define __SIZEOF_LONG__ 8
+#define __GNUC__ 12
+#define __DBL_MAX__ double(1.79769313486231570814527423731704357e+308L)
+#define __cplusplus 201703L
+#define __SIZEOF_POINTER__ 8
+#define __LP64__ 1
+#define __VERSION__ "12.2.0"
+#define __UINT64_C(c) c ## UL
+#define __FLOAT_WORD_ORDER__ __ORDER_LITTLE_ENDIAN__
+#define __x86_64__ 1
+#define __CHAR16_TYPE__ short unsigned int
+#define __SIZEOF_INT__ 4
+#define __INT_MAX__ 0x7fffffff
+#define __BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__
+
+# undef __LP64__
+#  define __INT_WIDTH__ 32
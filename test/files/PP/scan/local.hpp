@@ -0,0 +1,8 @@
+#ifndef KUSABIRA_SCAN_LOCAL
+#define KUSABIRA_SCAN_LOCAL
+
+#include "sub/nested.hpp"
+
+#define LOCAL_VALUE 1
+
+#endif
@@ -0,0 +1,16 @@
+#include "local.hpp"
+#include <sys_header.hpp>
+
+#define HEADER "sub/by_macro.hpp"
+#include HEADER
+
+/* 複数行の
+   ブロックコメント #include "not_included.hpp"
+*/
+const char* str = R"(
+#include "not_included.hpp"
+)";
+
+int main() {
+  return LOCAL_VALUE + SYS_VALUE;
+}
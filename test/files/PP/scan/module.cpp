@@ -0,0 +1,11 @@
+module;
+#include "sub/nested.hpp"
+export module kusabira.scan:part;
+import std;
+export import kusabira.util;
+import :other;
+import "local.hpp";
+import <sys_header.hpp>;
+export int f();
+module :private;
+int f() { return 0; }
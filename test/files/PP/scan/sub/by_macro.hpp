@@ -0,0 +1,2 @@
+#include "../local.hpp"
+int by_macro = 0;
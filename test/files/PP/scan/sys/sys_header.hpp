@@ -0,0 +1 @@
+#define SYS_VALUE 2
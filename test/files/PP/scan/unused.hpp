@@ -0,0 +1 @@
+#define KUSABIRA_SCAN_UNUSED 1
@@ -15,4 +15,21 @@
 #include "test/vocabulary/concat_test.hpp"
 #include "test/PP/unified_macro_test.hpp"
 #include "test/PP/pp_directive_test.hpp"
-#include "test/PP/pp_constexpr_test.hpp"
\ No newline at end of file
+#include "test/PP/pp_constexpr_test.hpp"
+#include "test/PP/token_cache_test.hpp"
+#include "test/PP/pp_server_test.hpp"
+#include "test/PP/macro_environment_test.hpp"
+#include "test/PP/macro_snapshot_test.hpp"
+#include "test/PP/if_condition_memo_test.hpp"
+#include "test/PP/header_cache_test.hpp"
+#include "test/PP/dependency_scan_test.hpp"
+#include "test/PP/minimized_source_test.hpp"
+#include "test/PP/module_test.hpp"
+#include "test/corpus_generator_test.hpp"
+#include "test/PP/phase_timer_test.hpp"
+#include "test/PP/time_trace_test.hpp"
+#include "test/PP/macro_profiler_test.hpp"
+#include "test/PP/allocation_stats_test.hpp"
+#include "test/PP/include_tree_test.hpp"
+#include "test/PP/include_usage_test.hpp"
+#include "test/PP/expansion_budget_test.hpp"
\ No newline at end of file